@@ -0,0 +1,111 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Askpass.h"
+#include "Interop.h"
+
+#define ASKPASS_MAX_LENGTH 4096 // more than any sane passphrase; anything claiming to be bigger is a framing error
+
+bool ReadAskpassFrame(FILE *in, struct AskpassRequest *request, long *index)
+{
+	// the header a character at a time, so that nothing past it is read ahead
+	char header[64];
+	size_t used = 0;
+	int c;
+	while((c = fgetc(in)) != EOF && c != '\n') {
+		if(used == sizeof(header) - 1) return false;
+		header[used++] = (char)c;
+	}
+	if(c != '\n') return false;
+	header[used] = '\0';
+
+	int status;
+	unsigned long length;
+	*index = -1;
+	int fields = sscanf(header, "%d %lu %ld", &status, &length, index);
+	if(fields < 2 || (fields == 3 && *index < 0) || length > ASKPASS_MAX_LENGTH) return false;
+
+	char *passphrase = malloc(length + 1);
+	if(!passphrase) return false;
+	if(fread(passphrase, 1, length, in) != length) {
+		explicit_bzero(passphrase, length);
+		free(passphrase);
+		return false;
+	}
+	passphrase[length] = '\0';
+
+	request->status = (enum AskpassStatus)status;
+	request->passphrase = passphrase;
+	request->length = length;
+	return true;
+}
+
+void StreamAskpassBatch(const char *askpass, struct AskpassRequest *requests, size_t count, ASKPASS_CALLBACK callback, void *context)
+{
+	for(size_t i = 0; i < count; ++i) requests[i].status = ASKPASS_FAILED;
+
+	size_t answered = 0;
+	char **argv = calloc(2 * count + 3, sizeof(char *));
+	bool *done = calloc(count + 1, sizeof(bool));
+	int pipefd[2];
+	if(argv && done && !pipe2(pipefd, O_CLOEXEC)) {
+		size_t argc = 0;
+		argv[argc++] = (char *)askpass;
+		argv[argc++] = "--batch";
+		for(size_t i = 0; i < count; ++i) {
+			if(requests[i].auth_error) argv[argc++] = "--auth-error=1";
+			argv[argc++] = (char *)requests[i].target;
+		}
+
+		pid_t pid = SpawnHelper(askpass, argv, -1, pipefd[1]);
+		close(pipefd[1]);
+		FILE *in = fdopen(pipefd[0], "r");
+		if(in) {
+			// fully buffered stdio would leave copies of the passphrases lying around in its buffer
+			// (and unbuffered, a record is handed on as soon as it's been written, not when a buffer's worth has)
+			setvbuf(in, NULL, _IONBF, 0);
+			struct AskpassRequest record;
+			long index;
+			for(size_t next = 0; answered < count && ReadAskpassFrame(in, &record, &index); ++answered) {
+				size_t i = index < 0 ? next : (size_t)index;
+				if(i >= count || done[i]) {
+					ClearAskpassRequests(&record, 1);
+					break;
+				}
+				requests[i].status = record.status;
+				requests[i].passphrase = record.passphrase;
+				requests[i].length = record.length;
+				done[i] = true;
+				next = i + 1;
+				if(callback) callback(&requests[i], context);
+			}
+			fclose(in);
+		} else {
+			close(pipefd[0]);
+		}
+		if(pid > 0) WaitHelper(pid);
+	}
+	free(argv);
+	for(size_t i = 0; callback && i < count; ++i) {
+		if(!done || !done[i]) callback(&requests[i], context);
+	}
+	free(done);
+}
+
+void RunAskpassBatch(const char *askpass, struct AskpassRequest *requests, size_t count)
+{
+	StreamAskpassBatch(askpass, requests, count, NULL, NULL);
+}
+
+void ClearAskpassRequests(struct AskpassRequest *requests, size_t count)
+{
+	for(size_t i = 0; i < count; ++i) {
+		if(requests[i].passphrase) {
+			explicit_bzero(requests[i].passphrase, requests[i].length);
+			free(requests[i].passphrase);
+		}
+		requests[i].passphrase = NULL;
+		requests[i].length = 0;
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+// Linux side of luks-askpass-wincred.exe --batch: one interop spawn answering any number of targets,
+// as framed records, one per target: "<Status> <Length> <Index>\n" then Length bytes of passphrase.
+// Index is the target's position among those asked for, so the records can come in any order (the stored credentials
+// straight away, the ones prompted for as each dialog is answered); a record without one is for the target after the last.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// same values luks-askpass-wincred.exe uses (and exits with, when asked for just one target)
+enum AskpassStatus {
+	ASKPASS_OK = 0,
+	ASKPASS_FAILED = 1,
+	ASKPASS_CANCELLED = 2,
+};
+
+struct AskpassRequest
+{
+	const char *target; // the <TargetName> in LUKS\<TargetName>
+	bool auth_error; // the last passphrase for this target didn't work, so don't just return the stored one
+
+	enum AskpassStatus status;
+	char *passphrase; // NUL-terminated for convenience, but may also contain NULs; see length
+	size_t length;
+};
+
+// reads one record (its status, passphrase and length); false at EOF or on a malformed record
+// *index is the record's Index, or -1 if it had none
+bool ReadAskpassFrame(FILE *in, struct AskpassRequest *request, long *index);
+
+// runs askpass --batch for all the requests, filling in their status/passphrase
+// (requests the helper didn't answer, e.g. because it crashed, are ASKPASS_FAILED)
+void RunAskpassBatch(const char *askpass, struct AskpassRequest *requests, size_t count);
+
+// called for each request as soon as its record arrives (on the thread running the batch), so that its passphrase can be
+// put to use while the helper is still prompting for others; those it didn't answer follow once it has exited
+typedef void (*ASKPASS_CALLBACK)(struct AskpassRequest *request, void *context);
+
+// RunAskpassBatch, calling callback for each request in turn
+void StreamAskpassBatch(const char *askpass, struct AskpassRequest *requests, size_t count, ASKPASS_CALLBACK callback, void *context);
+
+// wipes and frees the passphrases
+void ClearAskpassRequests(struct AskpassRequest *requests, size_t count);
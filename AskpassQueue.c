@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include "AskpassQueue.h"
+
+struct AskpassQueueEntry
+{
+	struct AskpassRequest *request;
+	bool answered; // under the queue's lock
+	struct AskpassQueueEntry *next;
+};
+
+struct QueuedBatch
+{
+	struct AskpassQueue *queue;
+	struct AskpassQueueEntry **entries; // in the order they were asked for, as are the requests
+	struct AskpassRequest *requests;
+};
+
+// hands the answer to the requester (the passphrase is theirs to clear now)
+static void Answer(struct AskpassRequest *request, void *context)
+{
+	struct QueuedBatch *batch = context;
+	struct AskpassQueueEntry *entry = batch->entries[request - batch->requests];
+	pthread_mutex_lock(&batch->queue->lock);
+	entry->request->status = request->status;
+	entry->request->passphrase = request->passphrase;
+	entry->request->length = request->length;
+	request->passphrase = NULL;
+	entry->answered = true;
+	pthread_cond_broadcast(&batch->queue->answered);
+	pthread_mutex_unlock(&batch->queue->lock);
+}
+
+// runs the pending requests as a batch, then any that arrived meanwhile as another, until there are none
+static void * RunBatches(void *context)
+{
+	struct AskpassQueue *queue = context;
+	pthread_mutex_lock(&queue->lock);
+	while(queue->pending) {
+		if(queue->settle_ms) {
+			pthread_mutex_unlock(&queue->lock);
+			usleep(queue->settle_ms * 1000);
+			pthread_mutex_lock(&queue->lock);
+		}
+		size_t count = 0;
+		for(struct AskpassQueueEntry *entry = queue->pending; entry; entry = entry->next) ++count;
+		struct QueuedBatch batch = { .queue = queue, .entries = calloc(count, sizeof(*batch.entries)),
+		                             .requests = calloc(count, sizeof(*batch.requests)) };
+		size_t i = count;
+		for(struct AskpassQueueEntry *entry = queue->pending; entry; entry = entry->next) {
+			--i;
+			if(batch.entries) batch.entries[i] = entry;
+			if(batch.requests) batch.requests[i] = (struct AskpassRequest){ .target = entry->request->target, .auth_error = entry->request->auth_error };
+		}
+		struct AskpassQueueEntry *taken = queue->pending;
+		queue->pending = NULL;
+		++queue->spawns;
+		pthread_mutex_unlock(&queue->lock);
+
+		if(batch.entries && batch.requests) {
+			StreamAskpassBatch(queue->askpass, batch.requests, count, &Answer, &batch);
+		}
+		free(batch.requests);
+		free(batch.entries);
+
+		pthread_mutex_lock(&queue->lock);
+		if(!batch.entries || !batch.requests) {
+			for(struct AskpassQueueEntry *entry = taken; entry; entry = entry->next) {
+				entry->request->status = ASKPASS_FAILED;
+				entry->answered = true;
+			}
+			pthread_cond_broadcast(&queue->answered);
+		}
+	}
+	queue->running = false;
+	pthread_mutex_unlock(&queue->lock);
+	return NULL;
+}
+
+void QueueAskpass(struct AskpassQueue *queue, struct AskpassRequest *request)
+{
+	struct AskpassQueueEntry entry = { .request = request };
+	request->status = ASKPASS_FAILED;
+	request->passphrase = NULL;
+	request->length = 0;
+
+	pthread_mutex_lock(&queue->lock);
+	entry.next = queue->pending;
+	queue->pending = &entry;
+	bool start = !queue->running;
+	queue->running = true;
+	pthread_mutex_unlock(&queue->lock);
+
+	if(start) {
+		pthread_t thread;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		bool started = !pthread_create(&thread, &attr, &RunBatches, queue);
+		pthread_attr_destroy(&attr);
+		// no thread to spare: run them here instead
+		if(!started) RunBatches(queue);
+	}
+
+	pthread_mutex_lock(&queue->lock);
+	while(!entry.answered) pthread_cond_wait(&queue->answered, &queue->lock);
+	pthread_mutex_unlock(&queue->lock);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+// Coalescing the passphrase requests of concurrent unlocks (wsl-mount-broker's, a thread per volume) into
+// luks-askpass-wincred.exe --batch runs, the askpass counterpart of the broker's attach queue:
+// - a request made while no batch is running starts one, after settle_ms for any others made together with it
+// - those made while one is running go together in the next, so volumes unlocked together cost one interop spawn (two, if
+//   they straggle) rather than one each, and their dialogs come one after another from one process rather than all at once
+//   from several
+// Each request is answered as soon as its record arrives (see StreamAskpassBatch), not once the whole batch is done,
+// so its cryptsetup can be running while the user is still typing the next passphrase.
+// The batches run on a thread of their own, so that no requester is held up reading the others' answers.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include "Askpass.h"
+
+struct AskpassQueue
+{
+	const char *askpass;
+	unsigned settle_ms; // how long a batch waits for more requests before starting (a few ms, against an interop spawn's 100)
+
+	pthread_mutex_t lock;
+	pthread_cond_t answered;
+	struct AskpassQueueEntry *pending; // most recent first
+	bool running;
+	unsigned spawns; // batches run so far
+};
+
+#define ASKPASS_QUEUE_INITIALIZER { .lock = PTHREAD_MUTEX_INITIALIZER, .answered = PTHREAD_COND_INITIALIZER }
+
+// fills in request's status and passphrase (to be ClearAskpassRequests'd), returning once it has them
+void QueueAskpass(struct AskpassQueue *queue, struct AskpassRequest *request);
@@ -0,0 +1,63 @@
+#include "Crc32.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+// https://create.stephan-brumme.com/crc32/#slicing-by-8-overview
+// table[0] is the usual byte-at-a-time table; table[k][b] is the CRC of b followed by k zero bytes,
+// so 8 lookups can be xor'ed together to consume 8 bytes at once
+static uint32_t table[8][256];
+
+static void InitTable(void)
+{
+	for(uint32_t i = 0; i < 256; ++i) {
+		uint32_t crc = i;
+		for(int bit = 0; bit < 8; ++bit) crc = crc >> 1 ^ (crc & 1 ? 0xEDB88320u : 0);
+		table[0][i] = crc;
+	}
+	for(uint32_t i = 0; i < 256; ++i) {
+		for(int k = 1; k < 8; ++k) table[k][i] = table[k-1][i] >> 8 ^ table[0][table[k-1][i] & 0xFF];
+	}
+}
+
+// the table is built on first use, and partition tables may be read from several threads (see EnumDisks)
+#ifdef _WIN32
+static BOOL CALLBACK InitTableOnce(PINIT_ONCE once, PVOID parameter, PVOID *context)
+{
+	(void)once;
+	(void)parameter;
+	(void)context;
+	InitTable();
+	return TRUE;
+}
+#endif
+
+static void EnsureTable(void)
+{
+#ifdef _WIN32
+	static INIT_ONCE once = INIT_ONCE_STATIC_INIT;
+	InitOnceExecuteOnce(&once, &InitTableOnce, NULL, NULL);
+#else
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, &InitTable);
+#endif
+}
+
+uint32_t crc32_ieee(uint32_t crc, const void *data, size_t len)
+{
+	EnsureTable();
+	const uint8_t *p = data;
+	crc = ~crc;
+
+	for(; len >= 8; p += 8, len -= 8) {
+		uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+		uint32_t hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+		crc = table[7][lo & 0xFF] ^ table[6][lo >> 8 & 0xFF] ^ table[5][lo >> 16 & 0xFF] ^ table[4][lo >> 24]
+		    ^ table[3][hi & 0xFF] ^ table[2][hi >> 8 & 0xFF] ^ table[1][hi >> 16 & 0xFF] ^ table[0][hi >> 24];
+	}
+	for(; len; ++p, --len) crc = crc >> 8 ^ table[0][(crc ^ *p) & 0xFF];
+
+	return ~crc;
+}
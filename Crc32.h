@@ -0,0 +1,10 @@
+#pragma once
+
+// CRC-32 (IEEE 802.3, the one zlib and the GPT headers use), slicing-by-8
+// Not the SSE4.2 crc32 instruction, which computes the Castagnoli polynomial (CRC-32C) instead
+
+#include <stddef.h>
+#include <stdint.h>
+
+// continues a CRC from a previous call (start from 0), so crc32_ieee(crc32_ieee(0, a, n), b, m) covers a then b
+uint32_t crc32_ieee(uint32_t crc, const void *data, size_t len);
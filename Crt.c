@@ -0,0 +1,14 @@
+#include <share.h>
+#include "Crt.h"
+
+FILE * OpenStream(const char *path, const char *mode)
+{
+	return _fsopen(path, mode, _SH_DENYNO);
+}
+
+const char * GetEnvironment(const char *name, char *buf, size_t size)
+{
+	size_t length;
+	// length counts the terminator, so is 0 only for a variable that isn't set
+	return !getenv_s(&length, buf, size, name) && length ? buf : NULL;
+}
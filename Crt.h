@@ -0,0 +1,18 @@
+#pragma once
+
+// The C runtime calls that MSVC deprecates in favour of its _s versions (warning C4996), for the code shared with linux,
+// which has no _s versions; there they're just fopen and getenv.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+// fopen, but via _fsopen, as fopen_s denies other processes write access, which the trace and lookup cache
+// (appended to, and replaced, by several invocations at once) can't have
+FILE * OpenStream(const char *path, const char *mode);
+// getenv, copied into buf; NULL if it isn't set (or is too long for buf)
+const char * GetEnvironment(const char *name, char *buf, size_t size);
+#else
+#define OpenStream fopen
+#define GetEnvironment(name, buf, size) ((void)(buf), (void)(size), getenv(name))
+#endif
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Crypttab.h"
+
+size_t ReadCrypttab(const char *path, struct CrypttabEntry **entries)
+{
+	*entries = NULL;
+	FILE *f = fopen(path, "re");
+	if(!f) return 0;
+
+	size_t count = 0;
+	char line[2048];
+	while(fgets(line, sizeof(line), f)) {
+		char *save;
+		line[strcspn(line, "\r\n#")] = '\0';
+		const char *name = strtok_r(line, " \t", &save);
+		const char *source = strtok_r(NULL, " \t", &save);
+		const char *key = strtok_r(NULL, " \t", &save);
+		const char *options = strtok_r(NULL, " \t", &save);
+		if(!name || !source) continue;
+
+		struct CrypttabEntry *grown = realloc(*entries, (count + 1) * sizeof(struct CrypttabEntry));
+		if(!grown) break;
+		*entries = grown;
+		struct CrypttabEntry *entry = &grown[count++];
+		snprintf(entry->name, sizeof(entry->name), "%s", name);
+		snprintf(entry->source, sizeof(entry->source), "%s", source);
+		snprintf(entry->key, sizeof(entry->key), "%s", key ? key : "none");
+		snprintf(entry->options, sizeof(entry->options), "%s", options ? options : "");
+	}
+	fclose(f);
+	return count;
+}
+
+const struct CrypttabEntry * FindCrypttabEntry(const struct CrypttabEntry *entries, size_t count, const char *name)
+{
+	for(size_t i = 0; i < count; ++i) {
+		if(!strcmp(entries[i].name, name)) return &entries[i];
+	}
+	return NULL;
+}
+
+void CrypttabSourcePath(const char *source, char *path, size_t size)
+{
+	static const struct { const char *prefix, *dir; } links[] = {
+		{ "PARTUUID=", "by-partuuid" },
+		{ "UUID=", "by-uuid" },
+		{ "PARTLABEL=", "by-partlabel" },
+		{ "LABEL=", "by-label" },
+	};
+	for(size_t i = 0; i < sizeof(links) / sizeof(links[0]); ++i) {
+		size_t len = strlen(links[i].prefix);
+		if(!strncmp(source, links[i].prefix, len)) {
+			snprintf(path, size, "/dev/disk/%s/%s", links[i].dir, source + len);
+			return;
+		}
+	}
+	snprintf(path, size, "%s", source);
+}
+
+// the option's text within the entry's options (pointing past the name), or NULL
+static const char * FindCrypttabOption(const struct CrypttabEntry *entry, const char *option)
+{
+	size_t len = strlen(option);
+	for(const char *p = entry->options; *p;) {
+		if(!strncmp(p, option, len) && (p[len] == ',' || p[len] == '=' || !p[len])) return p + len;
+		p += strcspn(p, ",");
+		if(*p) ++p;
+	}
+	return NULL;
+}
+
+bool HasCrypttabOption(const struct CrypttabEntry *entry, const char *option)
+{
+	return FindCrypttabOption(entry, option) != NULL;
+}
+
+bool GetCrypttabOption(const struct CrypttabEntry *entry, const char *option, char *value, size_t size)
+{
+	const char *found = FindCrypttabOption(entry, option);
+	if(!found || *found != '=') return false;
+	++found;
+	snprintf(value, size, "%.*s", (int)strcspn(found, ","), found);
+	return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+// /etc/crypttab, as read by the linux-side tools: <name> <source device> [<key file> [<options>]]
+// https://man7.org/linux/man-pages/man5/crypttab.5.html
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DEFAULT_CRYPTTAB "/etc/crypttab"
+
+struct CrypttabEntry
+{
+	char name[128];
+	char source[PATH_MAX]; // a path, or UUID=/PARTUUID=/LABEL=/PARTLABEL=
+	char key[PATH_MAX]; // "none" (or "-") when the passphrase is asked for
+	char options[512]; // comma separated, empty if none
+};
+
+// every entry in the file, in order (*entries to be free'd), or 0 if there are none (or no file)
+size_t ReadCrypttab(const char *path, struct CrypttabEntry **entries);
+
+const struct CrypttabEntry * FindCrypttabEntry(const struct CrypttabEntry *entries, size_t count, const char *name);
+
+// the device a source refers to: the /dev/disk/by-* link systemd-cryptsetup-generator would use for UUID= and the like
+void CrypttabSourcePath(const char *source, char *path, size_t size);
+
+// whether option (alone, or as option=...) is among the entry's options
+bool HasCrypttabOption(const struct CrypttabEntry *entry, const char *option);
+// the value of option=<value>, false if it's not there (or has no value)
+bool GetCrypttabOption(const struct CrypttabEntry *entry, const char *option, char *value, size_t size);
@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include "DeviceBackend.h"
+#include "Trace.h"
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+static bool EnumDisksSerial(struct DeviceBackend *backend, size_t count, ENUMDISK_CALLBACK callback, void *context)
+{
+	for(size_t i = 0; i < count; ++i) {
+		struct DiskInfo disk = { 0 };
+		bool keep_going = true;
+		uint64_t start = TRACE_BEGIN();
+		bool probed = backend->ProbeDevice(backend, i, &disk);
+		TRACE_END("ProbeDevice", start, "%zu %s", i, probed ? disk.DevicePath : "(failed)");
+		if(probed) {
+			keep_going = (*callback)(&disk, context);
+		}
+		FreeDiskInfo(&disk);
+		if(!keep_going) return false;
+	}
+	return true;
+}
+
+// Probing a disk is mostly waiting (CreateFile may have to spin up a sleeping USB enclosure, etc.),
+// so a few workers pull disk indexes off a shared counter and probe them concurrently.
+// Each result is held until those of every disk before it are in, so the callbacks still see the disks in order
+// (and the first match is the same one a serial enumeration would find), whichever probe finishes first.
+// Once the callback says stop, nobody starts another probe, and any still in flight are abandoned
+// (cancelled where the platform allows, and their results ignored regardless)
+enum { SLOT_PENDING, SLOT_PROBED, SLOT_FAILED };
+
+struct ParallelSlot
+{
+	struct DiskInfo disk;
+	int state;
+};
+
+struct ParallelEnum
+{
+	struct DeviceBackend *backend;
+	ENUMDISK_CALLBACK callback;
+	void *context;
+	size_t count;
+	volatile long next;
+	volatile long stop;
+	struct ParallelSlot *slots; // one per disk, filled in as probes finish
+	size_t delivered; // every disk before this has been passed to the callback (or failed)
+#ifdef _WIN32
+	CRITICAL_SECTION lock;
+	HANDLE *threads;
+	unsigned thread_count;
+#else
+	pthread_mutex_t lock;
+#endif
+};
+
+static long FetchAndIncrement(volatile long *value)
+{
+#ifdef _WIN32
+	return InterlockedIncrement(value) - 1;
+#else
+	return __atomic_fetch_add(value, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static bool IsStopped(struct ParallelEnum *parallel)
+{
+#ifdef _WIN32
+	return InterlockedCompareExchange(&parallel->stop, 0, 0) != 0;
+#else
+	return __atomic_load_n(&parallel->stop, __ATOMIC_SEQ_CST) != 0;
+#endif
+}
+
+static void Stop(struct ParallelEnum *parallel)
+{
+#ifdef _WIN32
+	InterlockedExchange(&parallel->stop, 1);
+	// knock the other workers out of any CreateFile/DeviceIoControl that's still waiting on a slow device
+	DWORD self = GetCurrentThreadId();
+	for(unsigned i = 0; i < parallel->thread_count; ++i) {
+		if(GetThreadId(parallel->threads[i]) != self) CancelSynchronousIo(parallel->threads[i]);
+	}
+#else
+	__atomic_store_n(&parallel->stop, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static void ParallelEnumWorker(struct ParallelEnum *parallel)
+{
+	while(!IsStopped(parallel)) {
+		long index = FetchAndIncrement(&parallel->next);
+		if(index < 0 || (size_t)index >= parallel->count) break;
+
+		struct DiskInfo disk = { 0 };
+		uint64_t start = TRACE_BEGIN();
+		bool probed = parallel->backend->ProbeDevice(parallel->backend, (size_t)index, &disk);
+		TRACE_END("ProbeDevice", start, "%ld %s", index, probed ? disk.DevicePath : "(failed)");
+
+#ifdef _WIN32
+		EnterCriticalSection(&parallel->lock);
+#else
+		pthread_mutex_lock(&parallel->lock);
+#endif
+		parallel->slots[index].disk = disk;
+		parallel->slots[index].state = probed ? SLOT_PROBED : SLOT_FAILED;
+		// whoever fills the gap delivers everything that was waiting behind it
+		while(parallel->delivered < parallel->count && parallel->slots[parallel->delivered].state != SLOT_PENDING) {
+			struct ParallelSlot *slot = &parallel->slots[parallel->delivered++];
+			if(slot->state == SLOT_PROBED && !IsStopped(parallel) && !(*parallel->callback)(&slot->disk, parallel->context)) Stop(parallel);
+			FreeDiskInfo(&slot->disk);
+			slot->state = SLOT_FAILED;
+		}
+#ifdef _WIN32
+		LeaveCriticalSection(&parallel->lock);
+#else
+		pthread_mutex_unlock(&parallel->lock);
+#endif
+	}
+}
+
+#ifdef _WIN32
+static DWORD WINAPI ParallelEnumThread(LPVOID context)
+{
+	ParallelEnumWorker(context);
+	return 0;
+}
+#else
+static void * ParallelEnumThread(void *context)
+{
+	ParallelEnumWorker(context);
+	return NULL;
+}
+#endif
+
+static bool EnumDisksParallel(struct DeviceBackend *backend, size_t count, ENUMDISK_CALLBACK callback, void *context)
+{
+	struct ParallelEnum parallel = { .backend = backend, .callback = callback, .context = context, .count = count };
+	unsigned workers = backend->ProbeWorkers < count ? backend->ProbeWorkers : (unsigned)count;
+	parallel.slots = calloc(count, sizeof(struct ParallelSlot));
+	if(!parallel.slots) return EnumDisksSerial(backend, count, callback, context);
+
+#ifdef _WIN32
+	InitializeCriticalSection(&parallel.lock);
+	parallel.threads = calloc(workers, sizeof(HANDLE));
+	if(parallel.threads) {
+		// created suspended, so the handle list is complete before anybody might need to cancel the others
+		for(unsigned i = 0; i < workers; ++i) {
+			HANDLE thread = CreateThread(NULL, 0, &ParallelEnumThread, &parallel, CREATE_SUSPENDED, NULL);
+			if(thread) parallel.threads[parallel.thread_count++] = thread;
+		}
+		for(unsigned i = 0; i < parallel.thread_count; ++i) ResumeThread(parallel.threads[i]);
+	}
+	if(!parallel.thread_count) ParallelEnumWorker(&parallel); // couldn't start any threads, but still get everything done
+	for(unsigned i = 0; i < parallel.thread_count; ++i) {
+		WaitForSingleObject(parallel.threads[i], INFINITE);
+		CloseHandle(parallel.threads[i]);
+	}
+	free(parallel.threads);
+	DeleteCriticalSection(&parallel.lock);
+#else
+	pthread_mutex_init(&parallel.lock, NULL);
+	pthread_t *threads = calloc(workers, sizeof(pthread_t));
+	unsigned started = 0;
+	for(; threads && started < workers; ++started) {
+		if(pthread_create(&threads[started], NULL, &ParallelEnumThread, &parallel)) break;
+	}
+	if(!started) ParallelEnumWorker(&parallel); // couldn't start any threads, but still get everything done
+	for(unsigned i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+	free(threads);
+	pthread_mutex_destroy(&parallel.lock);
+#endif
+
+	// what was still waiting on an earlier disk when the enumeration stopped
+	for(size_t i = parallel.delivered; i < count; ++i) FreeDiskInfo(&parallel.slots[i].disk);
+	free(parallel.slots);
+	return !parallel.stop;
+}
+
+bool EnumDisks(struct DeviceBackend *backend, ENUMDISK_CALLBACK callback, void *context)
+{
+	uint64_t start = TRACE_BEGIN();
+	size_t count = backend->ListDevices(backend);
+	TRACE_END("ListDevices", start, "%zu devices", count);
+
+	start = TRACE_BEGIN();
+	bool parallel = backend->ProbeWorkers > 1 && count > 1;
+	bool completed = parallel ? EnumDisksParallel(backend, count, callback, context) : EnumDisksSerial(backend, count, callback, context);
+	TRACE_END("EnumDisks", start, "%zu devices, %u workers, %s", count, parallel ? backend->ProbeWorkers : 1, completed ? "completed" : "stopped early");
+	return completed;
+}
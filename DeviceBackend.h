@@ -0,0 +1,102 @@
+#pragma once
+
+// How wsl-mount-findfs finds disks and reads their partition tables
+// The real implementation is SetupDi + DeviceIoControl, but the tag lookup and caching logic only needs
+// these few operations, so it can also be run against a fake set of disks (e.g. to benchmark it on linux)
+
+#include <stddef.h>
+#include "DiskInfo.h"
+
+struct DeviceBackend
+{
+	// snapshot the set of present disks, returning how many there are
+	size_t (*ListDevices)(struct DeviceBackend *self);
+	// open the index'th disk from the last ListDevices and read its layout
+	// returns false if it could not be read (having already reported why)
+	// may be called concurrently from several threads when ProbeWorkers > 1
+	bool (*ProbeDevice)(struct DeviceBackend *self, size_t index, struct DiskInfo *disk);
+	// open \\.\PhysicalDrive<n> directly and read its layout, without enumerating anything
+	bool (*ProbeDrive)(struct DeviceBackend *self, uint32_t DriveNumber, struct DiskInfo *disk);
+	void (*Destroy)(struct DeviceBackend *self);
+
+	// how many disks EnumDisks may probe at once (0 or 1 probes them one after another)
+	unsigned ProbeWorkers;
+};
+
+// return false to stop the enumeration (e.g. once the disk being looked for has been found)
+typedef bool (*ENUMDISK_CALLBACK)(const struct DiskInfo *disk, void *context);
+
+// probes every disk, calling back for each one that could be read; callbacks never run concurrently,
+// and come in list order even with ProbeWorkers > 1 (a slow disk holds back the callbacks for those after it)
+// returns true if it got through every disk, false if the callback stopped it
+bool EnumDisks(struct DeviceBackend *backend, ENUMDISK_CALLBACK callback, void *context);
+
+#ifdef _WIN32
+struct DeviceBackend * CreateWin32DeviceBackend(DWORD dwDesiredAccess);
+#else
+// the disks attached to this (WSL) VM, from /sys/class/block, reading their partition tables directly
+// they're known by their /dev node, and have no \\.\PhysicalDrive<n> (DriveNumber -1, ProbeDrive always fails)
+struct DeviceBackend * CreateLinuxDeviceBackend(void);
+// the /dev node for partition PartitionNumber of Drive (e.g. /dev/sdc 2 -> /dev/sdc2, /dev/nvme0n1 2 -> /dev/nvme0n1p2)
+bool FindPartitionDevice(const char *Drive, uint32_t PartitionNumber, char *device, size_t size);
+#endif
+
+// the disk images (raw, or fixed VHDs: *.img, *.raw and *.vhd) in a list of directories, for finding the image a tag is in,
+// to be attached with wsl --mount --vhd; each is known by its path (as DevicePath and Drive, with DriveNumber -1, and
+// ProbeDrive always fails), and read with 512 byte sectors. Dynamic VHDs and VHDX have to be looked up once attached.
+// index_path (NULL for none) is a file remembering each image's partition table along with its size and modification time,
+// so listing the images again (unlike opening them, a stat each, or on windows nothing the directory listing doesn't say)
+// is all an unchanged image costs; Destroy rewrites it, if anything changed
+// Images are probed IMAGE_PROBE_WORKERS at a time unless ProbeWorkers is changed
+struct ImageDeviceBackend
+{
+	struct DeviceBackend base;
+	char *directories; // separated by IMAGE_PATH_SEPARATOR, as in $PATH
+	char *index_path;
+	struct ImageFile *images; // as of the last ListDevices, directory by directory, each sorted by name
+	size_t count;
+	struct ImageFile *indexed; // what the index file held, until ListDevices takes what it can from it; sorted by path
+	size_t indexed_count;
+	bool dirty; // the index file no longer matches
+
+	// images that had to be opened and read, rather than taken from the index
+	volatile unsigned ReadCount;
+};
+#ifdef _WIN32
+#define IMAGE_PATH_SEPARATOR ';'
+#else
+#define IMAGE_PATH_SEPARATOR ':'
+#endif
+#define IMAGE_PROBE_WORKERS 4
+
+struct ImageDeviceBackend * CreateImageDeviceBackend(const char *directories, const char *index_path);
+
+// in-memory disks for exercising the lookup logic without real hardware
+struct FakeDeviceBackend
+{
+	struct DeviceBackend base;
+	struct DiskInfo *disks;
+	size_t count;
+
+	// simulated time each probe takes (e.g. a spun-down drive), per disk, in microseconds
+	unsigned *ProbeLatency;
+
+	// how much work a real backend would have done
+	volatile unsigned ListCount;
+	volatile unsigned ProbeCount;
+};
+
+struct FakeDeviceBackend * CreateFakeDeviceBackend(void);
+bool FakeAddDisk(struct FakeDeviceBackend *fake, const struct DiskInfo *disk);
+// the most partitions a synthetic GPT disk may have (the usual size of the entry array)
+#define FAKE_MAX_GPT_PARTITIONS 128
+
+// appends disks numbered from fake->count, each with partitions_per_disk partitions and GUIDs derived from seed
+bool FakeAddSyntheticDisks(struct FakeDeviceBackend *fake, size_t disks, enum PartitionStyle style, uint32_t partitions_per_disk, uint32_t seed);
+// the same, from a description like "900:gpt:128,100:mbr:4" (<disks>:<gpt|mbr|raw>:<partitions>, comma separated)
+bool FakeAddDescribedDisks(struct FakeDeviceBackend *fake, const char *description, uint32_t seed);
+#ifndef _WIN32
+// appends a disk whose layout is read from a raw disk image (e.g. dd of a real disk, or a truncate+sgdisk file)
+bool FakeAddImage(struct FakeDeviceBackend *fake, const char *path, uint32_t sector_size);
+#endif
+void FakeSetProbeLatency(struct FakeDeviceBackend *fake, size_t index, unsigned microseconds);
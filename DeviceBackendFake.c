@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#include "DeviceBackend.h"
+#include "PartitionTable.h"
+
+// probes may come from several threads at once (see EnumDisks)
+static void CountProbe(volatile unsigned *counter)
+{
+#ifdef _WIN32
+	InterlockedIncrement((volatile LONG *)counter);
+#else
+	__atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+static void SimulateLatency(struct FakeDeviceBackend *fake, size_t index)
+{
+	unsigned microseconds = fake->ProbeLatency[index];
+	if(!microseconds) return;
+#ifdef _WIN32
+	Sleep((microseconds + 999) / 1000);
+#else
+	struct timespec delay = { microseconds / 1000000, (long)(microseconds % 1000000) * 1000 };
+	while(nanosleep(&delay, &delay)) {}
+#endif
+}
+
+static size_t FakeListDevices(struct DeviceBackend *self)
+{
+	struct FakeDeviceBackend *fake = (struct FakeDeviceBackend *)self;
+	CountProbe(&fake->ListCount);
+	return fake->count;
+}
+
+static bool FakeProbeDevice(struct DeviceBackend *self, size_t index, struct DiskInfo *disk)
+{
+	struct FakeDeviceBackend *fake = (struct FakeDeviceBackend *)self;
+	CountProbe(&fake->ProbeCount);
+	if(index >= fake->count) return false;
+	SimulateLatency(fake, index);
+	return CopyDiskInfo(disk, &fake->disks[index]);
+}
+
+static bool FakeProbeDrive(struct DeviceBackend *self, uint32_t DriveNumber, struct DiskInfo *disk)
+{
+	struct FakeDeviceBackend *fake = (struct FakeDeviceBackend *)self;
+	CountProbe(&fake->ProbeCount);
+	for(size_t i = 0; i < fake->count; ++i) {
+		if(fake->disks[i].DriveNumber == (int32_t)DriveNumber) {
+			SimulateLatency(fake, i);
+			return CopyDiskInfo(disk, &fake->disks[i]);
+		}
+	}
+	return false;
+}
+
+static void FakeDestroy(struct DeviceBackend *self)
+{
+	struct FakeDeviceBackend *fake = (struct FakeDeviceBackend *)self;
+	for(size_t i = 0; i < fake->count; ++i) FreeDiskInfo(&fake->disks[i]);
+	free(fake->disks);
+	free(fake->ProbeLatency);
+	free(fake);
+}
+
+struct FakeDeviceBackend * CreateFakeDeviceBackend(void)
+{
+	struct FakeDeviceBackend *fake = calloc(1, sizeof(struct FakeDeviceBackend));
+	if(fake) {
+		fake->base.ListDevices = &FakeListDevices;
+		fake->base.ProbeDevice = &FakeProbeDevice;
+		fake->base.ProbeDrive = &FakeProbeDrive;
+		fake->base.Destroy = &FakeDestroy;
+	}
+	return fake;
+}
+
+bool FakeAddDisk(struct FakeDeviceBackend *fake, const struct DiskInfo *disk)
+{
+	struct DiskInfo *disks = realloc(fake->disks, (fake->count + 1) * sizeof(struct DiskInfo));
+	if(!disks) return false;
+	fake->disks = disks;
+	unsigned *latency = realloc(fake->ProbeLatency, (fake->count + 1) * sizeof(unsigned));
+	if(!latency) return false;
+	fake->ProbeLatency = latency;
+
+	if(!CopyDiskInfo(&fake->disks[fake->count], disk)) return false;
+	fake->ProbeLatency[fake->count] = 0;
+	++fake->count;
+	return true;
+}
+
+void FakeSetProbeLatency(struct FakeDeviceBackend *fake, size_t index, unsigned microseconds)
+{
+	if(index < fake->count) fake->ProbeLatency[index] = microseconds;
+}
+
+// deterministic, distinct GUIDs: Data1 identifies the seed and disk, Data2 the partition (0 being the disk itself)
+static void SyntheticGUID(GUID *guid, uint32_t seed, uint32_t disk, uint32_t partition)
+{
+	guid->Data1 = seed * 0x9E3779B9u ^ disk;
+	guid->Data2 = (uint16_t)partition;
+	guid->Data3 = 0x4000 | (uint16_t)(partition >> 16 & 0x0FFF);
+	for(int i = 0; i < 8; ++i) guid->Data4[i] = (uint8_t)(disk >> (8 * (i % 4)) ^ (i == 0 ? 0x80 : 0));
+}
+
+bool FakeAddSyntheticDisks(struct FakeDeviceBackend *fake, size_t disks, enum PartitionStyle style, uint32_t partitions_per_disk, uint32_t seed)
+{
+	for(size_t d = 0; d < disks; ++d) {
+		uint32_t DriveNumber = (uint32_t)fake->count;
+		char DevicePath[64], Drive[64];
+		snprintf(DevicePath, sizeof(DevicePath), "fake#disk#%u", DriveNumber);
+		snprintf(Drive, sizeof(Drive), "\\\\.\\PhysicalDrive%u", DriveNumber);
+
+		struct DiskInfo disk = {
+			.DevicePath = DevicePath,
+			.Drive = Drive,
+			.DriveNumber = (int32_t)DriveNumber,
+			.PartitionStyle = style,
+			.PartitionCount = style == PARTSTYLE_RAW ? 0 : partitions_per_disk,
+			.PartitionEntry = calloc(partitions_per_disk ? partitions_per_disk : 1, sizeof(struct PartitionInfo)),
+		};
+		if(!disk.PartitionEntry) return false;
+
+		// serial numbers are unique, models shared (a fleet of identical disks)
+		snprintf(disk.SerialNumber, sizeof(disk.SerialNumber), "FAKE%08X", seed * 0x9E3779B9u ^ DriveNumber);
+		snprintf(disk.Model, sizeof(disk.Model), "Fake Disk %u", DriveNumber % 4);
+		if(style == PARTSTYLE_GPT) SyntheticGUID(&disk.DiskId, seed, DriveNumber, 0);
+		if(style == PARTSTYLE_MBR) disk.Signature = seed * 0x9E3779B9u ^ DriveNumber;
+		uint64_t offset = 1024*1024;
+		for(uint32_t p = 0; p < disk.PartitionCount; ++p) {
+			struct PartitionInfo *partition = &disk.PartitionEntry[p];
+			partition->PartitionNumber = p + 1;
+			partition->StartingOffset = offset;
+			partition->PartitionLength = 64*1024*1024;
+			offset += partition->PartitionLength;
+			// for MBR this stands in for the GUID windows makes up
+			SyntheticGUID(&partition->PartitionId, seed, DriveNumber, p + 1);
+			if(style == PARTSTYLE_GPT) {
+				parse_guid("0fc63daf-8483-4772-8e79-3d69d8477de4", &partition->PartitionType); // linux filesystem data
+				snprintf(partition->Name, sizeof(partition->Name), "part%u", p + 1);
+			} else {
+				partition->MbrType = 0x83; // linux
+			}
+		}
+
+		bool success = FakeAddDisk(fake, &disk);
+		free(disk.PartitionEntry);
+		if(!success) return false;
+	}
+	return true;
+}
+
+bool FakeAddDescribedDisks(struct FakeDeviceBackend *fake, const char *description, uint32_t seed)
+{
+	const char *p = description;
+	while(*p) {
+		char style_name[4];
+		unsigned long disks, partitions;
+		int consumed = 0;
+		if(sscanf(p, "%lu:%3[a-z]:%lu%n", &disks, style_name, &partitions, &consumed) != 3 || !consumed || (p[consumed] && p[consumed] != ',')) {
+			fprintf(stderr, "*** bad disk description at \"%s\", expected <disks>:<gpt|mbr|raw>:<partitions>[,...]\n", p);
+			return false;
+		}
+
+		enum PartitionStyle style;
+		unsigned long max_partitions;
+		if(!strcmp(style_name, "gpt")) {
+			style = PARTSTYLE_GPT;
+			max_partitions = FAKE_MAX_GPT_PARTITIONS;
+		} else if(!strcmp(style_name, "mbr")) {
+			style = PARTSTYLE_MBR;
+			max_partitions = 4;
+		} else if(!strcmp(style_name, "raw")) {
+			style = PARTSTYLE_RAW;
+			max_partitions = 0;
+		} else {
+			fprintf(stderr, "*** unknown partition style %s\n", style_name);
+			return false;
+		}
+		if(partitions > max_partitions) {
+			fprintf(stderr, "*** %s disks can have at most %lu partitions\n", style_name, max_partitions);
+			return false;
+		}
+
+		if(!FakeAddSyntheticDisks(fake, disks, style, (uint32_t)partitions, seed)) return false;
+		p += consumed;
+		if(*p == ',') ++p;
+	}
+	return true;
+}
+
+#ifndef _WIN32
+bool FakeAddImage(struct FakeDeviceBackend *fake, const char *path, uint32_t sector_size)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		fprintf(stderr, "*** open(%s): %s\n", path, strerror(errno));
+		return false;
+	}
+
+	char Drive[64];
+	snprintf(Drive, sizeof(Drive), "\\\\.\\PhysicalDrive%u", (unsigned)fake->count);
+	struct DiskInfo disk = { .DevicePath = (char *)path, .Drive = Drive, .DriveNumber = (int32_t)fake->count };
+
+	bool success = ReadPartitionTableFd(fd, sector_size, &disk);
+	close(fd);
+	if(success) {
+		success = FakeAddDisk(fake, &disk);
+	} else {
+		fprintf(stderr, "*** %s: could not read partition table\n", path);
+	}
+	free(disk.PartitionEntry);
+	return success;
+}
+#endif
@@ -0,0 +1,508 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#define strcasecmp _stricmp
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "Crt.h"
+#include "DeviceBackend.h"
+#include "PartitionTable.h"
+#include "Trace.h"
+
+#ifdef _WIN32
+extern void ReportLastError(const char *caption, ...);
+#define PATH_SEPARATOR '\\'
+#else
+#define PATH_SEPARATOR '/'
+#endif
+
+#define IMAGE_SECTOR_SIZE 512 // as wsl --mount --vhd attaches them
+#define IMAGE_INDEX_LINE_MAX (4096 + 128)
+#define IMAGE_MAX_PARTITIONS 8192 // the most a 1MiB GPT entry array (PartitionTable.c's limit) can hold
+
+// https://learn.microsoft.com/en-us/windows/win32/vstor/about-vhd
+#define VHD_FOOTER_SIZE 512
+#define VHD_COOKIE "conectix"
+
+struct ImageFile
+{
+	char *path;
+	uint64_t size;
+	uint64_t mtime; // st_mtim in nanoseconds, or the FILETIME; only ever compared
+	bool known; // layout holds its partition table (from the index, or read since)
+	bool read; // by ProbeDevice, since the last ListDevices
+	struct DiskInfo layout; // without DevicePath or Drive
+};
+
+static char * CopyString(const char *str)
+{
+	size_t size = strlen(str) + 1;
+	char *copy = malloc(size);
+	if(copy) memcpy(copy, str, size);
+	return copy;
+}
+
+static void FreeImages(struct ImageFile *images, size_t count)
+{
+	for(size_t i = 0; i < count; ++i) {
+		free(images[i].path);
+		FreeDiskInfo(&images[i].layout);
+	}
+	free(images);
+}
+
+static int CompareImagePaths(const void *a, const void *b)
+{
+	return strcmp(((const struct ImageFile *)a)->path, ((const struct ImageFile *)b)->path);
+}
+
+static struct ImageFile * AppendImage(struct ImageFile **images, size_t *count, size_t *capacity)
+{
+	if(*count == *capacity) {
+		size_t grown_capacity = *capacity ? 2 * *capacity : 64;
+		struct ImageFile *grown = realloc(*images, grown_capacity * sizeof(struct ImageFile));
+		if(!grown) return NULL;
+		*images = grown;
+		*capacity = grown_capacity;
+	}
+	struct ImageFile *image = &(*images)[(*count)++];
+	*image = (struct ImageFile){ 0 };
+	return image;
+}
+
+//
+// the index file, a line per image followed by one per partition (in the units of struct PartitionInfo):
+// I <size> <mtime> <gpt|mbr|raw> <ptuuid|signature|-> <partitions> <path>
+// P <PartitionNumber> <offset> <length> <partuuid> <parttype> <mbrtype> <name>
+// (the path and name running to the end of the line)
+//
+
+static const char *style_names[] = { "raw", "mbr", "gpt" };
+
+// the image being read, dropped unless every one of its partitions was there
+static void FinishIndexedImage(struct ImageDeviceBackend *image_backend, uint32_t expected)
+{
+	struct ImageFile *image = &image_backend->indexed[image_backend->indexed_count - 1];
+	if(image->layout.PartitionCount == expected) {
+		image->known = true;
+	} else {
+		free(image->path);
+		FreeDiskInfo(&image->layout);
+		--image_backend->indexed_count;
+	}
+}
+
+// the next space-separated field of the line, NULL if there isn't one
+// (a field at a time rather than by sscanf, which for a few thousand images is most of the time a rescan takes)
+static char * NextField(char **cursor)
+{
+	char *field = *cursor, *space = strchr(field, ' ');
+	if(!*field || !space) return NULL;
+	*space = '\0';
+	*cursor = space + 1;
+	return field;
+}
+
+static bool ParseNumber(const char *field, int base, uint64_t max, uint64_t *value)
+{
+	char *end;
+	if(!field || !*field) return false;
+	*value = strtoull(field, &end, base);
+	return !*end && *value <= max;
+}
+
+static bool ParseImageLine(char *cursor, struct ImageFile *image, uint32_t *expected)
+{
+	uint64_t count, Signature;
+	if(!ParseNumber(NextField(&cursor), 10, UINT64_MAX, &image->size) || !ParseNumber(NextField(&cursor), 10, UINT64_MAX, &image->mtime)) return false;
+	const char *style = NextField(&cursor), *id = NextField(&cursor);
+	if(!style || !id || !ParseNumber(NextField(&cursor), 10, IMAGE_MAX_PARTITIONS, &count) || !*cursor) return false;
+	*expected = (uint32_t)count;
+
+	if(!strcmp(style, "gpt") && parse_guid(id, &image->layout.DiskId)) {
+		image->layout.PartitionStyle = PARTSTYLE_GPT;
+	} else if(!strcmp(style, "mbr") && ParseNumber(id, 16, UINT32_MAX, &Signature)) {
+		image->layout.PartitionStyle = PARTSTYLE_MBR;
+		image->layout.Signature = (uint32_t)Signature;
+	} else if(strcmp(style, "raw") || count) {
+		return false;
+	}
+	image->layout.DriveNumber = -1;
+	image->layout.PartitionEntry = calloc(count ? count : 1, sizeof(struct PartitionInfo));
+	image->path = CopyString(cursor);
+	return true;
+}
+
+static bool ParsePartitionLine(char *cursor, struct PartitionInfo *partition)
+{
+	uint64_t PartitionNumber, MbrType;
+	if(!ParseNumber(NextField(&cursor), 10, UINT32_MAX, &PartitionNumber) || !ParseNumber(NextField(&cursor), 10, UINT64_MAX, &partition->StartingOffset)
+	   || !ParseNumber(NextField(&cursor), 10, UINT64_MAX, &partition->PartitionLength)) {
+		return false;
+	}
+	const char *partuuid = NextField(&cursor), *parttype = NextField(&cursor);
+	if(!partuuid || !parttype || !parse_guid(partuuid, &partition->PartitionId) || !parse_guid(parttype, &partition->PartitionType)) return false;
+	// the MBR type runs to the end of the line when there's no name
+	char *name = strchr(cursor, ' ');
+	if(name) *name++ = '\0';
+	if(!ParseNumber(cursor, 10, UINT8_MAX, &MbrType)) return false;
+	partition->PartitionNumber = (uint32_t)PartitionNumber;
+	partition->MbrType = (uint8_t)MbrType;
+	snprintf(partition->Name, sizeof(partition->Name), "%s", name ? name : "");
+	return true;
+}
+
+static void LoadImageIndex(struct ImageDeviceBackend *image_backend)
+{
+	uint64_t start = TRACE_BEGIN();
+	FILE *f = OpenStream(image_backend->index_path, "r");
+	if(!f) return;
+	setvbuf(f, NULL, _IOFBF, 1 << 16);
+
+	char line[IMAGE_INDEX_LINE_MAX];
+	size_t capacity = 0;
+	bool reading = false; // an image's partition lines
+	uint32_t expected = 0;
+	while(fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if(line[0] == 'I' && line[1] == ' ') {
+			if(reading) FinishIndexedImage(image_backend, expected);
+			reading = false;
+
+			struct ImageFile parsed = { 0 };
+			if(!ParseImageLine(line + 2, &parsed, &expected)) {
+				FreeDiskInfo(&parsed.layout);
+				continue;
+			}
+			struct ImageFile *image = parsed.path && parsed.layout.PartitionEntry ? AppendImage(&image_backend->indexed, &image_backend->indexed_count, &capacity) : NULL;
+			if(!image) {
+				free(parsed.path);
+				FreeDiskInfo(&parsed.layout);
+				break;
+			}
+			*image = parsed;
+			reading = true;
+		} else if(line[0] == 'P' && line[1] == ' ' && reading) {
+			struct ImageFile *image = &image_backend->indexed[image_backend->indexed_count - 1];
+			if(image->layout.PartitionCount == expected) continue; // one too many, so won't be finished
+			if(ParsePartitionLine(line + 2, &image->layout.PartitionEntry[image->layout.PartitionCount])) ++image->layout.PartitionCount;
+		}
+	}
+	if(reading) FinishIndexedImage(image_backend, expected);
+	fclose(f);
+	TRACE_END("LoadImageIndex", start, "%zu images", image_backend->indexed_count);
+}
+
+static bool SaveImageIndex(struct ImageDeviceBackend *image_backend)
+{
+	const char *path = image_backend->index_path;
+	uint64_t start = TRACE_BEGIN();
+
+	// a new file renamed over the old one, as for the lookup cache (see SaveResolveCache)
+	char tmp_path[4096];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+	FILE *f = OpenStream(tmp_path, "w");
+	if(!f) {
+		fprintf(stderr, "*** could not write %s\n", tmp_path);
+		return false;
+	}
+	setvbuf(f, NULL, _IOFBF, 1 << 16);
+
+	size_t saved = 0;
+	for(size_t i = 0; i < image_backend->count; ++i) {
+		const struct ImageFile *image = &image_backend->images[i];
+		const struct DiskInfo *layout = &image->layout;
+		// (an image whose path or partition names can't be written on a line of their own is just read every time)
+		bool fits = image->known && !strpbrk(image->path, "\r\n");
+		for(uint32_t p = 0; fits && p < layout->PartitionCount; ++p) fits = !strpbrk(layout->PartitionEntry[p].Name, "\r\n");
+		if(!fits) continue;
+
+		char id[37] = "-";
+		GUIDSTR partuuid, parttype;
+		if(layout->PartitionStyle == PARTSTYLE_GPT) format_guid(id, &layout->DiskId);
+		if(layout->PartitionStyle == PARTSTYLE_MBR) snprintf(id, sizeof(id), "%08" PRIx32, layout->Signature);
+		fprintf(f, "I %" PRIu64 " %" PRIu64 " %s %s %" PRIu32 " %s\n", image->size, image->mtime, style_names[layout->PartitionStyle], id,
+		        layout->PartitionCount, image->path);
+		for(uint32_t p = 0; p < layout->PartitionCount; ++p) {
+			const struct PartitionInfo *partition = &layout->PartitionEntry[p];
+			fprintf(f, "P %" PRIu32 " %" PRIu64 " %" PRIu64 " %s %s %u %s\n", partition->PartitionNumber, partition->StartingOffset,
+			        partition->PartitionLength, format_guid(partuuid, &partition->PartitionId), format_guid(parttype, &partition->PartitionType),
+			        partition->MbrType, partition->Name);
+		}
+		++saved;
+	}
+
+	bool success = !ferror(f);
+	success = !fclose(f) && success;
+#ifdef _WIN32
+	success = success && MoveFileExA(tmp_path, path, MOVEFILE_REPLACE_EXISTING);
+#else
+	success = success && !rename(tmp_path, path);
+#endif
+	if(!success) {
+		fprintf(stderr, "*** could not replace %s\n", path);
+		remove(tmp_path);
+		return false;
+	}
+	image_backend->dirty = false;
+	TRACE_END("SaveImageIndex", start, "%zu images", saved);
+	return true;
+}
+
+//
+// listing and reading the images
+//
+
+static bool IsImageName(const char *name)
+{
+	const char *extension = strrchr(name, '.');
+	return extension && (!strcasecmp(extension, ".img") || !strcasecmp(extension, ".raw") || !strcasecmp(extension, ".vhd"));
+}
+
+static bool AddListedImage(struct ImageDeviceBackend *image_backend, size_t *capacity, const char *directory, size_t directory_length,
+                           const char *name, uint64_t size, uint64_t mtime)
+{
+	bool separated = directory_length && directory[directory_length - 1] == PATH_SEPARATOR;
+	size_t name_length = strlen(name);
+	char *path = malloc(directory_length + 1 + name_length + 1);
+	struct ImageFile *image = path ? AppendImage(&image_backend->images, &image_backend->count, capacity) : NULL;
+	if(!image) {
+		free(path);
+		return false;
+	}
+	memcpy(path, directory, directory_length);
+	size_t used = directory_length;
+	if(!separated) path[used++] = PATH_SEPARATOR;
+	memcpy(path + used, name, name_length + 1);
+	image->path = path;
+	image->size = size;
+	image->mtime = mtime;
+	return true;
+}
+
+// appends the images in the directory (directory_length characters of it), keeping no more than the listing says about each
+static void ListDirectory(struct ImageDeviceBackend *image_backend, size_t *capacity, const char *directory, size_t directory_length)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%.*s", (int)directory_length, directory);
+
+#ifdef _WIN32
+	// the size and last write time come with the listing, so nothing need be opened until an image is new or changed
+	char pattern[4096 + 2];
+	snprintf(pattern, sizeof(pattern), "%s\\*", path);
+	WIN32_FIND_DATAA found;
+	HANDLE find = FindFirstFileExA(pattern, FindExInfoBasic, &found, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if(find == INVALID_HANDLE_VALUE) {
+		if(GetLastError() != ERROR_FILE_NOT_FOUND) ReportLastError("FindFirstFileEx(%s)", pattern);
+		return;
+	}
+	do {
+		if(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY || !IsImageName(found.cFileName)) continue;
+		uint64_t size = (uint64_t)found.nFileSizeHigh << 32 | found.nFileSizeLow;
+		uint64_t mtime = (uint64_t)found.ftLastWriteTime.dwHighDateTime << 32 | found.ftLastWriteTime.dwLowDateTime;
+		if(!AddListedImage(image_backend, capacity, directory, directory_length, found.cFileName, size, mtime)) break;
+	} while(FindNextFileA(find, &found));
+	FindClose(find);
+#else
+	DIR *dir = opendir(path);
+	if(!dir) {
+		fprintf(stderr, "*** opendir(%s): %s\n", path, strerror(errno));
+		return;
+	}
+	struct dirent *entry;
+	while((entry = readdir(dir))) {
+		if(!IsImageName(entry->d_name)) continue;
+		struct stat st;
+		if(fstatat(dirfd(dir), entry->d_name, &st, 0) || !S_ISREG(st.st_mode)) continue;
+		uint64_t mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000 + (uint64_t)st.st_mtim.tv_nsec;
+		if(!AddListedImage(image_backend, capacity, directory, directory_length, entry->d_name, (uint64_t)st.st_size, mtime)) break;
+	}
+	closedir(dir);
+#endif
+}
+
+// a fixed VHD is the disk as it is, followed by a footer; a dynamic (or differencing) one starts with a copy of the footer,
+// its sectors being wherever its block allocation table says, which is more than a lookup should take on
+static bool ReadImageLayout(READBYTES_CALLBACK read, void *context, const char *path, uint64_t size, struct DiskInfo *layout)
+{
+	uint8_t footer[VHD_FOOTER_SIZE];
+	if(size >= VHD_FOOTER_SIZE && read(context, 0, footer, sizeof(footer)) && !memcmp(footer, VHD_COOKIE, 8)) {
+		// (indexed as having nothing to find in it, so this is only said once)
+		fprintf(stderr, "*** %s: not a fixed VHD, so can only be looked up once attached\n", path);
+		layout->PartitionStyle = PARTSTYLE_RAW;
+		return true;
+	}
+	if(size >= 2 * VHD_FOOTER_SIZE && read(context, size - VHD_FOOTER_SIZE, footer, sizeof(footer)) && !memcmp(footer, VHD_COOKIE, 8)) {
+		size -= VHD_FOOTER_SIZE;
+	}
+	return ReadPartitionTable(read, context, IMAGE_SECTOR_SIZE, size, layout);
+}
+
+#ifdef _WIN32
+static bool handle_callback(void *context, uint64_t offset, void *buf, size_t len)
+{
+	OVERLAPPED overlapped = { .Offset = (DWORD)offset, .OffsetHigh = (DWORD)(offset >> 32) };
+	DWORD done;
+	return len <= MAXDWORD && ReadFile((HANDLE)context, buf, (DWORD)len, &done, &overlapped) && done == len;
+}
+#endif
+
+// just the few sectors holding the partition table (and the VHD footer), by positioned reads
+static bool ReadImage(const struct ImageFile *image, struct DiskInfo *layout)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(image->path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+	                          FILE_FLAG_RANDOM_ACCESS, NULL);
+	if(file == INVALID_HANDLE_VALUE) {
+		ReportLastError("CreateFile(%s)", image->path);
+		return false;
+	}
+	bool success = ReadImageLayout(&handle_callback, file, image->path, image->size, layout);
+	CloseHandle(file);
+#else
+	int fd = open(image->path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		fprintf(stderr, "*** open(%s): %s\n", image->path, strerror(errno));
+		return false;
+	}
+	bool success = ReadImageLayout(&pread_callback, (void *)(intptr_t)fd, image->path, image->size, layout);
+	close(fd);
+#endif
+	if(!success) fprintf(stderr, "*** %s: could not read partition table\n", image->path);
+	return success;
+}
+
+static size_t ImageListDevices(struct DeviceBackend *self)
+{
+	struct ImageDeviceBackend *image_backend = (struct ImageDeviceBackend *)self;
+
+	// what the last listing found (and read) is what's known now
+	if(image_backend->images) {
+		for(size_t i = 0; i < image_backend->count; ++i) image_backend->dirty = image_backend->dirty || image_backend->images[i].read;
+		FreeImages(image_backend->indexed, image_backend->indexed_count);
+		image_backend->indexed = image_backend->images;
+		image_backend->indexed_count = image_backend->count;
+		image_backend->images = NULL;
+		image_backend->count = 0;
+		qsort(image_backend->indexed, image_backend->indexed_count, sizeof(struct ImageFile), &CompareImagePaths);
+	}
+
+	static const char separator[] = { IMAGE_PATH_SEPARATOR, '\0' };
+	uint64_t start = TRACE_BEGIN();
+	size_t capacity = 0;
+	for(const char *directory = image_backend->directories; *directory;) {
+		size_t length = strcspn(directory, separator);
+		size_t first = image_backend->count;
+		if(length) ListDirectory(image_backend, &capacity, directory, length);
+		qsort(image_backend->images + first, image_backend->count - first, sizeof(struct ImageFile), &CompareImagePaths);
+		directory += length;
+		if(*directory) ++directory;
+	}
+	TRACE_END("ListImages", start, "%zu images", image_backend->count);
+
+	// an image the same size, with the same modification time, as when it was indexed still has the same partition table
+	size_t indexed_known = 0, carried = 0;
+	for(size_t i = 0; i < image_backend->indexed_count; ++i) indexed_known += image_backend->indexed[i].known;
+	for(size_t i = 0; i < image_backend->count; ++i) {
+		struct ImageFile *image = &image_backend->images[i];
+		struct ImageFile *indexed = image_backend->indexed_count ? bsearch(image, image_backend->indexed, image_backend->indexed_count, sizeof(struct ImageFile), &CompareImagePaths) : NULL;
+		if(!indexed || !indexed->known || indexed->size != image->size || indexed->mtime != image->mtime) continue;
+		image->layout = indexed->layout;
+		image->known = true;
+		indexed->layout = (struct DiskInfo){ 0 };
+		indexed->known = false;
+		++carried;
+	}
+	// (anything not carried over was removed, or has changed)
+	image_backend->dirty = image_backend->dirty || carried != indexed_known;
+	FreeImages(image_backend->indexed, image_backend->indexed_count);
+	image_backend->indexed = NULL;
+	image_backend->indexed_count = 0;
+	return image_backend->count;
+}
+
+static bool ImageProbeDevice(struct DeviceBackend *self, size_t index, struct DiskInfo *disk)
+{
+	struct ImageDeviceBackend *image_backend = (struct ImageDeviceBackend *)self;
+	if(index >= image_backend->count) return false;
+	struct ImageFile *image = &image_backend->images[index];
+
+	// each image is only ever probed by one thread at a time, so its own fields need no lock
+	if(!image->known) {
+		struct DiskInfo layout = { .Drive = image->path, .DriveNumber = -1 }; // (for ReadPartitionTable's messages)
+		if(!ReadImage(image, &layout)) {
+			free(layout.PartitionEntry);
+			return false;
+		}
+		layout.Drive = NULL;
+		image->layout = layout;
+		image->known = image->read = true;
+#ifdef _WIN32
+		InterlockedIncrement((volatile LONG *)&image_backend->ReadCount);
+#else
+		__atomic_add_fetch(&image_backend->ReadCount, 1, __ATOMIC_RELAXED);
+#endif
+	}
+
+	if(!CopyDiskInfo(disk, &image->layout)) return false;
+	disk->DevicePath = CopyString(image->path);
+	disk->Drive = CopyString(image->path);
+	if(!disk->DevicePath || !disk->Drive) {
+		FreeDiskInfo(disk);
+		return false;
+	}
+	return true;
+}
+
+// an image has no \\.\PhysicalDrive<n> to go straight to
+static bool ImageProbeDrive(struct DeviceBackend *self, uint32_t DriveNumber, struct DiskInfo *disk)
+{
+	(void)self;
+	(void)DriveNumber;
+	(void)disk;
+	return false;
+}
+
+static void ImageDestroy(struct DeviceBackend *self)
+{
+	struct ImageDeviceBackend *image_backend = (struct ImageDeviceBackend *)self;
+	for(size_t i = 0; i < image_backend->count; ++i) image_backend->dirty = image_backend->dirty || image_backend->images[i].read;
+	if(image_backend->index_path && image_backend->dirty) SaveImageIndex(image_backend);
+
+	FreeImages(image_backend->images, image_backend->count);
+	FreeImages(image_backend->indexed, image_backend->indexed_count);
+	free(image_backend->directories);
+	free(image_backend->index_path);
+	free(image_backend);
+}
+
+struct ImageDeviceBackend * CreateImageDeviceBackend(const char *directories, const char *index_path)
+{
+	struct ImageDeviceBackend *image_backend = calloc(1, sizeof(struct ImageDeviceBackend));
+	if(!image_backend) return NULL;
+	image_backend->base.ListDevices = &ImageListDevices;
+	image_backend->base.ProbeDevice = &ImageProbeDevice;
+	image_backend->base.ProbeDrive = &ImageProbeDrive;
+	image_backend->base.Destroy = &ImageDestroy;
+	// separate files with nothing to spin up, so there's no reason to read them one at a time
+	image_backend->base.ProbeWorkers = IMAGE_PROBE_WORKERS;
+
+	image_backend->directories = CopyString(directories);
+	image_backend->index_path = index_path ? CopyString(index_path) : NULL;
+	if(!image_backend->directories || (index_path && !image_backend->index_path)) {
+		ImageDestroy(&image_backend->base);
+		return NULL;
+	}
+	if(image_backend->index_path) LoadImageIndex(image_backend);
+	return image_backend;
+}
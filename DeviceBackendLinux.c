@@ -0,0 +1,196 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "DeviceBackend.h"
+#include "PartitionTable.h"
+
+#define SYS_CLASS_BLOCK "/sys/class/block"
+
+struct LinuxDeviceBackend
+{
+	struct DeviceBackend base;
+	char **names; // whole disks (sda, nvme0n1, ...) as of the last ListDevices
+	size_t count;
+};
+
+static void FreeNames(struct LinuxDeviceBackend *linux_backend)
+{
+	for(size_t i = 0; i < linux_backend->count; ++i) free(linux_backend->names[i]);
+	free(linux_backend->names);
+	linux_backend->names = NULL;
+	linux_backend->count = 0;
+}
+
+static bool ReadSysfsULong(const char *devname, const char *attribute, unsigned long *value)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), SYS_CLASS_BLOCK "/%s/%s", devname, attribute);
+	FILE *f = fopen(path, "re");
+	if(!f) return false;
+	bool success = fscanf(f, "%lu", value) == 1;
+	fclose(f);
+	return success;
+}
+
+static bool ReadSysfsString(const char *devname, const char *attribute, char *value, size_t size)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), SYS_CLASS_BLOCK "/%s/%s", devname, attribute);
+	FILE *f = fopen(path, "re");
+	if(!f) return false;
+	bool success = fgets(value, (int)size, f) != NULL;
+	fclose(f);
+	if(success) TrimDeviceString(value);
+	return success && value[0];
+}
+
+// SCSI disks (which is what WSL attaches everything as) only have it in the unit serial number VPD page:
+// a 4 byte header, the last byte of which is the length
+static bool ReadVpdSerial(const char *devname, char *value, size_t size)
+{
+	char path[PATH_MAX];
+	unsigned char page[4 + 255];
+	snprintf(path, sizeof(path), SYS_CLASS_BLOCK "/%s/device/vpd_pg80", devname);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) return false;
+	ssize_t length = read(fd, page, sizeof(page));
+	close(fd);
+	if(length < 4 || page[1] != 0x80) return false;
+
+	size_t serial_length = page[3] < (size_t)length - 4 ? page[3] : (size_t)length - 4;
+	if(serial_length >= size) serial_length = size - 1;
+	memcpy(value, page + 4, serial_length);
+	value[serial_length] = '\0';
+	TrimDeviceString(value);
+	return value[0];
+}
+
+static bool IsPartition(const char *devname)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), SYS_CLASS_BLOCK "/%s/partition", devname);
+	return access(path, F_OK) == 0;
+}
+
+static size_t LinuxListDevices(struct DeviceBackend *self)
+{
+	struct LinuxDeviceBackend *linux_backend = (struct LinuxDeviceBackend *)self;
+	FreeNames(linux_backend);
+
+	DIR *dir = opendir(SYS_CLASS_BLOCK);
+	if(!dir) {
+		fprintf(stderr, "*** opendir(%s): %s\n", SYS_CLASS_BLOCK, strerror(errno));
+		return 0;
+	}
+
+	struct dirent *entry;
+	while((entry = readdir(dir))) {
+		if(entry->d_name[0] == '.' || IsPartition(entry->d_name)) continue;
+		unsigned long size = 0;
+		if(!ReadSysfsULong(entry->d_name, "size", &size) || size == 0) continue; // e.g. unbound loop devices
+
+		char **names = realloc(linux_backend->names, (linux_backend->count + 1) * sizeof(char *));
+		if(!names) break;
+		linux_backend->names = names;
+		if((linux_backend->names[linux_backend->count] = strdup(entry->d_name))) ++linux_backend->count;
+	}
+
+	closedir(dir);
+	return linux_backend->count;
+}
+
+static bool LinuxProbeDevice(struct DeviceBackend *self, size_t index, struct DiskInfo *disk)
+{
+	struct LinuxDeviceBackend *linux_backend = (struct LinuxDeviceBackend *)self;
+	if(index >= linux_backend->count) return false;
+	const char *name = linux_backend->names[index];
+
+	unsigned long logical_block_size = 512;
+	ReadSysfsULong(name, "queue/logical_block_size", &logical_block_size);
+
+	*disk = (struct DiskInfo){ .DriveNumber = -1 };
+	if(asprintf(&disk->DevicePath, SYS_CLASS_BLOCK "/%s", name) < 0 || asprintf(&disk->Drive, "/dev/%s", name) < 0) {
+		disk->DevicePath = disk->Drive = NULL;
+		FreeDiskInfo(disk);
+		return false;
+	}
+
+	int fd = open(disk->Drive, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		fprintf(stderr, "*** open(%s): %s\n", disk->Drive, strerror(errno));
+		return false;
+	}
+	bool success = ReadPartitionTableFd(fd, (uint32_t)logical_block_size, disk);
+	if(!success) fprintf(stderr, "*** %s: could not read partition table\n", disk->Drive);
+	close(fd);
+
+	// (nvme, and virtio) or failing that SCSI; note these are what the VM sees, which for a wsl --mount'ed disk
+	// is hyper-v's virtual disk rather than the physical one windows reports
+	if(!ReadSysfsString(name, "device/serial", disk->SerialNumber, sizeof(disk->SerialNumber))
+	   && !ReadSysfsString(name, "serial", disk->SerialNumber, sizeof(disk->SerialNumber))) {
+		ReadVpdSerial(name, disk->SerialNumber, sizeof(disk->SerialNumber));
+	}
+	ReadSysfsString(name, "device/model", disk->Model, sizeof(disk->Model));
+	return success;
+}
+
+// linux has no \\.\PhysicalDrive<n> to go straight to
+static bool LinuxProbeDrive(struct DeviceBackend *self, uint32_t DriveNumber, struct DiskInfo *disk)
+{
+	(void)self;
+	(void)DriveNumber;
+	(void)disk;
+	return false;
+}
+
+static void LinuxDestroy(struct DeviceBackend *self)
+{
+	struct LinuxDeviceBackend *linux_backend = (struct LinuxDeviceBackend *)self;
+	FreeNames(linux_backend);
+	free(linux_backend);
+}
+
+struct DeviceBackend * CreateLinuxDeviceBackend(void)
+{
+	struct LinuxDeviceBackend *linux_backend = calloc(1, sizeof(struct LinuxDeviceBackend));
+	if(!linux_backend) return NULL;
+	linux_backend->base.ListDevices = &LinuxListDevices;
+	linux_backend->base.ProbeDevice = &LinuxProbeDevice;
+	linux_backend->base.ProbeDrive = &LinuxProbeDrive;
+	linux_backend->base.Destroy = &LinuxDestroy;
+	return &linux_backend->base;
+}
+
+// the kernel names partition nodes inconsistently (sdc2, but nvme0n1p2, loop0p2), so ask sysfs which child is which
+bool FindPartitionDevice(const char *Drive, uint32_t PartitionNumber, char *device, size_t size)
+{
+	const char *name = strrchr(Drive, '/');
+	name = name ? name + 1 : Drive;
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), SYS_CLASS_BLOCK "/%s", name);
+	DIR *dir = opendir(path);
+	if(!dir) return false;
+
+	bool found = false;
+	struct dirent *entry;
+	while(!found && (entry = readdir(dir))) {
+		if(strncmp(entry->d_name, name, strlen(name))) continue;
+		// <disk>/<partition>, each a single sysfs name
+		char partition[2 * NAME_MAX + 2];
+		int length = snprintf(partition, sizeof(partition), "%s/%s", name, entry->d_name);
+		if(length < 0 || (size_t)length >= sizeof(partition)) continue;
+		unsigned long number;
+		if(ReadSysfsULong(partition, "partition", &number) && number == PartitionNumber) {
+			snprintf(device, size, "/dev/%s", entry->d_name);
+			found = true;
+		}
+	}
+	closedir(dir);
+	return found;
+}
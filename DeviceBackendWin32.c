@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <windows.h>
+#include <setupapi.h>
+#include "DeviceBackend.h"
+#include "Trace.h"
+
+extern void ReportLastError(const char *caption, ...);
+
+struct Win32DeviceBackend
+{
+	struct DeviceBackend base;
+	DWORD dwDesiredAccess;
+	LPTSTR *DevicePaths;
+	size_t count;
+};
+
+static void FreeDevicePaths(struct Win32DeviceBackend *win32)
+{
+	for(size_t i = 0; i < win32->count; ++i) free(win32->DevicePaths[i]);
+	free(win32->DevicePaths);
+	win32->DevicePaths = NULL;
+	win32->count = 0;
+}
+
+static char * utf8_from_wide(LPCWSTR wide, int cchWide)
+{
+	int cb = WideCharToMultiByte(CP_UTF8, 0, wide, cchWide, NULL, 0, NULL, NULL);
+	char *utf8 = malloc(cb + 1);
+	if(utf8) {
+		WideCharToMultiByte(CP_UTF8, 0, wide, cchWide, utf8, cb, NULL, NULL);
+		utf8[cb] = '\0';
+	}
+	return utf8;
+}
+
+// https://stackoverflow.com/questions/327718/how-to-list-physical-disks
+static size_t Win32ListDevices(struct DeviceBackend *self)
+{
+	struct Win32DeviceBackend *win32 = (struct Win32DeviceBackend *)self;
+	FreeDevicePaths(win32);
+
+	uint64_t start = TRACE_BEGIN();
+	HDEVINFO hDiskClassDevices = SetupDiGetClassDevs(&GUID_DEVINTERFACE_DISK, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+	TRACE_END("SetupDiGetClassDevs", start, "%s", hDiskClassDevices == INVALID_HANDLE_VALUE ? "failed" : "ok");
+
+	if(hDiskClassDevices == INVALID_HANDLE_VALUE) {
+		ReportLastError("SetupDiGetClassDevs");
+		return 0;
+	}
+
+	start = TRACE_BEGIN();
+	DWORD deviceIndex = 0;
+	SP_DEVICE_INTERFACE_DATA DeviceInterfaceData = { .cbSize = sizeof(SP_DEVICE_INTERFACE_DATA) };
+
+	while(SetupDiEnumDeviceInterfaces(hDiskClassDevices, NULL, &GUID_DEVINTERFACE_DISK, deviceIndex++, &DeviceInterfaceData))
+	{
+		PSP_DEVICE_INTERFACE_DETAIL_DATA DeviceInterfaceDetailData = NULL;
+		DWORD DeviceInterfaceDetailDataSize = 0;
+		BOOL success = SetupDiGetDeviceInterfaceDetail(hDiskClassDevices, &DeviceInterfaceData, DeviceInterfaceDetailData, DeviceInterfaceDetailDataSize, &DeviceInterfaceDetailDataSize, NULL);
+
+		if(!success && GetLastError() == ERROR_INSUFFICIENT_BUFFER) {
+			DeviceInterfaceDetailData = malloc(DeviceInterfaceDetailDataSize);
+
+			ZeroMemory(DeviceInterfaceDetailData, DeviceInterfaceDetailDataSize);
+			DeviceInterfaceDetailData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+			success = SetupDiGetDeviceInterfaceDetail(hDiskClassDevices, &DeviceInterfaceData, DeviceInterfaceDetailData, DeviceInterfaceDetailDataSize, &DeviceInterfaceDetailDataSize, NULL);
+		}
+
+		if(success && DeviceInterfaceDetailData) {
+			LPTSTR *DevicePaths = realloc(win32->DevicePaths, (win32->count + 1) * sizeof(LPTSTR));
+			if(DevicePaths) {
+				win32->DevicePaths = DevicePaths;
+				win32->DevicePaths[win32->count++] = _wcsdup(DeviceInterfaceDetailData->DevicePath);
+			}
+		} else {
+			ReportLastError("SetupDiGetDeviceInterfaceDetail");
+		}
+
+		free(DeviceInterfaceDetailData);
+	}
+
+	if(GetLastError() != ERROR_NO_MORE_ITEMS) ReportLastError("SetupDiEnumDeviceInterfaces");
+
+	SetupDiDestroyDeviceInfoList(hDiskClassDevices);
+	TRACE_END("SetupDiEnumDeviceInterfaces", start, "%zu disks", win32->count);
+	return win32->count;
+}
+
+// https://learn.microsoft.com/en-us/windows/win32/devio/calling-deviceiocontrol
+static PDRIVE_LAYOUT_INFORMATION_EX GetDriveLayoutInformationEx(HANDLE hDevice)
+{
+	// start with room for the 4 entries windows always reports for MBR, then double; even a GPT disk using
+	// all 128 slots takes only 6 tries, where growing one entry at a time took ~128 (each reallocating and zeroing)
+	DWORD partition_capacity = 4;
+	PDRIVE_LAYOUT_INFORMATION_EX drive_layout = NULL;
+	DWORD bytesReturned;
+	BOOL success = FALSE;
+	do {
+		/* Annoyingly, this call does not return how much space it needs, so keep doubling the room for the variable-sized array until it fits */
+		DWORD drive_layout_size = (DWORD)FIELD_OFFSET(DRIVE_LAYOUT_INFORMATION_EX, PartitionEntry[partition_capacity]);
+		PDRIVE_LAYOUT_INFORMATION_EX grown = realloc(drive_layout, drive_layout_size);
+		if(!grown) {
+			SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+			break;
+		}
+		drive_layout = grown;
+		uint64_t start = TRACE_BEGIN();
+		success = DeviceIoControl(hDevice, IOCTL_DISK_GET_DRIVE_LAYOUT_EX, NULL, 0, drive_layout, drive_layout_size, &bytesReturned, NULL);
+		TRACE_END("IOCTL_DISK_GET_DRIVE_LAYOUT_EX", start, "room for %lu partitions, %s", partition_capacity, success ? "ok" : "too small");
+		partition_capacity *= 2;
+	} while(!success && (GetLastError() == ERROR_INSUFFICIENT_BUFFER || GetLastError() == ERROR_MORE_DATA));
+
+	if(!success) {
+		ReportLastError("IOCTL_DISK_GET_DRIVE_LAYOUT_EX");
+		free(drive_layout);
+		drive_layout = NULL;
+	}
+
+	return drive_layout;
+}
+
+static void CopyDescriptorString(const STORAGE_DEVICE_DESCRIPTOR *descriptor, DWORD size, DWORD offset, char *value, size_t value_size)
+{
+	// an offset of 0 means the device didn't report one
+	if(!offset || offset >= size) return;
+	const char *str = (const char *)descriptor + offset;
+	size_t length = strnlen(str, size - offset);
+	if(length >= value_size) length = value_size - 1;
+	memcpy(value, str, length);
+	value[length] = '\0';
+	TrimDeviceString(value);
+}
+
+// the serial number and model, for SERIAL= and MODEL=; not every device has them, so failing isn't worth reporting
+// https://learn.microsoft.com/en-us/windows/win32/api/winioctl/ni-winioctl-ioctl_storage_query_property
+static void GetStorageDeviceDescriptor(HANDLE hDevice, struct DiskInfo *disk)
+{
+	STORAGE_PROPERTY_QUERY query = { .PropertyId = StorageDeviceProperty, .QueryType = PropertyStandardQuery };
+	STORAGE_DESCRIPTOR_HEADER header = { 0 };
+	DWORD bytesReturned;
+	uint64_t start = TRACE_BEGIN();
+	// the header says how big the whole thing (with its strings) is
+	if(DeviceIoControl(hDevice, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), &header, sizeof(header), &bytesReturned, NULL)
+	   && header.Size >= sizeof(STORAGE_DEVICE_DESCRIPTOR)) {
+		PSTORAGE_DEVICE_DESCRIPTOR descriptor = malloc(header.Size);
+		if(descriptor && DeviceIoControl(hDevice, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), descriptor, header.Size, &bytesReturned, NULL)) {
+			CopyDescriptorString(descriptor, bytesReturned, descriptor->SerialNumberOffset, disk->SerialNumber, sizeof(disk->SerialNumber));
+			CopyDescriptorString(descriptor, bytesReturned, descriptor->ProductIdOffset, disk->Model, sizeof(disk->Model));
+		}
+		free(descriptor);
+	}
+	TRACE_END("IOCTL_STORAGE_QUERY_PROPERTY", start, "SERIAL=%s MODEL=%s", disk->SerialNumber, disk->Model);
+}
+
+static bool GetPhysicalDriveNumber(LPCTSTR name, HANDLE hDevice, DWORD *DriveNumber)
+{
+	STORAGE_DEVICE_NUMBER device_number = {0};
+	DWORD bytesReturned;
+	if(!DeviceIoControl(hDevice, IOCTL_STORAGE_GET_DEVICE_NUMBER, NULL, 0, &device_number, sizeof(device_number), &bytesReturned, NULL)) {
+		ReportLastError("IOCTL_STORAGE_GET_DEVICE_NUMBER");
+	}
+
+	if(device_number.DeviceType == FILE_DEVICE_DISK) {
+		*DriveNumber = device_number.DeviceNumber;
+		return true;
+	} else {
+		fprintf(stderr, "*** %ls is not FILE_DEVICE_DISK, cannot map to \\\\.\\PhysicalDrive<n>\n", name);
+		return false;
+	}
+}
+
+static bool ConvertDriveLayout(const DRIVE_LAYOUT_INFORMATION_EX *drive_layout, struct DiskInfo *disk)
+{
+	disk->PartitionCount = 0;
+	disk->PartitionEntry = calloc(drive_layout->PartitionCount ? drive_layout->PartitionCount : 1, sizeof(struct PartitionInfo));
+	if(!disk->PartitionEntry) return false;
+
+	switch(drive_layout->PartitionStyle) {
+		case PARTITION_STYLE_MBR:
+			disk->PartitionStyle = PARTSTYLE_MBR;
+			disk->Signature = drive_layout->Mbr.Signature;
+			for(DWORD i = 0; i < drive_layout->PartitionCount; ++i) {
+				const PARTITION_INFORMATION_EX *entry = &drive_layout->PartitionEntry[i];
+				if(entry->Mbr.PartitionType == PARTITION_ENTRY_UNUSED) continue;
+
+				struct PartitionInfo *partition = &disk->PartitionEntry[disk->PartitionCount++];
+				partition->PartitionNumber = entry->PartitionNumber;
+				partition->StartingOffset = entry->StartingOffset.QuadPart;
+				partition->PartitionLength = entry->PartitionLength.QuadPart;
+				// MBR does not actually store a GUID, but windows seems to construct one out of something, so allow searching for it
+				partition->PartitionId = entry->Mbr.PartitionId;
+				partition->MbrType = entry->Mbr.PartitionType;
+			}
+			break;
+		case PARTITION_STYLE_GPT:
+			disk->PartitionStyle = PARTSTYLE_GPT;
+			disk->DiskId = drive_layout->Gpt.DiskId;
+			for(DWORD i = 0; i < drive_layout->PartitionCount; ++i) {
+				const PARTITION_INFORMATION_EX *entry = &drive_layout->PartitionEntry[i];
+				struct PartitionInfo *partition = &disk->PartitionEntry[disk->PartitionCount++];
+				partition->PartitionNumber = entry->PartitionNumber;
+				partition->StartingOffset = entry->StartingOffset.QuadPart;
+				partition->PartitionLength = entry->PartitionLength.QuadPart;
+				partition->PartitionId = entry->Gpt.PartitionId;
+				partition->PartitionType = entry->Gpt.PartitionType;
+				WideCharToMultiByte(CP_UTF8, 0, entry->Gpt.Name, (int)wcsnlen(entry->Gpt.Name, ARRAYSIZE(entry->Gpt.Name)),
+				                    partition->Name, sizeof(partition->Name) - 1, NULL, NULL);
+			}
+			break;
+		default:
+			disk->PartitionStyle = PARTSTYLE_RAW;
+			break;
+	}
+	return true;
+}
+
+static bool ProbeDevicePath(struct Win32DeviceBackend *win32, LPCTSTR DevicePath, struct DiskInfo *disk)
+{
+	uint64_t start = TRACE_BEGIN();
+	HANDLE hDevice = CreateFile(DevicePath, win32->dwDesiredAccess, FILE_SHARE_READ|FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	TRACE_END("CreateFile", start, "%ls", DevicePath);
+	if(hDevice == INVALID_HANDLE_VALUE) {
+		// ERROR_OPERATION_ABORTED is EnumDisks giving up on this disk (CancelSynchronousIo), not worth reporting
+		if(GetLastError() != ERROR_OPERATION_ABORTED) ReportLastError("CreateFile(%ls)", DevicePath);
+		return false;
+	}
+
+	bool success = false;
+	DWORD DriveNumber;
+	PDRIVE_LAYOUT_INFORMATION_EX drive_layout = NULL;
+	if(GetPhysicalDriveNumber(DevicePath, hDevice, &DriveNumber) && (drive_layout = GetDriveLayoutInformationEx(hDevice))) {
+		// apparently the \\.\PhysicalDrive<n> part is something you just construct - even Old New Thing just did so rather than pull out some way to retrieve this string
+		// https://devblogs.microsoft.com/oldnewthing/20201021-00/?p=104387 "How do I get from a volume to the physical disk that holds it?"
+		char PhysicalDrive[MAX_PATH];
+		sprintf_s(PhysicalDrive, MAX_PATH, "\\\\.\\PhysicalDrive%u", DriveNumber);
+
+		disk->DevicePath = utf8_from_wide(DevicePath, -1);
+		disk->Drive = _strdup(PhysicalDrive);
+		disk->DriveNumber = (int32_t)DriveNumber;
+		success = disk->DevicePath && disk->Drive && ConvertDriveLayout(drive_layout, disk);
+		if(success) GetStorageDeviceDescriptor(hDevice, disk);
+	}
+
+	free(drive_layout);
+	CloseHandle(hDevice);
+	return success;
+}
+
+static bool Win32ProbeDevice(struct DeviceBackend *self, size_t index, struct DiskInfo *disk)
+{
+	struct Win32DeviceBackend *win32 = (struct Win32DeviceBackend *)self;
+	return index < win32->count && win32->DevicePaths[index] && ProbeDevicePath(win32, win32->DevicePaths[index], disk);
+}
+
+static bool Win32ProbeDrive(struct DeviceBackend *self, uint32_t DriveNumber, struct DiskInfo *disk)
+{
+	struct Win32DeviceBackend *win32 = (struct Win32DeviceBackend *)self;
+	TCHAR PhysicalDrive[MAX_PATH];
+	_snwprintf_s(PhysicalDrive, MAX_PATH, _TRUNCATE, L"\\\\.\\PhysicalDrive%u", DriveNumber);
+	return ProbeDevicePath(win32, PhysicalDrive, disk);
+}
+
+static void Win32Destroy(struct DeviceBackend *self)
+{
+	struct Win32DeviceBackend *win32 = (struct Win32DeviceBackend *)self;
+	FreeDevicePaths(win32);
+	free(win32);
+}
+
+struct DeviceBackend * CreateWin32DeviceBackend(DWORD dwDesiredAccess)
+{
+	struct Win32DeviceBackend *win32 = calloc(1, sizeof(struct Win32DeviceBackend));
+	if(!win32) return NULL;
+	win32->base.ListDevices = &Win32ListDevices;
+	win32->base.ProbeDevice = &Win32ProbeDevice;
+	win32->base.ProbeDrive = &Win32ProbeDrive;
+	win32->base.Destroy = &Win32Destroy;
+	win32->dwDesiredAccess = dwDesiredAccess;
+	return &win32->base;
+}
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include "DeviceIndex.h"
+
+// compares against the disk/partition the entry refers to, since entries don't keep a copy of their key
+static bool EntryMatches(const struct DeviceIndex *index, const struct DeviceIndexEntry *entry, const struct Tag *tag)
+{
+	const struct DiskInfo *disk = &index->disks[entry->disk];
+	const struct PartitionInfo *partition = entry->partition == NO_PARTITION ? NULL : &disk->PartitionEntry[entry->partition];
+	switch(entry->kind) {
+		case TAG_PTUUID: return IsEqualGUID(&tag->guid, &disk->DiskId);
+		case TAG_PARTUUID: return IsEqualGUID(&tag->guid, &partition->PartitionId);
+		case TAG_PARTTYPE: return IsEqualGUID(&tag->guid, &partition->PartitionType);
+		case TAG_PARTLABEL: return !strcmp(tag->value, partition->Name);
+		case TAG_SERIAL: return !strcmp(tag->value, disk->SerialNumber);
+		case TAG_MODEL: return !strcmp(tag->value, disk->Model);
+	}
+	return false;
+}
+
+// the slot holding the entry for tag, or the empty slot where it would go
+static uint32_t * FindSlot(const struct DeviceIndex *index, const struct Tag *tag, uint64_t hash)
+{
+	size_t mask = index->slot_count - 1;
+	for(size_t i = (size_t)hash & mask;; i = (i + 1) & mask) {
+		uint32_t *slot = &index->slots[i];
+		if(!*slot) return slot;
+		const struct DeviceIndexEntry *entry = &index->entries[*slot - 1];
+		if(entry->hash == hash && entry->kind == tag->kind && EntryMatches(index, entry, tag)) return slot;
+	}
+}
+
+static bool Rehash(struct DeviceIndex *index, size_t slot_count)
+{
+	uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+	if(!slots) return false;
+	free(index->slots);
+	index->slots = slots;
+	index->slot_count = slot_count;
+
+	// the entries are already distinct, so each just goes in the first free slot
+	for(size_t e = 0; e < index->entry_count; ++e) {
+		size_t i = (size_t)index->entries[e].hash & (slot_count - 1);
+		while(slots[i]) i = (i + 1) & (slot_count - 1);
+		slots[i] = (uint32_t)(e + 1);
+	}
+	return true;
+}
+
+// room for more entries, so that adding a disk's either all go in or (out of memory) none do
+static bool Reserve(struct DeviceIndex *index, size_t more)
+{
+	size_t needed = index->entry_count + more;
+	if(needed > index->entry_capacity) {
+		size_t capacity = index->entry_capacity ? index->entry_capacity : 64;
+		while(capacity < needed) capacity *= 2;
+		struct DeviceIndexEntry *entries = realloc(index->entries, capacity * sizeof(struct DeviceIndexEntry));
+		if(!entries) return false;
+		index->entries = entries;
+		index->entry_capacity = capacity;
+	}
+	if(2 * needed > index->slot_count) {
+		size_t slot_count = index->slot_count ? index->slot_count : 64;
+		while(slot_count < 2 * needed) slot_count *= 2;
+		if(!Rehash(index, slot_count)) return false;
+	}
+	return true;
+}
+
+// (having Reserved room for it)
+static void AddEntry(struct DeviceIndex *index, const struct Tag *tag, uint32_t disk, uint32_t partition)
+{
+	if(!TagHasValue(tag)) return;
+
+	uint64_t hash = HashTag(tag);
+	uint32_t *slot = FindSlot(index, tag, hash);
+	if(*slot) return; // already carried by something indexed earlier, which is the one that counts
+
+	index->entries[index->entry_count] = (struct DeviceIndexEntry){ hash, disk, partition, tag->kind };
+	*slot = (uint32_t)++index->entry_count;
+}
+
+bool DeviceIndexAddDisk(struct DeviceIndex *index, const struct DiskInfo *disk)
+{
+	// at most PTUUID, SERIAL and MODEL, and a PARTUUID, PARTTYPE and PARTLABEL per partition
+	bool gpt = disk->PartitionStyle == PARTSTYLE_GPT;
+	if(!Reserve(index, 3 + (size_t)disk->PartitionCount * (gpt ? 3 : 1))) return false;
+	struct DiskInfo *disks = realloc(index->disks, (index->count + 1) * sizeof(struct DiskInfo));
+	if(!disks) return false;
+	index->disks = disks;
+	if(!CopyDiskInfo(&index->disks[index->count], disk)) return false;
+	uint32_t d = (uint32_t)index->count++;
+	disk = &index->disks[d];
+
+	// in the order DiskMatchesTag would find them
+	struct Tag tag = { .kind = TAG_PTUUID, .guid = disk->DiskId };
+	if(gpt) AddEntry(index, &tag, d, NO_PARTITION);
+	tag = (struct Tag){ .kind = TAG_SERIAL };
+	memcpy(tag.value, disk->SerialNumber, sizeof(disk->SerialNumber));
+	AddEntry(index, &tag, d, NO_PARTITION);
+	tag = (struct Tag){ .kind = TAG_MODEL };
+	memcpy(tag.value, disk->Model, sizeof(disk->Model));
+	AddEntry(index, &tag, d, NO_PARTITION);
+
+	for(uint32_t p = 0; p < disk->PartitionCount; ++p) {
+		const struct PartitionInfo *partition = &disk->PartitionEntry[p];
+		tag = (struct Tag){ .kind = TAG_PARTUUID, .guid = partition->PartitionId };
+		AddEntry(index, &tag, d, p);
+		if(!gpt) continue;
+		tag = (struct Tag){ .kind = TAG_PARTTYPE, .guid = partition->PartitionType };
+		AddEntry(index, &tag, d, p);
+		tag = (struct Tag){ .kind = TAG_PARTLABEL };
+		memcpy(tag.value, partition->Name, sizeof(partition->Name));
+		AddEntry(index, &tag, d, p);
+	}
+	return true;
+}
+
+static bool AddDiskCallback(const struct DiskInfo *disk, void *context)
+{
+	return DeviceIndexAddDisk(context, disk);
+}
+
+bool BuildDeviceIndex(struct DeviceIndex *index, struct DeviceBackend *backend)
+{
+	return EnumDisks(backend, &AddDiskCallback, index);
+}
+
+void FreeDeviceIndex(struct DeviceIndex *index)
+{
+	for(size_t i = 0; i < index->count; ++i) FreeDiskInfo(&index->disks[i]);
+	free(index->disks);
+	free(index->entries);
+	free(index->slots);
+	*index = (struct DeviceIndex){ 0 };
+}
+
+const struct DiskInfo * DeviceIndexFind(const struct DeviceIndex *index, const struct Tag *tag, uint32_t *PartitionNumber)
+{
+	if(!index->slot_count || !TagHasValue(tag)) return NULL;
+	uint32_t slot = *FindSlot(index, tag, HashTag(tag));
+	if(!slot) return NULL;
+
+	const struct DeviceIndexEntry *entry = &index->entries[slot - 1];
+	const struct DiskInfo *disk = &index->disks[entry->disk];
+	*PartitionNumber = entry->partition == NO_PARTITION ? 0 : disk->PartitionEntry[entry->partition].PartitionNumber;
+	return disk;
+}
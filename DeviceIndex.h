@@ -0,0 +1,42 @@
+#pragma once
+
+// Every identifier (PTUUID, PARTUUID, PARTLABEL, PARTTYPE, SERIAL, MODEL) of a set of disks, in one hash table,
+// so that after a single enumeration each tag lookup is one probe of the table, rather than a scan of every
+// partition of every disk per tag.
+//
+// Where several disks/partitions share an identifier (a model, a partition type, cloned disks), the one indexed
+// first is kept, so lookups give the same answer as DiskMatchesTag against the disks in the order they were added.
+
+#include "DeviceBackend.h"
+#include "Tag.h"
+
+struct DeviceIndexEntry
+{
+	uint64_t hash;
+	uint32_t disk; // index into disks
+	uint32_t partition; // index into its PartitionEntry, or NO_PARTITION for a disk identifier
+	enum TagKind kind;
+};
+#define NO_PARTITION UINT32_MAX
+
+struct DeviceIndex
+{
+	struct DiskInfo *disks; // copies
+	size_t count;
+
+	struct DeviceIndexEntry *entries;
+	size_t entry_count;
+	size_t entry_capacity;
+	uint32_t *slots; // open addressing, 1 + index into entries (0 for empty)
+	size_t slot_count; // a power of two, kept at least twice entry_count
+};
+
+// copies the disk and indexes each of its identifiers; false if out of memory (having added none of them)
+bool DeviceIndexAddDisk(struct DeviceIndex *index, const struct DiskInfo *disk);
+// indexes every disk the backend can read, in one EnumDisks
+bool BuildDeviceIndex(struct DeviceIndex *index, struct DeviceBackend *backend);
+void FreeDeviceIndex(struct DeviceIndex *index);
+
+// the disk carrying the tag (and in *PartitionNumber, the partition, or 0 for a disk tag), NULL if none does
+// (valid until the next DeviceIndexAddDisk)
+const struct DiskInfo * DeviceIndexFind(const struct DeviceIndex *index, const struct Tag *tag, uint32_t *PartitionNumber);
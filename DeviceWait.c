@@ -0,0 +1,135 @@
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/netlink.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include "DeviceWait.h"
+
+// how long to go without an event before checking anyway (in case one was dropped, e.g. the socket buffer overflowed),
+// and how often to check when there's nothing to wait on at all
+#define BACKSTOP_MS 1000
+#define POLL_MS 50
+
+static const char * const link_dirs[] = { "by-partuuid", "by-partlabel" };
+
+// (again after each change, since udev only creates by-partuuid/ along with its first link)
+static void WatchLinks(struct DeviceWait *wait)
+{
+	inotify_add_watch(wait->inotify_fd, wait->links, IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+	for(size_t i = 0; i < sizeof(link_dirs) / sizeof(link_dirs[0]); ++i) {
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s/%s", wait->links, link_dirs[i]);
+		inotify_add_watch(wait->inotify_fd, path, IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+	}
+}
+
+void OpenDeviceWait(struct DeviceWait *wait, const char *links)
+{
+	*wait = (struct DeviceWait){ .uevent_fd = -1, .inotify_fd = -1, .links = links };
+
+	// group 1 is the kernel's own uevents, which arrive before udev has done anything with the device
+	// (and so before its links exist), and don't need udev running at all
+	wait->uevent_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+	struct sockaddr_nl addr = { .nl_family = AF_NETLINK, .nl_groups = 1 };
+	if(wait->uevent_fd >= 0 && bind(wait->uevent_fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(wait->uevent_fd);
+		wait->uevent_fd = -1;
+	}
+
+	if(links && !access(links, F_OK)) {
+		wait->inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+		if(wait->inotify_fd >= 0) WatchLinks(wait);
+	}
+}
+
+void CloseDeviceWait(struct DeviceWait *wait)
+{
+	if(wait->uevent_fd >= 0) close(wait->uevent_fd);
+	if(wait->inotify_fd >= 0) close(wait->inotify_fd);
+	wait->uevent_fd = wait->inotify_fd = -1;
+}
+
+// true if any of the queued uevents added or changed a block device
+// (a uevent is "<action>@<devpath>" followed by NUL-separated KEY=value pairs)
+static bool DrainUevents(struct DeviceWait *wait)
+{
+	bool changed = false;
+	char buf[8192];
+	ssize_t len;
+	while((len = recv(wait->uevent_fd, buf, sizeof(buf) - 1, 0)) > 0) {
+		buf[len] = '\0';
+		bool block = false, added = false;
+		for(const char *field = buf; field < buf + len; field += strlen(field) + 1) {
+			if(!strcmp(field, "SUBSYSTEM=block")) block = true;
+			if(!strcmp(field, "ACTION=add") || !strcmp(field, "ACTION=change")) added = true;
+		}
+		changed = changed || (block && added);
+	}
+	return changed;
+}
+
+static bool DrainInotify(struct DeviceWait *wait)
+{
+	bool changed = false;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while(read(wait->inotify_fd, buf, sizeof(buf)) > 0) changed = true;
+	if(changed) WatchLinks(wait);
+	return changed;
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+bool DeviceWaitNext(struct DeviceWait *wait, int timeout_ms)
+{
+	if(wait->uevent_fd < 0 && wait->inotify_fd < 0) {
+		int ms = timeout_ms < POLL_MS ? timeout_ms : POLL_MS;
+		if(ms > 0) nanosleep(&(struct timespec){ ms / 1000, (long)(ms % 1000) * 1000000 }, NULL);
+		return false;
+	}
+
+	// other subsystems' uevents (and block removals) don't count, so keep waiting through them
+	double deadline = now_ms() + (timeout_ms < BACKSTOP_MS ? timeout_ms : BACKSTOP_MS);
+	for(double remaining; (remaining = deadline - now_ms()) > 0;) {
+		struct pollfd fds[] = { { wait->uevent_fd, POLLIN, 0 }, { wait->inotify_fd, POLLIN, 0 } };
+		if(poll(fds, 2, (int)remaining + 1) <= 0) break;
+		bool changed = false;
+		if(fds[0].revents & POLLIN) changed = DrainUevents(wait);
+		if(fds[1].revents & POLLIN) changed = DrainInotify(wait) || changed;
+		if(changed) {
+			++wait->events;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool FindDeviceLink(const char *links, const struct Tag *tag, char *device, size_t size)
+{
+	char path[PATH_MAX];
+	if(!links) return false;
+	if(tag->kind == TAG_PARTUUID) {
+		GUIDSTR guidstr;
+		snprintf(path, sizeof(path), "%s/by-partuuid/%s", links, format_guid(guidstr, &tag->guid));
+	} else if(tag->kind == TAG_PARTLABEL && tag->value[0] && !tag->value[strspn(tag->value, "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz#+-.:=@_")]) {
+		// udev escapes anything else in the name, differently between versions, so those are left to the uevents
+		snprintf(path, sizeof(path), "%s/by-partlabel/%s", links, tag->value);
+	} else {
+		return false;
+	}
+
+	// (a link left dangling by a detached disk doesn't count)
+	char target[PATH_MAX];
+	if(!realpath(path, target) || strlen(target) >= size) return false;
+	memcpy(device, target, strlen(target) + 1);
+	return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+// Waiting for a disk to show up in the VM after wsl --mount, without polling
+// wsl --mount returns once windows has handed the disk to the VM, but the kernel still has to scan it (and udev,
+// if there is one, to make its /dev/disk links); rather than rescanning every 50ms until the tag resolves,
+// this wakes on the kernel's block device uevents (netlink), and on new links under /dev/disk (inotify),
+// so the caller can check again the moment something has actually changed.
+//
+// Open it before starting the attach (or before the first check), so that nothing in between is missed.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "Tag.h"
+
+#define DEFAULT_DEVICE_LINKS "/dev/disk"
+
+struct DeviceWait
+{
+	int uevent_fd; // -1 if netlink isn't available (e.g. in a container)
+	int inotify_fd; // -1 if there's no links directory to watch
+	const char *links;
+	unsigned events; // block uevents and link changes seen so far
+};
+
+// links is the directory holding by-partuuid/ and by-partlabel/ (DEFAULT_DEVICE_LINKS, or NULL for uevents only)
+// never fails: with neither source available, DeviceWaitNext just sleeps as the old polling did
+void OpenDeviceWait(struct DeviceWait *wait, const char *links);
+void CloseDeviceWait(struct DeviceWait *wait);
+
+// blocks until a block device is added or changed, or a link appears, or timeout_ms passes, and returns whether
+// anything happened; it also wakes every second regardless, in case an event was lost, so callers should just
+// check again whenever it returns (until their deadline)
+bool DeviceWaitNext(struct DeviceWait *wait, int timeout_ms);
+
+// the device node a PARTUUID= (or plain PARTLABEL=) tag's udev link points to, if it exists yet
+bool FindDeviceLink(const char *links, const struct Tag *tag, char *device, size_t size);
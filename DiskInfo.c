@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <string.h>
+#include "DiskInfo.h"
+
+void PrintPartitionInfo(FILE *out, const struct DiskInfo *disk)
+{
+	GUIDSTR guidstr;
+	fprintf(out, "DevicePath = %s\n", disk->DevicePath);
+
+	switch(disk->PartitionStyle) {
+		case PARTSTYLE_MBR:
+			for(uint32_t i = 0; i < disk->PartitionCount; ++i) {
+				// MBR does not actually store a GUID, but windows seems to construct one out of something, so allow searching for it
+				// (when the table was read by something other than windows, there's no such GUID to show)
+				if(!IsNullGUID(&disk->PartitionEntry[i].PartitionId)) {
+					fprintf(out, "%s --partition %u PARTUUID=%s\n", disk->Drive, disk->PartitionEntry[i].PartitionNumber, format_guid(guidstr, &disk->PartitionEntry[i].PartitionId));
+				}
+			}
+			break;
+		case PARTSTYLE_GPT:
+			fprintf(out, "%s PTUUID=%s\n", disk->Drive, format_guid(guidstr, &disk->DiskId));
+			for(uint32_t i = 0; i < disk->PartitionCount; ++i) {
+				const struct PartitionInfo *partition = &disk->PartitionEntry[i];
+				fprintf(out, "%s --partition %u PARTUUID=%s\n", disk->Drive, partition->PartitionNumber, format_guid(guidstr, &partition->PartitionId));
+				if(partition->Name[0]) fprintf(out, "%s --partition %u PARTLABEL=%s\n", disk->Drive, partition->PartitionNumber, partition->Name);
+			}
+			break;
+		case PARTSTYLE_RAW:
+			break;
+	}
+
+	if(disk->SerialNumber[0]) fprintf(out, "%s SERIAL=%s\n", disk->Drive, disk->SerialNumber);
+	if(disk->Model[0]) fprintf(out, "%s MODEL=%s\n", disk->Drive, disk->Model);
+}
+
+bool ParseListOption(const char *arg, enum ListFormat *format)
+{
+	if(!strcmp(arg, "--list")) *format = LIST_TEXT;
+	else if(!strcmp(arg, "--list=json")) *format = LIST_JSON;
+	else if(!strcmp(arg, "--list=nul")) *format = LIST_NUL;
+	else return false;
+	return true;
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// one record, built up in place (without allocating, or going through printf) and then written out in one go
+struct Record
+{
+	enum ListFormat format;
+	size_t used;
+	bool truncated;
+	char buf[4096];
+};
+
+static void RecordChar(struct Record *record, char c)
+{
+	if(record->used < sizeof(record->buf)) {
+		record->buf[record->used++] = c;
+	} else {
+		record->truncated = true;
+	}
+}
+
+static void RecordRaw(struct Record *record, const char *str)
+{
+	size_t len = strlen(str);
+	if(len > sizeof(record->buf) - record->used) {
+		record->truncated = true;
+		return;
+	}
+	memcpy(record->buf + record->used, str, len);
+	record->used += len;
+}
+
+static void RecordKey(struct Record *record, const char *key)
+{
+	if(record->format == LIST_JSON) {
+		if(record->used > 1) RecordChar(record, ','); // (past the opening brace)
+		RecordChar(record, '"');
+		RecordRaw(record, key);
+		RecordRaw(record, "\":");
+	} else {
+		RecordRaw(record, key);
+		RecordChar(record, '=');
+	}
+}
+
+static void RecordEndField(struct Record *record)
+{
+	if(record->format == LIST_NUL) RecordChar(record, '\0');
+}
+
+static void RecordString(struct Record *record, const char *key, const char *value)
+{
+	RecordKey(record, key);
+	if(record->format == LIST_JSON) {
+		RecordChar(record, '"');
+		for(const unsigned char *p = (const unsigned char *)value; *p; ++p) {
+			if(*p == '"' || *p == '\\') {
+				RecordChar(record, '\\');
+				RecordChar(record, (char)*p);
+			} else if(*p < 0x20) {
+				RecordRaw(record, "\\u00");
+				RecordChar(record, hex_digits[*p >> 4]);
+				RecordChar(record, hex_digits[*p & 0xf]);
+			} else {
+				RecordChar(record, (char)*p);
+			}
+		}
+		RecordChar(record, '"');
+	} else {
+		RecordRaw(record, value);
+	}
+	RecordEndField(record);
+}
+
+static void RecordNumber(struct Record *record, const char *key, uint64_t value)
+{
+	char digits[21], *p = digits + sizeof(digits);
+	*--p = '\0';
+	do {
+		*--p = (char)('0' + value % 10);
+		value /= 10;
+	} while(value);
+	RecordKey(record, key);
+	RecordRaw(record, p);
+	RecordEndField(record);
+}
+
+static void RecordGUID(struct Record *record, const char *key, const GUID *guid)
+{
+	GUIDSTR guidstr;
+	RecordString(record, key, format_guid(guidstr, guid));
+}
+
+static void RecordBegin(struct Record *record, enum ListFormat format, const struct DiskInfo *disk, const char *type, uint32_t PartitionNumber)
+{
+	static const char *styles[] = { "raw", "mbr", "gpt" };
+	record->format = format;
+	record->used = 0;
+	record->truncated = false;
+	if(format == LIST_JSON) RecordChar(record, '{');
+	RecordString(record, "type", type);
+	RecordString(record, "drive", disk->Drive ? disk->Drive : "");
+	if(disk->DriveNumber >= 0) RecordNumber(record, "disk_number", (uint32_t)disk->DriveNumber);
+	RecordNumber(record, "partition", PartitionNumber);
+	RecordString(record, "style", styles[disk->PartitionStyle]);
+}
+
+static void RecordWrite(struct Record *record, FILE *out)
+{
+	if(record->format == LIST_JSON) RecordRaw(record, "}\n");
+	else RecordChar(record, '\0');
+	// better no record than a corrupt one
+	if(record->truncated) return;
+	fwrite(record->buf, 1, record->used, out);
+}
+
+void PrintDiskRecords(FILE *out, const struct DiskInfo *disk, enum ListFormat format)
+{
+	if(format == LIST_TEXT) {
+		PrintPartitionInfo(out, disk);
+		return;
+	}
+
+	struct Record record;
+	RecordBegin(&record, format, disk, "disk", 0);
+	if(disk->PartitionStyle == PARTSTYLE_GPT) RecordGUID(&record, "ptuuid", &disk->DiskId);
+	if(disk->PartitionStyle == PARTSTYLE_MBR) {
+		char signature[9];
+		for(int i = 0; i < 8; ++i) signature[i] = hex_digits[disk->Signature >> (28 - 4 * i) & 0xf];
+		signature[8] = '\0';
+		RecordString(&record, "signature", signature);
+	}
+	if(disk->SerialNumber[0]) RecordString(&record, "serial", disk->SerialNumber);
+	if(disk->Model[0]) RecordString(&record, "model", disk->Model);
+	RecordNumber(&record, "partitions", disk->PartitionCount);
+	if(disk->DevicePath) RecordString(&record, "device_path", disk->DevicePath);
+	RecordWrite(&record, out);
+
+	for(uint32_t i = 0; i < disk->PartitionCount; ++i) {
+		const struct PartitionInfo *partition = &disk->PartitionEntry[i];
+		RecordBegin(&record, format, disk, "partition", partition->PartitionNumber);
+		RecordNumber(&record, "offset", partition->StartingOffset);
+		RecordNumber(&record, "size", partition->PartitionLength);
+		if(!IsNullGUID(&partition->PartitionId)) RecordGUID(&record, "partuuid", &partition->PartitionId);
+		if(disk->PartitionStyle == PARTSTYLE_GPT) {
+			RecordGUID(&record, "parttype", &partition->PartitionType);
+			RecordString(&record, "name", partition->Name);
+		} else {
+			char type[5] = { '0', 'x', hex_digits[partition->MbrType >> 4], hex_digits[partition->MbrType & 0xf], '\0' };
+			RecordString(&record, "parttype", type);
+		}
+		RecordWrite(&record, out);
+	}
+}
+
+const struct PartitionInfo * FindPartitionByGUID(const struct DiskInfo *disk, const GUID *guid)
+{
+	for(uint32_t i = 0; i < disk->PartitionCount; ++i) {
+		if(IsEqualGUID(guid, &disk->PartitionEntry[i].PartitionId)) return &disk->PartitionEntry[i];
+	}
+	return NULL;
+}
+
+const struct PartitionInfo * FindPartitionByType(const struct DiskInfo *disk, const GUID *type)
+{
+	for(uint32_t i = 0; i < disk->PartitionCount; ++i) {
+		if(IsEqualGUID(type, &disk->PartitionEntry[i].PartitionType)) return &disk->PartitionEntry[i];
+	}
+	return NULL;
+}
+
+const struct PartitionInfo * FindPartitionByName(const struct DiskInfo *disk, const char *name)
+{
+	for(uint32_t i = 0; i < disk->PartitionCount; ++i) {
+		if(!strcmp(name, disk->PartitionEntry[i].Name)) return &disk->PartitionEntry[i];
+	}
+	return NULL;
+}
+
+void TrimDeviceString(char *str)
+{
+	size_t start = strspn(str, " \t"), end = strlen(str);
+	while(end > start && (str[end - 1] == ' ' || str[end - 1] == '\t' || str[end - 1] == '\n')) --end;
+	memmove(str, str + start, end - start);
+	str[end - start] = '\0';
+}
+
+static char * strdup_or_null(const char *s)
+{
+	if(!s) return NULL;
+	size_t size = strlen(s) + 1;
+	char *copy = malloc(size);
+	if(copy) memcpy(copy, s, size);
+	return copy;
+}
+
+bool CopyDiskInfo(struct DiskInfo *dst, const struct DiskInfo *src)
+{
+	*dst = *src;
+	dst->DevicePath = strdup_or_null(src->DevicePath);
+	dst->Drive = strdup_or_null(src->Drive);
+	dst->PartitionEntry = malloc((src->PartitionCount ? src->PartitionCount : 1) * sizeof(struct PartitionInfo));
+	if((src->DevicePath && !dst->DevicePath) || (src->Drive && !dst->Drive) || !dst->PartitionEntry) {
+		FreeDiskInfo(dst);
+		return false;
+	}
+	memcpy(dst->PartitionEntry, src->PartitionEntry, src->PartitionCount * sizeof(struct PartitionInfo));
+	return true;
+}
+
+void FreeDiskInfo(struct DiskInfo *disk)
+{
+	free(disk->DevicePath);
+	free(disk->Drive);
+	free(disk->PartitionEntry);
+	*disk = (struct DiskInfo){ 0 };
+}
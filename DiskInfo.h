@@ -0,0 +1,67 @@
+#pragma once
+
+// Platform-neutral view of a disk and its partition table
+// The win32 side fills this from IOCTL_DISK_GET_DRIVE_LAYOUT_EX, the linux side by reading the partition table itself,
+// so that tag matching and the --list output only need to be written once
+
+#include <stdio.h>
+#include "Guid.h"
+
+enum PartitionStyle {
+	PARTSTYLE_RAW = 0,
+	PARTSTYLE_MBR,
+	PARTSTYLE_GPT,
+};
+
+struct PartitionInfo
+{
+	uint32_t PartitionNumber; // as accepted by wsl --mount --partition
+	uint64_t StartingOffset;
+	uint64_t PartitionLength;
+	GUID PartitionId; // GPT unique partition GUID (or the one windows constructs for MBR)
+	GUID PartitionType; // GPT only
+	uint8_t MbrType; // MBR only
+	char Name[109]; // GPT partition name, converted to UTF-8 (36 UTF-16 code units)
+};
+
+struct DiskInfo
+{
+	char *DevicePath; // how the device was found (interface path, /sys/class/block/..., image file)
+	char *Drive; // what gets passed to wsl --mount (\\.\PhysicalDrive<n>), or the linux device node
+	int32_t DriveNumber; // the <n> in \\.\PhysicalDrive<n>, or -1 when not known
+	enum PartitionStyle PartitionStyle;
+	GUID DiskId; // GPT only
+	uint32_t Signature; // MBR only
+	char SerialNumber[128]; // from the storage device descriptor (or sysfs), trimmed; empty if the device has none
+	char Model[128]; // the product id (e.g. "Samsung SSD 870 EVO 1TB"), likewise
+	uint32_t PartitionCount;
+	struct PartitionInfo *PartitionEntry;
+};
+
+// prints the lines wsl-mount-findfs --list shows for this disk
+void PrintPartitionInfo(FILE *out, const struct DiskInfo *disk);
+
+// --list=<format>, for scripts
+enum ListFormat {
+	LIST_TEXT, // --list: the PrintPartitionInfo lines
+	LIST_JSON, // --list=json: one JSON object per line (JSON lines)
+	LIST_NUL, // --list=nul: key=value fields, each NUL-terminated, with an empty field (so a second NUL) ending each record
+};
+// false if arg isn't --list or --list=<json|nul>
+bool ParseListOption(const char *arg, enum ListFormat *format);
+// a record for the disk itself (type=disk), then one per partition (type=partition), each written with a single fwrite:
+// drive, disk_number (when known), partition (0 for the disk), style (gpt|mbr|raw), then for the disk
+// ptuuid or signature, serial, model, partitions and device_path, and for each partition offset, size (bytes),
+// partuuid, parttype (a GUID, or for MBR the type byte, as 0x83) and name
+// Field values are as in the text form, so e.g. partuuid can be used as PARTUUID=<partuuid>
+void PrintDiskRecords(FILE *out, const struct DiskInfo *disk, enum ListFormat format);
+
+const struct PartitionInfo * FindPartitionByGUID(const struct DiskInfo *disk, const GUID *guid);
+const struct PartitionInfo * FindPartitionByType(const struct DiskInfo *disk, const GUID *type);
+const struct PartitionInfo * FindPartitionByName(const struct DiskInfo *disk, const char *name);
+
+// drops the padding devices report their serial number and model with
+void TrimDeviceString(char *str);
+
+bool CopyDiskInfo(struct DiskInfo *dst, const struct DiskInfo *src);
+void FreeDiskInfo(struct DiskInfo *disk);
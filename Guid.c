@@ -0,0 +1,67 @@
+#include "Guid.h"
+
+// table-driven, since these run for every partition of every disk on --list, and every line of the cache:
+// each hex digit is one lookup, rather than a trip through the sscanf/printf format interpreters
+
+// 0x10 | the value of each hex digit (either case), 0 for anything else
+static const uint8_t hex_value[256] = {
+	['0'] = 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,
+	['A'] = 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+	['a'] = 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+};
+static const char hex_digit[16] = "0123456789abcdef";
+
+// where each byte of the canonical xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx form starts, in big-endian reading order
+// (Data1 bytes, Data2 bytes, Data3 bytes, then Data4)
+static const uint8_t guid_offsets[16] = { 0, 2, 4, 6, 9, 11, 14, 16, 19, 21, 24, 26, 28, 30, 32, 34 };
+
+bool parse_guid(const char *str, GUID *guid)
+{
+	uint8_t bytes[16];
+	for(int i = 0; i < 16; ++i) {
+		// strictly left to right, so a short string fails at its terminator rather than reading past it
+		const unsigned char *p = (const unsigned char *)str + guid_offsets[i];
+		if((i == 4 || i == 6 || i == 8 || i == 10) && p[-1] != '-') return false;
+		uint8_t hi = hex_value[p[0]], lo = hi ? hex_value[p[1]] : 0;
+		if(!hi || !lo) return false;
+		bytes[i] = (uint8_t)((hi & 0xf) << 4 | (lo & 0xf));
+	}
+
+	guid->Data1 = (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+	guid->Data2 = (uint16_t)(bytes[4] << 8 | bytes[5]);
+	guid->Data3 = (uint16_t)(bytes[6] << 8 | bytes[7]);
+	memcpy(guid->Data4, bytes + 8, 8);
+	return true;
+}
+
+const char * format_guid(GUIDSTR buf, const GUID *guid)
+{
+	uint8_t bytes[16] = {
+		(uint8_t)(guid->Data1 >> 24), (uint8_t)(guid->Data1 >> 16), (uint8_t)(guid->Data1 >> 8), (uint8_t)guid->Data1,
+		(uint8_t)(guid->Data2 >> 8), (uint8_t)guid->Data2,
+		(uint8_t)(guid->Data3 >> 8), (uint8_t)guid->Data3,
+	};
+	memcpy(bytes + 8, guid->Data4, 8);
+
+	buf[8] = buf[13] = buf[18] = buf[23] = '-';
+	for(int i = 0; i < 16; ++i) {
+		buf[guid_offsets[i]] = hex_digit[bytes[i] >> 4];
+		buf[guid_offsets[i] + 1] = hex_digit[bytes[i] & 0xf];
+	}
+	buf[36] = '\0';
+	return buf;
+}
+
+bool IsNullGUID(const GUID *guid)
+{
+	static const GUID null_guid = { 0 };
+	return IsEqualGUID(guid, &null_guid);
+}
+
+void guid_from_le_bytes(GUID *guid, const uint8_t bytes[16])
+{
+	guid->Data1 = (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+	guid->Data2 = (uint16_t)(bytes[4] | bytes[5] << 8);
+	guid->Data3 = (uint16_t)(bytes[6] | bytes[7] << 8);
+	memcpy(guid->Data4, bytes + 8, 8);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+// GUID parsing/formatting shared by the win32 helpers and the linux-side utilities
+// On windows this is just the normal GUID from <guiddef.h>; elsewhere we declare a layout-compatible one
+// so that code comparing partition GUIDs can be shared verbatim
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+typedef struct _GUID {
+	uint32_t Data1;
+	uint16_t Data2;
+	uint16_t Data3;
+	uint8_t Data4[8];
+} GUID;
+
+#define IsEqualGUID(rguid1, rguid2) (!memcmp((rguid1), (rguid2), sizeof(GUID)))
+#endif
+
+typedef char GUIDSTR[37];
+
+// the 36 character xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx form, either case (anything after it is ignored); neither allocates
+bool parse_guid(const char *str, GUID *guid);
+// lower case, as lsblk and blkid show them
+const char * format_guid(GUIDSTR buf, const GUID *guid);
+
+bool IsNullGUID(const GUID *guid);
+
+// GPT (and windows) store GUIDs in "mixed-endian" form: Data1-3 little-endian, Data4 as bytes
+void guid_from_le_bytes(GUID *guid, const uint8_t bytes[16]);
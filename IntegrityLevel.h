@@ -1,3 +1,6 @@
 #pragma once
 
-void RunAsHighIntegrity();
+#include <windows.h>
+
+DWORD GetCurrentProcessIntegrityLevel();
+DWORD RunSelfElevated(LPCSTR parameters);
@@ -0,0 +1,58 @@
+#include <errno.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "Interop.h"
+
+extern char **environ;
+
+void LocateHelper(const char *name, const char *env, char *exe, size_t size)
+{
+	const char *override = env ? getenv(env) : NULL;
+	if(override && *override) {
+		snprintf(exe, size, "%s", override);
+		return;
+	}
+
+	char self[PATH_MAX];
+	ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	char *slash = len > 0 ? memrchr(self, '/', (size_t)len) : NULL;
+	if(slash) {
+		*slash = '\0';
+		if((size_t)snprintf(exe, size, "%s/%s", self, name) < size && access(exe, X_OK) == 0) return;
+	}
+	snprintf(exe, size, "%s", name); // search PATH
+}
+
+// posix_spawn rather than fork, since the callers may be large multithreaded daemons
+pid_t SpawnHelper(const char *exe, char *const argv[], int stdin_fd, int stdout_fd)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	if(stdin_fd >= 0) posix_spawn_file_actions_adddup2(&actions, stdin_fd, STDIN_FILENO);
+	if(stdout_fd >= 0) posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO);
+
+	pid_t pid;
+	int error = posix_spawnp(&pid, exe, &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if(error) {
+		fprintf(stderr, "*** exec %s: %s\n", exe, strerror(error));
+		return -1;
+	}
+	return pid;
+}
+
+int WaitHelper(pid_t pid)
+{
+	int status;
+	while(waitpid(pid, &status, 0) < 0) {
+		if(errno != EINTR) return -1;
+	}
+	if(WIFEXITED(status)) return WEXITSTATUS(status);
+	if(WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+	return -1;
+}
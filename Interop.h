@@ -0,0 +1,18 @@
+#pragma once
+
+// Finding and running the helper programs (the win32 .exe's via WSL interop, or their linux-side counterparts)
+// from the linux-side tools
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// $<env> if that's set (env may be NULL), else <name> next to this executable if it's there,
+// else just <name> (for execvp/posix_spawnp to look up in $PATH)
+void LocateHelper(const char *name, const char *env, char *exe, size_t size);
+
+// starts exe (searching $PATH if it has no /) with stdin/stdout connected to the given descriptors (-1 to inherit)
+// returns the pid, or -1 having reported why it couldn't
+pid_t SpawnHelper(const char *exe, char *const argv[], int stdin_fd, int stdout_fd);
+
+// returns the exit code of a SpawnHelper child (128+signal if it was killed, -1 if it couldn't be waited for)
+int WaitHelper(pid_t pid);
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "KeyslotHints.h"
+
+void LoadKeyslotHints(struct KeyslotHints *hints, const char *path)
+{
+	*hints = (struct KeyslotHints){ 0 };
+
+	FILE *f = fopen(path, "re");
+	if(!f) return;
+
+	char line[256];
+	while(fgets(line, sizeof(line), f)) {
+		char uuid[64];
+		int keyslot;
+		if(sscanf(line, "%63s %d", uuid, &keyslot) != 2 || keyslot < 0) continue;
+		SetKeyslotHint(hints, uuid, keyslot);
+	}
+	fclose(f);
+	hints->dirty = false;
+}
+
+bool SaveKeyslotHints(struct KeyslotHints *hints, const char *path)
+{
+	if(!hints->dirty) return true;
+
+	// write a new file and rename it over the old one, so a concurrent reader never sees a partial file
+	char tmp_path[4096];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	FILE *f = fopen(tmp_path, "we");
+	if(!f) {
+		fprintf(stderr, "*** could not write %s\n", tmp_path);
+		return false;
+	}
+
+	for(size_t i = 0; i < hints->count; ++i) fprintf(f, "%s %d\n", hints->hints[i].uuid, hints->hints[i].keyslot);
+
+	bool success = !ferror(f);
+	success = !fclose(f) && success;
+	success = success && !rename(tmp_path, path);
+	if(!success) {
+		fprintf(stderr, "*** could not replace %s\n", path);
+		remove(tmp_path);
+		return false;
+	}
+	hints->dirty = false;
+	return true;
+}
+
+void FreeKeyslotHints(struct KeyslotHints *hints)
+{
+	free(hints->hints);
+	*hints = (struct KeyslotHints){ 0 };
+}
+
+int FindKeyslotHint(const struct KeyslotHints *hints, const char *uuid)
+{
+	if(!uuid) return -1;
+	for(size_t i = 0; i < hints->count; ++i) {
+		if(!strcmp(hints->hints[i].uuid, uuid)) return hints->hints[i].keyslot;
+	}
+	return -1;
+}
+
+void SetKeyslotHint(struct KeyslotHints *hints, const char *uuid, int keyslot)
+{
+	// UUIDs go into the file space-separated
+	if(!uuid || !*uuid || strlen(uuid) >= sizeof(hints->hints[0].uuid) || strpbrk(uuid, " \t\r\n")) return;
+
+	for(size_t i = 0; i < hints->count; ++i) {
+		if(!strcmp(hints->hints[i].uuid, uuid)) {
+			if(hints->hints[i].keyslot != keyslot) {
+				hints->hints[i].keyslot = keyslot;
+				hints->dirty = true;
+			}
+			return;
+		}
+	}
+
+	struct KeyslotHint *grown = realloc(hints->hints, (hints->count + 1) * sizeof(struct KeyslotHint));
+	if(!grown) return; // it's just a hint
+	hints->hints = grown;
+	struct KeyslotHint *hint = &hints->hints[hints->count++];
+	snprintf(hint->uuid, sizeof(hint->uuid), "%s", uuid);
+	hint->keyslot = keyslot;
+	hints->dirty = true;
+}
+
+const char * DefaultKeyslotHintsPath(void)
+{
+	const char *override = getenv("WSL_LUKS_KEYSLOT_HINTS");
+	if(override) return *override ? override : NULL;
+	return "/var/cache/wsl-luks-keyslot-hints";
+}
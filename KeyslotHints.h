@@ -0,0 +1,38 @@
+#pragma once
+
+// Remembers which keyslot last accepted the passphrase for each LUKS volume, by its header's UUID
+// (several volumes may share one LUKS\<Target>, each with the passphrase in a different slot),
+// so unlocking normally costs one KDF run (on that slot) rather than one for every slot tried before it.
+//
+// The file is plain text, one volume per line:
+// <UUID> <keyslot>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct KeyslotHint
+{
+	char uuid[64];
+	int keyslot;
+};
+
+struct KeyslotHints
+{
+	struct KeyslotHint *hints;
+	size_t count;
+	bool dirty; // differs from what was loaded
+};
+
+// a missing or unreadable file just gives no hints
+void LoadKeyslotHints(struct KeyslotHints *hints, const char *path);
+// replaces the file atomically, if anything changed
+bool SaveKeyslotHints(struct KeyslotHints *hints, const char *path);
+void FreeKeyslotHints(struct KeyslotHints *hints);
+
+// -1 if there's no hint for the volume (or uuid is NULL)
+int FindKeyslotHint(const struct KeyslotHints *hints, const char *uuid);
+void SetKeyslotHint(struct KeyslotHints *hints, const char *uuid, int keyslot);
+
+// default location of the file (/var/cache/wsl-luks-keyslot-hints), overridden by $WSL_LUKS_KEYSLOT_HINTS;
+// returns NULL if hints are disabled (WSL_LUKS_KEYSLOT_HINTS set but empty)
+const char * DefaultKeyslotHintsPath(void);
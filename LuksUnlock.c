@@ -0,0 +1,214 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "LuksUnlock.h"
+#include "Metrics.h"
+
+#define MAX_FETCHES 3 // like cryptsetup's --tries, per volume
+
+struct Round
+{
+	struct LuksUnlock *unlock;
+	struct LuksVolume **volumes;
+	size_t count;
+	size_t next;
+};
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static const char * Target(const struct LuksVolume *volume)
+{
+	return volume->target ? volume->target : volume->name;
+}
+
+void OpenLuksVolume(const struct LuksUnlock *unlock, struct LuksVolume *volume)
+{
+	volume->state = LUKS_PENDING;
+	volume->keyslot = -1;
+	volume->hint = -1;
+
+	if(!unlock->test && crypt_status(NULL, volume->name) == CRYPT_ACTIVE) {
+		volume->state = LUKS_ACTIVE;
+		return;
+	}
+	int r = crypt_init(&volume->cd, volume->device);
+	if(r >= 0) r = crypt_load(volume->cd, CRYPT_LUKS, NULL);
+	if(r < 0) {
+		fprintf(stderr, "*** %s: %s: %s\n", volume->name, volume->device, strerror(-r));
+		volume->state = LUKS_FAILED;
+		return;
+	}
+	// by the header's UUID, as volumes sharing a target can each have the passphrase in a different slot
+	if(unlock->hints) volume->hint = FindKeyslotHint(unlock->hints, crypt_get_uuid(volume->cd));
+}
+
+void CloseLuksVolume(struct LuksVolume *volume)
+{
+	ClearAskpassRequests(&volume->own, 1);
+	if(volume->cd) crypt_free(volume->cd);
+	volume->cd = NULL;
+}
+
+static int Activate(const struct LuksUnlock *unlock, struct LuksVolume *volume, int keyslot)
+{
+	double start = now_ms();
+	// a NULL name only checks the passphrase
+	int r = crypt_activate_by_passphrase(volume->cd, unlock->test ? NULL : volume->name, keyslot,
+	                                     volume->attempt->passphrase, volume->attempt->length, volume->flags);
+	double elapsed = now_ms() - start;
+	volume->kdf_ms += elapsed;
+	++volume->attempts;
+	// -EPERM (a wrong passphrase) is outcome 1
+	RecordMetricDuration("luks.kdf", (uint64_t)(elapsed * 1e3), r < 0 ? -r : 0);
+	return r;
+}
+
+// the keyslot returned, or -errno (-EPERM for a wrong passphrase)
+static int TryKeyslots(const struct LuksUnlock *unlock, struct LuksVolume *volume)
+{
+	if(volume->key_slot >= 0) return Activate(unlock, volume, volume->key_slot);
+	if(volume->hint < 0) return Activate(unlock, volume, CRYPT_ANY_SLOT);
+
+	int r = Activate(unlock, volume, volume->hint);
+	if(r >= 0 || (r != -EPERM && r != -ENOENT && r != -EINVAL)) return r;
+
+	// the hinted slot didn't take (or is gone); the others one at a time, so as not to check that one twice
+	int max = crypt_keyslot_max(crypt_get_type(volume->cd));
+	for(int keyslot = 0; keyslot < max; ++keyslot) {
+		if(keyslot == volume->hint) continue;
+		crypt_keyslot_info info = crypt_keyslot_status(volume->cd, keyslot);
+		if(info != CRYPT_SLOT_ACTIVE && info != CRYPT_SLOT_ACTIVE_LAST) continue;
+		r = Activate(unlock, volume, keyslot);
+		if(r != -EPERM) return r;
+	}
+	return -EPERM;
+}
+
+static void * AttemptWorker(void *arg)
+{
+	struct Round *round = arg;
+	for(;;) {
+		size_t i = __atomic_fetch_add(&round->next, 1, __ATOMIC_RELAXED);
+		if(i >= round->count) return NULL;
+		struct LuksVolume *volume = round->volumes[i];
+		volume->result = TryKeyslots(round->unlock, volume);
+	}
+}
+
+// tries each volume's attempt passphrase, the KDFs running concurrently
+static void RunRound(struct LuksUnlock *unlock, struct LuksVolume **volumes, size_t count)
+{
+	struct Round round = { .unlock = unlock, .volumes = volumes, .count = count };
+	size_t threads = unlock->jobs < count ? unlock->jobs : count;
+	pthread_t *thread = calloc(threads ? threads : 1, sizeof(pthread_t));
+	size_t started = 0;
+	while(thread && started + 1 < threads && !pthread_create(&thread[started], NULL, &AttemptWorker, &round)) ++started;
+	AttemptWorker(&round);
+	for(size_t i = 0; i < started; ++i) pthread_join(thread[i], NULL);
+	free(thread);
+
+	for(size_t i = 0; i < count; ++i) {
+		struct LuksVolume *volume = volumes[i];
+		if(volume->result >= 0) {
+			volume->state = LUKS_UNLOCKED;
+			volume->keyslot = volume->result;
+			if(unlock->hints) SetKeyslotHint(unlock->hints, crypt_get_uuid(volume->cd), volume->keyslot);
+		} else if(volume->result != -EPERM) {
+			fprintf(stderr, "*** %s: %s\n", volume->name, strerror(-volume->result));
+			volume->state = LUKS_FAILED;
+		}
+	}
+}
+
+// asks for each of these volumes' passphrases (one per target), in one askpass batch
+static void FetchPassphrases(struct LuksUnlock *unlock, struct LuksVolume **volumes, size_t count)
+{
+	struct AskpassRequest *requests = calloc(count, sizeof(struct AskpassRequest));
+	for(size_t i = 0; !requests && i < count; ++i) {
+		ClearAskpassRequests(&volumes[i]->own, 1);
+		volumes[i]->own.status = ASKPASS_FAILED;
+	}
+	if(!requests) return;
+	for(size_t i = 0; i < count; ++i) {
+		// one asked for before didn't work, so don't just get the stored credential again
+		requests[i].target = Target(volumes[i]);
+		requests[i].auth_error = volumes[i]->fetches > 0;
+	}
+	double start = now_ms();
+	RunAskpassBatch(unlock->askpass, requests, count);
+	++unlock->spawns;
+
+	int unanswered = 0;
+	for(size_t i = 0; i < count; ++i) {
+		ClearAskpassRequests(&volumes[i]->own, 1);
+		volumes[i]->own = requests[i];
+		unanswered += requests[i].status != ASKPASS_OK;
+	}
+	// the batch as a whole: its outcome is how many of its targets got no passphrase
+	RecordMetricDuration("luks.askpass", (uint64_t)((now_ms() - start) * 1e3), unanswered);
+	free(requests);
+}
+
+// the volume among askers that fetches the passphrase for volume's target
+static struct LuksVolume * Asker(struct LuksVolume **askers, size_t count, const struct LuksVolume *volume)
+{
+	for(size_t i = 0; i < count; ++i) {
+		if(!strcmp(Target(askers[i]), Target(volume))) return askers[i];
+	}
+	return NULL;
+}
+
+void UnlockLuksVolumes(struct LuksUnlock *unlock, struct LuksVolume *volumes, size_t count)
+{
+	struct LuksVolume **pending = calloc(count ? count : 1, sizeof(struct LuksVolume *));
+	struct LuksVolume **askers = calloc(count ? count : 1, sizeof(struct LuksVolume *));
+	if(!pending || !askers) {
+		free(pending);
+		free(askers);
+		return;
+	}
+
+	// each round fetches one passphrase per target still pending, all in one batch, and tries it on just the volumes
+	// stored under that target; those it doesn't unlock go round again, asking anew (skipping the stored credential)
+	for(;;) {
+		size_t n = 0, asked = 0;
+		for(size_t i = 0; i < count; ++i) {
+			struct LuksVolume *volume = &volumes[i];
+			if(volume->state != LUKS_PENDING) continue;
+			if(volume->fetches >= MAX_FETCHES) {
+				fprintf(stderr, "*** %s: no key available with this passphrase\n", volume->name);
+				volume->state = LUKS_FAILED;
+				continue;
+			}
+			pending[n++] = volume;
+			if(!Asker(askers, asked, volume)) askers[asked++] = volume;
+		}
+		if(!n) break;
+		FetchPassphrases(unlock, askers, asked);
+
+		size_t attempts = 0;
+		for(size_t i = 0; i < n; ++i) {
+			struct LuksVolume *volume = pending[i];
+			const struct AskpassRequest *passphrase = &Asker(askers, asked, volume)->own;
+			++volume->fetches;
+			if(passphrase->status != ASKPASS_OK) {
+				fprintf(stderr, "*** %s: no passphrase (%s)\n", volume->name, passphrase->status == ASKPASS_CANCELLED ? "cancelled" : "askpass failed");
+				volume->state = LUKS_FAILED;
+				continue;
+			}
+			volume->attempt = passphrase;
+			pending[attempts++] = volume;
+		}
+		RunRound(unlock, pending, attempts);
+	}
+	free(pending);
+	free(askers);
+}
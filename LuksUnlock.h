@@ -0,0 +1,61 @@
+#pragma once
+
+// Unlocks several LUKS volumes at once via libcryptsetup, with passphrases from luks-askpass-wincred.exe
+//
+// Each keyslot check is a deliberately expensive KDF (a second or two of argon2 with the LUKS2 defaults),
+// which `luks-askpass-wincred.exe | cryptsetup open` does for one volume after another; here they run concurrently.
+// Volumes stored under the same askpass target share a passphrase, fetched once and tried on all of them (and only them);
+// every target's is fetched together, with one askpass batch per round.
+// The keyslot each volume last unlocked with is tried first (see KeyslotHints.h), and key_slot restricts it to just one,
+// so a wrong passphrase costs one KDF run rather than one per slot.
+
+#include <libcryptsetup.h>
+#include <limits.h>
+#include <stdbool.h>
+#include "Askpass.h"
+#include "KeyslotHints.h"
+
+enum LuksVolumeState {
+	LUKS_PENDING,
+	LUKS_UNLOCKED,
+	LUKS_ACTIVE, // already was
+	LUKS_FAILED,
+};
+
+struct LuksVolume
+{
+	char name[128]; // the /dev/mapper name
+	char device[PATH_MAX];
+	const char *target; // the askpass <TargetName> (LUKS\<TargetName>); NULL for name
+	uint32_t flags; // CRYPT_ACTIVATE_*
+	int key_slot; // the only keyslot to try, or -1 for any
+
+	enum LuksVolumeState state;
+	int keyslot; // that unlocked it
+	int hint; // the keyslot last unlocked with (kept under the header's UUID), or -1
+	unsigned fetches; // how many times its target's passphrase was asked for
+	unsigned attempts;
+	double kdf_ms;
+
+	struct crypt_device *cd;
+	struct AskpassRequest own; // the passphrase last fetched for its target, if it was the one that asked
+	const struct AskpassRequest *attempt; // what this round tries
+	int result;
+};
+
+struct LuksUnlock
+{
+	const char *askpass;
+	unsigned jobs; // KDFs at a time
+	bool test; // only check the passphrases (no device-mapper, so no root needed, and image files work as-is)
+	struct KeyslotHints *hints; // may be NULL
+
+	unsigned spawns; // askpass batches run
+};
+
+// name, device, target, flags and key_slot set; loads the LUKS header (unless it's already active),
+// leaving the volume LUKS_FAILED having reported why if it can't
+void OpenLuksVolume(const struct LuksUnlock *unlock, struct LuksVolume *volume);
+// unlocks every LUKS_PENDING volume it can
+void UnlockLuksVolumes(struct LuksUnlock *unlock, struct LuksVolume *volumes, size_t count);
+void CloseLuksVolume(struct LuksVolume *volume);
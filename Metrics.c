@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#include "Crt.h"
+#include "Metrics.h"
+#include "Trace.h"
+
+bool metrics_enabled;
+static char metrics_path[1024];
+#ifdef _WIN32
+static HANDLE metrics_handle = INVALID_HANDLE_VALUE;
+#else
+static int metrics_fd = -1;
+#endif
+
+static uint32_t Checksum(const struct MetricRecord *record)
+{
+	const unsigned char *p = (const unsigned char *)&record->time_us, *end = (const unsigned char *)(record + 1);
+	uint32_t hash = 2166136261u;
+	for(; p < end; ++p) hash = (hash ^ *p) * 16777619u;
+	return hash;
+}
+
+const char * DefaultMetricsPath(void)
+{
+	static char path[1024];
+#ifdef _WIN32
+	char value[MAX_PATH];
+	const char *dir = GetEnvironment("LOCALAPPDATA", value, sizeof(value));
+	if(!dir || !*dir) return NULL;
+	snprintf(path, sizeof(path), "%s\\wsl-mount-metrics.log", dir);
+#else
+	const char *state = getenv("XDG_STATE_HOME"), *home = getenv("HOME");
+	if(!getuid()) snprintf(path, sizeof(path), "/var/lib/wsl-mount-metrics.log");
+	else if(state && *state) snprintf(path, sizeof(path), "%s/wsl-mount-metrics.log", state);
+	else if(home && *home) snprintf(path, sizeof(path), "%s/.local/state/wsl-mount-metrics.log", home);
+	else return NULL;
+#endif
+	return path;
+}
+
+// opens the log for appending, first moving it to <log>.old if it's full
+// (only if it's still the file this process found full, so that two processes starting together don't rotate twice;
+// on linux that check and the rename are under a lock on the full file, on windows there's just the check)
+static bool OpenLog(void)
+{
+	char old_path[sizeof(metrics_path) + 8];
+	snprintf(old_path, sizeof(old_path), "%s.old", metrics_path);
+#ifdef _WIN32
+	for(int attempt = 0; attempt < 2; ++attempt) {
+		metrics_handle = CreateFileA(metrics_path, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		                             OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if(metrics_handle == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER size;
+		if(attempt || !GetFileSizeEx(metrics_handle, &size) || (uint64_t)size.QuadPart < METRICS_MAX_RECORDS * sizeof(struct MetricRecord)) break;
+		BY_HANDLE_FILE_INFORMATION opened, current;
+		HANDLE check = CreateFileA(metrics_path, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		bool same = check != INVALID_HANDLE_VALUE && GetFileInformationByHandle(metrics_handle, &opened) && GetFileInformationByHandle(check, &current)
+		            && opened.nFileIndexHigh == current.nFileIndexHigh && opened.nFileIndexLow == current.nFileIndexLow;
+		if(check != INVALID_HANDLE_VALUE) CloseHandle(check);
+		CloseHandle(metrics_handle);
+		metrics_handle = INVALID_HANDLE_VALUE;
+		if(same) MoveFileExA(metrics_path, old_path, MOVEFILE_REPLACE_EXISTING);
+	}
+#else
+	for(int attempt = 0; attempt < 2; ++attempt) {
+		metrics_fd = open(metrics_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+		if(metrics_fd < 0) return false;
+		struct stat opened, current;
+		if(attempt || fstat(metrics_fd, &opened) || (uint64_t)opened.st_size < METRICS_MAX_RECORDS * sizeof(struct MetricRecord)) break;
+		flock(metrics_fd, LOCK_EX);
+		bool same = !stat(metrics_path, &current) && current.st_dev == opened.st_dev && current.st_ino == opened.st_ino;
+		if(same) rename(metrics_path, old_path);
+		close(metrics_fd);
+		metrics_fd = -1;
+	}
+#endif
+	return true;
+}
+
+bool MetricsStart(const char *path)
+{
+	char value[1024];
+	if(!path) path = GetEnvironment("WSL_MOUNT_METRICS", value, sizeof(value));
+	if(!path) path = DefaultMetricsPath();
+	if(!path || !*path) return false;
+
+	// absolute, since an elevated re-exec starts out in System32
+#ifdef _WIN32
+	if(!_fullpath(metrics_path, path, sizeof(metrics_path)))
+#else
+	if(!realpath(path, metrics_path))
+#endif
+		snprintf(metrics_path, sizeof(metrics_path), "%s", path);
+	// (quietly: the default log's directory may well not exist, and metrics are never worth failing over)
+	metrics_enabled = OpenLog();
+	return metrics_enabled;
+}
+
+bool MetricsArguments(int *argc, char *argv[])
+{
+	const char *path = NULL;
+	int kept = 1;
+	for(int i = 1; i < *argc; ++i) {
+		if(!strncmp(argv[i], "--metrics=", 10)) {
+			if(!path) path = argv[i] + 10;
+		} else {
+			argv[kept++] = argv[i];
+		}
+	}
+	*argc = kept;
+	argv[kept] = NULL;
+	char value[1024];
+	bool chosen = path || GetEnvironment("WSL_MOUNT_METRICS", value, sizeof(value));
+	if(!MetricsStart(path)) return false;
+
+#ifndef _WIN32
+	// only a log chosen explicitly: the default one is root's, in the distribution, which the windows side can't write to
+	if(chosen) {
+		const char *wslenv = getenv("WSLENV");
+		if(!wslenv || !strstr(wslenv, "WSL_MOUNT_METRICS")) {
+			char exported[1024];
+			snprintf(exported, sizeof(exported), "%s%sWSL_MOUNT_METRICS/p", wslenv ? wslenv : "", wslenv && *wslenv ? ":" : "");
+			setenv("WSLENV", exported, 1);
+		}
+		setenv("WSL_MOUNT_METRICS", metrics_path, 1);
+	}
+#else
+	(void)chosen;
+#endif
+	return true;
+}
+
+const char * MetricsPath(void)
+{
+	return metrics_enabled ? metrics_path : NULL;
+}
+
+void RecordMetricDuration(const char *step, uint64_t duration_us, int outcome)
+{
+	if(!metrics_enabled) return;
+	struct MetricRecord record = { .magic = METRICS_MAGIC, .time_us = WallClock(), .duration_us = duration_us, .outcome = outcome };
+#ifdef _WIN32
+	record.pid = GetCurrentProcessId();
+#else
+	record.pid = (uint32_t)getpid();
+#endif
+	snprintf(record.step, sizeof(record.step), "%s", step);
+	record.checksum = Checksum(&record);
+#ifdef _WIN32
+	DWORD written;
+	WriteFile(metrics_handle, &record, sizeof(record), &written, NULL);
+#else
+	ssize_t written = write(metrics_fd, &record, sizeof(record));
+	(void)written;
+#endif
+}
+
+void RecordMetric(const char *step, uint64_t start, int outcome)
+{
+	RecordMetricDuration(step, TraceNow() - start, outcome);
+}
+
+// the valid records of one file; anything else is stepped over a byte at a time until the records line up again
+static bool ReadMetricsFile(const char *path, struct MetricRecord **records, size_t *count)
+{
+	FILE *file = OpenStream(path, "rb");
+	if(!file) return false;
+	unsigned char buffer[1 << 16];
+	size_t have = 0, got;
+	while((got = fread(buffer + have, 1, sizeof(buffer) - have, file)) > 0 || have >= sizeof(struct MetricRecord)) {
+		have += got;
+		size_t offset = 0;
+		while(offset + sizeof(struct MetricRecord) <= have) {
+			struct MetricRecord record;
+			memcpy(&record, buffer + offset, sizeof(record));
+			if(record.magic != METRICS_MAGIC || record.checksum != Checksum(&record)) {
+				++offset;
+				continue;
+			}
+			if(*count % 1024 == 0) {
+				struct MetricRecord *grown = realloc(*records, (*count + 1024) * sizeof(struct MetricRecord));
+				if(!grown) {
+					fclose(file);
+					return true;
+				}
+				*records = grown;
+			}
+			record.step[sizeof(record.step) - 1] = '\0';
+			(*records)[(*count)++] = record;
+			offset += sizeof(record);
+		}
+		memmove(buffer, buffer + offset, have - offset);
+		have -= offset;
+		if(!got) break;
+	}
+	fclose(file);
+	return true;
+}
+
+bool ReadMetrics(const char *path, struct MetricRecord **records, size_t *count)
+{
+	char old_path[1040];
+	snprintf(old_path, sizeof(old_path), "%s.old", path);
+	bool old = ReadMetricsFile(old_path, records, count);
+	bool current = ReadMetricsFile(path, records, count);
+	return old || current;
+}
+
+uint64_t MetricsPercentile(const uint64_t *sorted, size_t count, double percentile)
+{
+	if(!count) return 0;
+	double exact = percentile * (double)count / 100;
+	size_t rank = (size_t)exact;
+	if((double)rank < exact || rank < 1) ++rank;
+	if(rank > count) rank = count;
+	return sorted[rank - 1];
+}
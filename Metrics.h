@@ -0,0 +1,59 @@
+#pragma once
+
+// Cumulative step metrics: how long each step (enumeration, UAC, credential read, prompt, KDF, wsl --mount, mount...) took
+// and how it came out, appended by every helper to a compact local log, so that percentiles and failure rates can be had
+// across runs and machines (wsl-mount-metrics summarizes a log, or writes it out for Prometheus' textfile collector).
+//
+// The log is a flat array of fixed-size binary records. Each is appended with a single write to a file opened with
+// O_APPEND/FILE_APPEND_DATA, so concurrent processes (and threads) never interleave, and recording costs one small write.
+// It's a ring of two files: a process that finds the log has reached METRICS_MAX_RECORDS on starting renames it
+// to <log>.old (replacing the one before), so the two together hold the latest 64-128K records (4-8 MiB).
+// A torn or foreign record fails its magic or checksum and is skipped when reading.
+//
+// The log is --metrics=<file>, or $WSL_MOUNT_METRICS, or else
+// %LOCALAPPDATA%\wsl-mount-metrics.log on windows,
+// /var/lib/wsl-mount-metrics.log for root on linux, and $XDG_STATE_HOME (~/.local/state)/wsl-mount-metrics.log otherwise;
+// an empty value turns recording off. When not recording, a metric point costs a test of one global.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define METRICS_MAGIC 0x4d4c5357u // "WSLM", little-endian
+#define METRICS_MAX_RECORDS 65536
+#define METRICS_STEP_MAX 32
+
+struct MetricRecord
+{
+	uint32_t magic;
+	uint32_t checksum; // FNV-1a of the rest of the record
+	uint64_t time_us; // wall clock (microseconds since 1970) when the step finished
+	uint64_t duration_us;
+	int32_t outcome; // 0 for success, otherwise an exit code, errno or win32 error (1223 is ERROR_CANCELLED)
+	uint32_t pid;
+	char step[METRICS_STEP_MAX]; // NUL-padded
+};
+
+extern bool metrics_enabled;
+
+// path NULL for $WSL_MOUNT_METRICS or the default; false if recording is off (or the log can't be opened)
+bool MetricsStart(const char *path);
+// takes any --metrics=<file> out of argv (wherever it is), then MetricsStart()s with it
+// On linux a log given explicitly is also exported (via WSLENV) to any win32 helper run from here on, so it records there too
+bool MetricsArguments(int *argc, char *argv[]);
+// the full path being recorded to (to pass on to a re-exec), NULL if not recording
+const char * MetricsPath(void);
+// the default log (for reading), or NULL if there's none
+const char * DefaultMetricsPath(void);
+// appends a record, start being from TraceNow() (see Trace.h)
+void RecordMetric(const char *step, uint64_t start, int outcome);
+// appends a record with the given duration (for wsl-mount-metrics record, from stand-in scripts)
+void RecordMetricDuration(const char *step, uint64_t duration_us, int outcome);
+
+// usage: uint64_t start = TraceNow(); ...; METRIC_END("step", start, outcome);
+#define METRIC_END(step, start, outcome) do { if(metrics_enabled) RecordMetric(step, start, outcome); } while(0)
+
+// appends the valid records of <path>.old and then <path> to *records (both may be missing); false if neither could be read
+bool ReadMetrics(const char *path, struct MetricRecord **records, size_t *count);
+// nearest-rank percentile (0-100) of count ascending values
+uint64_t MetricsPercentile(const uint64_t *sorted, size_t count, double percentile);
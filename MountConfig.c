@@ -0,0 +1,149 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include "MountConfig.h"
+
+static char * NextField(char **line)
+{
+	char *field = strtok_r(NULL, " \t", line);
+	return field ? strdup(field) : NULL;
+}
+
+static void FreeMountEntry(struct MountEntry *entry)
+{
+	free(entry->name);
+	free(entry->source);
+	free(entry->key);
+	free(entry->target);
+	free(entry->fstype);
+	free(entry->options);
+}
+
+bool LoadMountConfig(const char *path, struct MountEntry **entries, size_t *count)
+{
+	*entries = NULL;
+	*count = 0;
+	FILE *f = fopen(path, "re");
+	if(!f) {
+		fprintf(stderr, "*** %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	char line[1024];
+	unsigned lineno = 0;
+	bool success = true;
+	while(success && fgets(line, sizeof(line), f)) {
+		++lineno;
+		line[strcspn(line, "\r\n#")] = '\0';
+		char *save;
+		char *name = strtok_r(line, " \t", &save);
+		if(!name) continue;
+
+		struct MountEntry entry = { .name = strdup(name) };
+		entry.source = NextField(&save);
+		entry.key = NextField(&save);
+		entry.target = NextField(&save);
+		entry.fstype = NextField(&save);
+		entry.options = NextField(&save);
+		if(!entry.source || !entry.key || !entry.target || (strcmp(entry.target, "-") && !entry.fstype)) {
+			fprintf(stderr, "*** %s:%u: expected <Volume> <Source> <Key> <MountPoint> <FsType> [<Options>]\n", path, lineno);
+			FreeMountEntry(&entry);
+			success = false;
+			break;
+		}
+		if(!strcmp(entry.key, "-")) {
+			free(entry.key);
+			entry.key = NULL;
+		}
+		if(!strcmp(entry.target, "-")) {
+			free(entry.target);
+			entry.target = NULL;
+		}
+
+		entry.is_tag = entry.source[0] != '/';
+		if(entry.is_tag && !ParseTag(entry.source, &entry.tag)) {
+			fprintf(stderr, "*** %s:%u: bad source %s\n", path, lineno, entry.source);
+			FreeMountEntry(&entry);
+			success = false;
+			break;
+		}
+
+		struct MountEntry *grown = realloc(*entries, (*count + 1) * sizeof(struct MountEntry));
+		if(!grown) {
+			FreeMountEntry(&entry);
+			success = false;
+			break;
+		}
+		*entries = grown;
+		(*entries)[(*count)++] = entry;
+	}
+	fclose(f);
+	if(!success) {
+		FreeMountConfig(*entries, *count);
+		*entries = NULL;
+		*count = 0;
+	}
+	return success;
+}
+
+void FreeMountConfig(struct MountEntry *entries, size_t count)
+{
+	for(size_t i = 0; i < count; ++i) FreeMountEntry(&entries[i]);
+	free(entries);
+}
+
+static const struct {
+	const char *name;
+	unsigned long flag;
+} MountFlags[] = {
+	{ "ro", MS_RDONLY },
+	{ "nosuid", MS_NOSUID },
+	{ "nodev", MS_NODEV },
+	{ "noexec", MS_NOEXEC },
+	{ "noatime", MS_NOATIME },
+	{ "nodiratime", MS_NODIRATIME },
+	{ "relatime", MS_RELATIME },
+	{ "sync", MS_SYNCHRONOUS },
+};
+
+unsigned long ParseMountOptions(const char *options, char *data, size_t size)
+{
+	unsigned long flags = 0;
+	size_t used = 0;
+	data[0] = '\0';
+	if(!options) return flags;
+
+	char *copy = strdup(options);
+	char *save;
+	for(char *option = copy ? strtok_r(copy, ",", &save) : NULL; option; option = strtok_r(NULL, ",", &save)) {
+		bool is_flag = !strcmp(option, "defaults") || !strcmp(option, "rw");
+		for(size_t i = 0; !is_flag && i < sizeof(MountFlags) / sizeof(MountFlags[0]); ++i) {
+			if(!strcmp(option, MountFlags[i].name)) {
+				flags |= MountFlags[i].flag;
+				is_flag = true;
+			}
+		}
+		if(!is_flag) used += (size_t)snprintf(data + used, used < size ? size - used : 0, "%s%s", used ? "," : "", option);
+	}
+	free(copy);
+	return flags;
+}
+
+bool IsMountPoint(const char *target)
+{
+	FILE *mounts = fopen("/proc/self/mounts", "re");
+	if(!mounts) return false;
+	char line[PATH_MAX + 256];
+	bool found = false;
+	while(!found && fgets(line, sizeof(line), mounts)) {
+		char *save;
+		strtok_r(line, " ", &save);
+		const char *mount_point = strtok_r(NULL, " ", &save);
+		found = mount_point && !strcmp(mount_point, target);
+	}
+	fclose(mounts);
+	return found;
+}
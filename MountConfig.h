@@ -0,0 +1,30 @@
+#pragma once
+
+// The volumes wsl-mount-broker and wsl-mount-init bring up, one per line, like a crypttab and fstab entry run together:
+// <Volume> <PARTUUID=...|PTUUID=...|PARTLABEL=...|SERIAL=...|/path> <askpass TargetName, or - if not encrypted> <mount point, or -> <fstype> [<options>]
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "Tag.h"
+
+#define DEFAULT_MOUNT_CONFIG "/etc/wsl-mount-broker.conf"
+
+struct MountEntry
+{
+	char *name;
+	char *source; // tag, or a device/image path that needs no attaching
+	char *key; // luks-askpass-wincred TargetName, NULL if not encrypted
+	char *target; // mount point, NULL to stop at unlock
+	char *fstype;
+	char *options;
+	struct Tag tag;
+	bool is_tag;
+};
+
+// false (having reported where) if the file is missing or has a bad line
+bool LoadMountConfig(const char *path, struct MountEntry **entries, size_t *count);
+void FreeMountConfig(struct MountEntry *entries, size_t count);
+
+// splits fstab-style options into the MS_* flags mount(2) takes and the rest, which go to the filesystem
+unsigned long ParseMountOptions(const char *options, char *data, size_t size);
+bool IsMountPoint(const char *target);
@@ -0,0 +1,291 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Crypttab.h"
+#include "MountGenerator.h"
+#include "Tag.h"
+
+#define HEADER "# Automatically generated by wsl-mount-generator\n\n"
+
+bool EscapeUnitName(const char *str, bool path, char *out, size_t size)
+{
+	size_t used = 0;
+	if(path) {
+		while(*str == '/') ++str;
+		if(!*str) return snprintf(out, size, "-") < (int)size;
+	}
+	for(const char *p = str; *p && used + 5 < size; ++p) {
+		unsigned char c = (unsigned char)*p;
+		if(c == '/') {
+			// (a path's repeated and trailing slashes don't count)
+			if(path && (p[1] == '/' || !p[1])) continue;
+			out[used++] = '-';
+		} else if(isalnum(c) || c == ':' || c == '_' || (c == '.' && p != str)) {
+			out[used++] = (char)c;
+		} else {
+			used += (size_t)snprintf(out + used, size - used, "\\x%02x", c);
+		}
+	}
+	out[used] = '\0';
+	return used + 5 < size;
+}
+
+// what can go in the units' command lines as-is (within double quotes, in sh -c '...'), and in a Description=
+static bool Plain(const char *str)
+{
+	if(!*str) return false;
+	for(; *str; ++str) {
+		if(!isgraph((unsigned char)*str) || strchr("\"'\\$`%", *str)) return false;
+	}
+	return true;
+}
+
+// O_EXCL, so that a unit already written for another entry (two mounts of one partition, say) is just left as it is
+static FILE * CreateUnit(const char *dir, const char *name, bool *existed)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	*existed = fd < 0 && errno == EEXIST;
+	if(fd < 0) {
+		if(!*existed) fprintf(stderr, "*** %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	FILE *f = fdopen(fd, "w");
+	if(!f) close(fd);
+	return f;
+}
+
+// <dir>/<unit>.<kind>/<name> -> ../<name>
+static bool AddDependency(const char *dir, const char *unit, const char *kind, const char *name)
+{
+	char path[PATH_MAX], target[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s.%s", dir, unit, kind);
+	if(mkdir(path, 0755) && errno != EEXIST) {
+		fprintf(stderr, "*** %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	snprintf(path, sizeof(path), "%s/%s.%s/%s", dir, unit, kind, name);
+	snprintf(target, sizeof(target), "../%s", name);
+	if(symlink(target, path) && errno != EEXIST) {
+		fprintf(stderr, "*** %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+// the .device unit of a device path
+static bool DeviceUnit(const char *device, char *unit, size_t size)
+{
+	char escaped[PATH_MAX];
+	return EscapeUnitName(device, true, escaped, sizeof(escaped)) && snprintf(unit, size, "%s.device", escaped) < (int)size;
+}
+
+static bool CloseUnit(FILE *f, const char *name)
+{
+	if(fclose(f)) {
+		fprintf(stderr, "*** writing %s: %s\n", name, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+//
+// crypttab
+//
+
+static bool IsOurCrypttabEntry(const struct CrypttabEntry *entry)
+{
+	if(HasCrypttabOption(entry, "x-wsl-mount")) return true;
+	// the tags systemd-cryptsetup has no /dev/disk/by-* link for
+	static const char * const prefixes[] = { "PTUUID=", "SERIAL=", "MODEL=", "PARTTYPE=" };
+	for(size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); ++i) {
+		if(!strncmp(entry->source, prefixes[i], strlen(prefixes[i]))) return true;
+	}
+	return false;
+}
+
+// systemd-cryptsetup@<name>.service, attaching and unlocking
+static bool WriteUnlockUnit(const struct GeneratorConfig *config, const char *dir, const struct CrypttabEntry *entry)
+{
+	struct Tag tag;
+	bool asks = !strcmp(entry->key, "none") || !strcmp(entry->key, "-");
+	char key_slot[32] = "";
+	bool has_key_slot = GetCrypttabOption(entry, "key-slot", key_slot, sizeof(key_slot));
+	if(!ParseTagQuietly(entry->source, &tag) || !Plain(entry->name) || !Plain(entry->source) || (!asks && !Plain(entry->key))
+	   || (has_key_slot && strspn(key_slot, "0123456789") != strlen(key_slot))) {
+		fprintf(stderr, "*** %s: skipping crypttab entry %s (not a tag, or has characters that would need quoting)\n", config->crypttab, entry->name);
+		return false;
+	}
+	// the helpers go into the sh -c '...' too
+	const char *helper = !Plain(config->wait) ? config->wait : asks && !Plain(config->askpass) ? config->askpass
+	                   : !Plain(config->cryptsetup) ? config->cryptsetup : NULL;
+	if(helper) {
+		fprintf(stderr, "*** %s: skipping crypttab entry %s (%s has characters that would need quoting)\n", config->crypttab, entry->name, helper);
+		return false;
+	}
+
+	char escaped[256], service[300], mapper[PATH_MAX], device[PATH_MAX], blockdev[PATH_MAX];
+	snprintf(mapper, sizeof(mapper), "/dev/mapper/%s", entry->name);
+	if(!EscapeUnitName(entry->name, false, escaped, sizeof(escaped)) || !DeviceUnit(mapper, device, sizeof(device))
+	   || !EscapeUnitName(mapper, true, blockdev, sizeof(blockdev))) {
+		fprintf(stderr, "*** %s: skipping crypttab entry %s (name too long)\n", config->crypttab, entry->name);
+		return false;
+	}
+	snprintf(service, sizeof(service), "systemd-cryptsetup@%s.service", escaped);
+
+	bool existed;
+	FILE *f = CreateUnit(dir, service, &existed);
+	if(!f) return existed;
+
+	char options[64] = "";
+	if(HasCrypttabOption(entry, "readonly") || HasCrypttabOption(entry, "read-only")) strcat(options, " --readonly");
+	if(HasCrypttabOption(entry, "discard")) strcat(options, " --allow-discards");
+	if(has_key_slot) snprintf(options + strlen(options), sizeof(options) - strlen(options), " --key-slot=%s", key_slot);
+	bool nofail = HasCrypttabOption(entry, "nofail");
+
+	fprintf(f, HEADER
+	        "[Unit]\n"
+	        "Description=Attach and unlock %s\n"
+	        "Documentation=man:crypttab(5)\n"
+	        "SourcePath=%s\n"
+	        "DefaultDependencies=no\n"
+	        "IgnoreOnIsolate=true\n"
+	        "After=cryptsetup-pre.target systemd-binfmt.service\n"
+	        "Before=blockdev@%s.target%s umount.target\n"
+	        "Wants=blockdev@%s.target\n"
+	        "Conflicts=umount.target\n"
+	        "\n"
+	        "[Service]\n"
+	        "Type=oneshot\n"
+	        "RemainAfterExit=yes\n"
+	        "TimeoutSec=0\n"
+	        "KeyringMode=shared\n",
+	        entry->name, config->crypttab, blockdev, nofail ? "" : " cryptsetup.target", blockdev);
+	// wsl-mount-wait prints the device node once it's there (attaching it first if it isn't)
+	if(asks) {
+		fprintf(f, "ExecStart=/bin/sh -c 'dev=$$(%s --mount \"%s\") && %s \"%s\" | %s open --type luks --key-file=-%s \"$$dev\" \"%s\"'\n",
+		        config->wait, entry->source, config->askpass, entry->name, config->cryptsetup, options, entry->name);
+	} else {
+		fprintf(f, "ExecStart=/bin/sh -c 'dev=$$(%s --mount \"%s\") && %s open --type luks --key-file=\"%s\"%s \"$$dev\" \"%s\"'\n",
+		        config->wait, entry->source, config->cryptsetup, entry->key, options, entry->name);
+	}
+	fprintf(f, "ExecStop=%s close \"%s\"\n", config->cryptsetup, entry->name);
+	if(!CloseUnit(f, service)) return false;
+
+	bool linked = AddDependency(dir, device, "requires", service);
+	if(!HasCrypttabOption(entry, "noauto")) linked = AddDependency(dir, "cryptsetup.target", nofail ? "wants" : "requires", service) && linked;
+	return linked;
+}
+
+//
+// fstab
+//
+
+// \040 and the like, in place
+static char * Unescape(char *str)
+{
+	char *out = str;
+	for(const char *in = str; *in;) {
+		if(in[0] == '\\' && in[1] >= '0' && in[1] <= '3' && in[2] >= '0' && in[2] <= '7' && in[3] >= '0' && in[3] <= '7') {
+			*out++ = (char)((in[1] - '0') << 6 | (in[2] - '0') << 3 | (in[3] - '0'));
+			in += 4;
+		} else {
+			*out++ = *in++;
+		}
+	}
+	*out = '\0';
+	return str;
+}
+
+static bool HasOption(const char *options, const char *option)
+{
+	size_t len = strlen(option);
+	for(const char *p = options; *p;) {
+		if(!strncmp(p, option, len) && (p[len] == ',' || p[len] == '=' || !p[len])) return true;
+		p += strcspn(p, ",");
+		if(*p) ++p;
+	}
+	return false;
+}
+
+// wsl-mount@<tag>.service, attaching the partition of an fstab entry
+static bool WriteAttachUnit(const struct GeneratorConfig *config, const char *dir, const char *source)
+{
+	struct Tag tag;
+	if(!ParseTagQuietly(source, &tag) || (tag.kind != TAG_PARTUUID && tag.kind != TAG_PARTLABEL) || !Plain(source)) {
+		fprintf(stderr, "*** %s: skipping %s (x-wsl-mount needs a PARTUUID= or PARTLABEL= source, without characters that would need quoting)\n",
+		        config->fstab, source);
+		return false;
+	}
+	if(!Plain(config->wait)) {
+		fprintf(stderr, "*** %s: skipping %s (%s has characters that would need quoting)\n", config->fstab, source, config->wait);
+		return false;
+	}
+
+	char escaped[512], service[600], link[PATH_MAX], device[PATH_MAX];
+	CrypttabSourcePath(source, link, sizeof(link));
+	if(!EscapeUnitName(source, false, escaped, sizeof(escaped)) || !DeviceUnit(link, device, sizeof(device))) {
+		fprintf(stderr, "*** %s: skipping %s (too long)\n", config->fstab, source);
+		return false;
+	}
+	snprintf(service, sizeof(service), "wsl-mount@%s.service", escaped);
+
+	bool existed;
+	FILE *f = CreateUnit(dir, service, &existed);
+	if(!f) return existed;
+	fprintf(f, HEADER
+	        "[Unit]\n"
+	        "Description=Attach %s\n"
+	        "SourcePath=%s\n"
+	        "DefaultDependencies=no\n"
+	        "After=systemd-binfmt.service\n"
+	        "Before=umount.target\n"
+	        "Conflicts=umount.target\n"
+	        "\n"
+	        "[Service]\n"
+	        "Type=oneshot\n"
+	        "RemainAfterExit=yes\n"
+	        "TimeoutSec=0\n"
+	        "ExecStart=%s --mount \"%s\"\n",
+	        source, config->fstab, config->wait, source);
+	if(!CloseUnit(f, service)) return false;
+	return AddDependency(dir, device, "requires", service);
+}
+
+int GenerateMountUnits(const struct GeneratorConfig *config, const char *dir)
+{
+	if(access(dir, W_OK)) {
+		fprintf(stderr, "*** %s: %s\n", dir, strerror(errno));
+		return -1;
+	}
+
+	int volumes = 0;
+	struct CrypttabEntry *entries;
+	size_t count = ReadCrypttab(config->crypttab, &entries);
+	for(size_t i = 0; i < count; ++i) {
+		if(!IsOurCrypttabEntry(&entries[i])) continue;
+		volumes += WriteUnlockUnit(config, dir, &entries[i]);
+	}
+	free(entries);
+
+	FILE *fstab = fopen(config->fstab, "re");
+	char line[4096];
+	while(fstab && fgets(line, sizeof(line), fstab)) {
+		char *save;
+		line[strcspn(line, "\r\n")] = '\0';
+		char *source = strtok_r(line, " \t", &save);
+		char *target = strtok_r(NULL, " \t", &save);
+		char *fstype = strtok_r(NULL, " \t", &save);
+		char *options = strtok_r(NULL, " \t", &save);
+		if(!source || *source == '#' || !target || !fstype || !options || !HasOption(options, "x-wsl-mount")) continue;
+		volumes += WriteAttachUnit(config, dir, Unescape(source));
+	}
+	if(fstab) fclose(fstab);
+	return volumes;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+// The units wsl-mount-generator writes for the volumes of /etc/crypttab and /etc/fstab that are on disks that have to be
+// attached (wsl --mount) first, in place of the hand-written wsl-mount@.service / systemd-cryptsetup@.service / BindsTo= chains:
+//
+// - a crypttab entry is one of these if it has the x-wsl-mount option, or a source only wsl-mount-findfs can resolve
+//   (PTUUID=, SERIAL=, MODEL=, PARTTYPE=); it gets a systemd-cryptsetup@<name>.service that attaches and unlocks in one go
+//   (wsl-mount-wait --mount, which returns once the device is there, then luks-askpass-wincred.exe | cryptsetup open),
+//   so there's no wsl-mount@ unit, and no wait on udev and the disk's .device unit, between the two
+// - an fstab entry with the x-wsl-mount option and a PARTUUID=/PARTLABEL= source gets a wsl-mount@<tag>.service that
+//   attaches it (for volumes that aren't encrypted)
+//
+// Each is hooked in as a requirement of the device it brings up (dev-mapper-<name>.device, or the by-partuuid/by-partlabel
+// link's), as systemd-cryptsetup-generator does, so a mount of that device pulls it in with no further edges:
+// the fstab entry itself (mount, automount, noauto...) is left to systemd-fstab-generator.
+// crypttab's noauto and nofail have their usual effect on cryptsetup.target; readonly, discard and key-slot= are passed to
+// cryptsetup, and a key file (rather than none or -) is used instead of asking.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct GeneratorConfig
+{
+	const char *crypttab;
+	const char *fstab;
+	// the programs the units run
+	const char *wait; // wsl-mount-wait
+	const char *askpass; // luks-askpass-wincred.exe
+	const char *cryptsetup;
+};
+
+// writes the units (and the .requires/.wants symlinks) into dir, returning how many entries it wrote them for,
+// or -1 having reported why if it couldn't; entries it can't use are reported and skipped
+int GenerateMountUnits(const struct GeneratorConfig *config, const char *dir);
+
+// as systemd-escape (--path, if path) would: false if it doesn't fit
+bool EscapeUnitName(const char *str, bool path, char *out, size_t size);
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include "Crc32.h"
+#include "PartitionTable.h"
+
+// https://uefi.org/specs/UEFI/2.10/05_GUID_Partition_Table_Format.html
+#define GPT_HEADER_SIGNATURE "EFI PART"
+#define GPT_MAX_ENTRIES_SIZE (1024*1024) // sanity limit; the spec minimum is 16KiB, and nothing real is near this
+#define GPT_MAX_HEADER_SIZE 512 // the header may be as large as a sector, but everything writes the 92 byte one
+#define MBR_PRIMARY_ENTRIES 4
+#define MBR_TYPE_GPT_PROTECTIVE 0xEE
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+	return (uint64_t)get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+// GPT partition names are (nominally) UCS-2, but be a little generous and treat them as UTF-16
+static void utf16le_to_utf8(char *out, size_t out_size, const uint8_t *in, size_t in_units)
+{
+	size_t o = 0;
+	for(size_t i = 0; i < in_units; ++i) {
+		uint32_t c = in[2*i] | in[2*i+1] << 8;
+		if(c == 0) break;
+		if(c >= 0xD800 && c < 0xDC00 && i+1 < in_units) {
+			uint32_t c2 = in[2*i+2] | in[2*i+3] << 8;
+			if(c2 >= 0xDC00 && c2 < 0xE000) {
+				c = 0x10000 + ((c - 0xD800) << 10) + (c2 - 0xDC00);
+				++i;
+			}
+		}
+
+		char utf8[4];
+		size_t len;
+		if(c < 0x80) {
+			utf8[0] = (char)c;
+			len = 1;
+		} else if(c < 0x800) {
+			utf8[0] = (char)(0xC0 | c >> 6);
+			utf8[1] = (char)(0x80 | (c & 0x3F));
+			len = 2;
+		} else if(c < 0x10000) {
+			utf8[0] = (char)(0xE0 | c >> 12);
+			utf8[1] = (char)(0x80 | (c >> 6 & 0x3F));
+			utf8[2] = (char)(0x80 | (c & 0x3F));
+			len = 3;
+		} else {
+			utf8[0] = (char)(0xF0 | c >> 18);
+			utf8[1] = (char)(0x80 | (c >> 12 & 0x3F));
+			utf8[2] = (char)(0x80 | (c >> 6 & 0x3F));
+			utf8[3] = (char)(0x80 | (c & 0x3F));
+			len = 4;
+		}
+		if(o + len >= out_size) break;
+		memcpy(out + o, utf8, len);
+		o += len;
+	}
+	out[o] = '\0';
+}
+
+static bool ReadMbrEntries(const uint8_t mbr[512], uint32_t sector_size, struct DiskInfo *disk)
+{
+	disk->PartitionEntry = calloc(MBR_PRIMARY_ENTRIES, sizeof(struct PartitionInfo));
+	if(!disk->PartitionEntry) return false;
+	disk->PartitionStyle = PARTSTYLE_MBR;
+	disk->Signature = get_le32(mbr + 440);
+
+	// only the four primary entries; extended/logical partitions aren't something wsl --mount users are likely to have
+	// (and they have no GUID to look them up by anyway)
+	for(uint32_t i = 0; i < MBR_PRIMARY_ENTRIES; ++i) {
+		const uint8_t *entry = mbr + 446 + 16*i;
+		uint32_t first_lba = get_le32(entry + 8);
+		uint32_t sectors = get_le32(entry + 12);
+		if(entry[4] == 0 || sectors == 0) continue; // unused entry
+
+		struct PartitionInfo *partition = &disk->PartitionEntry[disk->PartitionCount++];
+		partition->PartitionNumber = i + 1;
+		partition->StartingOffset = (uint64_t)first_lba * sector_size;
+		partition->PartitionLength = (uint64_t)sectors * sector_size;
+		partition->MbrType = entry[4];
+	}
+	return true;
+}
+
+struct GptHeader
+{
+	GUID DiskId;
+	uint64_t entries_lba;
+	uint32_t num_entries;
+	uint32_t entry_size;
+	uint8_t *entries; // num_entries * entry_size bytes, CRC already checked
+};
+
+// reads and checks the header at lba (1 for the primary, the last sector for the backup) and the entry array it points to
+static bool ReadGptHeader(READBYTES_CALLBACK read, void *context, uint32_t sector_size, uint64_t size, uint64_t lba, struct GptHeader *gpt)
+{
+	uint8_t header[GPT_MAX_HEADER_SIZE];
+	if(!read(context, lba * sector_size, header, sizeof(header))) return false;
+	if(memcmp(header, GPT_HEADER_SIGNATURE, 8)) return false;
+
+	// the CRC covers header_size bytes, computed with the CRC field itself zeroed
+	uint32_t header_size = get_le32(header + 12);
+	uint32_t header_crc = get_le32(header + 16);
+	if(header_size < 92 || header_size > sizeof(header) || header_size > sector_size) return false;
+	memset(header + 16, 0, 4);
+	if(crc32_ieee(0, header, header_size) != header_crc) return false;
+	if(get_le64(header + 24) != lba) return false; // a copy of the other header, or from before the disk was resized
+
+	gpt->entries_lba = get_le64(header + 72);
+	gpt->num_entries = get_le32(header + 80);
+	gpt->entry_size = get_le32(header + 84);
+	uint32_t entries_crc = get_le32(header + 88);
+	if(gpt->entry_size < 128 || gpt->entry_size % 8 || (uint64_t)gpt->num_entries * gpt->entry_size > GPT_MAX_ENTRIES_SIZE) return false;
+
+	size_t entries_size = (size_t)gpt->num_entries * gpt->entry_size;
+	if(size && (gpt->entries_lba > size / sector_size || entries_size > size - gpt->entries_lba * sector_size)) return false;
+
+	gpt->entries = malloc(entries_size ? entries_size : 1);
+	if(!gpt->entries) return false;
+	if(!read(context, gpt->entries_lba * sector_size, gpt->entries, entries_size) || crc32_ieee(0, gpt->entries, entries_size) != entries_crc) {
+		free(gpt->entries);
+		gpt->entries = NULL;
+		return false;
+	}
+
+	guid_from_le_bytes(&gpt->DiskId, header + 56);
+	return true;
+}
+
+static bool ReadGptEntries(const struct GptHeader *gpt, uint32_t sector_size, struct DiskInfo *disk)
+{
+	disk->PartitionEntry = calloc(gpt->num_entries ? gpt->num_entries : 1, sizeof(struct PartitionInfo));
+	if(!disk->PartitionEntry) return false;
+	disk->PartitionStyle = PARTSTYLE_GPT;
+	disk->DiskId = gpt->DiskId;
+
+	for(uint32_t i = 0; i < gpt->num_entries; ++i) {
+		const uint8_t *entry = gpt->entries + (size_t)i * gpt->entry_size;
+		struct PartitionInfo *partition = &disk->PartitionEntry[disk->PartitionCount];
+
+		guid_from_le_bytes(&partition->PartitionType, entry);
+		if(IsNullGUID(&partition->PartitionType)) continue; // unused entry
+
+		// linux (and so wsl --mount --partition) numbers GPT partitions by their slot in the entry array
+		partition->PartitionNumber = i + 1;
+		guid_from_le_bytes(&partition->PartitionId, entry + 16);
+		uint64_t first_lba = get_le64(entry + 32);
+		uint64_t last_lba = get_le64(entry + 40);
+		partition->StartingOffset = first_lba * sector_size;
+		partition->PartitionLength = (last_lba + 1 - first_lba) * sector_size;
+		utf16le_to_utf8(partition->Name, sizeof(partition->Name), entry + 56, 36);
+		++disk->PartitionCount;
+	}
+	return true;
+}
+
+bool ReadPartitionTable(READBYTES_CALLBACK read, void *context, uint32_t sector_size, uint64_t size, struct DiskInfo *disk)
+{
+	disk->PartitionStyle = PARTSTYLE_RAW;
+	disk->PartitionCount = 0;
+	disk->PartitionEntry = NULL;
+	const char *name = disk->Drive ? disk->Drive : "disk";
+
+	uint8_t mbr[512];
+	if(!read(context, 0, mbr, sizeof(mbr))) return false;
+
+	bool mbr_valid = mbr[510] == 0x55 && mbr[511] == 0xAA;
+	bool protective = false;
+	for(int i = 0; mbr_valid && i < MBR_PRIMARY_ENTRIES; ++i) protective |= mbr[446 + 16*i + 4] == MBR_TYPE_GPT_PROTECTIVE;
+	// a plain MBR disk, no need to look any further
+	if(mbr_valid && !protective) return ReadMbrEntries(mbr, sector_size, disk);
+
+	struct GptHeader gpt = { 0 };
+	bool found = ReadGptHeader(read, context, sector_size, size, 1, &gpt);
+	if(!found && size >= 2 * (uint64_t)sector_size) {
+		found = ReadGptHeader(read, context, sector_size, size, size / sector_size - 1, &gpt);
+		if(found) fprintf(stderr, "*** %s: primary GPT header is damaged, using the backup\n", name);
+	}
+
+	if(found) {
+		bool success = ReadGptEntries(&gpt, sector_size, disk);
+		free(gpt.entries);
+		return success;
+	}
+	if(protective) {
+		fprintf(stderr, "*** %s: has a protective MBR, but no intact GPT header\n", name);
+		return false;
+	}
+	return true; // no partition table at all
+}
+
+#ifndef _WIN32
+bool pread_callback(void *context, uint64_t offset, void *buf, size_t len)
+{
+	int fd = (int)(intptr_t)context;
+	size_t done = 0;
+	while(done < len) {
+		ssize_t n = pread(fd, (char *)buf + done, len - done, (off_t)(offset + done));
+		if(n <= 0) return false;
+		done += (size_t)n;
+	}
+	return true;
+}
+#endif
+
+bool memory_callback(void *context, uint64_t offset, void *buf, size_t len)
+{
+	const struct MemoryDisk *memory = context;
+	if(offset > memory->size || len > memory->size - offset) return false;
+	memcpy(buf, memory->base + offset, len);
+	return true;
+}
+
+#ifndef _WIN32
+bool ReadPartitionTableFd(int fd, uint32_t sector_size, struct DiskInfo *disk)
+{
+	// fstat says 0 for a block device, but seeking to the end works for both those and image files
+	// (read with pread rather than mmap: a device that goes away, or a file truncated under us, is then just a failed read
+	// rather than a SIGBUS, and for the few sectors needed the reads are cheaper than setting up and tearing down a mapping)
+	off_t size = lseek(fd, 0, SEEK_END);
+	return ReadPartitionTable(&pread_callback, (void *)(intptr_t)fd, sector_size, size > 0 ? (uint64_t)size : 0, disk);
+}
+#endif
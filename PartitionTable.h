@@ -0,0 +1,33 @@
+#pragma once
+
+// Reads a GPT (or MBR) partition table directly from the disk (rather than asking windows via IOCTL_DISK_GET_DRIVE_LAYOUT_EX)
+// so that linux can answer PARTUUID=/PTUUID= lookups for disks that are already attached
+
+#include <stddef.h>
+#include <stdint.h>
+#include "DiskInfo.h"
+
+// reads len bytes at offset; returns false on error or short read
+typedef bool (*READBYTES_CALLBACK)(void *context, uint64_t offset, void *buf, size_t len);
+
+// fills in PartitionStyle, DiskId/Signature, and PartitionEntry (DevicePath/Drive are left to the caller)
+// GPT headers and entry arrays are CRC checked; if the primary is damaged, the backup in the last sector is used instead,
+// which needs the disk size in bytes (0 if unknown, to only try the primary)
+// a disk without a recognizable partition table is reported as PARTSTYLE_RAW and still returns true
+bool ReadPartitionTable(READBYTES_CALLBACK read, void *context, uint32_t sector_size, uint64_t size, struct DiskInfo *disk);
+
+// READBYTES_CALLBACK for a disk (or image) already in memory
+struct MemoryDisk
+{
+	const uint8_t *base;
+	uint64_t size;
+};
+bool memory_callback(void *context, uint64_t offset, void *buf, size_t len);
+
+#ifndef _WIN32
+// READBYTES_CALLBACK for a file descriptor passed as (void*)(intptr_t)fd
+bool pread_callback(void *context, uint64_t offset, void *buf, size_t len);
+
+// reads the partition table of an open block device or image file
+bool ReadPartitionTableFd(int fd, uint32_t sector_size, struct DiskInfo *disk);
+#endif
@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+#include "Crt.h"
+#include "DeviceIndex.h"
+#include "ResolveCache.h"
+#include "Trace.h"
+
+// below this many tags to find, checking each disk's partitions for them directly is cheaper than indexing every disk
+#define INDEX_MIN_REQUESTS 4
+
+static void ResolveCacheAdd(struct ResolveCache *cache, const struct Tag *tag, uint32_t DriveNumber, uint32_t PartitionNumber)
+{
+	if(!TagHasValue(tag)) return;
+
+	// a tag may be listed more than once (a duplicated PARTLABEL, a cloned disk, or one that moved), see ResolveCacheFind
+	if(cache->count == cache->capacity) {
+		size_t capacity = cache->capacity ? 2 * cache->capacity : 16;
+		struct ResolveCacheEntry *entries = realloc(cache->entries, capacity * sizeof(struct ResolveCacheEntry));
+		if(!entries) return; // it's just a cache
+		cache->entries = entries;
+		cache->capacity = capacity;
+	}
+	cache->entries[cache->count++] = (struct ResolveCacheEntry){ *tag, DriveNumber, PartitionNumber };
+	cache->dirty = true;
+}
+
+void LoadResolveCache(struct ResolveCache *cache, const char *path)
+{
+	*cache = (struct ResolveCache){ 0 };
+
+	uint64_t start = TRACE_BEGIN();
+	FILE *f = OpenStream(path, "r");
+	if(!f) return;
+
+	char line[256];
+	while(fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		// <Tag> <DriveNumber> [<PartitionNumber>], the tag perhaps containing spaces itself
+		unsigned long numbers[2];
+		int count = 0;
+		for(; count < 2; ++count) {
+			char *space = strrchr(line, ' '), *end;
+			if(!space) break;
+			numbers[count] = strtoul(space + 1, &end, 10);
+			if(end == space + 1 || *end) break;
+			*space = '\0';
+		}
+
+		struct Tag tag;
+		if(!count || !ParseTagQuietly(line, &tag)) continue;
+		// read back to front, the tag itself having been left in line by the first number that wasn't
+		if(TagNamesPartition(&tag)) {
+			if(count != 2) continue;
+			ResolveCacheAdd(cache, &tag, (uint32_t)numbers[1], (uint32_t)numbers[0]);
+		} else {
+			ResolveCacheAdd(cache, &tag, (uint32_t)numbers[count - 1], 0);
+		}
+	}
+	fclose(f);
+	cache->dirty = false;
+	TRACE_END("LoadResolveCache", start, "%zu entries", cache->count);
+}
+
+bool SaveResolveCache(struct ResolveCache *cache, const char *path)
+{
+	if(!cache->dirty) return true;
+
+	// write a new file and rename it over the old one, so a concurrent reader never sees a partial cache
+	// (named for this process, so that concurrent writers don't write over each other's; the last rename wins)
+	char tmp_path[4096];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+	FILE *f = OpenStream(tmp_path, "w");
+	if(!f) {
+		fprintf(stderr, "*** could not write %s\n", tmp_path);
+		return false;
+	}
+
+	for(size_t i = 0; i < cache->count; ++i) {
+		const struct ResolveCacheEntry *entry = &cache->entries[i];
+		char tag[160];
+		if(!FormatTag(tag, sizeof(tag), &entry->tag)) continue;
+		if(TagNamesPartition(&entry->tag)) {
+			fprintf(f, "%s %u %u\n", tag, entry->DriveNumber, entry->PartitionNumber);
+		} else {
+			fprintf(f, "%s %u\n", tag, entry->DriveNumber);
+		}
+	}
+
+	bool success = !ferror(f);
+	success = !fclose(f) && success;
+#ifdef _WIN32
+	success = success && MoveFileExA(tmp_path, path, MOVEFILE_REPLACE_EXISTING);
+#else
+	success = success && !rename(tmp_path, path);
+#endif
+	if(!success) {
+		fprintf(stderr, "*** could not replace %s\n", path);
+		remove(tmp_path);
+		return false;
+	}
+	cache->dirty = false;
+	return true;
+}
+
+void FreeResolveCache(struct ResolveCache *cache)
+{
+	free(cache->entries);
+	*cache = (struct ResolveCache){ 0 };
+}
+
+void ResolveCacheForgetDrive(struct ResolveCache *cache, uint32_t DriveNumber)
+{
+	size_t kept = 0;
+	for(size_t i = 0; i < cache->count; ++i) {
+		if(cache->entries[i].DriveNumber != DriveNumber) cache->entries[kept++] = cache->entries[i];
+	}
+	if(kept != cache->count) cache->dirty = true;
+	cache->count = kept;
+}
+
+static void ResolveCacheAddDisk(struct ResolveCache *cache, const struct DiskInfo *disk)
+{
+	uint32_t DriveNumber = (uint32_t)disk->DriveNumber;
+	bool gpt = disk->PartitionStyle == PARTSTYLE_GPT;
+	struct Tag tag = { .kind = TAG_PTUUID, .guid = disk->DiskId };
+	if(gpt) ResolveCacheAdd(cache, &tag, DriveNumber, 0);
+	tag = (struct Tag){ .kind = TAG_SERIAL };
+	memcpy(tag.value, disk->SerialNumber, sizeof(disk->SerialNumber));
+	ResolveCacheAdd(cache, &tag, DriveNumber, 0);
+	for(uint32_t i = 0; i < disk->PartitionCount; ++i) {
+		const struct PartitionInfo *partition = &disk->PartitionEntry[i];
+		tag = (struct Tag){ .kind = TAG_PARTUUID, .guid = partition->PartitionId };
+		ResolveCacheAdd(cache, &tag, DriveNumber, partition->PartitionNumber);
+		if(!gpt) continue;
+		tag = (struct Tag){ .kind = TAG_PARTLABEL };
+		memcpy(tag.value, partition->Name, sizeof(partition->Name));
+		ResolveCacheAdd(cache, &tag, DriveNumber, partition->PartitionNumber);
+	}
+}
+
+void ResolveCacheRecordDisk(struct ResolveCache *cache, const struct DiskInfo *disk)
+{
+	if(disk->DriveNumber < 0) return;
+	ResolveCacheForgetDrive(cache, (uint32_t)disk->DriveNumber);
+	ResolveCacheAddDisk(cache, disk);
+}
+
+const struct ResolveCacheEntry * ResolveCacheFind(const struct ResolveCache *cache, const struct Tag *tag)
+{
+	// a tag at more than one place is left to the enumeration, so it resolves to the first match as it would uncached,
+	// rather than to wherever the cache happened to record it
+	const struct ResolveCacheEntry *found = NULL;
+	for(size_t i = 0; i < cache->count; ++i) {
+		const struct ResolveCacheEntry *entry = &cache->entries[i];
+		if(!IsEqualTag(&entry->tag, tag)) continue;
+		if(found && (found->DriveNumber != entry->DriveNumber || found->PartitionNumber != entry->PartitionNumber)) return NULL;
+		if(!found) found = entry;
+	}
+	return found;
+}
+
+struct ResolveContext
+{
+	struct ResolveCache *cache;
+	struct ResolveCache fresh; // what this enumeration found, merged into cache at the end
+	struct ResolveRequest *requests;
+	size_t count;
+	size_t unresolved;
+	// every disk seen so far, so each request is checked with a hash lookup rather than a scan of its partitions
+	struct DeviceIndex index;
+	bool indexed;
+
+	// which drives the enumeration has seen, to drop cache entries for the others if it got through them all
+	uint32_t *seen;
+	size_t seen_count;
+};
+
+static bool RecordAndMatch(const struct DiskInfo *disk, void *context)
+{
+	struct ResolveContext *resolve = context;
+	if(disk->DriveNumber < 0) return true;
+
+	if(resolve->cache) {
+		ResolveCacheAddDisk(&resolve->fresh, disk);
+		uint32_t *seen = realloc(resolve->seen, (resolve->seen_count + 1) * sizeof(uint32_t));
+		if(seen) {
+			resolve->seen = seen;
+			resolve->seen[resolve->seen_count++] = (uint32_t)disk->DriveNumber;
+		}
+	}
+
+	// anything found earlier would have matched then, so a hit in the index is on this disk
+	bool indexed = resolve->indexed && DeviceIndexAddDisk(&resolve->index, disk);
+	for(size_t i = 0; i < resolve->count; ++i) {
+		struct ResolveRequest *request = &resolve->requests[i];
+		if(request->result != RESOLVE_NOT_FOUND) continue;
+		bool found = indexed ? DeviceIndexFind(&resolve->index, &request->tag, &request->PartitionNumber) != NULL
+		                     : DiskMatchesTag(disk, &request->tag, &request->PartitionNumber);
+		if(found) {
+			request->result = RESOLVE_ENUMERATED;
+			request->DriveNumber = (uint32_t)disk->DriveNumber;
+			--resolve->unresolved;
+		}
+	}
+
+	// no need to open the rest of the disks once everything has been found
+	return resolve->unresolved > 0;
+}
+
+// a stale drive's entries are replaced with what the probe found there (or dropped, if it found nothing), as the enumeration
+// may stop before it gets to that drive, which would leave the tag cached at both its old and new places
+static bool ValidateCached(struct DeviceBackend *backend, struct ResolveCache *cache, struct ResolveRequest *request)
+{
+	const struct ResolveCacheEntry *cached = ResolveCacheFind(cache, &request->tag);
+	if(!cached) return false;
+
+	bool valid = false;
+	uint32_t DriveNumber = cached->DriveNumber, PartitionNumber = cached->PartitionNumber;
+	struct DiskInfo disk = { 0 };
+	uint64_t start = TRACE_BEGIN();
+	bool probed = backend->ProbeDrive(backend, DriveNumber, &disk);
+	if(probed) {
+		uint32_t found;
+		valid = DiskMatchesTag(&disk, &request->tag, &found) && found == PartitionNumber;
+	}
+	TRACE_END("ProbeDrive", start, "PhysicalDrive%u %s", DriveNumber, valid ? "hit" : "stale");
+
+	if(valid) {
+		request->result = RESOLVE_CACHE_HIT;
+		request->DriveNumber = DriveNumber;
+		request->PartitionNumber = PartitionNumber;
+	} else if(probed) {
+		disk.DriveNumber = (int32_t)DriveNumber;
+		ResolveCacheRecordDisk(cache, &disk);
+	} else {
+		ResolveCacheForgetDrive(cache, DriveNumber);
+	}
+	FreeDiskInfo(&disk);
+	return valid;
+}
+
+static int CompareDriveNumbers(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// the cache becomes: what it had for drives the enumeration didn't get to, followed by everything the enumeration saw
+// (having seen every disk, anything cached for a drive that wasn't there, e.g. a detached disk, is dropped)
+// done once at the end, since doing it disk by disk is quadratic in the number of partitions on a big system
+static void MergeEnumerated(struct ResolveCache *cache, struct ResolveContext *context, bool completed)
+{
+	struct ResolveCache merged = { 0 };
+	if(context->seen_count) qsort(context->seen, context->seen_count, sizeof(uint32_t), &CompareDriveNumbers);
+	for(size_t i = 0; !completed && i < cache->count; ++i) {
+		const struct ResolveCacheEntry *entry = &cache->entries[i];
+		if(context->seen_count && bsearch(&entry->DriveNumber, context->seen, context->seen_count, sizeof(uint32_t), &CompareDriveNumbers)) continue;
+		ResolveCacheAdd(&merged, &entry->tag, entry->DriveNumber, entry->PartitionNumber);
+	}
+	for(size_t i = 0; i < context->fresh.count; ++i) {
+		const struct ResolveCacheEntry *entry = &context->fresh.entries[i];
+		ResolveCacheAdd(&merged, &entry->tag, entry->DriveNumber, entry->PartitionNumber);
+	}
+	FreeResolveCache(&context->fresh);
+
+	merged.dirty = cache->dirty || merged.count != cache->count
+	               || (merged.count && memcmp(merged.entries, cache->entries, merged.count * sizeof(struct ResolveCacheEntry)));
+	FreeResolveCache(cache);
+	*cache = merged;
+}
+
+void ResolveTags(struct DeviceBackend *backend, struct ResolveCache *cache, struct ResolveRequest *requests, size_t count)
+{
+	size_t unresolved = 0;
+	for(size_t i = 0; i < count; ++i) {
+		requests[i].result = RESOLVE_NOT_FOUND;
+		// a stale entry just falls through to the enumeration, which will update the cache
+		if(!cache || !ValidateCached(backend, cache, &requests[i])) ++unresolved;
+	}
+	if(!unresolved) return;
+
+	struct ResolveContext context = { .cache = cache, .requests = requests, .count = count, .unresolved = unresolved, .indexed = unresolved >= INDEX_MIN_REQUESTS };
+	bool completed = EnumDisks(backend, &RecordAndMatch, &context);
+	uint64_t start = TRACE_BEGIN();
+	if(cache) MergeEnumerated(cache, &context, completed);
+	TRACE_END("MergeEnumerated", start, "%zu cache entries", cache ? cache->count : 0);
+	FreeDeviceIndex(&context.index);
+	free(context.seen);
+}
+
+enum ResolveResult ResolveTag(struct DeviceBackend *backend, struct ResolveCache *cache, const struct Tag *tag,
+                              uint32_t *DriveNumber, uint32_t *PartitionNumber)
+{
+	struct ResolveRequest request = { .tag = *tag };
+	ResolveTags(backend, cache, &request, 1);
+	*DriveNumber = request.DriveNumber;
+	*PartitionNumber = request.PartitionNumber;
+	return request.result;
+}
+
+const char * DefaultResolveCachePath(void)
+{
+	static char path[4096], value[4096];
+	const char *override = GetEnvironment("WSL_MOUNT_FINDFS_CACHE", value, sizeof(value));
+	if(override) return *override ? override : NULL;
+
+#ifdef _WIN32
+	const char *dir = GetEnvironment("LOCALAPPDATA", value, sizeof(value));
+	if(!dir) return NULL;
+	snprintf(path, sizeof(path), "%s\\wsl-mount-findfs.cache", dir);
+#else
+	const char *dir = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	if(dir) {
+		snprintf(path, sizeof(path), "%s/wsl-mount-findfs.cache", dir);
+	} else if(home) {
+		snprintf(path, sizeof(path), "%s/.cache/wsl-mount-findfs.cache", home);
+	} else {
+		return NULL;
+	}
+#endif
+	return path;
+}
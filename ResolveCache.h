@@ -0,0 +1,66 @@
+#pragma once
+
+// Remembers which \\.\PhysicalDrive<n> (and partition) each PTUUID/PARTUUID/PARTLABEL/SERIAL was last seen on,
+// so a lookup normally costs one targeted IOCTL_DISK_GET_DRIVE_LAYOUT_EX on that drive to confirm it's still there,
+// rather than opening and querying every disk in the system.
+//
+// The file is plain text, one tag per line:
+// PTUUID=<guid> <DriveNumber>
+// PARTUUID=<guid> <DriveNumber> <PartitionNumber>
+// (and likewise SERIAL=<serial>, PARTLABEL=<name>, whose values may contain spaces, so the numbers are read from the end)
+// PARTTYPE= and MODEL= aren't kept, as they're seldom unique, and every disk would fill it with copies of the same few
+
+#include "DeviceBackend.h"
+#include "Tag.h"
+
+struct ResolveCacheEntry
+{
+	struct Tag tag;
+	uint32_t DriveNumber;
+	uint32_t PartitionNumber;
+};
+
+struct ResolveCache
+{
+	struct ResolveCacheEntry *entries;
+	size_t count;
+	size_t capacity;
+	bool dirty; // differs from what was loaded
+};
+
+// a missing or unreadable file just gives an empty cache
+void LoadResolveCache(struct ResolveCache *cache, const char *path);
+// replaces the file atomically, if anything changed
+bool SaveResolveCache(struct ResolveCache *cache, const char *path);
+void FreeResolveCache(struct ResolveCache *cache);
+
+// replaces whatever was known about disk->DriveNumber with its current contents
+void ResolveCacheRecordDisk(struct ResolveCache *cache, const struct DiskInfo *disk);
+void ResolveCacheForgetDrive(struct ResolveCache *cache, uint32_t DriveNumber);
+// NULL if the tag isn't cached, or is cached at more than one location (which only an enumeration can settle)
+const struct ResolveCacheEntry * ResolveCacheFind(const struct ResolveCache *cache, const struct Tag *tag);
+
+enum ResolveResult {
+	RESOLVE_NOT_FOUND,
+	RESOLVE_CACHE_HIT, // confirmed with a single ProbeDrive
+	RESOLVE_ENUMERATED, // needed a full enumeration (cache miss, or the cached drive no longer matched)
+};
+
+struct ResolveRequest
+{
+	struct Tag tag;
+	enum ResolveResult result;
+	uint32_t DriveNumber;
+	uint32_t PartitionNumber;
+};
+
+// resolves every request, validating cached locations individually and then finding all the rest in a single enumeration
+// cache may be NULL, to always enumerate
+void ResolveTags(struct DeviceBackend *backend, struct ResolveCache *cache, struct ResolveRequest *requests, size_t count);
+
+enum ResolveResult ResolveTag(struct DeviceBackend *backend, struct ResolveCache *cache, const struct Tag *tag,
+                              uint32_t *DriveNumber, uint32_t *PartitionNumber);
+
+// default location of the cache file (%LOCALAPPDATA%\wsl-mount-findfs.cache), overridden by $WSL_MOUNT_FINDFS_CACHE;
+// returns NULL if caching is disabled (WSL_MOUNT_FINDFS_CACHE set but empty)
+const char * DefaultResolveCachePath(void);
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#include "Crt.h"
+#include "SingleFlight.h"
+#include "Trace.h"
+
+//
+// locked files: opening one takes an exclusive lock on it (waiting for it if need be), closing it lets go
+//
+
+#ifdef _WIN32
+typedef HANDLE LockedFile;
+#define NO_LOCKED_FILE INVALID_HANDLE_VALUE
+
+static LockedFile OpenLocked(const char *path)
+{
+	HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+	                          NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE) return NO_LOCKED_FILE;
+	OVERLAPPED whole_file = { 0 };
+	if(!LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &whole_file)) {
+		CloseHandle(file);
+		return NO_LOCKED_FILE;
+	}
+	return file;
+}
+
+static void CloseLocked(LockedFile file)
+{
+	CloseHandle(file);
+}
+
+static bool AppendLocked(LockedFile file, const char *data, size_t size)
+{
+	DWORD written;
+	return SetFilePointer(file, 0, NULL, FILE_END) != INVALID_SET_FILE_POINTER &&
+	       WriteFile(file, data, (DWORD)size, &written, NULL) && written == size;
+}
+
+// the whole contents (NUL-terminated, to be freed), leaving the file empty
+static char * TakeLocked(LockedFile file)
+{
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(file, &size) || SetFilePointer(file, 0, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) return NULL;
+	char *data = malloc((size_t)size.QuadPart + 1);
+	DWORD read = 0;
+	if(!data || !ReadFile(file, data, (DWORD)size.QuadPart, &read, NULL)) {
+		free(data);
+		return NULL;
+	}
+	data[read] = '\0';
+	SetFilePointer(file, 0, NULL, FILE_BEGIN);
+	SetEndOfFile(file);
+	return data;
+}
+
+static void InvocationId(char *id, size_t size)
+{
+	snprintf(id, size, "%lu-%llx", (unsigned long)GetCurrentProcessId(), (unsigned long long)GetTickCount64());
+}
+#else
+typedef int LockedFile;
+#define NO_LOCKED_FILE -1
+
+static LockedFile OpenLocked(const char *path)
+{
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if(fd < 0) return NO_LOCKED_FILE;
+	int result;
+	while((result = flock(fd, LOCK_EX)) && errno == EINTR) {}
+	if(result) {
+		close(fd);
+		return NO_LOCKED_FILE;
+	}
+	return fd;
+}
+
+static void CloseLocked(LockedFile fd)
+{
+	close(fd);
+}
+
+static bool AppendLocked(LockedFile fd, const char *data, size_t size)
+{
+	if(lseek(fd, 0, SEEK_END) < 0) return false;
+	while(size) {
+		ssize_t written = write(fd, data, size);
+		if(written < 0 && errno == EINTR) continue;
+		if(written <= 0) return false;
+		data += written;
+		size -= (size_t)written;
+	}
+	return true;
+}
+
+static char * TakeLocked(LockedFile fd)
+{
+	off_t size = lseek(fd, 0, SEEK_END);
+	if(size < 0 || lseek(fd, 0, SEEK_SET)) return NULL;
+	char *data = malloc((size_t)size + 1);
+	size_t got = 0;
+	while(data && got < (size_t)size) {
+		ssize_t n = read(fd, data + got, (size_t)size - got);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) break;
+		got += (size_t)n;
+	}
+	if(!data) return NULL;
+	data[got] = '\0';
+	if(ftruncate(fd, 0)) {} // (if it can't be emptied, the same requests just get run again)
+	return data;
+}
+
+static void InvocationId(char *id, size_t size)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	snprintf(id, size, "%ld-%llx", (long)getpid(), (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec);
+}
+#endif
+
+//
+// the flight
+//
+
+static void ResultPath(char *path, size_t size, const char *base, const char *id)
+{
+	snprintf(path, size, "%s.%s.result", base, id);
+}
+
+// one result line per request, in the order they were queued; written whole and renamed into place,
+// so a partial file is never mistaken for the results
+static void WriteResults(const char *base, const char *id, const struct FlightRequest *requests, size_t count)
+{
+	char path[4096], tmp_path[4096 + 8];
+	ResultPath(path, sizeof(path), base, id);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	FILE *f = OpenStream(tmp_path, "w");
+	if(!f) {
+		fprintf(stderr, "*** could not write %s\n", tmp_path);
+		return;
+	}
+	for(size_t i = 0; i < count; ++i) {
+		if(!strcmp(requests[i].id, id)) fprintf(f, "%s\n", requests[i].result);
+	}
+	bool success = !ferror(f);
+	success = !fclose(f) && success;
+#ifdef _WIN32
+	success = success && MoveFileExA(tmp_path, path, MOVEFILE_REPLACE_EXISTING);
+#else
+	success = success && !rename(tmp_path, path);
+#endif
+	if(!success) {
+		fprintf(stderr, "*** could not replace %s\n", path);
+		remove(tmp_path);
+	}
+}
+
+// true if a leader left this invocation's results
+static bool ReadResults(const char *base, struct FlightRequest *requests, size_t count)
+{
+	char path[4096];
+	ResultPath(path, sizeof(path), base, requests[0].id);
+	FILE *f = OpenStream(path, "r");
+	if(!f) return false;
+	for(size_t i = 0; i < count && fgets(requests[i].result, sizeof(requests[i].result), f); ++i) {
+		requests[i].result[strcspn(requests[i].result, "\r\n")] = '\0';
+	}
+	fclose(f);
+	remove(path);
+	return true;
+}
+
+// what InvocationId makes; anything else in the queue wasn't put there by an invocation, and isn't to name a result file
+static bool IsInvocationId(const char *id)
+{
+	return *id && id[strspn(id, "0123456789abcdef-")] == '\0';
+}
+
+// everything queued so far (by id<TAB>request lines), plus any of ours (if given) that aren't among them
+// (if a leader took them and then died before leaving results)
+static struct FlightRequest * TakeQueue(const char *queue_path, struct FlightRequest *ours, size_t our_count, size_t *count)
+{
+	LockedFile queue = OpenLocked(queue_path);
+	char *data = queue != NO_LOCKED_FILE ? TakeLocked(queue) : NULL;
+	if(queue != NO_LOCKED_FILE) CloseLocked(queue);
+
+	size_t lines = 0;
+	for(const char *p = data; p && *p; ++p) lines += *p == '\n';
+	struct FlightRequest *requests = calloc(lines + our_count, sizeof(struct FlightRequest));
+	if(!requests) {
+		free(data);
+		return NULL;
+	}
+
+	size_t n = 0;
+	bool ours_queued = false;
+	for(char *line = data, *next; line && *line; line = next) {
+		next = strchr(line, '\n');
+		if(!next) break; // (a partial line, from an append that failed)
+		*next++ = '\0';
+		char *tab = strchr(line, '\t');
+		if(!tab) continue;
+		*tab = '\0';
+		if(!IsInvocationId(line) || strlen(line) >= sizeof(requests[n].id)) continue;
+		snprintf(requests[n].id, sizeof(requests[n].id), "%s", line);
+		snprintf(requests[n].request, sizeof(requests[n].request), "%s", tab + 1);
+		ours_queued = ours_queued || (our_count && !strcmp(requests[n].id, ours[0].id));
+		++n;
+	}
+	free(data);
+
+	if(!ours_queued && our_count) {
+		memcpy(requests + n, ours, our_count * sizeof(struct FlightRequest));
+		n += our_count;
+	}
+	*count = n;
+	return requests;
+}
+
+// runs a batch, and leaves each invocation in it its results (but skip_id's, which the caller takes itself)
+static void RunBatch(const char *base, struct FlightRequest *batch, size_t count, const char *skip_id, FLIGHT_CALLBACK callback, void *context)
+{
+	callback(batch, count, context);
+	for(size_t i = 0; i < count; ++i) {
+		if(skip_id && !strcmp(batch[i].id, skip_id)) continue;
+		// once per invocation, at its first request
+		bool first = true;
+		for(size_t j = 0; first && j < i; ++j) first = strcmp(batch[j].id, batch[i].id) != 0;
+		if(first) WriteResults(base, batch[i].id, batch, count);
+	}
+}
+
+void DrainSingleFlight(const char *base, FLIGHT_CALLBACK callback, void *context)
+{
+	char queue_path[4096];
+	snprintf(queue_path, sizeof(queue_path), "%s.queue", base);
+	size_t count;
+	struct FlightRequest *batch;
+	while((batch = TakeQueue(queue_path, NULL, 0, &count)) && count) {
+		uint64_t start = TRACE_BEGIN();
+		RunBatch(base, batch, count, NULL, callback, context);
+		TRACE_END("DrainSingleFlight", start, "%zu requests", count);
+		free(batch);
+	}
+	free(batch);
+}
+
+bool RunSingleFlight(const char *base, struct FlightRequest *requests, size_t count, FLIGHT_CALLBACK callback, void *context)
+{
+	char lock_path[4096], queue_path[4096];
+	snprintf(lock_path, sizeof(lock_path), "%s.lock", base);
+	snprintf(queue_path, sizeof(queue_path), "%s.queue", base);
+
+	char id[sizeof(requests->id)];
+	InvocationId(id, sizeof(id));
+	for(size_t i = 0; i < count; ++i) {
+		snprintf(requests[i].id, sizeof(requests[i].id), "%s", id);
+		requests[i].result[0] = '\0';
+	}
+
+	// queue up, then wait for whoever's leading
+	uint64_t start = TRACE_BEGIN();
+	bool queued = false;
+	LockedFile queue = OpenLocked(queue_path);
+	if(queue != NO_LOCKED_FILE) {
+		queued = true;
+		for(size_t i = 0; queued && i < count; ++i) {
+			char line[sizeof(requests->id) + FLIGHT_LINE_MAX + 2];
+			int len = snprintf(line, sizeof(line), "%s\t%s\n", id, requests[i].request);
+			queued = AppendLocked(queue, line, (size_t)len);
+		}
+		CloseLocked(queue);
+	}
+	LockedFile lock = queued ? OpenLocked(lock_path) : NO_LOCKED_FILE;
+	if(lock == NO_LOCKED_FILE) {
+		TRACE_END("SingleFlight", start, "no lock, running alone");
+		callback(requests, count, context);
+		return true;
+	}
+
+	if(ReadResults(base, requests, count)) {
+		CloseLocked(lock);
+		TRACE_END("SingleFlight", start, "followed");
+		return false;
+	}
+
+	// nobody has run ours yet, so this one leads, taking along everyone else that's queued meanwhile
+	size_t batch_count;
+	struct FlightRequest *batch = TakeQueue(queue_path, requests, count, &batch_count);
+	if(!batch) {
+		callback(requests, count, context);
+	} else {
+		RunBatch(base, batch, batch_count, id, callback, context);
+		for(size_t i = 0, mine = 0; i < batch_count && mine < count; ++i) {
+			if(!strcmp(batch[i].id, id)) memcpy(requests[mine++].result, batch[i].result, sizeof(batch[i].result));
+		}
+	}
+	// and whoever queued while that ran (unless the callback already served them)
+	DrainSingleFlight(base, callback, context);
+	CloseLocked(lock);
+	TRACE_END("SingleFlight", start, "led %zu requests", batch ? batch_count : count);
+	free(batch);
+	return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+// Coalescing concurrent invocations (e.g. the several wsl-mount@ units systemd starts at once at boot)
+// so that one of them enumerates the disks and elevates on behalf of all of them,
+// rather than each doing its own enumeration and UAC prompt.
+// This is the cross-process counterpart of wsl-mount-broker's attach queue:
+// - each invocation appends its requests to <base>.queue, then waits for <base>.lock
+// - whoever holds the lock leads: it takes everything queued so far (its own requests included), runs it all
+//   as one batch, and leaves each of the others its results in <base>.<id>.result before letting go of the lock
+// - an invocation that then gets the lock and finds its results waiting just uses them; if they aren't there
+//   (it queued after the leader took the queue, or the leader died) it leads the next batch itself
+// The locks are released by the OS if their holder dies, so nothing is left stuck.
+//
+// Requests and results are opaque single lines of text, as far as this is concerned; since anything running as the same
+// user can append to the queue, whatever runs them (possibly elevated) has to check each one it's given.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define FLIGHT_LINE_MAX 1024
+
+struct FlightRequest
+{
+	char id[40]; // the invocation it came from
+	char request[FLIGHT_LINE_MAX]; // no newlines
+	char result[FLIGHT_LINE_MAX]; // filled in by the leader (left empty if it didn't run this one)
+};
+
+// runs every request in the batch (from any number of invocations), filling in each result
+typedef void (*FLIGHT_CALLBACK)(struct FlightRequest *requests, size_t count, void *context);
+
+// runs the requests, through whichever invocation leads the flight they get into, filling in their results
+// returns true if this invocation led (ran callback itself); if the lock can't be had at all, it also just runs them itself
+bool RunSingleFlight(const char *base, struct FlightRequest *requests, size_t count, FLIGHT_CALLBACK callback, void *context);
+
+// for the leader, or whatever runs its batches for it (i.e. its elevated copy, which can then do the mounts of everyone who
+// queued during the UAC prompt without another one): runs everything queued since, until nothing more is,
+// leaving each invocation its results
+void DrainSingleFlight(const char *base, FLIGHT_CALLBACK callback, void *context);
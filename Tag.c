@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include "Tag.h"
+
+static const struct {
+	const char *prefix;
+	size_t length;
+	enum TagKind kind;
+} tag_prefixes[] = {
+	{ "PTUUID=", 7, TAG_PTUUID },
+	{ "PARTUUID=", 9, TAG_PARTUUID },
+	{ "PARTLABEL=", 10, TAG_PARTLABEL },
+	{ "PARTTYPE=", 9, TAG_PARTTYPE },
+	{ "SERIAL=", 7, TAG_SERIAL },
+	{ "MODEL=", 6, TAG_MODEL },
+};
+#define TAG_PREFIX_COUNT (sizeof(tag_prefixes) / sizeof(tag_prefixes[0]))
+
+static bool IsGUIDTag(enum TagKind kind)
+{
+	return kind == TAG_PTUUID || kind == TAG_PARTUUID || kind == TAG_PARTTYPE;
+}
+
+// the tag_prefixes entry for str, or TAG_PREFIX_COUNT
+static size_t FindTagPrefix(const char *str)
+{
+	size_t i = 0;
+	while(i < TAG_PREFIX_COUNT && strncmp(str, tag_prefixes[i].prefix, tag_prefixes[i].length)) ++i;
+	return i;
+}
+
+bool HasTagPrefix(const char *str)
+{
+	return FindTagPrefix(str) < TAG_PREFIX_COUNT;
+}
+
+bool ParseTagQuietly(const char *str, struct Tag *tag)
+{
+	size_t i = FindTagPrefix(str);
+	if(i == TAG_PREFIX_COUNT) return false;
+
+	const char *value = str + tag_prefixes[i].length;
+	*tag = (struct Tag){ .kind = tag_prefixes[i].kind };
+	if(IsGUIDTag(tag->kind)) return parse_guid(value, &tag->guid);
+
+	size_t length = strlen(value);
+	if(!length || length >= sizeof(tag->value)) return false;
+	memcpy(tag->value, value, length + 1);
+	return true;
+}
+
+bool ParseTag(const char *str, struct Tag *tag)
+{
+	if(!HasTagPrefix(str)) {
+		fputs("*** <Tag> must be from the GPT partition table (PARTUUID|PTUUID|PARTLABEL|PARTTYPE=...)\n"
+		      "    or identify the disk itself (SERIAL|MODEL=...)\n"
+		      "    Other linux blkid tags (e.g. UUID=, LABEL=, etc) are only parsed by linux\n"
+		      "    and so cannot be used to locate the device to attach to wsl\n", stderr);
+		return false;
+	}
+
+	if(!ParseTagQuietly(str, tag)) {
+		fprintf(stderr, "*** %s: %s\n", str, IsGUIDTag(tag->kind) ? "invalid GUID" : "empty, or too long");
+		return false;
+	}
+	return true;
+}
+
+bool FormatTag(char *buf, size_t size, const struct Tag *tag)
+{
+	const char *prefix = "";
+	for(size_t i = 0; i < TAG_PREFIX_COUNT; ++i) {
+		if(tag_prefixes[i].kind == tag->kind) prefix = tag_prefixes[i].prefix;
+	}
+
+	GUIDSTR guidstr;
+	const char *value = IsGUIDTag(tag->kind) ? format_guid(guidstr, &tag->guid) : tag->value;
+	if(strpbrk(value, "\r\n")) return false;
+	int length = snprintf(buf, size, "%s%s", prefix, value);
+	return length > 0 && (size_t)length < size;
+}
+
+bool TagNamesPartition(const struct Tag *tag)
+{
+	return tag->kind == TAG_PARTUUID || tag->kind == TAG_PARTLABEL || tag->kind == TAG_PARTTYPE;
+}
+
+bool TagHasValue(const struct Tag *tag)
+{
+	return IsGUIDTag(tag->kind) ? !IsNullGUID(&tag->guid) : tag->value[0] != '\0';
+}
+
+bool IsEqualTag(const struct Tag *a, const struct Tag *b)
+{
+	if(a->kind != b->kind) return false;
+	return IsGUIDTag(a->kind) ? IsEqualGUID(&a->guid, &b->guid) : !strcmp(a->value, b->value);
+}
+
+uint64_t HashTag(const struct Tag *tag)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	const uint8_t *p = IsGUIDTag(tag->kind) ? (const uint8_t *)&tag->guid : (const uint8_t *)tag->value;
+	size_t length = IsGUIDTag(tag->kind) ? sizeof(GUID) : strlen(tag->value);
+	hash = (hash ^ (uint8_t)tag->kind) * 0x100000001b3ull;
+	for(size_t i = 0; i < length; ++i) hash = (hash ^ p[i]) * 0x100000001b3ull;
+	return hash;
+}
+
+bool DiskMatchesTag(const struct DiskInfo *disk, const struct Tag *tag, uint32_t *PartitionNumber)
+{
+	// unused entries (or MBR tables read by linux) have no GUID to match, nor devices without a serial one to compare
+	if(!TagHasValue(tag)) return false;
+
+	const struct PartitionInfo *partition = NULL;
+	*PartitionNumber = 0;
+	switch(tag->kind) {
+		case TAG_PTUUID:
+			return disk->PartitionStyle == PARTSTYLE_GPT && IsEqualGUID(&tag->guid, &disk->DiskId);
+		case TAG_SERIAL:
+			return !strcmp(tag->value, disk->SerialNumber);
+		case TAG_MODEL:
+			return !strcmp(tag->value, disk->Model);
+		case TAG_PARTUUID:
+			partition = FindPartitionByGUID(disk, &tag->guid);
+			break;
+		case TAG_PARTLABEL:
+			if(disk->PartitionStyle == PARTSTYLE_GPT) partition = FindPartitionByName(disk, tag->value);
+			break;
+		case TAG_PARTTYPE:
+			if(disk->PartitionStyle == PARTSTYLE_GPT) partition = FindPartitionByType(disk, &tag->guid);
+			break;
+	}
+	if(partition) *PartitionNumber = partition->PartitionNumber;
+	return partition != NULL;
+}
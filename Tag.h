@@ -0,0 +1,43 @@
+#pragma once
+
+// findfs-style tags naming a disk (PTUUID=, SERIAL=, MODEL=) or partition (PARTUUID=, PARTLABEL=, PARTTYPE=)
+// by what's in its partition table, or what the device reports about itself
+
+#include "DiskInfo.h"
+
+enum TagKind {
+	TAG_PTUUID,
+	TAG_PARTUUID,
+	TAG_PARTLABEL, // GPT partition name
+	TAG_PARTTYPE, // GPT partition type GUID (the first partition of that type)
+	TAG_SERIAL, // disk serial number
+	TAG_MODEL, // disk model (the first disk of that model)
+};
+
+struct Tag
+{
+	enum TagKind kind;
+	GUID guid; // PTUUID, PARTUUID, PARTTYPE
+	char value[128]; // PARTLABEL, SERIAL, MODEL
+};
+
+// true for anything ParseTag would recognize as a tag (valid or not)
+bool HasTagPrefix(const char *str);
+
+// returns false (after reporting why) if str is not a tag this can locate
+bool ParseTag(const char *str, struct Tag *tag);
+// the same, but quietly (for reading back tags this wrote)
+bool ParseTagQuietly(const char *str, struct Tag *tag);
+// the inverse of ParseTag; false if it doesn't fit (or couldn't be read back, e.g. a name with a newline in it)
+bool FormatTag(char *buf, size_t size, const struct Tag *tag);
+
+// whether the tag names a partition (so wsl --mount needs --partition), rather than a whole disk
+bool TagNamesPartition(const struct Tag *tag);
+// false for the null GUID or an empty string, which never match anything
+bool TagHasValue(const struct Tag *tag);
+bool IsEqualTag(const struct Tag *a, const struct Tag *b);
+// FNV-1a over the kind and value, for DeviceIndex
+uint64_t HashTag(const struct Tag *tag);
+
+// true if this disk contains the tagged disk/partition; *PartitionNumber is 0 for a disk tag
+bool DiskMatchesTag(const struct DiskInfo *disk, const struct Tag *tag, uint32_t *PartitionNumber);
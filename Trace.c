@@ -0,0 +1,181 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#include "Crt.h"
+#include "Trace.h"
+
+FILE *trace_file;
+static bool trace_jsonl;
+static char trace_path[1024];
+static uint64_t trace_origin; // what to add to TraceNow() for the wall clock, as of TraceStart()
+
+static unsigned long ProcessId(void)
+{
+#ifdef _WIN32
+	return GetCurrentProcessId();
+#else
+	return (unsigned long)getpid();
+#endif
+}
+
+static unsigned long ThreadId(void)
+{
+#ifdef _WIN32
+	return GetCurrentThreadId();
+#else
+	return (unsigned long)syscall(SYS_gettid);
+#endif
+}
+
+uint64_t TraceNow(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	uint64_t ticks = (uint64_t)counter.QuadPart, hz = (uint64_t)frequency.QuadPart;
+	return ticks / hz * 1000000 + ticks % hz * 1000000 / hz;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#endif
+}
+
+uint64_t WallClock(void)
+{
+#ifdef _WIN32
+	FILETIME ft;
+	GetSystemTimePreciseAsFileTime(&ft);
+	uint64_t ticks = (uint64_t)ft.dwHighDateTime << 32 | ft.dwLowDateTime; // 100ns since 1601
+	return (ticks - 116444736000000000ull) / 10;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#endif
+}
+
+// JSON string contents (device paths are full of backslashes)
+static size_t JsonEscape(char *out, size_t size, const char *in)
+{
+	size_t used = 0;
+	for(; *in && used + 7 < size; ++in) {
+		unsigned char c = (unsigned char)*in;
+		if(c == '"' || c == '\\') {
+			out[used++] = '\\';
+			out[used++] = (char)c;
+		} else if(c < 0x20) {
+			used += (size_t)snprintf(out + used, size - used, "\\u%04x", c);
+		} else {
+			out[used++] = (char)c;
+		}
+	}
+	out[used] = '\0';
+	return used;
+}
+
+// one write per event, so events from concurrent probe threads (or processes appending) don't interleave
+static void WriteEvent(const char *event)
+{
+	fprintf(trace_file, trace_jsonl ? "%s\n" : "%s,\n", event);
+	fflush(trace_file);
+}
+
+bool TraceStart(const char *path, const char *process_name)
+{
+	char value[1024];
+	if(!path) path = GetEnvironment("WSL_MOUNT_TRACE", value, sizeof(value));
+	if(!path || !*path) return false;
+
+	trace_file = OpenStream(path, "a");
+	if(!trace_file) {
+		fprintf(stderr, "*** could not open trace file %s\n", path);
+		return false;
+	}
+	// (wrapping around, if the wall clock is somehow behind the monotonic one, comes out right once added back)
+	trace_origin = WallClock() - TraceNow();
+	// absolute, since an elevated re-exec starts out in System32
+#ifdef _WIN32
+	if(!_fullpath(trace_path, path, sizeof(trace_path)))
+#else
+	if(!realpath(path, trace_path))
+#endif
+		snprintf(trace_path, sizeof(trace_path), "%s", path);
+	size_t len = strlen(path);
+	trace_jsonl = len > 6 && !strcmp(path + len - 6, ".jsonl");
+
+	// the array format tolerates a missing ] (and trailing comma), so appending events is all there is to it
+	fseek(trace_file, 0, SEEK_END);
+	if(!trace_jsonl && ftell(trace_file) == 0) fputs("[\n", trace_file);
+
+	char name[256], event[512];
+	JsonEscape(name, sizeof(name), process_name);
+	snprintf(event, sizeof(event), "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%lu,\"args\":{\"name\":\"%s\"}}",
+	         ProcessId(), ThreadId(), name);
+	WriteEvent(event);
+	return true;
+}
+
+bool TraceArguments(int *argc, char *argv[], const char *process_name)
+{
+	const char *path = NULL;
+	int kept = 1;
+	for(int i = 1; i < *argc; ++i) {
+		if(!strncmp(argv[i], "--trace=", 8)) {
+			if(!path) path = argv[i] + 8;
+		} else {
+			argv[kept++] = argv[i];
+		}
+	}
+	*argc = kept;
+	argv[kept] = NULL;
+	if(!TraceStart(path, process_name)) return false;
+
+#ifndef _WIN32
+	// /p has interop translate the path for windows
+	const char *wslenv = getenv("WSLENV");
+	if(!wslenv || !strstr(wslenv, "WSL_MOUNT_TRACE")) {
+		char exported[1024];
+		snprintf(exported, sizeof(exported), "%s%sWSL_MOUNT_TRACE/p", wslenv ? wslenv : "", wslenv && *wslenv ? ":" : "");
+		setenv("WSLENV", exported, 1);
+	}
+	setenv("WSL_MOUNT_TRACE", trace_path, 1);
+#endif
+	return true;
+}
+
+const char * TracePath(void)
+{
+	return trace_file ? trace_path : NULL;
+}
+
+void TraceStop(void)
+{
+	if(trace_file) fclose(trace_file);
+	trace_file = NULL;
+}
+
+void TraceEvent(const char *name, uint64_t start, const char *format, ...)
+{
+	uint64_t end = TraceNow();
+	char detail[512], escaped[1024], event[1536];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(detail, sizeof(detail), format, args);
+	va_end(args);
+	JsonEscape(escaped, sizeof(escaped), detail);
+
+	snprintf(event, sizeof(event),
+	         "{\"name\":\"%s\",\"cat\":\"wsl-mount\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%lu,\"tid\":%lu,\"args\":{\"detail\":\"%s\"}}",
+	         name, (unsigned long long)(trace_origin + start), (unsigned long long)(end - start), ProcessId(), ThreadId(), escaped);
+	WriteEvent(event);
+}
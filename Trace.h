@@ -0,0 +1,34 @@
+#pragma once
+
+// Phase-level tracing: when enabled (--trace=<file>, or $WSL_MOUNT_TRACE), each phase, and each device probe,
+// is written as a Chrome trace event (open the file in https://ui.perfetto.dev or chrome://tracing),
+// or as one JSON object per line if the file name ends in .jsonl.
+// Events are timed with the monotonic clock (QueryPerformanceCounter/CLOCK_MONOTONIC), but stamped with the wall clock
+// (microseconds since 1970), by adding the difference between the two as of TraceStart(): the linux side's monotonic clock
+// is the WSL VM's rather than windows', so the wall clock is the only one shared by every process appending to one file.
+// Their events line up to within how far apart those wall clocks are (WSL keeps the VM's in step with the host's).
+// When disabled, a trace point costs a test of one global.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+extern FILE *trace_file;
+
+// path NULL for $WSL_MOUNT_TRACE; false if neither says to trace (or the file can't be opened)
+bool TraceStart(const char *path, const char *process_name);
+// takes any --trace=<file> out of argv (wherever it is), then TraceStart()s with it
+// On linux the file is also exported (via WSLENV) to any win32 helper run from here on, so its events land in the same file
+bool TraceArguments(int *argc, char *argv[], const char *process_name);
+// the full path being traced to (to pass on to a re-exec), NULL if not tracing
+const char * TracePath(void);
+void TraceStop(void);
+uint64_t TraceNow(void);
+// microseconds since 1970 (what Metrics.h records are stamped with, too)
+uint64_t WallClock(void);
+// a complete event, from start to now
+void TraceEvent(const char *name, uint64_t start, const char *format, ...);
+
+// usage: uint64_t start = TRACE_BEGIN(); ...; TRACE_END("phase", start, "%s", detail);
+#define TRACE_BEGIN() (trace_file ? TraceNow() : 0)
+#define TRACE_END(name, start, ...) do { if(trace_file) TraceEvent(name, start, __VA_ARGS__); } while(0)
@@ -0,0 +1,387 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Trace.h"
+#include "WarmProfile.h"
+
+#define RECORD_WINDOW (64 << 20) // of a file mapped at once, for mincore()
+
+// grows the array when count reaches a power of two (16 at least), so the capacity needn't be kept anywhere
+static struct WarmEntry * AddEntry(struct WarmProfile *profile)
+{
+	size_t count = profile->count;
+	if(!count || (count >= 16 && !(count & (count - 1)))) {
+		struct WarmEntry *grown = realloc(profile->entries, (count ? count * 2 : 16) * sizeof(struct WarmEntry));
+		if(!grown) return NULL;
+		profile->entries = grown;
+	}
+	struct WarmEntry *entry = &profile->entries[profile->count++];
+	*entry = (struct WarmEntry){ 0 };
+	return entry;
+}
+
+static bool CopyEntry(struct WarmProfile *profile, const struct WarmEntry *from, const char *path, const struct WarmExtent *extents)
+{
+	char *copied_path = strdup(path);
+	struct WarmExtent *copied_extents = from->extent_count ? malloc(from->extent_count * sizeof(struct WarmExtent)) : NULL;
+	struct WarmEntry *entry = copied_path && (copied_extents || !from->extent_count) ? AddEntry(profile) : NULL;
+	if(!entry) {
+		free(copied_path);
+		free(copied_extents);
+		return false;
+	}
+	*entry = *from;
+	entry->path = copied_path;
+	entry->extents = copied_extents;
+	if(from->extent_count) memcpy(copied_extents, extents, from->extent_count * sizeof(struct WarmExtent));
+	return true;
+}
+
+void FreeWarmProfile(struct WarmProfile *profile)
+{
+	for(size_t i = 0; i < profile->count; ++i) {
+		free(profile->entries[i].path);
+		free(profile->entries[i].extents);
+	}
+	free(profile->entries);
+	*profile = (struct WarmProfile){ 0 };
+}
+
+//
+// the file
+//
+
+void LoadWarmProfile(struct WarmProfile *profile, const char *path)
+{
+	*profile = (struct WarmProfile){ 0 };
+	FILE *f = fopen(path, "r");
+	if(!f) return;
+
+	char *line = NULL;
+	size_t size = 0;
+	struct WarmExtent extents[WARM_MAX_EXTENTS];
+	while(getline(&line, &size, f) > 0) {
+		line[strcspn(line, "\n")] = '\0';
+		char *p = line;
+		struct WarmEntry entry = { .age = (unsigned)strtoul(p, &p, 10) };
+		if(p == line || p[0] != ' ' || (p[1] != 'D' && p[1] != 'F') || p[2] != ' ') continue;
+		entry.directory = p[1] == 'D';
+		p += 3;
+		bool valid = true;
+		while(!entry.directory && valid) {
+			struct WarmExtent extent;
+			extent.offset = strtoull(p, &p, 10);
+			valid = *p++ == '+';
+			extent.length = valid ? strtoull(p, &p, 10) : 0;
+			valid = valid && entry.extent_count < WARM_MAX_EXTENTS && (*p == ',' || *p == ' ');
+			if(valid) {
+				extents[entry.extent_count++] = extent;
+				entry.bytes += extent.length;
+			}
+			if(*p++ == ' ') break;
+		}
+		if(valid && *p) CopyEntry(profile, &entry, p, extents);
+	}
+	free(line);
+	fclose(f);
+}
+
+bool SaveWarmProfile(const struct WarmProfile *profile, const char *path)
+{
+	// write a new file and rename it over the old one, so a concurrent reader never sees a partial file
+	char tmp_path[4096];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	FILE *f = fopen(tmp_path, "w");
+	if(!f) {
+		fprintf(stderr, "*** could not write %s\n", tmp_path);
+		return false;
+	}
+
+	for(size_t i = 0; i < profile->count; ++i) {
+		const struct WarmEntry *entry = &profile->entries[i];
+		fprintf(f, "%u %c ", entry->age, entry->directory ? 'D' : 'F');
+		for(size_t e = 0; e < entry->extent_count; ++e) {
+			fprintf(f, "%llu+%llu%c", (unsigned long long)entry->extents[e].offset, (unsigned long long)entry->extents[e].length,
+			        e + 1 < entry->extent_count ? ',' : ' ');
+		}
+		fprintf(f, "%s\n", entry->path);
+	}
+
+	bool success = !ferror(f);
+	success = !fclose(f) && success;
+	success = success && !rename(tmp_path, path);
+	if(!success) {
+		fprintf(stderr, "*** could not replace %s\n", path);
+		remove(tmp_path);
+	}
+	return success;
+}
+
+//
+// recording
+//
+
+struct RecordContext
+{
+	struct WarmProfile *profile;
+	dev_t dev;
+	long page_size;
+	char path[PATH_MAX]; // relative to the root
+	unsigned char vec[RECORD_WINDOW / 4096];
+};
+
+static int OpenNoAtime(int dirfd, const char *name, int flags)
+{
+	// (O_NOATIME is only allowed on one's own files, so root or the owner; anyone else just leaves the atime to be updated)
+	int fd = openat(dirfd, name, flags | O_NOATIME);
+	return fd >= 0 || errno != EPERM ? fd : openat(dirfd, name, flags);
+}
+
+// the resident ranges of the file, if any
+static bool RecordFile(struct RecordContext *record, int dirfd, const char *name, const struct stat *st)
+{
+	int fd = st->st_size ? OpenNoAtime(dirfd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW) : -1;
+	if(fd < 0) return false;
+
+	struct WarmEntry entry = { 0 };
+	struct WarmExtent extents[WARM_MAX_EXTENTS];
+	uint64_t size = (uint64_t)st->st_size;
+	for(uint64_t window = 0; window < size; window += RECORD_WINDOW) {
+		size_t length = size - window < RECORD_WINDOW ? (size_t)(size - window) : RECORD_WINDOW;
+		void *map = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, (off_t)window);
+		if(map == MAP_FAILED) break;
+		size_t pages = mincore(map, length, record->vec) ? 0 : (length + (size_t)record->page_size - 1) / (size_t)record->page_size;
+		for(size_t p = 0; p < pages; ++p) {
+			if(!(record->vec[p] & 1)) continue;
+			uint64_t offset = window + p * (uint64_t)record->page_size;
+			uint64_t end = offset + (uint64_t)record->page_size < size ? offset + (uint64_t)record->page_size : size;
+			struct WarmExtent *last = entry.extent_count ? &extents[entry.extent_count - 1] : NULL;
+			if(last && (last->offset + last->length == offset || entry.extent_count == WARM_MAX_EXTENTS)) {
+				last->length = end - last->offset;
+			} else {
+				extents[entry.extent_count++] = (struct WarmExtent){ offset, end - offset };
+			}
+		}
+		munmap(map, length);
+	}
+	close(fd);
+
+	for(size_t e = 0; e < entry.extent_count; ++e) entry.bytes += extents[e].length;
+	return entry.extent_count && CopyEntry(record->profile, &entry, record->path, extents);
+}
+
+// the directory's files and subdirectories (dirfd, which this closes, being record->path), and itself if anything in it was recorded
+static bool RecordDirectory(struct RecordContext *record, int dirfd, size_t len)
+{
+	DIR *dir = fdopendir(dirfd);
+	if(!dir) {
+		close(dirfd);
+		return false;
+	}
+
+	bool any = false;
+	for(struct dirent *entry; (entry = readdir(dir));) {
+		const char *name = entry->d_name;
+		if(!strcmp(name, ".") || !strcmp(name, "..") || strchr(name, '\n')) continue;
+		struct stat st;
+		if(fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) || st.st_dev != record->dev) continue;
+		int added = snprintf(record->path + len, sizeof(record->path) - len, "%s%s", len ? "/" : "", name);
+		if(added < 0 || (size_t)added >= sizeof(record->path) - len) {
+			record->path[len] = '\0';
+			continue;
+		}
+
+		if(S_ISDIR(st.st_mode)) {
+			int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+			if(fd >= 0 && RecordDirectory(record, fd, len + (size_t)added)) any = true;
+		} else if(S_ISREG(st.st_mode) && RecordFile(record, dirfd, name, &st)) {
+			any = true;
+		}
+		record->path[len] = '\0';
+	}
+	closedir(dir);
+
+	// (the mount point itself is ".")
+	struct WarmEntry directory = { .directory = true };
+	if(any) CopyEntry(record->profile, &directory, len ? record->path : ".", NULL);
+	return any;
+}
+
+bool RecordWarmProfile(struct WarmProfile *profile, const char *root)
+{
+	*profile = (struct WarmProfile){ 0 };
+	struct RecordContext *record = calloc(1, sizeof(struct RecordContext));
+	int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	struct stat st;
+	if(!record || fd < 0 || fstat(fd, &st)) {
+		fprintf(stderr, "*** %s: %s\n", root, strerror(errno));
+		if(fd >= 0) close(fd);
+		free(record);
+		return false;
+	}
+	record->profile = profile;
+	record->dev = st.st_dev;
+	record->page_size = sysconf(_SC_PAGESIZE);
+	if(record->page_size < 4096) record->page_size = 4096;
+
+	uint64_t start = TRACE_BEGIN();
+	RecordDirectory(record, fd, 0);
+	TRACE_END("RecordWarmProfile", start, "%s: %zu entries", root, profile->count);
+	free(record);
+	return true;
+}
+
+static int CompareEntryPaths(const void *a, const void *b)
+{
+	const struct WarmEntry *x = a, *y = b;
+	int order = strcmp(x->path, y->path);
+	return order ? order : (int)x->directory - (int)y->directory;
+}
+
+void MergeWarmProfile(struct WarmProfile *profile, const struct WarmProfile *previous, unsigned keep)
+{
+	size_t current = profile->count;
+	qsort(profile->entries, current, sizeof(struct WarmEntry), &CompareEntryPaths);
+	for(size_t i = 0; i < previous->count; ++i) {
+		const struct WarmEntry *entry = &previous->entries[i];
+		if(entry->age + 1 >= keep) continue;
+		// (only the entries of this session are sorted, and searched; the previous profile has no duplicates)
+		if(bsearch(entry, profile->entries, current, sizeof(struct WarmEntry), &CompareEntryPaths)) continue;
+		struct WarmEntry older = *entry;
+		++older.age;
+		CopyEntry(profile, &older, entry->path, entry->extents);
+	}
+}
+
+//
+// replay
+//
+
+struct ReplayContext
+{
+	int root_fd;
+	const struct WarmEntry **items;
+	size_t count;
+	size_t next;
+	struct WarmStats *stats;
+};
+
+// lists it, and stats everything in it, as a directory listing from windows would
+static bool WarmDirectory(int root_fd, const char *path)
+{
+	int fd = openat(root_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+	if(!dir) {
+		if(fd >= 0) close(fd);
+		return false;
+	}
+	for(struct dirent *entry; (entry = readdir(dir));) {
+		struct stat st;
+		fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW);
+	}
+	closedir(dir);
+	return true;
+}
+
+// reads the extents ahead into the page cache, adding up the bytes asked for; false if it couldn't be opened
+static bool WarmFile(int root_fd, const struct WarmEntry *entry, uint64_t *bytes)
+{
+	int fd = OpenNoAtime(root_fd, entry->path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+		if(fd >= 0) close(fd);
+		return false;
+	}
+
+	uint64_t size = (uint64_t)st.st_size;
+	for(size_t e = 0; e < entry->extent_count; ++e) {
+		uint64_t offset = entry->extents[e].offset;
+		if(offset >= size) continue;
+		uint64_t length = size - offset < entry->extents[e].length ? size - offset : entry->extents[e].length;
+		// readahead(2) returns once the reads are issued, so each worker has one file's worth in flight at a time;
+		// where the filesystem doesn't support it, the same hint through fadvise
+		if(readahead(fd, (off_t)offset, (size_t)length)) posix_fadvise(fd, (off_t)offset, (off_t)length, POSIX_FADV_WILLNEED);
+		*bytes += length;
+	}
+	close(fd);
+	return true;
+}
+
+static void * ReplayWorker(void *arg)
+{
+	struct ReplayContext *replay = arg;
+	for(;;) {
+		size_t i = __atomic_fetch_add(&replay->next, 1, __ATOMIC_RELAXED);
+		if(i >= replay->count) return NULL;
+		const struct WarmEntry *entry = replay->items[i];
+		if(entry->directory) {
+			if(WarmDirectory(replay->root_fd, entry->path)) __atomic_add_fetch(&replay->stats->directories, 1, __ATOMIC_RELAXED);
+			else __atomic_add_fetch(&replay->stats->skipped, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+		uint64_t bytes = 0;
+		if(WarmFile(replay->root_fd, entry, &bytes)) {
+			__atomic_add_fetch(&replay->stats->files, 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&replay->stats->bytes, bytes, __ATOMIC_RELAXED);
+		} else {
+			__atomic_add_fetch(&replay->stats->skipped, 1, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+// directories first (by path, so parents before children), then files from the most recently used and smallest
+static int CompareReplayOrder(const void *a, const void *b)
+{
+	const struct WarmEntry *x = *(const struct WarmEntry * const *)a, *y = *(const struct WarmEntry * const *)b;
+	if(x->directory != y->directory) return x->directory ? -1 : 1;
+	if(x->directory) return strcmp(x->path, y->path);
+	if(x->age != y->age) return x->age < y->age ? -1 : 1;
+	return x->bytes < y->bytes ? -1 : x->bytes > y->bytes;
+}
+
+void ReplayWarmProfile(const struct WarmProfile *profile, const char *root, unsigned jobs, uint64_t memory_cap, struct WarmStats *stats)
+{
+	*stats = (struct WarmStats){ 0 };
+	struct ReplayContext replay = { .root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC), .stats = stats };
+	replay.items = calloc(profile->count ? profile->count : 1, sizeof(struct WarmEntry *));
+	if(replay.root_fd < 0 || !replay.items) {
+		fprintf(stderr, "*** %s: %s\n", root, strerror(errno));
+		if(replay.root_fd >= 0) close(replay.root_fd);
+		free(replay.items);
+		return;
+	}
+
+	uint64_t start = TRACE_BEGIN();
+	for(size_t i = 0; i < profile->count; ++i) replay.items[i] = &profile->entries[i];
+	qsort(replay.items, profile->count, sizeof(struct WarmEntry *), &CompareReplayOrder);
+	uint64_t planned = 0;
+	for(size_t i = 0; i < profile->count; ++i) {
+		const struct WarmEntry *entry = replay.items[i];
+		if(memory_cap && planned + entry->bytes > memory_cap) {
+			++stats->skipped;
+			continue;
+		}
+		planned += entry->bytes;
+		replay.items[replay.count++] = entry;
+	}
+
+	pthread_t *thread = calloc(jobs ? jobs : 1, sizeof(pthread_t));
+	unsigned started = 0;
+	while(thread && started + 1 < jobs && !pthread_create(&thread[started], NULL, &ReplayWorker, &replay)) ++started;
+	ReplayWorker(&replay);
+	for(unsigned i = 0; i < started; ++i) pthread_join(thread[i], NULL);
+	free(thread);
+	TRACE_END("ReplayWarmProfile", start, "%s: %zu directories, %zu files, %llu bytes", root, stats->directories, stats->files,
+	          (unsigned long long)stats->bytes);
+
+	close(replay.root_fd);
+	free(replay.items);
+}
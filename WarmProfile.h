@@ -0,0 +1,62 @@
+#pragma once
+
+// Access profiles of a mounted volume, for warming its page cache after the next mount
+// (the first listing or open from \\wsl.localhost otherwise goes cold through 9P, dm-crypt, and the disk).
+// Recording takes what's in the page cache at the time (mincore() of every file: what this session touched, give or take),
+// and the directories above those files; replaying reads those ranges back in, and lists and stats those directories.
+//
+// The file is plain text, one entry per line, paths being relative to the mount point:
+// <age> D <path>
+// <age> F <offset>+<length>[,<offset>+<length>...] <path>
+// age is how many sessions ago it was last seen in the cache (0 for the latest), so that something used once doesn't stay forever
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WARM_MAX_EXTENTS 64 // per file; past that the last one just grows to take in the rest
+
+struct WarmExtent
+{
+	uint64_t offset;
+	uint64_t length;
+};
+
+struct WarmEntry
+{
+	char *path;
+	bool directory;
+	unsigned age;
+	uint64_t bytes; // the sum of its extents
+	struct WarmExtent *extents;
+	size_t extent_count;
+};
+
+struct WarmProfile
+{
+	struct WarmEntry *entries;
+	size_t count;
+};
+
+// a missing or unreadable file just gives an empty profile
+void LoadWarmProfile(struct WarmProfile *profile, const char *path);
+// replaces the file atomically
+bool SaveWarmProfile(const struct WarmProfile *profile, const char *path);
+void FreeWarmProfile(struct WarmProfile *profile);
+
+// what of the tree under root (not crossing into other filesystems) is in the page cache now
+bool RecordWarmProfile(struct WarmProfile *profile, const char *root);
+// carries over the entries of an older profile that aren't in this one, a session older, until they're keep sessions old
+void MergeWarmProfile(struct WarmProfile *profile, const struct WarmProfile *previous, unsigned keep);
+
+struct WarmStats
+{
+	size_t directories, files;
+	uint64_t bytes;
+	size_t skipped; // files left out for the memory cap (or gone)
+};
+
+// reads the profile's files back into the page cache, and lists its directories, with up to jobs at once
+// The directories go first, then the files from the most recently used and smallest (so a memory cap leaves out
+// the fewest files); memory_cap (bytes, 0 for none) bounds the total read ahead.
+void ReplayWarmProfile(const struct WarmProfile *profile, const char *root, unsigned jobs, uint64_t memory_cap, struct WarmStats *stats);
@@ -1,7 +1,11 @@
+#include <fcntl.h>
+#include <io.h>
 #include <stdio.h>
 #include <windows.h>
 #include <tchar.h>
 #include <wincred.h>
+#include "Metrics.h"
+#include "Trace.h"
 
 // simple "askpass" GUI helper allowing WSL to invoke a win32 process that uses the normal
 // wincred UI prompt and session credential store to securely retain the LUKS passphrase,
@@ -14,6 +18,10 @@
 // https://github.com/GitCredentialManager/git-credential-manager/blob/main/docs/wsl.md#how-it-works
 // https://learn.microsoft.com/en-us/windows/wsl/filesystems#interoperability-between-windows-and-linux-commands
 
+// $WSL_MOUNT_TRACE (passed through WSLENV) records the time taken by the credential store and each prompt, see Trace.h
+// and the metrics log ($WSL_MOUNT_METRICS, or %LOCALAPPDATA%\wsl-mount-metrics.log) gets the same, with how each came out
+// (a prompt cancelled is 1223, ERROR_CANCELLED) and which were retries after a wrong passphrase, see Metrics.h
+
 void ReportLastError(const char *caption, ...)
 {
 	char *messageBuffer;
@@ -30,109 +38,246 @@ void ReportLastError(const char *caption, ...)
 	LocalFree(messageBuffer);
 }
 
-int _tmain(int argc, LPCTSTR argv[])
+// outcome for one target, and the exit code when only one was asked for
+enum AskpassStatus {
+	ASKPASS_OK = 0,
+	ASKPASS_FAILED = 1,
+	ASKPASS_CANCELLED = 2,
+};
+
+// the credential stored for LUKS\<Target>, if there is one
+// on success *passphrase is the UTF-8 passphrase (SecureZeroMemory it, then free; NULL if it couldn't be copied)
+static BOOL ReadStoredPassphrase(LPCTSTR TargetName, BYTE **passphrase, DWORD *cbPassphrase)
 {
-	if(argc >= 2) {
-		TCHAR TargetName[MAX_PATH];
-		_stprintf_s(TargetName, MAX_PATH, TEXT("LUKS\\%s"), argv[1]);
-		PCREDENTIAL pCredential;
-
-		DWORD dwAuthError = ERROR_SUCCESS;
-		if(argc >= 3 && !_tcsncmp(argv[2], TEXT("--auth-error="), 12)) {
-			// used after crypt_activate_* returned an error
-			// to indicate that a previous attmpt failed and we should *not* just use the stored password
-			dwAuthError = ERROR_INVALID_PASSWORD; // posix errno == EPERM, but just assume that's the only case (for now)
+	PCREDENTIAL pCredential;
+	uint64_t start = TraceNow();
+	BOOL found = CredRead(TargetName, CRED_TYPE_GENERIC, 0, &pCredential);
+	TRACE_END("CredRead", start, "%ls: %s", TargetName, found ? "found" : "not found");
+	METRIC_END("askpass.credread", start, found ? 0 : ERROR_NOT_FOUND);
+	if(!found) return FALSE;
+
+	*cbPassphrase = pCredential->CredentialBlobSize;
+	*passphrase = malloc(*cbPassphrase ? *cbPassphrase : 1);
+	if(*passphrase) memcpy(*passphrase, pCredential->CredentialBlob, *cbPassphrase);
+	SecureZeroMemory(pCredential->CredentialBlob, pCredential->CredentialBlobSize);
+	CredFree(pCredential);
+	return TRUE;
+}
+
+// prompts for the passphrase of LUKS\<Target>, storing it for the session if the user ticks the box
+// dwAuthError is ERROR_INVALID_PASSWORD if the last one didn't work (which the dialog then says)
+static enum AskpassStatus PromptPassphrase(LPTSTR TargetName, DWORD dwAuthError, BYTE **passphrase, DWORD *cbPassphrase)
+{
+	CREDUI_INFO UiInfo = { .cbSize = sizeof(CREDUI_INFO) };
+	UiInfo.pszCaptionText = TEXT("LUKS cryptsetup");
+	// with several volumes asked for in a row, say which one this is
+	UiInfo.pszMessageText = TargetName;
+	//TODO:UiInfo.hbmBanner, 320x60 pixels
+
+	ULONG ulAuthPackage;
+	LPVOID pvOutAuthBuffer;
+	ULONG ulOutAuthBufferSize;
+	BOOL fSave = TRUE;
+
+	BYTE *pPackedCredentials = NULL;
+	DWORD cbPackedCredentials = 50;
+	BOOL success = CredPackAuthenticationBuffer(CRED_PACK_GENERIC_CREDENTIALS, TargetName, TEXT(""), pPackedCredentials, &cbPackedCredentials);
+	if(!success && GetLastError() == ERROR_INSUFFICIENT_BUFFER) {
+		pPackedCredentials = malloc(cbPackedCredentials);
+		success = CredPackAuthenticationBuffer(CRED_PACK_GENERIC_CREDENTIALS, TargetName, TEXT(""), pPackedCredentials, &cbPackedCredentials);
+	}
+	if(!success) ReportLastError("CredPackAuthenticationBuffer");
+
+	uint64_t start = TraceNow();
+	DWORD dwPrompt = CredUIPromptForWindowsCredentials(&UiInfo, dwAuthError, &ulAuthPackage,
+	                                                   pPackedCredentials, cbPackedCredentials,
+	                                                   &pvOutAuthBuffer, &ulOutAuthBufferSize, &fSave, CREDUIWIN_CHECKBOX | CREDUIWIN_GENERIC | CREDUIWIN_IN_CRED_ONLY);
+	free(pPackedCredentials);
+	TRACE_END("CredUIPromptForWindowsCredentials", start, "%ls: %lu", TargetName, dwPrompt);
+	METRIC_END("askpass.prompt", start, (int)dwPrompt);
+	switch(dwPrompt) {
+		case ERROR_SUCCESS:
+			break;
+		case ERROR_CANCELLED:
+			return ASKPASS_CANCELLED;
+		default:
+			return ASKPASS_FAILED;
+	}
+
+	LPTSTR pszUsername = NULL;
+	DWORD cchUsername = 0;
+	LPTSTR pszDomainName = NULL;
+	DWORD cchDomainName = 0;
+	LPTSTR pszPassword = NULL;
+	DWORD cchPassword = 0;
+	success = CredUnPackAuthenticationBuffer(0, pvOutAuthBuffer, ulOutAuthBufferSize, pszUsername, &cchUsername, pszDomainName, &cchDomainName, pszPassword, &cchPassword);
+	if(!success && GetLastError() == ERROR_INSUFFICIENT_BUFFER) {
+		pszUsername = calloc(cchUsername, sizeof(TCHAR));
+		pszDomainName = calloc(cchDomainName, sizeof(TCHAR));
+		pszPassword = calloc(cchPassword, sizeof(TCHAR));
+		success = CredUnPackAuthenticationBuffer(0, pvOutAuthBuffer, ulOutAuthBufferSize, pszUsername, &cchUsername, pszDomainName, &cchDomainName, pszPassword, &cchPassword);
+	}
+	if(!success) ReportLastError("CredUnPackAuthenticationBufferW");
+
+	SecureZeroMemory(pvOutAuthBuffer, ulOutAuthBufferSize);
+	CoTaskMemFree(pvOutAuthBuffer);
+
+	BYTE *pu8Password = NULL;
+	int cbu8Password = WideCharToMultiByte(CP_UTF8, WC_ERR_INVALID_CHARS | WC_COMPOSITECHECK, pszPassword, cchPassword, NULL, 0, NULL, NULL);
+	pu8Password = malloc(cbu8Password+1);
+	WideCharToMultiByte(CP_UTF8, WC_ERR_INVALID_CHARS | WC_COMPOSITECHECK, pszPassword, cchPassword, pu8Password, cbu8Password, NULL, NULL);
+	pu8Password[cbu8Password] = '\0';
+
+	SecureZeroMemory(pszPassword, sizeof(TCHAR)*cchPassword);
+	free(pszPassword);
+
+	//_ftprintf(stderr, L"Username = %s, Domain = %s\n", pszUsername, pszDomainName);
+	free(pszDomainName);
+	free(pszUsername);
+
+	if(fSave) {
+		CREDENTIAL cred;
+		cred.Flags = 0;
+		cred.Type = CRED_TYPE_GENERIC;
+		cred.TargetName = TargetName;
+		cred.Comment = TEXT("saved by luks-askpass-wincred");
+		cred.CredentialBlobSize = cbu8Password;
+		cred.CredentialBlob = pu8Password;
+		cred.Persist = CRED_PERSIST_SESSION; //CRED_PERSIST_LOCAL_MACHINE, but I don't want it actually saved
+		cred.AttributeCount = 0;
+		cred.Attributes = NULL;
+		cred.TargetAlias = NULL;
+		cred.UserName = TargetName;
+
+		start = TRACE_BEGIN();
+		if(!CredWrite(&cred, 0)) ReportLastError("CredWrite");
+		TRACE_END("CredWrite", start, "%ls", TargetName);
+	}
+
+	*passphrase = pu8Password;
+	*cbPassphrase = cbu8Password;
+	return ASKPASS_OK;
+}
+
+// the credential stored for LUKS\<Target> (unless a previous attempt with it failed), otherwise prompts for one
+static enum AskpassStatus GetPassphrase(LPCTSTR Target, BOOL fAuthError, BYTE **passphrase, DWORD *cbPassphrase)
+{
+	TCHAR TargetName[MAX_PATH];
+	_stprintf_s(TargetName, MAX_PATH, TEXT("LUKS\\%s"), Target);
+	// fAuthError is used after crypt_activate_* returned an error, to indicate that a previous attempt failed
+	// and we should *not* just use the stored password (posix errno == EPERM, but just assume that's the only case, for now)
+	if(!fAuthError && ReadStoredPassphrase(TargetName, passphrase, cbPassphrase)) return *passphrase ? ASKPASS_OK : ASKPASS_FAILED;
+	if(!fAuthError) fprintf(stderr, "*** %ls not found\n", TargetName);
+	return PromptPassphrase(TargetName, fAuthError ? ERROR_INVALID_PASSWORD : ERROR_SUCCESS, passphrase, cbPassphrase);
+}
+
+struct BatchTarget
+{
+	LPCTSTR Target;
+	BOOL fAuthError, fStored;
+	enum AskpassStatus status;
+	BYTE *passphrase;
+	DWORD cbPassphrase;
+};
+
+// writes the target's record, then wipes its passphrase
+static void WriteRecord(int index, struct BatchTarget *target)
+{
+	printf("%d %lu %d\n", (int)target->status, target->status == ASKPASS_OK ? target->cbPassphrase : 0, index);
+	if(target->status == ASKPASS_OK) fwrite(target->passphrase, 1, target->cbPassphrase, stdout);
+	// each as soon as it's known, so the linux side can start unlocking that volume while the next dialog is up
+	fflush(stdout);
+	if(target->passphrase) {
+		SecureZeroMemory(target->passphrase, target->cbPassphrase);
+		free(target->passphrase);
+		target->passphrase = NULL;
+	}
+}
+
+// --batch [--auth-error=1] <Target> [[--auth-error=1] <Target>...]
+// answers every target from one process (so one interop spawn) as a record per target:
+// "<AskpassStatus> <Length> <Index>\n" followed by Length bytes of passphrase, Index being the target's position among
+// those given (--auth-error applies only to the target after it, and isn't counted).
+// The stored credentials are all read and answered first, then the missing ones are prompted for one dialog after another,
+// so the volumes whose passphrases are stored don't wait on the dialogs, and the dialogs come as one sequence.
+static int RunBatch(int argc, LPCTSTR argv[])
+{
+	// the records are binary, don't let the CRT turn \n into \r\n
+	_setmode(_fileno(stdout), _O_BINARY);
+
+	struct BatchTarget *targets = calloc((size_t)argc, sizeof(struct BatchTarget));
+	if(!targets) return ASKPASS_FAILED;
+	int count = 0;
+	BOOL fAuthError = FALSE;
+	for(int i = 0; i < argc; ++i) {
+		if(!_tcsncmp(argv[i], TEXT("--auth-error="), 13)) {
+			fAuthError = TRUE;
+			continue;
 		}
+		targets[count].Target = argv[i];
+		targets[count++].fAuthError = fAuthError;
+		fAuthError = FALSE;
+	}
 
-		if((dwAuthError == ERROR_SUCCESS) && CredRead(TargetName, CRED_TYPE_GENERIC, 0, &pCredential)) {
-			fwrite(pCredential->CredentialBlob, 1, pCredential->CredentialBlobSize, stdout);
-		} else {
-			fprintf(stderr, "*** %ls not found\n", TargetName);
-			CREDUI_INFO UiInfo = { .cbSize = sizeof(CREDUI_INFO) };
-			UiInfo.pszCaptionText = TEXT("LUKS cryptsetup");
-			//UiInfo.pszMessageText = TEXT("password for ");
-			//TODO:UiInfo.hbmBanner, 320x60 pixels
-
-			ULONG ulAuthPackage;
-			LPVOID pvOutAuthBuffer;
-			ULONG ulOutAuthBufferSize;
-			BOOL fSave = TRUE;
-
-			BYTE *pPackedCredentials = NULL;
-			DWORD cbPackedCredentials = 50;
-			BOOL success = CredPackAuthenticationBuffer(CRED_PACK_GENERIC_CREDENTIALS, TargetName, TEXT(""), pPackedCredentials, &cbPackedCredentials);
-			if(!success && GetLastError() == ERROR_INSUFFICIENT_BUFFER) {
-				pPackedCredentials = malloc(cbPackedCredentials);
-				success = CredPackAuthenticationBuffer(CRED_PACK_GENERIC_CREDENTIALS, TargetName, TEXT(""), pPackedCredentials, &cbPackedCredentials);
-			}
-			if(!success) ReportLastError("CredPackAuthenticationBuffer");
-
-			switch(CredUIPromptForWindowsCredentials(&UiInfo, dwAuthError, &ulAuthPackage,
-			                                         pPackedCredentials, cbPackedCredentials,
-			                                         &pvOutAuthBuffer, &ulOutAuthBufferSize, &fSave, CREDUIWIN_CHECKBOX | CREDUIWIN_GENERIC | CREDUIWIN_IN_CRED_ONLY)) {
-				case ERROR_SUCCESS:
-					LPTSTR pszUsername = NULL;
-					DWORD cchUsername = 0;
-					LPTSTR pszDomainName = NULL;
-					DWORD cchDomainName = 0;
-					LPTSTR pszPassword = NULL;
-					DWORD cchPassword = 0;
-					success = CredUnPackAuthenticationBuffer(0, pvOutAuthBuffer, ulOutAuthBufferSize, pszUsername, &cchUsername, pszDomainName, &cchDomainName, pszPassword, &cchPassword);
-					if(!success && GetLastError() == ERROR_INSUFFICIENT_BUFFER) {
-						pszUsername = calloc(cchUsername, sizeof(TCHAR));
-						pszDomainName = calloc(cchDomainName, sizeof(TCHAR));
-						pszPassword = calloc(cchPassword, sizeof(TCHAR));
-						success = CredUnPackAuthenticationBuffer(0, pvOutAuthBuffer, ulOutAuthBufferSize, pszUsername, &cchUsername, pszDomainName, &cchDomainName, pszPassword, &cchPassword);
-					}
-					if(!success) ReportLastError("CredUnPackAuthenticationBufferW");
-
-					SecureZeroMemory(pvOutAuthBuffer, ulOutAuthBufferSize);
-					CoTaskMemFree(pvOutAuthBuffer);
-
-					BYTE *pu8Password = NULL;
-					int cbu8Password = WideCharToMultiByte(CP_UTF8, WC_ERR_INVALID_CHARS | WC_COMPOSITECHECK, pszPassword, cchPassword, NULL, 0, NULL, NULL);
-					pu8Password = malloc(cbu8Password+1);
-					WideCharToMultiByte(CP_UTF8, WC_ERR_INVALID_CHARS | WC_COMPOSITECHECK, pszPassword, cchPassword, pu8Password, cbu8Password, NULL, NULL);
-					pu8Password[cbu8Password] = '\0';
-
-					SecureZeroMemory(pszPassword, sizeof(TCHAR)*cchPassword);
-					free(pszPassword);
-
-					//_ftprintf(stderr, L"Username = %s, Domain = %s\n", pszUsername, pszDomainName);
-					free(pszDomainName);
-					free(pszUsername);
-
-					fwrite(pu8Password, 1, cbu8Password, stdout);
-
-					if(fSave) {
-						CREDENTIAL cred;
-						cred.Flags = 0;
-						cred.Type = CRED_TYPE_GENERIC;
-						cred.TargetName = TargetName;
-						cred.Comment = TEXT("saved by luks-askpass-wincred");
-						cred.CredentialBlobSize = cbu8Password;
-						cred.CredentialBlob = pu8Password;
-						cred.Persist = CRED_PERSIST_SESSION; //CRED_PERSIST_LOCAL_MACHINE, but I don't want it actually saved
-						cred.AttributeCount = 0;
-						cred.Attributes = NULL;
-						cred.TargetAlias = NULL;
-						cred.UserName = TargetName;
-
-						if(!CredWrite(&cred, 0)) ReportLastError("CredWrite");
-					}
-
-					SecureZeroMemory(pu8Password, cbu8Password);
-					free(pu8Password);
-
-					break;
-				case ERROR_CANCELLED:
-					return 2;
-				default:
-					return 1;
-			}
+	for(int i = 0; i < count; ++i) {
+		struct BatchTarget *target = &targets[i];
+		if(target->fAuthError) continue;
+		TCHAR TargetName[MAX_PATH];
+		_stprintf_s(TargetName, MAX_PATH, TEXT("LUKS\\%s"), target->Target);
+		uint64_t start = TraceNow();
+		target->fStored = ReadStoredPassphrase(TargetName, &target->passphrase, &target->cbPassphrase);
+		if(!target->fStored) continue;
+		target->status = target->passphrase ? ASKPASS_OK : ASKPASS_FAILED;
+		TRACE_END("GetPassphrase", start, "%ls: %d", target->Target, (int)target->status);
+		METRIC_END("askpass.passphrase", start, (int)target->status);
+		WriteRecord(i, target);
+	}
+
+	for(int i = 0; i < count; ++i) {
+		struct BatchTarget *target = &targets[i];
+		if(target->fStored) continue;
+		TCHAR TargetName[MAX_PATH];
+		_stprintf_s(TargetName, MAX_PATH, TEXT("LUKS\\%s"), target->Target);
+		if(!target->fAuthError) fprintf(stderr, "*** %ls not found\n", TargetName);
+		uint64_t start = TraceNow();
+		target->status = PromptPassphrase(TargetName, target->fAuthError ? ERROR_INVALID_PASSWORD : ERROR_SUCCESS,
+		                                  &target->passphrase, &target->cbPassphrase);
+		TRACE_END("GetPassphrase", start, "%ls: %d", target->Target, (int)target->status);
+		METRIC_END(target->fAuthError ? "askpass.retry" : "askpass.passphrase", start, (int)target->status);
+		WriteRecord(i, target);
+	}
+
+	int result = ASKPASS_OK;
+	for(int i = 0; i < count; ++i) {
+		if(targets[i].status != ASKPASS_OK) result = ASKPASS_FAILED;
+	}
+	free(targets);
+	return result;
+}
+
+int _tmain(int argc, LPCTSTR argv[])
+{
+	TraceStart(NULL, "luks-askpass-wincred.exe");
+	MetricsStart(NULL);
+	if(argc >= 3 && !_tcscmp(argv[1], TEXT("--batch"))) return RunBatch(argc - 2, argv + 2);
+
+	if(argc >= 2) {
+		BOOL fAuthError = argc >= 3 && !_tcsncmp(argv[2], TEXT("--auth-error="), 12);
+		BYTE *passphrase = NULL;
+		DWORD cbPassphrase = 0;
+		uint64_t start = TraceNow();
+		enum AskpassStatus status = GetPassphrase(argv[1], fAuthError, &passphrase, &cbPassphrase);
+		TRACE_END("GetPassphrase", start, "%ls: %d", argv[1], (int)status);
+		METRIC_END(fAuthError ? "askpass.retry" : "askpass.passphrase", start, (int)status);
+		if(status == ASKPASS_OK) fwrite(passphrase, 1, cbPassphrase, stdout);
+		if(passphrase) {
+			SecureZeroMemory(passphrase, cbPassphrase);
+			free(passphrase);
 		}
+		return status;
 	} else {
-		fprintf(stderr, "usage: luks-askpass-wincred.exe <TargetName>\n");
+		fprintf(stderr, "usage: luks-askpass-wincred.exe <TargetName>\n"
+		                "       luks-askpass-wincred.exe --batch [--auth-error=1] <TargetName>...\n");
 		return 1;
 	}
 }
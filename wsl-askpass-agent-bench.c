@@ -0,0 +1,242 @@
+//benchmark for wsl-askpass-agent: a burst of systemd password prompts (as when several systemd-cryptsetup@ units start together),
+//answered by one batched askpass, versus the one-askpass-per-prompt of a simple agent (or the keyscript= approach)
+//
+// wsl-askpass-agent-bench [--prompts <n>] [--latency <ms>] [--agent <path>] [--iterations <n>]
+//
+// --latency is how long the stand-in askpass takes to start (a WSL interop spawn of a win32 .exe being far from free),
+// --agent the wsl-askpass-agent to run (by default the one next to this executable)
+// It then checks that a prompt askpass has no passphrase for is only asked about once, however many others come and go
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "Askpass.h"
+#include "Interop.h"
+
+#define DEFAULT_PROMPTS 8
+#define DEFAULT_LATENCY_MS 100
+#define DEFAULT_ITERATIONS 3
+#define REPLY_TIMEOUT_MS 10000
+
+// logs each spawn, then answers "<target>-secret" for each target, in the --batch framing when asked to
+// (except for a target with "nokey" in its name, which has no stored credential and whose dialog is declined)
+static const char standin_askpass[] =
+	"#!/bin/sh\n"
+	"echo \"$$ $*\" >> \"$(dirname \"$0\")/spawns\"\n"
+	"sleep \"$ASKPASS_LATENCY\"\n"
+	"if [ \"$1\" != --batch ]; then printf '%s-secret' \"$1\"; exit 0; fi\n"
+	"shift\n"
+	"for target; do\n"
+	"\tcase \"$target\" in --auth-error=*) continue;; *nokey*) printf '1 0\\n'; continue;; esac\n"
+	"\tprintf '0 %d\\n%s-secret' $(( ${#target} + 7 )) \"$target\"\n"
+	"done\n";
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+// how many askpass runs there were (that asked about target, if not NULL) since the last count
+static unsigned CountSpawns(const char *dir, const char *target)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/spawns", dir);
+	FILE *f = fopen(path, "r");
+	if(!f) return 0;
+	unsigned lines = 0;
+	char line[4096];
+	while(fgets(line, sizeof(line), f)) lines += !target || strstr(line, target);
+	fclose(f);
+	unlink(path);
+	return lines;
+}
+
+// what systemd-cryptsetup does: a datagram socket to be answered on, and an ask.* file (written aside, then renamed into place)
+static int Ask(const char *dir, unsigned i, const char *device)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/sck.%u", dir, i);
+	unlink(addr.sun_path);
+	int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if(fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		fprintf(stderr, "*** %s: %s\n", addr.sun_path, strerror(errno));
+		if(fd >= 0) close(fd);
+		return -1;
+	}
+
+	char tmp[PATH_MAX], ask[PATH_MAX];
+	snprintf(tmp, sizeof(tmp), "%s/tmp.%u", dir, i);
+	snprintf(ask, sizeof(ask), "%s/ask.%u", dir, i);
+	FILE *f = fopen(tmp, "w");
+	if(!f) {
+		close(fd);
+		return -1;
+	}
+	fprintf(f, "[Ask]\nPID=%d\nSocket=%s\nAcceptCached=1\nEcho=0\nNotAfter=0\nId=cryptsetup:%s\nMessage=Please enter passphrase for disk %s\n",
+	        (int)getpid(), addr.sun_path, device, device);
+	fclose(f);
+	rename(tmp, ask);
+	return fd;
+}
+
+// waits for every prompt's answer, checking each is the right one; returns how many were
+static unsigned CollectReplies(const char *dir, const int *fds, unsigned prompts)
+{
+	unsigned correct = 0;
+	for(unsigned i = 0; i < prompts; ++i) {
+		struct pollfd pfd = { .fd = fds[i], .events = POLLIN };
+		char reply[256], expected[64];
+		if(poll(&pfd, 1, REPLY_TIMEOUT_MS) <= 0) {
+			fprintf(stderr, "*** no reply to prompt %u\n", i);
+			continue;
+		}
+		ssize_t length = recv(fds[i], reply, sizeof(reply) - 1, 0);
+		reply[length > 0 ? length : 0] = '\0';
+		snprintf(expected, sizeof(expected), "+/dev/bench%u-secret", i);
+		if(!strcmp(reply, expected)) {
+			++correct;
+		} else {
+			fprintf(stderr, "*** prompt %u answered \"%s\"\n", i, reply);
+		}
+
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s/ask.%u", dir, i);
+		unlink(path);
+	}
+	return correct;
+}
+
+static void Report(const char *name, double ms, unsigned spawns, unsigned correct, unsigned prompts)
+{
+	printf("%-32s %9.1f ms %4u spawns %4u/%u answered\n", name, ms, spawns, correct, prompts);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned prompts = DEFAULT_PROMPTS, latency_ms = DEFAULT_LATENCY_MS, iterations = DEFAULT_ITERATIONS;
+	char agent[PATH_MAX];
+	LocateHelper("wsl-askpass-agent", NULL, agent, sizeof(agent));
+
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "--prompts") && i+1 < argc) {
+			prompts = (unsigned)strtoul(argv[++i], NULL, 0);
+		} else if(!strcmp(argv[i], "--latency") && i+1 < argc) {
+			latency_ms = (unsigned)strtoul(argv[++i], NULL, 0);
+		} else if(!strcmp(argv[i], "--iterations") && i+1 < argc) {
+			iterations = (unsigned)strtoul(argv[++i], NULL, 0);
+		} else if(!strcmp(argv[i], "--agent") && i+1 < argc) {
+			snprintf(agent, sizeof(agent), "%s", argv[++i]);
+		} else {
+			fputs("wsl-askpass-agent-bench [--prompts <n>] [--latency <ms>] [--agent <path>] [--iterations <n>]\n", stderr);
+			return 1;
+		}
+	}
+	if(!prompts) prompts = 1;
+
+	char dir[] = "/tmp/wsl-askpass-agent-bench.XXXXXX";
+	if(!mkdtemp(dir)) {
+		fprintf(stderr, "*** mkdtemp: %s\n", strerror(errno));
+		return 1;
+	}
+	char askpass[PATH_MAX];
+	snprintf(askpass, sizeof(askpass), "%s/askpass", dir);
+	FILE *f = fopen(askpass, "w");
+	if(!f) return 1;
+	fputs(standin_askpass, f);
+	fclose(f);
+	chmod(askpass, 0755);
+	char latency[32];
+	snprintf(latency, sizeof(latency), "%u.%03u", latency_ms / 1000, latency_ms % 1000);
+	setenv("ASKPASS_LATENCY", latency, 1);
+
+	int *fds = calloc(prompts, sizeof(int));
+	struct AskpassRequest *requests = calloc(prompts, sizeof(struct AskpassRequest));
+	char (*targets)[32] = calloc(prompts, sizeof(*targets));
+	if(!fds || !requests || !targets) return 1;
+	for(unsigned i = 0; i < prompts; ++i) snprintf(targets[i], sizeof(targets[i]), "/dev/bench%u", i);
+
+	printf("%u prompts, askpass startup %u ms\n", prompts, latency_ms);
+	for(unsigned iteration = 0; iteration < iterations; ++iteration) {
+		// one askpass per prompt, one after the other (as each systemd-cryptsetup@ unit's keyscript, or a simple agent, would)
+		double start = now_ms();
+		unsigned correct = 0;
+		for(unsigned i = 0; i < prompts; ++i) {
+			requests[i] = (struct AskpassRequest){ .target = targets[i] };
+			RunAskpassBatch(askpass, &requests[i], 1);
+			char expected[64];
+			snprintf(expected, sizeof(expected), "%s-secret", targets[i]);
+			correct += requests[i].status == ASKPASS_OK && !strcmp(requests[i].passphrase, expected);
+		}
+		double elapsed = now_ms() - start;
+		ClearAskpassRequests(requests, prompts);
+		Report("askpass per prompt", elapsed, CountSpawns(dir, NULL), correct, prompts);
+
+		// the agent, answering the burst
+		char *agent_argv[] = { agent, "--dir", dir, "--askpass", askpass, "--crypttab", "/dev/null", NULL };
+		pid_t pid = SpawnHelper(agent, agent_argv, -1, -1);
+		if(pid < 0) return 1;
+		usleep(100 * 1000); // let it get its inotify watch in place, so this measures the watching rather than the startup scan
+
+		start = now_ms();
+		for(unsigned i = 0; i < prompts; ++i) fds[i] = Ask(dir, i, targets[i]);
+		correct = CollectReplies(dir, fds, prompts);
+		elapsed = now_ms() - start;
+		for(unsigned i = 0; i < prompts; ++i) {
+			if(fds[i] >= 0) close(fds[i]);
+		}
+		kill(pid, SIGTERM);
+		WaitHelper(pid);
+		Report("wsl-askpass-agent", elapsed, CountSpawns(dir, NULL), correct, prompts);
+	}
+
+	// a prompt that can't be answered stays put (for another agent), but mustn't go to askpass again with every other one
+	char *agent_argv[] = { agent, "--dir", dir, "--askpass", askpass, "--crypttab", "/dev/null", NULL };
+	pid_t pid = SpawnHelper(agent, agent_argv, -1, -1);
+	if(pid < 0) return 1;
+	usleep(100 * 1000);
+	int unanswerable = Ask(dir, prompts, "/dev/nokey");
+	usleep(100 * 1000 + latency_ms * 1000);
+	// one at a time, each answered before the next, so every one is a separate pass over the directory
+	for(unsigned i = 0; i < prompts; ++i) {
+		fds[i] = Ask(dir, i, targets[i]);
+		usleep((100 + latency_ms) * 1000);
+	}
+	CollectReplies(dir, fds, prompts);
+	for(unsigned i = 0; i < prompts; ++i) {
+		if(fds[i] >= 0) close(fds[i]);
+	}
+	kill(pid, SIGTERM);
+	WaitHelper(pid);
+	unsigned asked = CountSpawns(dir, "nokey");
+	printf("%-32s %4u askpass runs for it, with %u other prompts%s\n", "unanswerable prompt", asked, prompts, asked == 1 ? "" : "  *** MISMATCH: expected 1");
+	if(unanswerable >= 0) close(unanswerable);
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/ask.%u", dir, prompts);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/sck.%u", dir, prompts);
+	unlink(path);
+
+	for(unsigned i = 0; i < prompts; ++i) {
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s/sck.%u", dir, i);
+		unlink(path);
+	}
+	unlink(askpass);
+	rmdir(dir);
+	free(targets);
+	free(requests);
+	free(fds);
+	return asked == 1 ? 0 : 1;
+}
@@ -0,0 +1,317 @@
+//systemd password agent answering LUKS passphrase prompts from the windows credential store (via luks-askpass-wincred.exe)
+// https://systemd.io/PASSWORD_AGENTS/
+//
+// Watches /run/systemd/ask-password with inotify, and when prompts appear, waits a moment for the rest of a burst
+// (e.g. several systemd-cryptsetup@ units starting together at boot) and answers them all with a single
+// luks-askpass-wincred.exe --batch, so one interop spawn (and at most one run of credential dialogs) rather than one per volume.
+// With this running, the stock systemd-cryptsetup-generator units work as-is, without the hand-written ones in the README.
+//
+// wsl-askpass-agent [--dir <ask-password dir>] [--askpass <exe>] [--crypttab <file>] [--settle <ms>] [--query]
+//
+// Only cryptsetup prompts are answered (others are left to other agents). The credential used for each is LUKS\<Volume>,
+// <Volume> being the crypttab name of the device systemd-cryptsetup is asking about.
+// A prompt repeated soon after being answered means the passphrase was wrong, so the retry skips the stored credential.
+// --query answers whatever is already pending and exits, rather than watching for more.
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "Askpass.h"
+#include "Crypttab.h"
+#include "Interop.h"
+
+#define DEFAULT_ASK_DIR "/run/systemd/ask-password"
+#define DEFAULT_SETTLE_MS 50
+#define RETRY_WINDOW_US (60ull * 1000000) // asked again this soon after an answer: that answer was wrong
+
+struct Ask
+{
+	char path[PATH_MAX];
+	char socket[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	char id[256];
+	char target[256];
+	pid_t pid;
+	unsigned long long not_after; // CLOCK_MONOTONIC usec, 0 for never
+};
+
+// what's been answered: sockets (so a prompt isn't answered twice while systemd gets around to removing it),
+// and ids (so a repeated prompt can be recognized as a retry)
+// Prompts askpass had no passphrase for are kept too, so they aren't asked about again on every inotify event,
+// but they don't make the next prompt for that id a retry
+struct Answered
+{
+	char socket[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	char id[256];
+	unsigned long long when;
+	bool failed;
+};
+
+static struct {
+	const char *dir;
+	const char *crypttab;
+	char askpass[PATH_MAX];
+	unsigned settle_ms;
+
+	struct Answered *answered;
+	size_t answered_count;
+} agent = { .dir = DEFAULT_ASK_DIR, .crypttab = DEFAULT_CRYPTTAB, .settle_ms = DEFAULT_SETTLE_MS };
+
+static unsigned long long monotonic_usec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + (unsigned long long)ts.tv_nsec / 1000;
+}
+
+static bool CopyTarget(char *target, size_t size, const char *value)
+{
+	size_t length = strlen(value);
+	if(length >= size) {
+		fprintf(stderr, "*** credential name too long: %s\n", value);
+		return false;
+	}
+	memcpy(target, value, length + 1);
+	return true;
+}
+
+// systemd-cryptsetup asks with Id=cryptsetup:<source device>; the credential is named after the crypttab volume
+// for that device, or failing that (no crypttab entry), just the device
+// (a name that doesn't fit isn't answered, rather than truncated into some other credential's)
+static bool TargetForId(const char *id, char *target, size_t size)
+{
+	if(strncmp(id, "cryptsetup:", 11)) return false;
+	const char *device = id + 11;
+	char device_real[PATH_MAX];
+	bool have_device_real = realpath(device, device_real) != NULL;
+
+	const char *name = device;
+	struct CrypttabEntry *entries;
+	size_t count = ReadCrypttab(agent.crypttab, &entries);
+	for(size_t i = 0; i < count; ++i) {
+		char path[PATH_MAX], path_real[PATH_MAX];
+		CrypttabSourcePath(entries[i].source, path, sizeof(path));
+		if(!strcmp(path, device) || (have_device_real && realpath(path, path_real) && !strcmp(path_real, device_real))) {
+			name = entries[i].name;
+			break;
+		}
+	}
+	bool success = CopyTarget(target, size, name);
+	free(entries);
+	return success;
+}
+
+static bool ReadAsk(const char *name, struct Ask *ask)
+{
+	*ask = (struct Ask){ 0 };
+	snprintf(ask->path, sizeof(ask->path), "%s/%s", agent.dir, name);
+	FILE *f = fopen(ask->path, "re");
+	if(!f) return false;
+
+	char line[1024];
+	bool in_ask = false;
+	while(fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if(line[0] == '[') {
+			in_ask = !strcmp(line, "[Ask]");
+			continue;
+		}
+		char *value = strchr(line, '=');
+		if(!in_ask || !value) continue;
+		*value++ = '\0';
+
+		if(!strcmp(line, "Socket")) snprintf(ask->socket, sizeof(ask->socket), "%s", value);
+		else if(!strcmp(line, "Id")) snprintf(ask->id, sizeof(ask->id), "%s", value);
+		else if(!strcmp(line, "PID")) ask->pid = (pid_t)strtol(value, NULL, 10);
+		else if(!strcmp(line, "NotAfter")) ask->not_after = strtoull(value, NULL, 10);
+	}
+	fclose(f);
+
+	if(!ask->socket[0]) return false;
+	if(ask->not_after && monotonic_usec() > ask->not_after) return false; // expired
+	if(ask->pid > 0 && kill(ask->pid, 0) && errno == ESRCH) return false; // nobody waiting any more
+	return TargetForId(ask->id, ask->target, sizeof(ask->target));
+}
+
+// by socket, any prompt dealt with; by id, only those actually answered
+static struct Answered * FindAnswered(const char *socket, const char *id)
+{
+	for(size_t i = agent.answered_count; i-- > 0;) {
+		struct Answered *answered = &agent.answered[i];
+		if(socket ? !strcmp(answered->socket, socket) : !answered->failed && !strcmp(answered->id, id)) return answered;
+	}
+	return NULL;
+}
+
+static void RememberAnswered(const struct Ask *ask, bool failed)
+{
+	// forget anything old enough not to count as a retry, whose prompt systemd has long since removed
+	unsigned long long now = monotonic_usec();
+	size_t kept = 0;
+	for(size_t i = 0; i < agent.answered_count; ++i) {
+		if(now - agent.answered[i].when < RETRY_WINDOW_US) agent.answered[kept++] = agent.answered[i];
+	}
+	agent.answered_count = kept;
+
+	struct Answered *answered = realloc(agent.answered, (agent.answered_count + 1) * sizeof(struct Answered));
+	if(!answered) return;
+	agent.answered = answered;
+	struct Answered *entry = &agent.answered[agent.answered_count++];
+	snprintf(entry->socket, sizeof(entry->socket), "%s", ask->socket);
+	snprintf(entry->id, sizeof(entry->id), "%s", ask->id);
+	entry->when = now;
+	entry->failed = failed;
+}
+
+// "+<passphrase>" to answer, "-" to cancel
+static void Reply(const struct Ask *ask, const char *reply, size_t length)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", ask->socket);
+	int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if(fd < 0 || sendto(fd, reply, length, MSG_NOSIGNAL, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "*** %s: %s\n", ask->socket, strerror(errno));
+	}
+	if(fd >= 0) close(fd);
+}
+
+struct PendingAsks
+{
+	struct Ask *asks;
+	struct AskpassRequest *requests;
+};
+
+// answers a prompt as soon as askpass has its passphrase, rather than once it has them all
+static void AnswerAsk(struct AskpassRequest *request, void *context)
+{
+	struct PendingAsks *pending = context;
+	struct Ask *ask = &pending->asks[request - pending->requests];
+	if(request->status == ASKPASS_OK) {
+		// the datagram is "+" followed by the passphrase, so build it in one buffer that can be wiped afterwards
+		char *reply = malloc(request->length + 1);
+		if(!reply) return;
+		reply[0] = '+';
+		memcpy(reply + 1, request->passphrase, request->length);
+		Reply(ask, reply, request->length + 1);
+		explicit_bzero(reply, request->length + 1);
+		free(reply);
+	} else if(request->status == ASKPASS_CANCELLED) {
+		Reply(ask, "-", 1);
+	} else {
+		// leave it for another agent (e.g. the tty one) to answer, without asking askpass again each time the directory changes
+		fprintf(stderr, "*** no passphrase for %s\n", ask->target);
+		RememberAnswered(ask, true);
+		return;
+	}
+	RememberAnswered(ask, false);
+	ClearAskpassRequests(request, 1);
+}
+
+static void AnswerPending(void)
+{
+	DIR *dir = opendir(agent.dir);
+	if(!dir) {
+		fprintf(stderr, "*** opendir(%s): %s\n", agent.dir, strerror(errno));
+		return;
+	}
+
+	struct Ask *asks = NULL;
+	size_t count = 0;
+	struct dirent *entry;
+	while((entry = readdir(dir))) {
+		if(strncmp(entry->d_name, "ask.", 4)) continue;
+		struct Ask ask;
+		if(!ReadAsk(entry->d_name, &ask) || FindAnswered(ask.socket, NULL)) continue;
+		struct Ask *grown = realloc(asks, (count + 1) * sizeof(struct Ask));
+		if(!grown) break;
+		asks = grown;
+		asks[count++] = ask;
+	}
+	closedir(dir);
+	if(!count) {
+		free(asks);
+		return;
+	}
+
+	struct AskpassRequest *requests = calloc(count, sizeof(struct AskpassRequest));
+	if(requests) {
+		unsigned long long now = monotonic_usec();
+		for(size_t i = 0; i < count; ++i) {
+			const struct Answered *previous = FindAnswered(NULL, asks[i].id);
+			requests[i].target = asks[i].target;
+			requests[i].auth_error = previous && now - previous->when < RETRY_WINDOW_US;
+		}
+
+		struct PendingAsks pending = { .asks = asks, .requests = requests };
+		StreamAskpassBatch(agent.askpass, requests, count, &AnswerAsk, &pending);
+		ClearAskpassRequests(requests, count);
+		free(requests);
+	}
+	free(asks);
+}
+
+static void DrainEvents(int fd)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while(read(fd, buf, sizeof(buf)) > 0) {}
+}
+
+int main(int argc, char *argv[])
+{
+	bool query = false;
+	LocateHelper("luks-askpass-wincred.exe", NULL, agent.askpass, sizeof(agent.askpass));
+
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "--dir") && i+1 < argc) {
+			agent.dir = argv[++i];
+		} else if(!strcmp(argv[i], "--askpass") && i+1 < argc) {
+			snprintf(agent.askpass, sizeof(agent.askpass), "%s", argv[++i]);
+		} else if(!strcmp(argv[i], "--crypttab") && i+1 < argc) {
+			agent.crypttab = argv[++i];
+		} else if(!strcmp(argv[i], "--settle") && i+1 < argc) {
+			agent.settle_ms = (unsigned)strtoul(argv[++i], NULL, 0);
+		} else if(!strcmp(argv[i], "--query")) {
+			query = true;
+		} else {
+			fputs("wsl-askpass-agent [--dir <ask-password dir>] [--askpass <exe>] [--crypttab <file>] [--settle <ms>] [--query]\n", stderr);
+			return 1;
+		}
+	}
+
+	if(query) {
+		AnswerPending();
+		return 0;
+	}
+
+	int fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if(fd < 0 || inotify_add_watch(fd, agent.dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		fprintf(stderr, "*** inotify %s: %s\n", agent.dir, strerror(errno));
+		return 1;
+	}
+
+	// anything asked before we started watching
+	AnswerPending();
+
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	for(;;) {
+		if(poll(&pfd, 1, -1) < 0) {
+			if(errno == EINTR) continue;
+			fprintf(stderr, "*** poll: %s\n", strerror(errno));
+			return 1;
+		}
+		DrainEvents(fd);
+
+		// give the rest of a burst a chance to arrive, so they all go to the one askpass
+		while(agent.settle_ms && poll(&pfd, 1, (int)agent.settle_ms) > 0) DrainEvents(fd);
+		AnswerPending();
+	}
+}
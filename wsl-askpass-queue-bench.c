@@ -0,0 +1,277 @@
+//benchmark for the askpass queue (see AskpassQueue.h): several volumes asking for their passphrases at once, as
+//wsl-mount-broker's unlock threads do, answered by a stand-in luks-askpass-wincred.exe, three ways:
+// - one askpass per volume, all at once (as the broker used to)
+// - one batch for all of them, each answer handed on only once the whole batch is done (RunAskpassBatch)
+// - the queue: batched, and each answer handed on as soon as its record arrives
+// For each, how many askpasses were spawned, when the first and the last volume had their passphrase, and how many were right.
+// It also checks the framing holds up: records out of order (the stored credentials first) go to the right volumes,
+// a cancelled prompt comes back as cancelled, and when the helper dies partway through a batch, the volumes it did answer
+// keep their passphrases and the rest fail (each answered exactly once).
+//
+// wsl-askpass-queue-bench [--volumes <n>] [--stored <n>] [--latency <ms>] [--prompt <ms>] [--settle <ms>] [--iterations <n>]
+//
+// --stored of the volumes have their credential stored, the rest get a dialog; --latency is how long the stand-in takes to
+// start (a WSL interop spawn of a win32 .exe being far from free), --prompt how long the user takes to answer a dialog
+// (one at a time, however many processes put them up), and --settle the queue's settle_ms (as wsl-mount-broker's, 20)
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "Askpass.h"
+#include "AskpassQueue.h"
+
+#define DEFAULT_VOLUMES 8
+#define DEFAULT_STORED 4
+#define DEFAULT_LATENCY_MS 100
+#define DEFAULT_PROMPT_MS 200
+#define DEFAULT_SETTLE_MS 20
+#define DEFAULT_ITERATIONS 3
+
+// logs each spawn, then answers "<target>-secret" for each target in the --batch framing, as luks-askpass-wincred.exe does:
+// stored* straight away, then the rest in turn, cancel* with a cancelled dialog, crash* by dying, anything else with a dialog
+// (the dialogs of all the stand-ins at once taking turns, as one user can only answer one at a time)
+static const char standin_askpass[] =
+	"#!/bin/sh\n"
+	"dir=\"$(dirname \"$0\")\"\n"
+	"echo \"$$ $*\" >> \"$dir/spawns\"\n"
+	"sleep \"$ASKPASS_LATENCY\"\n"
+	"shift\n"
+	"i=0\n"
+	"for target; do\n"
+	"\tcase \"$target\" in\n"
+	"\t--auth-error=*) continue;;\n"
+	"\tstored*) printf '0 %d %d\\n%s-secret' $(( ${#target} + 7 )) $i \"$target\";;\n"
+	"\tesac\n"
+	"\ti=$((i + 1))\n"
+	"done\n"
+	"i=0\n"
+	"for target; do\n"
+	"\tcase \"$target\" in\n"
+	"\t--auth-error=*) continue;;\n"
+	"\tstored*) ;;\n"
+	"\tcrash*) exit 1;;\n"
+	"\tcancel*) flock \"$dir/dialog\" sleep \"$ASKPASS_PROMPT\"; printf '2 0 %d\\n' $i;;\n"
+	"\t*) flock \"$dir/dialog\" sleep \"$ASKPASS_PROMPT\"; printf '0 %d %d\\n%s-secret' $(( ${#target} + 7 )) $i \"$target\";;\n"
+	"\tesac\n"
+	"\ti=$((i + 1))\n"
+	"done\n";
+
+enum Mode { PER_VOLUME, WHOLE_BATCH, QUEUED };
+
+struct Volume
+{
+	char target[32];
+	struct AskpassRequest request;
+	double answered; // ms after the start
+};
+
+static struct {
+	const char *askpass;
+	struct Volume *volumes;
+	unsigned count;
+	double start;
+	pthread_barrier_t barrier;
+	struct AskpassQueue queue;
+} bench = { .queue = ASKPASS_QUEUE_INITIALIZER };
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static unsigned CountSpawns(const char *dir)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/spawns", dir);
+	FILE *f = fopen(path, "r");
+	if(!f) return 0;
+	unsigned lines = 0;
+	int c;
+	while((c = fgetc(f)) != EOF) lines += c == '\n';
+	fclose(f);
+	unlink(path);
+	return lines;
+}
+
+static void * VolumeThread(void *context)
+{
+	struct Volume *volume = context;
+	pthread_barrier_wait(&bench.barrier);
+	if(volume == &bench.volumes[0]) bench.start = now_ms();
+	volume->request = (struct AskpassRequest){ .target = volume->target };
+	// (the whole-batch mode has the main thread ask for everyone)
+	QueueAskpass(&bench.queue, &volume->request);
+	volume->answered = now_ms() - bench.start;
+	return NULL;
+}
+
+static void * PerVolumeThread(void *context)
+{
+	struct Volume *volume = context;
+	pthread_barrier_wait(&bench.barrier);
+	if(volume == &bench.volumes[0]) bench.start = now_ms();
+	volume->request = (struct AskpassRequest){ .target = volume->target };
+	RunAskpassBatch(bench.askpass, &volume->request, 1);
+	volume->answered = now_ms() - bench.start;
+	return NULL;
+}
+
+static bool Run(enum Mode mode, const char *dir)
+{
+	static const char * const names[] = { "askpass per volume", "one batch, answered at the end", "queued, answered as they come" };
+	pthread_t *threads = calloc(bench.count, sizeof(pthread_t));
+	struct AskpassRequest *requests = calloc(bench.count, sizeof(struct AskpassRequest));
+	if(!threads || !requests) return false;
+
+	if(mode == WHOLE_BATCH) {
+		bench.start = now_ms();
+		for(unsigned i = 0; i < bench.count; ++i) requests[i].target = bench.volumes[i].target;
+		RunAskpassBatch(bench.askpass, requests, bench.count);
+		double done = now_ms() - bench.start;
+		for(unsigned i = 0; i < bench.count; ++i) {
+			bench.volumes[i].request = requests[i];
+			bench.volumes[i].answered = done;
+		}
+	} else {
+		pthread_barrier_init(&bench.barrier, NULL, bench.count);
+		for(unsigned i = 0; i < bench.count; ++i) {
+			pthread_create(&threads[i], NULL, mode == QUEUED ? &VolumeThread : &PerVolumeThread, &bench.volumes[i]);
+		}
+		for(unsigned i = 0; i < bench.count; ++i) pthread_join(threads[i], NULL);
+		pthread_barrier_destroy(&bench.barrier);
+	}
+
+	double first = 0, last = 0;
+	unsigned correct = 0;
+	for(unsigned i = 0; i < bench.count; ++i) {
+		struct Volume *volume = &bench.volumes[i];
+		char expected[64];
+		snprintf(expected, sizeof(expected), "%s-secret", volume->target);
+		correct += volume->request.status == ASKPASS_OK && !strcmp(volume->request.passphrase, expected);
+		if(!i || volume->answered < first) first = volume->answered;
+		if(volume->answered > last) last = volume->answered;
+		ClearAskpassRequests(&volume->request, 1);
+	}
+	printf("%-32s %4u spawns  first %8.1f ms  all %8.1f ms  %u/%u answered\n", names[mode], CountSpawns(dir), first, last, correct, bench.count);
+	if(correct != bench.count) printf("*** MISMATCH: %u of %u volumes got the wrong passphrase, or none\n", bench.count - correct, bench.count);
+	free(requests);
+	free(threads);
+	return correct == bench.count;
+}
+
+static void CountAnswer(struct AskpassRequest *request, void *context)
+{
+	(void)request;
+	++*(unsigned *)context;
+}
+
+// records out of order, a cancelled prompt, and a helper that dies partway through
+static bool CheckFraming(const char *dir)
+{
+	bool correct = true;
+	struct AskpassRequest requests[4] = { { .target = "stored-a" }, { .target = "cancel-b" }, { .target = "crash-c" }, { .target = "stored-d" } };
+	// stored-d is answered before the dialogs, so the crash doesn't take it down
+	static const enum AskpassStatus expected[4] = { ASKPASS_OK, ASKPASS_CANCELLED, ASKPASS_FAILED, ASKPASS_OK };
+	unsigned answers = 0;
+	StreamAskpassBatch(bench.askpass, requests, 4, &CountAnswer, &answers);
+	for(unsigned i = 0; i < 4; ++i) {
+		char secret[64];
+		snprintf(secret, sizeof(secret), "%s-secret", requests[i].target);
+		if(requests[i].status != expected[i] || (expected[i] == ASKPASS_OK ? !requests[i].passphrase || strcmp(requests[i].passphrase, secret) : requests[i].length)) {
+			printf("*** MISMATCH: %s came back %d (%zu bytes), not %d\n", requests[i].target, (int)requests[i].status, requests[i].length, (int)expected[i]);
+			correct = false;
+		}
+	}
+	if(answers != 4) {
+		printf("*** MISMATCH: %u answers for 4 requests\n", answers);
+		correct = false;
+	}
+	ClearAskpassRequests(requests, 4);
+
+	// and through the queue
+	struct AskpassRequest request = { .target = "cancel-e" };
+	QueueAskpass(&bench.queue, &request);
+	if(request.status != ASKPASS_CANCELLED) {
+		printf("*** MISMATCH: queued cancel-e came back %d\n", (int)request.status);
+		correct = false;
+	}
+	CountSpawns(dir);
+	if(correct) printf("framing: out of order, cancelled, crashed partway, and queued cancel all as expected\n");
+	return correct;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned volumes = DEFAULT_VOLUMES, stored = DEFAULT_STORED, latency_ms = DEFAULT_LATENCY_MS, prompt_ms = DEFAULT_PROMPT_MS,
+	         settle_ms = DEFAULT_SETTLE_MS, iterations = DEFAULT_ITERATIONS;
+	for(int i = 1; i < argc; ++i) {
+		unsigned *option = NULL;
+		if(!strcmp(argv[i], "--volumes")) option = &volumes;
+		else if(!strcmp(argv[i], "--stored")) option = &stored;
+		else if(!strcmp(argv[i], "--latency")) option = &latency_ms;
+		else if(!strcmp(argv[i], "--prompt")) option = &prompt_ms;
+		else if(!strcmp(argv[i], "--settle")) option = &settle_ms;
+		else if(!strcmp(argv[i], "--iterations")) option = &iterations;
+		if(!option || i+1 >= argc) {
+			fputs("wsl-askpass-queue-bench [--volumes <n>] [--stored <n>] [--latency <ms>] [--prompt <ms>] [--settle <ms>] [--iterations <n>]\n",
+			      stderr);
+			return 1;
+		}
+		*option = (unsigned)strtoul(argv[++i], NULL, 0);
+	}
+	if(!volumes) volumes = 1;
+	if(stored > volumes) stored = volumes;
+
+	char dir[] = "/tmp/wsl-askpass-queue-bench.XXXXXX";
+	if(!mkdtemp(dir)) {
+		fprintf(stderr, "*** mkdtemp: %s\n", strerror(errno));
+		return 1;
+	}
+	char askpass[PATH_MAX];
+	snprintf(askpass, sizeof(askpass), "%s/askpass", dir);
+	FILE *f = fopen(askpass, "w");
+	if(!f) return 1;
+	fputs(standin_askpass, f);
+	fclose(f);
+	chmod(askpass, 0755);
+	char value[32];
+	snprintf(value, sizeof(value), "%u.%03u", latency_ms / 1000, latency_ms % 1000);
+	setenv("ASKPASS_LATENCY", value, 1);
+	snprintf(value, sizeof(value), "%u.%03u", prompt_ms / 1000, prompt_ms % 1000);
+	setenv("ASKPASS_PROMPT", value, 1);
+	bench.askpass = bench.queue.askpass = askpass;
+	bench.queue.settle_ms = settle_ms;
+
+	bench.count = volumes;
+	bench.volumes = calloc(volumes, sizeof(struct Volume));
+	if(!bench.volumes) return 1;
+	// the prompted ones first, so that the stored ones' answers would wait behind the dialogs if handed on in order
+	for(unsigned i = 0; i < volumes; ++i) {
+		if(i < volumes - stored) snprintf(bench.volumes[i].target, sizeof(bench.volumes[i].target), "prompt%u", i);
+		else snprintf(bench.volumes[i].target, sizeof(bench.volumes[i].target), "stored%u", i);
+	}
+
+	bool correct = CheckFraming(dir);
+	printf("%u volumes (%u stored, %u prompted), askpass startup %u ms, %u ms per dialog, queue settling for %u ms\n", volumes, stored,
+	       volumes - stored, latency_ms, prompt_ms, settle_ms);
+	for(unsigned iteration = 0; iteration < iterations; ++iteration) {
+		correct = Run(PER_VOLUME, dir) && correct;
+		correct = Run(WHOLE_BATCH, dir) && correct;
+		correct = Run(QUEUED, dir) && correct;
+	}
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/dialog", dir);
+	unlink(path);
+	unlink(askpass);
+	rmdir(dir);
+	return correct ? 0 : 1;
+}
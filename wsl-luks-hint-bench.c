@@ -0,0 +1,186 @@
+//benchmark for the keyslot hints (see KeyslotHints.h): two LUKS2 images stored under the same askpass target, each with several
+//keyslots and the passphrase in a different one of them (the last, and the one before), unlocked with --test's passphrase check
+//(so no root needed) three ways:
+// - no hints: every slot before the right one costs a KDF run
+// - hints, first run: nothing known yet, so the same, but the slots are remembered
+// - hints, again (after saving them to a file and loading it back): one KDF run per volume
+// For each, the KDF time per volume and the wall time for both; it also checks that, the second time, each volume went straight
+// to its own slot (which it can't if the hint is kept per target, as the two would overwrite each other's).
+//
+// wsl-luks-hint-bench [--slots <n>] [--kdf-ms <ms>]
+//
+// --slots is how many keyslots each image has (at least 2), --kdf-ms how long each keyslot's KDF is set up to take
+// (the LUKS2 default being 2000, though with the memory capped so that both images' KDFs can run at once anywhere)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "LuksUnlock.h"
+
+#define DEFAULT_SLOTS 4
+#define DEFAULT_KDF_MS 200
+#define IMAGE_SIZE (32 << 20) // room for the LUKS2 header and keyslots
+#define KDF_MEMORY_KB 65536
+#define TARGET "shared"
+#define IMAGES 2
+
+// answers "<target>-secret" for each target, in the --batch framing luks-askpass-wincred.exe uses
+static const char standin_askpass[] =
+	"#!/bin/sh\n"
+	"shift\n"
+	"i=0\n"
+	"for target; do\n"
+	"\tcase \"$target\" in\n"
+	"\t--auth-error=*) continue;;\n"
+	"\tesac\n"
+	"\tprintf '0 %d %d\\n%s-secret' $(( ${#target} + 7 )) $i \"$target\"\n"
+	"\ti=$((i + 1))\n"
+	"done\n";
+
+static bool failed;
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+// a LUKS2 image with slots keyslots, the passphrase for TARGET in secret_slot and decoys in the rest
+static bool MakeImage(const char *path, int slots, int secret_slot, unsigned kdf_ms)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if(fd < 0 || ftruncate(fd, IMAGE_SIZE)) {
+		fprintf(stderr, "*** %s: %s\n", path, strerror(errno));
+		if(fd >= 0) close(fd);
+		return false;
+	}
+	close(fd);
+
+	struct crypt_device *cd;
+	int r = crypt_init(&cd, path);
+	if(r < 0) {
+		fprintf(stderr, "*** %s: %s\n", path, strerror(-r));
+		return false;
+	}
+	struct crypt_pbkdf_type pbkdf = *crypt_get_pbkdf_default(CRYPT_LUKS2);
+	pbkdf.time_ms = kdf_ms;
+	pbkdf.max_memory_kb = KDF_MEMORY_KB;
+	r = crypt_set_pbkdf_type(cd, &pbkdf);
+	if(r >= 0) r = crypt_format(cd, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, 64, NULL);
+	for(int keyslot = 0; r >= 0 && keyslot < slots; ++keyslot) {
+		char passphrase[32];
+		if(keyslot == secret_slot) snprintf(passphrase, sizeof(passphrase), "%s-secret", TARGET);
+		else snprintf(passphrase, sizeof(passphrase), "decoy-%d", keyslot);
+		r = crypt_keyslot_add_by_volume_key(cd, keyslot, NULL, 0, passphrase, strlen(passphrase));
+	}
+	crypt_free(cd);
+	if(r < 0) {
+		fprintf(stderr, "*** formatting %s: %s\n", path, strerror(-r));
+		return false;
+	}
+	return true;
+}
+
+// expect_hinted: each volume should have had a hint, been unlocked with it, and in one attempt
+static void Run(const char *name, struct LuksUnlock *unlock, char images[][PATH_MAX], const int *secret_slots, bool expect_hinted)
+{
+	struct LuksVolume volumes[IMAGES] = { 0 };
+	for(int i = 0; i < IMAGES; ++i) {
+		snprintf(volumes[i].name, sizeof(volumes[i].name), "image%d", i);
+		snprintf(volumes[i].device, sizeof(volumes[i].device), "%s", images[i]);
+		volumes[i].target = TARGET;
+		volumes[i].key_slot = -1;
+		OpenLuksVolume(unlock, &volumes[i]);
+	}
+
+	double start = now_ms();
+	UnlockLuksVolumes(unlock, volumes, IMAGES);
+	double elapsed = now_ms() - start;
+
+	printf("%-24s", name);
+	for(int i = 0; i < IMAGES; ++i) {
+		struct LuksVolume *volume = &volumes[i];
+		printf(" %s: %6.0f ms KDF%s", volume->name, volume->kdf_ms, volume->keyslot == volume->hint ? " (hinted)" : "         ");
+		if(volume->state != LUKS_UNLOCKED || volume->keyslot != secret_slots[i]) {
+			printf("\n*** MISMATCH: %s unlocked with keyslot %d, not %d\n", volume->name, volume->keyslot, secret_slots[i]);
+			failed = true;
+		} else if(expect_hinted && (volume->hint != volume->keyslot || volume->attempts != 1)) {
+			printf("\n*** MISMATCH: %s had hint %d, and took %u attempts\n", volume->name, volume->hint, volume->attempts);
+			failed = true;
+		}
+		CloseLuksVolume(volume);
+	}
+	printf("  %6.0f ms wall\n", elapsed);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned slots = DEFAULT_SLOTS, kdf_ms = DEFAULT_KDF_MS;
+	for(int i = 1; i < argc; ++i) {
+		unsigned *option = NULL;
+		if(!strcmp(argv[i], "--slots")) option = &slots;
+		else if(!strcmp(argv[i], "--kdf-ms")) option = &kdf_ms;
+		if(!option || i+1 >= argc) {
+			fputs("wsl-luks-hint-bench [--slots <n>] [--kdf-ms <ms>]\n", stderr);
+			return 1;
+		}
+		*option = (unsigned)strtoul(argv[++i], NULL, 0);
+	}
+	if(slots < 2) slots = 2;
+	if(slots > (unsigned)crypt_keyslot_max(CRYPT_LUKS2)) slots = (unsigned)crypt_keyslot_max(CRYPT_LUKS2);
+
+	char dir[] = "/tmp/wsl-luks-hint-bench.XXXXXX";
+	if(!mkdtemp(dir)) {
+		fprintf(stderr, "*** mkdtemp: %s\n", strerror(errno));
+		return 1;
+	}
+	char askpass[PATH_MAX], hints_path[PATH_MAX], images[IMAGES][PATH_MAX];
+	snprintf(askpass, sizeof(askpass), "%s/askpass", dir);
+	snprintf(hints_path, sizeof(hints_path), "%s/hints", dir);
+	FILE *f = fopen(askpass, "we");
+	if(!f) return 1;
+	fputs(standin_askpass, f);
+	fclose(f);
+	chmod(askpass, 0755);
+
+	// the same target, the passphrase in a different slot of each
+	int secret_slots[IMAGES];
+	bool made = true;
+	for(int i = 0; i < IMAGES; ++i) {
+		snprintf(images[i], sizeof(images[i]), "%s/image%d.img", dir, i);
+		secret_slots[i] = (int)slots - 1 - i;
+		made = made && MakeImage(images[i], (int)slots, secret_slots[i], kdf_ms);
+	}
+
+	if(made) {
+		printf("%d images under LUKS\\%s, %u keyslots each, the passphrase in slots %d and %d, %u ms per KDF\n", IMAGES, TARGET,
+		       slots, secret_slots[0], secret_slots[1], kdf_ms);
+		struct KeyslotHints hints = { 0 };
+		struct LuksUnlock unlock = { .askpass = askpass, .jobs = IMAGES, .test = true };
+		Run("no hints", &unlock, images, secret_slots, false);
+
+		unlock.hints = &hints;
+		Run("hints, first run", &unlock, images, secret_slots, false);
+		if(!SaveKeyslotHints(&hints, hints_path)) failed = true;
+		FreeKeyslotHints(&hints);
+
+		LoadKeyslotHints(&hints, hints_path);
+		Run("hints, again", &unlock, images, secret_slots, true);
+		FreeKeyslotHints(&hints);
+	} else {
+		failed = true;
+	}
+
+	for(int i = 0; i < IMAGES; ++i) unlink(images[i]);
+	unlink(hints_path);
+	unlink(askpass);
+	rmdir(dir);
+	return failed ? 1 : 0;
+}
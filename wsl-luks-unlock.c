@@ -0,0 +1,152 @@
+//unlocks several LUKS volumes at once, via libcryptsetup, with passphrases from luks-askpass-wincred.exe (see LuksUnlock.h)
+//
+// wsl-luks-unlock [--crypttab <file>] [--askpass <exe>] [--jobs <n>] [--hints <file>|--no-hints] [--test] [--metrics=<file>] <Volume|device>...
+//
+// The KDFs run up to --jobs (by default, the number of cores) at a time; each volume's credential is LUKS\<Volume>,
+// and a crypttab key-slot= restricts it to that keyslot.
+//
+// <Volume> is a crypttab name (only entries with no key file, i.e. "none" or "-"), or a device/image path, named after its basename.
+// --test only checks the passphrases (no device-mapper, so no root needed, and image files work as-is), which makes
+// this its own benchmark: the report is the KDF time per volume, and the wall time for all of them
+// (try --jobs 1, or --no-hints with an image having several keyslots, to compare).
+// Each KDF run and askpass batch is also recorded in the metrics log (--metrics=<file>, see Metrics.h).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "Crypttab.h"
+#include "Interop.h"
+#include "LuksUnlock.h"
+#include "Metrics.h"
+
+static struct {
+	const char *crypttab;
+	char askpass[PATH_MAX];
+	const char *hints_path;
+} options = { .crypttab = DEFAULT_CRYPTTAB };
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static bool SetupVolume(struct LuksVolume *volume, const char *arg, const struct CrypttabEntry *entries, size_t count)
+{
+	const struct CrypttabEntry *entry = FindCrypttabEntry(entries, count, arg);
+	volume->key_slot = -1;
+	if(entry) {
+		if(strcmp(entry->key, "none") && strcmp(entry->key, "-")) {
+			fprintf(stderr, "*** %s has a key file, leaving that to cryptsetup\n", arg);
+			return false;
+		}
+		snprintf(volume->name, sizeof(volume->name), "%s", entry->name);
+		CrypttabSourcePath(entry->source, volume->device, sizeof(volume->device));
+		if(HasCrypttabOption(entry, "readonly") || HasCrypttabOption(entry, "read-only")) volume->flags |= CRYPT_ACTIVATE_READONLY;
+		if(HasCrypttabOption(entry, "discard")) volume->flags |= CRYPT_ACTIVATE_ALLOW_DISCARDS;
+		char key_slot[16];
+		if(GetCrypttabOption(entry, "key-slot", key_slot, sizeof(key_slot))) {
+			char *end;
+			volume->key_slot = (int)strtol(key_slot, &end, 10);
+			if(*end || volume->key_slot < 0) {
+				fprintf(stderr, "*** %s: bad key-slot=%s\n", arg, key_slot);
+				return false;
+			}
+		}
+	} else if(strchr(arg, '/')) {
+		const char *base = strrchr(arg, '/') + 1;
+		snprintf(volume->name, sizeof(volume->name), "%s", base);
+		snprintf(volume->device, sizeof(volume->device), "%s", arg);
+	} else {
+		fprintf(stderr, "*** %s is not in %s\n", arg, options.crypttab);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	struct KeyslotHints hints = { 0 };
+	struct LuksUnlock unlock = { .askpass = options.askpass, .jobs = cores > 0 ? (unsigned)cores : 1 };
+	LocateHelper("luks-askpass-wincred.exe", NULL, options.askpass, sizeof(options.askpass));
+	options.hints_path = DefaultKeyslotHintsPath();
+
+	MetricsArguments(&argc, argv);
+	int i = 1;
+	for(; i < argc && !strncmp(argv[i], "--", 2); ++i) {
+		if(!strcmp(argv[i], "--crypttab") && i+1 < argc) {
+			options.crypttab = argv[++i];
+		} else if(!strcmp(argv[i], "--askpass") && i+1 < argc) {
+			snprintf(options.askpass, sizeof(options.askpass), "%s", argv[++i]);
+		} else if(!strcmp(argv[i], "--jobs") && i+1 < argc) {
+			unlock.jobs = (unsigned)strtoul(argv[++i], NULL, 0);
+			if(!unlock.jobs) unlock.jobs = 1;
+		} else if(!strcmp(argv[i], "--hints") && i+1 < argc) {
+			options.hints_path = argv[++i];
+		} else if(!strcmp(argv[i], "--no-hints")) {
+			options.hints_path = NULL;
+		} else if(!strcmp(argv[i], "--test")) {
+			unlock.test = true;
+		} else {
+			break;
+		}
+	}
+	if(i >= argc || !strncmp(argv[i], "--", 2)) {
+		fputs("wsl-luks-unlock [--crypttab <file>] [--askpass <exe>] [--jobs <n>] [--hints <file>|--no-hints] [--test] [--metrics=<file>] <Volume|device>...\n", stderr);
+		return 1;
+	}
+
+	size_t count = (size_t)(argc - i);
+	struct LuksVolume *volumes = calloc(count, sizeof(struct LuksVolume));
+	struct CrypttabEntry *entries;
+	size_t entry_count = ReadCrypttab(options.crypttab, &entries);
+	if(!volumes) return 1;
+	if(options.hints_path) {
+		LoadKeyslotHints(&hints, options.hints_path);
+		unlock.hints = &hints;
+	}
+	for(size_t v = 0; v < count; ++v) {
+		if(SetupVolume(&volumes[v], argv[i + (int)v], entries, entry_count)) {
+			OpenLuksVolume(&unlock, &volumes[v]);
+		} else {
+			volumes[v].state = LUKS_FAILED;
+		}
+	}
+	free(entries);
+
+	double start = now_ms();
+	UnlockLuksVolumes(&unlock, volumes, count);
+	double elapsed = now_ms() - start;
+	if(options.hints_path) SaveKeyslotHints(&hints, options.hints_path);
+	FreeKeyslotHints(&hints);
+
+	double kdf_ms = 0;
+	size_t unlocked = 0;
+	for(size_t v = 0; v < count; ++v) {
+		struct LuksVolume *volume = &volumes[v];
+		switch(volume->state) {
+			case LUKS_UNLOCKED:
+				printf("%-24s keyslot %d%s, %u attempt(s), %.0f ms KDF\n", volume->name, volume->keyslot,
+				       volume->keyslot == volume->hint ? " (hinted)" : "", volume->attempts, volume->kdf_ms);
+				++unlocked;
+				break;
+			case LUKS_ACTIVE:
+				printf("%-24s already active\n", volume->name);
+				++unlocked;
+				break;
+			default:
+				printf("%-24s FAILED, %u attempt(s), %.0f ms KDF\n", volume->name, volume->attempts, volume->kdf_ms);
+				break;
+		}
+		kdf_ms += volume->kdf_ms;
+		CloseLuksVolume(volume);
+	}
+	printf("%zu/%zu %s in %.0f ms (%.0f ms of KDF, %u jobs), %u askpass spawn(s)\n",
+	       unlocked, count, unlock.test ? "verified" : "unlocked", elapsed, kdf_ms, unlock.jobs, unlock.spawns);
+	free(volumes);
+	return unlocked == count ? 0 : 1;
+}
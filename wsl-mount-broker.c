@@ -0,0 +1,650 @@
+//Resident linux-side broker that attaches, unlocks, and mounts the volumes listed in its config file
+// Replaces the per-volume chain of units in the README (sh -c, wsl-mount-findfs.exe, findfs, luks-askpass-wincred.exe | cryptsetup,
+// mount) with one long-lived process, which keeps what it has resolved in memory and does each step itself:
+// - attach resolves the tag among the disks already attached (in-process, no findfs) and otherwise runs wsl-mount-findfs,
+//   coalescing attaches that arrive while one is already running into a single batch (so a single UAC prompt)
+// - unlock feeds the passphrase from luks-askpass-wincred.exe straight into cryptsetup open, the askpasses of unlocks
+//   that arrive while one is already running going together in the next batch (see AskpassQueue.h)
+// - mount is the mount(2) syscall
+// Requests for different volumes run concurrently, each on its own thread; requests for the same volume queue up.
+//
+// wsl-mount-broker serve [--config <file>] [--socket <path>] [--findfs <exe>] [--askpass <exe>] [--cryptsetup <exe>]
+//                        [--timeout <seconds>] [--dry-mount]
+// wsl-mount-broker [--socket <path>] attach|unlock|mount|teardown <Volume>
+// wsl-mount-broker [--socket <path>] status [<Volume>]
+//
+// Each step implies the ones before it (mount attaches and unlocks as needed); teardown unmounts and closes the LUKS
+// volume, but leaves the disk attached. status reports each volume's state and how long each step took, including
+// cold start (broker start) to mounted.
+//
+// The config file (/etc/wsl-mount-broker.conf) has one volume per line, like a crypttab and fstab entry run together:
+// <Volume> <PARTUUID=...|PTUUID=...|PARTLABEL=...|SERIAL=...|/path> <askpass TargetName, or - if not encrypted> <mount point, or -> <fstype> [<options>]
+//
+// Every step's duration and outcome (each unlock attempt's, too) is also appended to the metrics log (see Metrics.h).
+//
+// The protocol on the socket is a single request line, answered by any number of lines of output and then OK or ERR <reason>.
+// For testing without windows (or root), --findfs/--askpass/--cryptsetup can point at stand-in scripts,
+// and --dry-mount skips the mount/umount syscalls.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "AskpassQueue.h"
+#include "DeviceBackend.h"
+#include "DeviceWait.h"
+#include "Interop.h"
+#include "Metrics.h"
+#include "MountConfig.h"
+
+#define DEFAULT_SOCKET "/run/wsl-mount-broker.sock"
+#define UNLOCK_ATTEMPTS 3
+#define ASKPASS_SETTLE_MS 20 // for the unlocks of volumes attached in one batch to get their askpasses into one too
+
+enum VolumeState {
+	VOLUME_DETACHED,
+	VOLUME_ATTACHED,
+	VOLUME_UNLOCKED,
+	VOLUME_MOUNTED,
+};
+
+static const char * const VolumeStateNames[] = { "detached", "attached", "unlocked", "mounted" };
+
+struct Volume
+{
+	struct MountEntry config;
+
+	pthread_mutex_t lock; // held for the duration of a request on this volume
+	enum VolumeState state;
+	char device[PATH_MAX]; // the attached partition (or source path)
+
+	// seconds (CLOCK_MONOTONIC) when the latest request to bring this volume up arrived, and how long each step took
+	double requested;
+	double attach_time, unlock_time, mount_time;
+	double appear_time; // of attach_time, from wsl --mount returning to the device being there
+	double mounted; // when it was last mounted
+};
+
+static struct {
+	struct Volume *volumes;
+	size_t count;
+
+	char findfs[PATH_MAX];
+	char askpass[PATH_MAX];
+	char cryptsetup[PATH_MAX];
+	unsigned timeout;
+	bool dry_mount;
+	double started;
+
+	struct DeviceBackend *backend;
+	pthread_mutex_t backend_lock; // the linux backend keeps its device list between ListDevices and ProbeDevice
+	struct AskpassQueue askpass_queue;
+} broker = { .timeout = 30, .backend_lock = PTHREAD_MUTEX_INITIALIZER, .askpass_queue = ASKPASS_QUEUE_INITIALIZER };
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// seconds from now() to microseconds
+static void RecordStep(const char *step, double start, int outcome)
+{
+	RecordMetricDuration(step, (uint64_t)((now() - start) * 1e6), outcome);
+}
+
+static void Reply(FILE *client, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vfprintf(client, format, args);
+	va_end(args);
+	fflush(client);
+}
+
+//
+// config
+//
+
+static bool LoadConfig(const char *path)
+{
+	struct MountEntry *entries;
+	size_t count;
+	if(!LoadMountConfig(path, &entries, &count)) return false;
+	broker.volumes = calloc(count ? count : 1, sizeof(struct Volume));
+	if(!broker.volumes) return false;
+	for(size_t i = 0; i < count; ++i) {
+		broker.volumes[i].config = entries[i];
+		pthread_mutex_init(&broker.volumes[i].lock, NULL);
+	}
+	broker.count = count;
+	free(entries); // the strings now belong to the volumes
+	return true;
+}
+
+static struct Volume * FindVolume(const char *name)
+{
+	for(size_t i = 0; i < broker.count; ++i) {
+		if(!strcmp(broker.volumes[i].config.name, name)) return &broker.volumes[i];
+	}
+	return NULL;
+}
+
+//
+// attach
+//
+
+struct FindDeviceContext
+{
+	const struct Tag *tag;
+	char *device;
+	size_t size;
+	bool found;
+};
+
+static bool FindDevice(const struct DiskInfo *disk, void *context)
+{
+	struct FindDeviceContext *find = context;
+	uint32_t PartitionNumber;
+	if(!DiskMatchesTag(disk, find->tag, &PartitionNumber)) return true;
+
+	if(!TagNamesPartition(find->tag)) {
+		snprintf(find->device, find->size, "%s", disk->Drive);
+		find->found = true;
+	} else {
+		find->found = FindPartitionDevice(disk->Drive, PartitionNumber, find->device, find->size);
+	}
+	return false;
+}
+
+static bool ResolveAttached(struct Volume *volume)
+{
+	struct FindDeviceContext find = { .tag = &volume->config.tag, .device = volume->device, .size = sizeof(volume->device) };
+	pthread_mutex_lock(&broker.backend_lock);
+	EnumDisks(broker.backend, &FindDevice, &find);
+	pthread_mutex_unlock(&broker.backend_lock);
+	return find.found;
+}
+
+// attaches requested while wsl-mount-findfs is already running wait for it to finish, and then go together in the next batch
+struct AttachRequest
+{
+	const char *tag;
+	int result;
+	bool reported; // by wsl-mount-findfs, only touched by the thread running the batch
+	bool done; // under attach_queue.lock
+	struct AttachRequest *next;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	struct AttachRequest *pending;
+	bool running;
+} attach_queue = { .lock = PTHREAD_MUTEX_INITIALIZER, .done = PTHREAD_COND_INITIALIZER };
+
+// wsl-mount-findfs --mount <Tag>... --batch --bare, which answers with a line per tag: <Tag> <ExitCode> [...]
+static void RunAttachBatch(struct AttachRequest *batch)
+{
+	size_t count = 0;
+	for(struct AttachRequest *request = batch; request; request = request->next) ++count;
+
+	char **argv = calloc(count + 5, sizeof(char *));
+	int pipefd[2] = { -1, -1 };
+	int status = -1;
+	if(argv && !pipe2(pipefd, O_CLOEXEC)) {
+		size_t argc = 0;
+		argv[argc++] = broker.findfs;
+		argv[argc++] = "--mount";
+		for(struct AttachRequest *request = batch; request; request = request->next) argv[argc++] = (char *)request->tag;
+		argv[argc++] = "--batch";
+		argv[argc++] = "--bare";
+
+		pid_t pid = SpawnHelper(broker.findfs, argv, -1, pipefd[1]);
+		close(pipefd[1]);
+		FILE *output = fdopen(pipefd[0], "r");
+		char line[512];
+		while(output && fgets(line, sizeof(line), output)) {
+			char *space = strchr(line, ' ');
+			if(!space) continue;
+			*space = '\0';
+			for(struct AttachRequest *request = batch; request; request = request->next) {
+				if(!request->reported && !strcmp(request->tag, line)) {
+					request->result = atoi(space + 1);
+					request->reported = true;
+				}
+			}
+		}
+		if(output) fclose(output);
+		else close(pipefd[0]);
+		if(pid > 0) status = WaitHelper(pid);
+	}
+	free(argv);
+
+	// anything it didn't report on gets the overall exit code
+	for(struct AttachRequest *request = batch; request; request = request->next) {
+		if(!request->reported) request->result = status ? status : 1;
+	}
+}
+
+static int QueueAttach(const char *tag)
+{
+	struct AttachRequest request = { .tag = tag };
+
+	pthread_mutex_lock(&attach_queue.lock);
+	request.next = attach_queue.pending;
+	attach_queue.pending = &request;
+	while(!request.done) {
+		if(attach_queue.running) {
+			pthread_cond_wait(&attach_queue.done, &attach_queue.lock);
+			continue;
+		}
+
+		// nobody is running a batch, so this thread runs one for everything that's queued up (including itself)
+		struct AttachRequest *batch = attach_queue.pending;
+		attach_queue.pending = NULL;
+		attach_queue.running = true;
+		pthread_mutex_unlock(&attach_queue.lock);
+
+		RunAttachBatch(batch);
+
+		pthread_mutex_lock(&attach_queue.lock);
+		attach_queue.running = false;
+		for(struct AttachRequest *done = batch; done; done = done->next) done->done = true;
+		pthread_cond_broadcast(&attach_queue.done);
+	}
+	pthread_mutex_unlock(&attach_queue.lock);
+	return request.result;
+}
+
+static bool Attach(struct Volume *volume, FILE *client)
+{
+	if(volume->state >= VOLUME_ATTACHED) return true;
+	double start = now();
+
+	volume->appear_time = 0;
+	if(!volume->config.is_tag) {
+		snprintf(volume->device, sizeof(volume->device), "%s", volume->config.source);
+	} else {
+		// listening from before the first look, so that nothing can appear unnoticed in between
+		struct DeviceWait wait;
+		OpenDeviceWait(&wait, DEFAULT_DEVICE_LINKS);
+		bool found = ResolveAttached(volume);
+		bool queued = !found; // rather than attached already
+		int result = queued ? QueueAttach(volume->config.source) : 0;
+		if(result) {
+			RecordStep("broker.attach", start, result);
+			CloseDeviceWait(&wait);
+			Reply(client, "ERR wsl-mount-findfs --mount %s exited with %d\n", volume->config.source, result);
+			return false;
+		}
+
+		// wsl --mount returns before the disk shows up in the VM, so check again each time a block device does
+		double attached = now();
+		for(double deadline = attached + broker.timeout; !found && now() < deadline;) {
+			DeviceWaitNext(&wait, (int)((deadline - now()) * 1e3) + 1);
+			found = ResolveAttached(volume);
+		}
+		CloseDeviceWait(&wait);
+		if(queued) RecordStep("broker.appear", attached, found ? 0 : ETIMEDOUT);
+		if(!found) {
+			RecordStep("broker.attach", start, ETIMEDOUT);
+			Reply(client, "ERR %s was attached, but did not appear within %u seconds\n", volume->config.source, broker.timeout);
+			return false;
+		}
+		if(queued) volume->appear_time = now() - attached;
+	}
+
+	if(volume->config.is_tag) RecordStep("broker.attach", start, 0);
+	volume->attach_time = now() - start;
+	volume->state = VOLUME_ATTACHED;
+	Reply(client, "%s attached as %s\n", volume->config.name, volume->device);
+	return true;
+}
+
+//
+// unlock
+//
+
+// the passphrase from luks-askpass-wincred.exe --batch [--auth-error=1] <Key> (along with any other volumes' being unlocked
+// at the same time), then cryptsetup open --type luks --key-file=- <Device> <Volume> with it on stdin
+static int RunUnlock(struct Volume *volume, bool retry)
+{
+	char *cryptsetup_argv[] = { broker.cryptsetup, "open", "--type", "luks", "--key-file=-", volume->device, volume->config.name, NULL };
+
+	double start = now();
+	struct AskpassRequest request = { .target = volume->config.key, .auth_error = retry };
+	QueueAskpass(&broker.askpass_queue, &request);
+	int result = request.status;
+	if(request.status == ASKPASS_OK) {
+		// a passphrase fits in a pipe's buffer, so it can all go in before cryptsetup starts
+		int pipefd[2];
+		result = -1;
+		if(!pipe2(pipefd, O_CLOEXEC)) {
+			bool written = write(pipefd[1], request.passphrase, request.length) == (ssize_t)request.length;
+			close(pipefd[1]);
+			pid_t cryptsetup = written ? SpawnHelper(broker.cryptsetup, cryptsetup_argv, pipefd[0], -1) : -1;
+			close(pipefd[0]);
+			if(cryptsetup > 0) result = WaitHelper(cryptsetup);
+		}
+	}
+	ClearAskpassRequests(&request, 1);
+	RecordStep(retry ? "broker.unlock-retry" : "broker.unlock-attempt", start, result);
+	return result;
+}
+
+static bool Unlock(struct Volume *volume, FILE *client)
+{
+	if(volume->state >= VOLUME_UNLOCKED) return true;
+	if(!Attach(volume, client)) return false;
+	double start = now();
+
+	if(volume->config.key) {
+		char mapper[PATH_MAX];
+		snprintf(mapper, sizeof(mapper), "/dev/mapper/%s", volume->config.name);
+		if(access(mapper, F_OK)) {
+			// cryptsetup exits with 2 for a wrong passphrase; ask again, this time without the stored credential
+			int result = RunUnlock(volume, false);
+			for(int attempt = 1; result == 2 && attempt < UNLOCK_ATTEMPTS; ++attempt) result = RunUnlock(volume, true);
+			if(result) {
+				RecordStep("broker.unlock", start, result);
+				Reply(client, "ERR unlocking %s failed (%d)\n", volume->config.name, result);
+				return false;
+			}
+		}
+	}
+
+	if(volume->config.key) RecordStep("broker.unlock", start, 0);
+	volume->unlock_time = now() - start;
+	volume->state = VOLUME_UNLOCKED;
+	Reply(client, "%s unlocked\n", volume->config.name);
+	return true;
+}
+
+//
+// mount
+//
+
+static bool Mount(struct Volume *volume, FILE *client)
+{
+	if(volume->state >= VOLUME_MOUNTED) return true;
+	if(!Unlock(volume, client)) return false;
+	if(!volume->config.target) {
+		Reply(client, "ERR %s has no mount point\n", volume->config.name);
+		return false;
+	}
+	double start = now();
+
+	char source[PATH_MAX];
+	if(volume->config.key) snprintf(source, sizeof(source), "/dev/mapper/%s", volume->config.name);
+	else snprintf(source, sizeof(source), "%s", volume->device);
+
+	char data[1024];
+	unsigned long flags = ParseMountOptions(volume->config.options, data, sizeof(data));
+	if(!broker.dry_mount && !IsMountPoint(volume->config.target) && mount(source, volume->config.target, volume->config.fstype, flags, data)) {
+		int error = errno;
+		RecordStep("broker.mount", start, error);
+		Reply(client, "ERR mount %s %s: %s\n", source, volume->config.target, strerror(error));
+		return false;
+	}
+
+	RecordStep("broker.mount", start, 0);
+	volume->mounted = now();
+	volume->mount_time = volume->mounted - start;
+	volume->state = VOLUME_MOUNTED;
+	Reply(client, "%s mounted on %s\n", volume->config.name, volume->config.target);
+	return true;
+}
+
+static bool Teardown(struct Volume *volume, FILE *client)
+{
+	if(volume->state >= VOLUME_MOUNTED && !broker.dry_mount && umount2(volume->config.target, 0) && errno != EINVAL) {
+		Reply(client, "ERR umount %s: %s\n", volume->config.target, strerror(errno));
+		return false;
+	}
+	if(volume->state >= VOLUME_UNLOCKED && volume->config.key) {
+		char *argv[] = { broker.cryptsetup, "close", volume->config.name, NULL };
+		pid_t pid = SpawnHelper(broker.cryptsetup, argv, -1, -1);
+		int result = pid > 0 ? WaitHelper(pid) : -1;
+		if(result) {
+			volume->state = VOLUME_UNLOCKED;
+			Reply(client, "ERR cryptsetup close %s failed (%d)\n", volume->config.name, result);
+			return false;
+		}
+	}
+	// wsl --unmount would detach the whole disk, which may hold other volumes too, so leave it attached
+	if(volume->state > VOLUME_ATTACHED) volume->state = VOLUME_ATTACHED;
+	Reply(client, "%s torn down\n", volume->config.name);
+	return true;
+}
+
+static void Status(const struct Volume *volume, FILE *client)
+{
+	Reply(client, "%s %s %s attach=%.1fms (appear=%.1fms) unlock=%.1fms mount=%.1fms", volume->config.name, VolumeStateNames[volume->state],
+	      volume->state >= VOLUME_ATTACHED ? volume->device : "-",
+	      volume->attach_time * 1e3, volume->appear_time * 1e3, volume->unlock_time * 1e3, volume->mount_time * 1e3);
+	if(volume->state == VOLUME_MOUNTED) {
+		Reply(client, " requested-to-mounted=%.1fms start-to-mounted=%.1fms",
+		      (volume->mounted - volume->requested) * 1e3, (volume->mounted - broker.started) * 1e3);
+	}
+	Reply(client, "\n");
+}
+
+//
+// server
+//
+
+static void HandleRequest(char *line, FILE *client)
+{
+	char *save;
+	const char *command = strtok_r(line, " \t\r\n", &save);
+	const char *name = strtok_r(NULL, " \t\r\n", &save);
+	if(!command) {
+		Reply(client, "ERR empty request\n");
+		return;
+	}
+
+	if(!strcmp(command, "status") && !name) {
+		for(size_t i = 0; i < broker.count; ++i) {
+			pthread_mutex_lock(&broker.volumes[i].lock);
+			Status(&broker.volumes[i], client);
+			pthread_mutex_unlock(&broker.volumes[i].lock);
+		}
+		Reply(client, "OK\n");
+		return;
+	}
+
+	struct Volume *volume = name ? FindVolume(name) : NULL;
+	if(!volume) {
+		Reply(client, "ERR unknown volume %s\n", name ? name : "(none)");
+		return;
+	}
+
+	pthread_mutex_lock(&volume->lock);
+	if(volume->state < VOLUME_MOUNTED && strcmp(command, "status") && strcmp(command, "teardown")) volume->requested = now();
+	bool success = true;
+	if(!strcmp(command, "attach")) success = Attach(volume, client);
+	else if(!strcmp(command, "unlock")) success = Unlock(volume, client);
+	else if(!strcmp(command, "mount")) success = Mount(volume, client);
+	else if(!strcmp(command, "teardown")) success = Teardown(volume, client);
+	else if(!strcmp(command, "status")) Status(volume, client);
+	else {
+		Reply(client, "ERR unknown request %s\n", command);
+		success = false;
+	}
+	pthread_mutex_unlock(&volume->lock);
+	if(success) Reply(client, "OK\n");
+}
+
+static void * ClientThread(void *context)
+{
+	int fd = (int)(intptr_t)context;
+	FILE *client = fdopen(fd, "r+");
+	if(!client) {
+		close(fd);
+		return NULL;
+	}
+
+	char line[512];
+	if(fgets(line, sizeof(line), client)) HandleRequest(line, client);
+	fclose(client);
+	return NULL;
+}
+
+static volatile sig_atomic_t stopping;
+
+static void OnSignal(int sig)
+{
+	(void)sig;
+	stopping = 1;
+}
+
+static int Serve(const char *socket_path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if(strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "*** socket path too long: %s\n", socket_path);
+		return 1;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	unlink(socket_path);
+	mode_t umask_was = umask(077); // only root may ask for things to be mounted
+	bool bound = listener >= 0 && !bind(listener, (struct sockaddr *)&addr, sizeof(addr)) && !listen(listener, 16);
+	umask(umask_was);
+	if(!bound) {
+		fprintf(stderr, "*** %s: %s\n", socket_path, strerror(errno));
+		return 1;
+	}
+
+	struct sigaction action = { .sa_handler = &OnSignal }; // no SA_RESTART, so accept returns EINTR
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+	signal(SIGPIPE, SIG_IGN); // a client that hangs up early shouldn't take the broker with it
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	while(!stopping) {
+		int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+		if(fd < 0) {
+			if(errno != EINTR) fprintf(stderr, "*** accept: %s\n", strerror(errno));
+			continue;
+		}
+		pthread_t thread;
+		if(pthread_create(&thread, &attr, &ClientThread, (void *)(intptr_t)fd)) close(fd);
+	}
+
+	pthread_attr_destroy(&attr);
+	close(listener);
+	unlink(socket_path);
+	return 0;
+}
+
+static int Request(const char *socket_path, int argc, char *argv[])
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		fprintf(stderr, "*** %s: %s\n", socket_path, strerror(errno));
+		if(fd >= 0) close(fd);
+		return 1;
+	}
+
+	FILE *broker_stream = fdopen(fd, "r+");
+	if(!broker_stream) {
+		fprintf(stderr, "*** %s: %s\n", socket_path, strerror(errno));
+		close(fd);
+		return 1;
+	}
+	for(int i = 0; i < argc; ++i) fprintf(broker_stream, "%s%s", i ? " " : "", argv[i]);
+	fputc('\n', broker_stream);
+	fflush(broker_stream);
+
+	int result = 1;
+	char line[1024];
+	while(fgets(line, sizeof(line), broker_stream)) {
+		if(!strcmp(line, "OK\n")) {
+			result = 0;
+		} else if(!strncmp(line, "ERR ", 4)) {
+			fprintf(stderr, "*** %s", line + 4);
+		} else {
+			fputs(line, stdout);
+		}
+	}
+	fclose(broker_stream);
+	return result;
+}
+
+// options may come before or after serve; returns false if argv[*i] isn't one
+static bool ParseOption(int argc, char *argv[], int *i, const char **socket_path, const char **config)
+{
+	const char *arg = argv[*i];
+	const char *value = *i + 1 < argc ? argv[*i + 1] : NULL;
+	if(!strcmp(arg, "--dry-mount")) {
+		broker.dry_mount = true;
+		return true;
+	}
+	if(!value) return false;
+
+	if(!strcmp(arg, "--socket")) *socket_path = value;
+	else if(!strcmp(arg, "--config")) *config = value;
+	else if(!strcmp(arg, "--findfs")) snprintf(broker.findfs, sizeof(broker.findfs), "%s", value);
+	else if(!strcmp(arg, "--askpass")) snprintf(broker.askpass, sizeof(broker.askpass), "%s", value);
+	else if(!strcmp(arg, "--cryptsetup")) snprintf(broker.cryptsetup, sizeof(broker.cryptsetup), "%s", value);
+	else if(!strcmp(arg, "--timeout")) broker.timeout = (unsigned)strtoul(value, NULL, 0);
+	else return false;
+	++*i;
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *socket_path = DEFAULT_SOCKET;
+	const char *config = DEFAULT_MOUNT_CONFIG;
+	LocateHelper("wsl-mount-findfs", NULL, broker.findfs, sizeof(broker.findfs));
+	LocateHelper("luks-askpass-wincred.exe", NULL, broker.askpass, sizeof(broker.askpass));
+	snprintf(broker.cryptsetup, sizeof(broker.cryptsetup), "cryptsetup");
+
+	int i = 1;
+	bool serve = false;
+	for(; i < argc; ++i) {
+		if(ParseOption(argc, argv, &i, &socket_path, &config)) continue;
+		if(!serve && !strcmp(argv[i], "serve")) {
+			serve = true;
+			continue;
+		}
+		break;
+	}
+
+	if(serve && i == argc) {
+		broker.started = now();
+		broker.askpass_queue.askpass = broker.askpass;
+		broker.askpass_queue.settle_ms = ASKPASS_SETTLE_MS;
+		MetricsStart(NULL);
+		broker.backend = CreateLinuxDeviceBackend();
+		if(!broker.backend || !LoadConfig(config)) return 1;
+		return Serve(socket_path);
+	}
+	if(!serve && i < argc) return Request(socket_path, argc - i, argv + i);
+
+	fputs("wsl-mount-broker serve [--config <file>] [--socket <path>] [--findfs <exe>] [--askpass <exe>] [--cryptsetup <exe>]\n"
+	      "                       [--timeout <seconds>] [--dry-mount]\n"
+	      "wsl-mount-broker [--socket <path>] attach|unlock|mount|teardown <Volume>\n"
+	      "wsl-mount-broker [--socket <path>] status [<Volume>]\n", stderr);
+	return 1;
+}
@@ -0,0 +1,730 @@
+//Benchmarks for the wsl-mount-findfs lookup logic, run against the fake device backend so it works on linux
+// Each scenario reports the wall time per operation (a --list, or a tag lookup) and how many disks had to be probed,
+// which is the number that matters on a real system (each probe being a CreateFile + DeviceIoControl)
+// With --trace=<file>, every enumeration and probe of the runs below is also written out as a trace event
+// (so e.g. --iterations 1 --slow 20000 --workers 4 shows the parallel probes, and the slow disks, on a timeline)
+// --compare <Tag> instead times the real thing, in WSL: the linux-side wsl-mount-findfs looking up an attached disk,
+// against wsl-mount-findfs.exe doing the same through interop
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include "Crc32.h"
+#include "DeviceBackend.h"
+#include "DeviceIndex.h"
+#include "Interop.h"
+#include "PartitionTable.h"
+#include "ResolveCache.h"
+#include "Trace.h"
+
+// set by any check that gets a wrong answer, so the exit status shows it
+static bool failed;
+
+#define COMPARE_RUNS 10
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void Report(const char *scenario, struct FakeDeviceBackend *fake, unsigned iterations, double elapsed, const char *outcome)
+{
+	printf("%-28s %10.2f us/op %8.2f probes/op  %s\n", scenario, elapsed / iterations * 1e6, (double)fake->ProbeCount / iterations, outcome);
+	fake->ProbeCount = 0;
+	fake->ListCount = 0;
+}
+
+static const char * ResultName(enum ResolveResult result)
+{
+	switch(result) {
+		case RESOLVE_NOT_FOUND: return "not found";
+		case RESOLVE_CACHE_HIT: return "cache hit";
+		case RESOLVE_ENUMERATED: return "enumerated";
+	}
+	return "?";
+}
+
+// picks something to look up on the disk at index (or failing that, the nearest one before it that has anything)
+// preferring its last partition; returns the index of the disk it came from, or -1 if there's nothing to look for
+static long PickTag(struct FakeDeviceBackend *fake, size_t index, struct Tag *tag)
+{
+	for(long d = (long)index; d >= 0; --d) {
+		const struct DiskInfo *disk = &fake->disks[d];
+		for(uint32_t p = disk->PartitionCount; p-- > 0;) {
+			if(!IsNullGUID(&disk->PartitionEntry[p].PartitionId)) {
+				*tag = (struct Tag){ .kind = TAG_PARTUUID, .guid = disk->PartitionEntry[p].PartitionId };
+				return d;
+			}
+		}
+		if(disk->PartitionStyle == PARTSTYLE_GPT && !IsNullGUID(&disk->DiskId)) {
+			*tag = (struct Tag){ .kind = TAG_PTUUID, .guid = disk->DiskId };
+			return d;
+		}
+	}
+	return -1;
+}
+
+struct ListContext
+{
+	FILE *out;
+	enum ListFormat format;
+};
+
+static bool PrintPartitionInfoCallback(const struct DiskInfo *disk, void *context)
+{
+	struct ListContext *list = context;
+	PrintDiskRecords(list->out, disk, list->format);
+	return true;
+}
+
+static void BenchList(struct FakeDeviceBackend *fake, unsigned iterations)
+{
+	static const char *scenarios[] = { "--list", "--list=json", "--list=nul" };
+	struct ListContext list = { fopen("/dev/null", "w"), LIST_TEXT };
+	if(!list.out) {
+		perror("/dev/null");
+		return;
+	}
+	setvbuf(list.out, NULL, _IOFBF, 1 << 16);
+
+	for(int s = 0; s < 3; ++s) {
+		ParseListOption(scenarios[s], &list.format);
+		double start = now();
+		for(unsigned i = 0; i < iterations; ++i) EnumDisks(&fake->base, &PrintPartitionInfoCallback, &list);
+		Report(scenarios[s], fake, iterations, now() - start, "");
+	}
+
+	fclose(list.out);
+}
+
+static void BenchCache(struct FakeDeviceBackend *fake, unsigned iterations)
+{
+	struct DeviceBackend *backend = &fake->base;
+	uint32_t DriveNumber, PartitionNumber;
+	enum ResolveResult result = RESOLVE_NOT_FOUND;
+
+	// look for something on the last disk, the worst case for a linear scan
+	struct Tag tag;
+	long target = PickTag(fake, fake->count - 1, &tag);
+	if(target < 0) {
+		puts("(no GUIDs to look up)");
+		return;
+	}
+	// and the disk to trade drive numbers with for the stale case
+	size_t other = target ? 0 : fake->count - 1;
+
+	char cache_path[] = "/tmp/wsl-mount-findfs-bench.XXXXXX";
+	int fd = mkstemp(cache_path);
+	if(fd < 0) {
+		perror("mkstemp");
+		return;
+	}
+	close(fd);
+
+	double start = now();
+	for(unsigned i = 0; i < iterations; ++i) {
+		result = ResolveTag(backend, NULL, &tag, &DriveNumber, &PartitionNumber);
+	}
+	Report("no cache", fake, iterations, now() - start, ResultName(result));
+
+	// populate the file once, then each lookup is load + validate (as each wsl-mount-findfs.exe invocation would be)
+	struct ResolveCache cache;
+	LoadResolveCache(&cache, cache_path);
+	ResolveTag(backend, &cache, &tag, &DriveNumber, &PartitionNumber);
+	SaveResolveCache(&cache, cache_path);
+	FreeResolveCache(&cache);
+	fake->ProbeCount = 0;
+
+	start = now();
+	for(unsigned i = 0; i < iterations; ++i) {
+		LoadResolveCache(&cache, cache_path);
+		result = ResolveTag(backend, &cache, &tag, &DriveNumber, &PartitionNumber);
+		SaveResolveCache(&cache, cache_path);
+		FreeResolveCache(&cache);
+	}
+	Report("cache hit", fake, iterations, now() - start, ResultName(result));
+
+	// renumber the target disk each time, so the cached \\.\PhysicalDrive<n> is always wrong
+	start = now();
+	for(unsigned i = 0; i < iterations; ++i) {
+		int32_t swap = fake->disks[other].DriveNumber;
+		fake->disks[other].DriveNumber = fake->disks[target].DriveNumber;
+		fake->disks[target].DriveNumber = swap;
+
+		LoadResolveCache(&cache, cache_path);
+		result = ResolveTag(backend, &cache, &tag, &DriveNumber, &PartitionNumber);
+		SaveResolveCache(&cache, cache_path);
+		FreeResolveCache(&cache);
+	}
+	Report("cache stale", fake, iterations, now() - start, ResultName(result));
+
+	// a tag that moves to a drive the enumeration gets to before its old one, so that it stops before seeing that again:
+	// unless the probe that found the old drive stale replaced its entries, the tag is cached at both and never hits again
+	struct Tag early;
+	size_t last = fake->count - 1;
+	if(last && PickTag(fake, 0, &early) == 0) {
+		struct ResolveCache moved = { 0 };
+		ResolveTag(backend, &moved, &early, &DriveNumber, &PartitionNumber);
+		int32_t swap = fake->disks[last].DriveNumber;
+		fake->disks[last].DriveNumber = fake->disks[0].DriveNumber;
+		fake->disks[0].DriveNumber = swap;
+		ResolveTag(backend, &moved, &early, &DriveNumber, &PartitionNumber);
+		fake->ProbeCount = 0;
+		start = now();
+		result = ResolveTag(backend, &moved, &early, &DriveNumber, &PartitionNumber);
+		bool hit = result == RESOLVE_CACHE_HIT && DriveNumber == (uint32_t)fake->disks[0].DriveNumber;
+		Report("cache stale, then again", fake, 1, now() - start, hit ? "cache hit" : "*** MISMATCH: not a cache hit");
+		failed = failed || !hit;
+		fake->disks[0].DriveNumber = fake->disks[last].DriveNumber;
+		fake->disks[last].DriveNumber = swap;
+		FreeResolveCache(&moved);
+	}
+
+	struct Tag missing = { .kind = TAG_PARTUUID, .guid = { 0xdeadbeef, 1, 2, { 3, 4, 5, 6, 7, 8, 9, 10 } } };
+	start = now();
+	for(unsigned i = 0; i < iterations; ++i) {
+		LoadResolveCache(&cache, cache_path);
+		result = ResolveTag(backend, &cache, &missing, &DriveNumber, &PartitionNumber);
+		SaveResolveCache(&cache, cache_path);
+		FreeResolveCache(&cache);
+	}
+	Report("cache miss", fake, iterations, now() - start, ResultName(result));
+
+	remove(cache_path);
+}
+
+static bool NeverStop(const struct DiskInfo *disk, void *context)
+{
+	(void)disk;
+	(void)context;
+	return true;
+}
+
+// the disks a full scan saw, checked against the order they were listed in
+struct OrderCheck
+{
+	struct FakeDeviceBackend *fake;
+	size_t next;
+	bool in_order;
+};
+
+static bool CheckOrder(const struct DiskInfo *disk, void *context)
+{
+	struct OrderCheck *check = context;
+	if(check->next >= check->fake->count || strcmp(disk->DevicePath, check->fake->disks[check->next].DevicePath)) check->in_order = false;
+	++check->next;
+	return true;
+}
+
+static void BenchProbe(struct FakeDeviceBackend *fake, unsigned iterations, unsigned workers)
+{
+	struct DeviceBackend *backend = &fake->base;
+	uint32_t DriveNumber, PartitionNumber;
+	enum ResolveResult result = RESOLVE_NOT_FOUND;
+
+	backend->ProbeWorkers = 0;
+	double start = now();
+	for(unsigned i = 0; i < iterations; ++i) EnumDisks(backend, &NeverStop, NULL);
+	Report("serial, full scan", fake, iterations, now() - start, "(every disk)");
+
+	// the target is halfway through, so stopping early can skip about half the disks
+	struct Tag tag;
+	if(PickTag(fake, fake->count / 2, &tag) < 0) return;
+
+	start = now();
+	for(unsigned i = 0; i < iterations; ++i) {
+		result = ResolveTag(backend, NULL, &tag, &DriveNumber, &PartitionNumber);
+	}
+	Report("serial, early exit", fake, iterations, now() - start, ResultName(result));
+
+	char scenario[64];
+	snprintf(scenario, sizeof(scenario), "parallel x%u, full scan", workers);
+	backend->ProbeWorkers = workers;
+	struct OrderCheck check = { fake, 0, true };
+	start = now();
+	for(unsigned i = 0; i < iterations; ++i) {
+		check.next = 0;
+		EnumDisks(backend, &CheckOrder, &check);
+		if(check.next != fake->count) check.in_order = false;
+	}
+	if(!check.in_order) failed = true;
+	Report(scenario, fake, iterations, now() - start, check.in_order ? "(every disk, in list order)" : "*** MISMATCH: out of list order");
+
+	snprintf(scenario, sizeof(scenario), "parallel x%u, early exit", workers);
+	start = now();
+	for(unsigned i = 0; i < iterations; ++i) {
+		result = ResolveTag(backend, NULL, &tag, &DriveNumber, &PartitionNumber);
+	}
+	Report(scenario, fake, iterations, now() - start, ResultName(result));
+	backend->ProbeWorkers = 0;
+}
+
+// the textbook bit-at-a-time CRC, to check crc32_ieee against and to show what slicing-by-8 buys
+static uint32_t crc32_bitwise(const uint8_t *p, size_t len)
+{
+	uint32_t crc = ~0u;
+	while(len--) {
+		crc ^= *p++;
+		for(int bit = 0; bit < 8; ++bit) crc = crc >> 1 ^ (crc & 1 ? 0xEDB88320u : 0);
+	}
+	return ~crc;
+}
+
+static void BenchCrc(unsigned iterations)
+{
+	// the size of a standard GPT entry array, the most any one disk needs checked
+	static uint8_t buf[128 * 128];
+	for(size_t i = 0; i < sizeof(buf); ++i) buf[i] = (uint8_t)(i * 2654435761u >> 24);
+
+	uint32_t expected = crc32_bitwise(buf, sizeof(buf));
+	bool match = crc32_ieee(0, buf, sizeof(buf)) == expected;
+	if(!match) failed = true;
+
+	// the first byte changes every time and each result goes to the sink, so neither loop can be hoisted or dropped
+	volatile uint32_t sink = 0;
+	double start = now();
+	for(unsigned i = 0; i < iterations; ++i) {
+		buf[0] = (uint8_t)i;
+		sink = crc32_ieee(0, buf, sizeof(buf));
+	}
+	double elapsed = now() - start;
+	printf("%-28s %10.2f MB/s%s\n", "crc32 (slicing-by-8)", (double)sizeof(buf) * iterations / elapsed / 1e6, match ? "" : "  *** MISMATCH");
+
+	start = now();
+	for(unsigned i = 0; i < iterations; ++i) {
+		buf[0] = (uint8_t)i;
+		sink = crc32_bitwise(buf, sizeof(buf));
+	}
+	elapsed = now() - start;
+	(void)sink;
+	printf("%-28s %10.2f MB/s\n", "crc32 (bitwise)", (double)sizeof(buf) * iterations / elapsed / 1e6);
+}
+
+// what parse_guid/format_guid used to be, to check the table-driven ones against and to show what they buy
+static bool parse_guid_sscanf(const char *str, GUID *guid)
+{
+	unsigned int Data1, Data2, Data3, Data4[8];
+	int consumed = 0;
+	if(sscanf(str, "%8x-%4x-%4x-%2x%2x-%2x%2x%2x%2x%2x%2x%n",
+	          &Data1, &Data2, &Data3,
+	          &Data4[0], &Data4[1], &Data4[2], &Data4[3], &Data4[4], &Data4[5], &Data4[6], &Data4[7], &consumed) != 11 || consumed != 36) {
+		return false;
+	}
+
+	guid->Data1 = Data1;
+	guid->Data2 = (uint16_t)Data2;
+	guid->Data3 = (uint16_t)Data3;
+	for(int i = 0; i < 8; ++i) guid->Data4[i] = (uint8_t)Data4[i];
+	return true;
+}
+
+static const char * format_guid_snprintf(GUIDSTR buf, const GUID *guid)
+{
+	snprintf(buf, sizeof(GUIDSTR), "%08lx-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+	         (unsigned long)guid->Data1, guid->Data2, guid->Data3,
+	         guid->Data4[0], guid->Data4[1], guid->Data4[2], guid->Data4[3], guid->Data4[4], guid->Data4[5], guid->Data4[6], guid->Data4[7]);
+	return buf;
+}
+
+// round trips random GUIDs through both codecs (and upper case through both parsers, and malformed strings),
+// then times each
+static void BenchGuid(unsigned iterations)
+{
+	enum { SAMPLES = 256 };
+	static GUID guids[SAMPLES];
+	static GUIDSTR strs[SAMPLES];
+	uint64_t x = 0x9E3779B97F4A7C15u;
+	size_t mismatches = 0;
+	for(size_t i = 0; i < SAMPLES; ++i) {
+		uint8_t *bytes = (uint8_t *)&guids[i];
+		for(size_t b = 0; b < sizeof(GUID); ++b) {
+			x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+			bytes[b] = (uint8_t)x;
+		}
+
+		GUIDSTR reference, upper;
+		GUID parsed, reference_parsed;
+		format_guid(strs[i], &guids[i]);
+		format_guid_snprintf(reference, &guids[i]);
+		for(int c = 0; c < 37; ++c) upper[c] = (char)(reference[c] >= 'a' && reference[c] <= 'f' ? reference[c] - 'a' + 'A' : reference[c]);
+		if(strcmp(strs[i], reference)) ++mismatches;
+		if(!parse_guid(strs[i], &parsed) || !IsEqualGUID(&parsed, &guids[i])) ++mismatches;
+		if(!parse_guid(upper, &parsed) || !parse_guid_sscanf(upper, &reference_parsed) || !IsEqualGUID(&parsed, &reference_parsed)) ++mismatches;
+	}
+
+	static const char *malformed[] = {
+		"", "0", "12345678-1234-1234-1234-12345678901", "12345678-1234-1234-1234-12345678901g",
+		"12345678+1234-1234-1234-123456789012", "12345678-1234-1234-12341234567890-12", "1234567g-1234-1234-1234-123456789012",
+		"{2345678-1234-1234-1234-123456789012", " 2345678-1234-1234-1234-123456789012",
+	};
+	for(size_t i = 0; i < sizeof(malformed) / sizeof(*malformed); ++i) {
+		GUID parsed;
+		if(parse_guid(malformed[i], &parsed)) ++mismatches; // (sscanf's %x let some of these through, skipping whitespace)
+	}
+	if(mismatches) failed = true;
+
+	unsigned rounds = iterations / 10 + 1;
+	volatile uint32_t sink = 0;
+	double elapsed[4];
+	for(int variant = 0; variant < 4; ++variant) {
+		double start = now();
+		for(unsigned r = 0; r < rounds; ++r) {
+			for(size_t i = 0; i < SAMPLES; ++i) {
+				GUIDSTR buf;
+				GUID parsed;
+				switch(variant) {
+					case 0: sink += (uint8_t)format_guid(buf, &guids[i])[35]; break;
+					case 1: sink += (uint8_t)format_guid_snprintf(buf, &guids[i])[35]; break;
+					case 2: sink += parse_guid(strs[i], &parsed) ? parsed.Data1 : 0; break;
+					case 3: sink += parse_guid_sscanf(strs[i], &parsed) ? parsed.Data1 : 0; break;
+				}
+			}
+		}
+		elapsed[variant] = (now() - start) / ((double)rounds * SAMPLES) * 1e9;
+	}
+	printf("%-28s %10.2f ns/guid%s\n", "format_guid (table)", elapsed[0], mismatches ? "  *** MISMATCH with sscanf/snprintf" : "");
+	printf("%-28s %10.2f ns/guid\n", "format_guid (snprintf)", elapsed[1]);
+	printf("%-28s %10.2f ns/guid\n", "parse_guid (table)", elapsed[2]);
+	printf("%-28s %10.2f ns/guid\n", "parse_guid (sscanf)", elapsed[3]);
+}
+
+// the identifiers of every disk and partition, of every kind, spread evenly over the disks (at most max of them)
+static size_t SampleTags(struct FakeDeviceBackend *fake, struct Tag *tags, size_t max)
+{
+	size_t total = 0;
+	for(size_t d = 0; d < fake->count; ++d) total += 3 + 3 * (size_t)fake->disks[d].PartitionCount;
+	size_t stride = total / max + 1, n = 0, i = 0;
+
+	for(size_t d = 0; d < fake->count && n < max; ++d) {
+		const struct DiskInfo *disk = &fake->disks[d];
+		for(uint32_t k = 0; k < 3 + 3 * disk->PartitionCount && n < max; ++k, ++i) {
+			if(i % stride) continue;
+			const struct PartitionInfo *partition = k < 3 ? NULL : &disk->PartitionEntry[(k - 3) / 3];
+			struct Tag *tag = &tags[n++];
+			*tag = (struct Tag){ 0 };
+			switch(k < 3 ? k : 3 + (k - 3) % 3) {
+				case 0: *tag = (struct Tag){ .kind = TAG_PTUUID, .guid = disk->DiskId }; break;
+				case 1: tag->kind = TAG_SERIAL; memcpy(tag->value, disk->SerialNumber, sizeof(disk->SerialNumber)); break;
+				case 2: tag->kind = TAG_MODEL; memcpy(tag->value, disk->Model, sizeof(disk->Model)); break;
+				case 3: *tag = (struct Tag){ .kind = TAG_PARTUUID, .guid = partition->PartitionId }; break;
+				case 4: *tag = (struct Tag){ .kind = TAG_PARTTYPE, .guid = partition->PartitionType }; break;
+				case 5: tag->kind = TAG_PARTLABEL; memcpy(tag->value, partition->Name, sizeof(partition->Name)); break;
+			}
+		}
+	}
+	// and one that isn't there
+	if(n < max) tags[n++] = (struct Tag){ .kind = TAG_SERIAL, .value = "NO SUCH DISK" };
+	return n;
+}
+
+// what every lookup used to be: DiskMatchesTag against each disk in turn
+static const struct DiskInfo * FindLinear(struct FakeDeviceBackend *fake, const struct Tag *tag, uint32_t *PartitionNumber)
+{
+	for(size_t d = 0; d < fake->count; ++d) {
+		if(DiskMatchesTag(&fake->disks[d], tag, PartitionNumber)) return &fake->disks[d];
+	}
+	return NULL;
+}
+
+// building the DeviceIndex, and looking tags up in it versus scanning the disks, checking both give the same answers
+// (every kind of tag, including the ambiguous ones, where both must pick the first disk/partition)
+static void BenchIndex(struct FakeDeviceBackend *fake, unsigned iterations)
+{
+	enum { MAX_SAMPLES = 512 };
+	static struct Tag tags[MAX_SAMPLES];
+	size_t count = SampleTags(fake, tags, MAX_SAMPLES);
+	struct DeviceBackend *backend = &fake->base;
+	unsigned workers = backend->ProbeWorkers;
+	backend->ProbeWorkers = 0; // (the index is built the same either way, but serially is what's being timed)
+
+	struct DeviceIndex index = { 0 };
+	double start = now();
+	for(unsigned i = 0; i < iterations; ++i) {
+		FreeDeviceIndex(&index);
+		BuildDeviceIndex(&index, backend);
+	}
+	char outcome[64];
+	snprintf(outcome, sizeof(outcome), "%zu identifiers", index.entry_count);
+	Report("index build", fake, iterations, now() - start, outcome);
+
+	size_t mismatches = 0, found = 0;
+	for(size_t t = 0; t < count; ++t) {
+		uint32_t linear_partition = 0, indexed_partition = 0;
+		const struct DiskInfo *linear = FindLinear(fake, &tags[t], &linear_partition);
+		const struct DiskInfo *indexed = DeviceIndexFind(&index, &tags[t], &indexed_partition);
+		found += linear != NULL;
+		if(!linear != !indexed || (linear && (linear->DriveNumber != indexed->DriveNumber || linear_partition != indexed_partition))) ++mismatches;
+	}
+
+	// and through a cache that has seen every disk, which mustn't resolve a duplicated tag anywhere else either
+	// (refilled for each tag, as a miss enumerates and reorders it)
+	struct ResolveCache cache = { 0 };
+	size_t cache_mismatches = 0;
+	for(size_t t = 0; t < count; ++t) {
+		for(size_t d = 0; d < fake->count; ++d) ResolveCacheRecordDisk(&cache, &fake->disks[d]);
+		uint32_t linear_partition = 0, DriveNumber = 0, PartitionNumber = 0;
+		const struct DiskInfo *linear = FindLinear(fake, &tags[t], &linear_partition);
+		enum ResolveResult result = ResolveTag(backend, &cache, &tags[t], &DriveNumber, &PartitionNumber);
+		if(!linear != (result == RESOLVE_NOT_FOUND) || (linear && ((uint32_t)linear->DriveNumber != DriveNumber || linear_partition != PartitionNumber))) ++cache_mismatches;
+	}
+	FreeResolveCache(&cache);
+	if(mismatches || cache_mismatches) failed = true;
+
+	unsigned rounds = iterations / 10 + 1;
+	volatile uintptr_t sink = 0;
+	start = now();
+	for(unsigned i = 0; i < rounds; ++i) {
+		for(size_t t = 0; t < count; ++t) {
+			uint32_t PartitionNumber;
+			sink += (uintptr_t)FindLinear(fake, &tags[t], &PartitionNumber);
+		}
+	}
+	double linear_elapsed = now() - start;
+
+	start = now();
+	for(unsigned i = 0; i < iterations; ++i) {
+		for(size_t t = 0; t < count; ++t) {
+			uint32_t PartitionNumber;
+			sink += (uintptr_t)DeviceIndexFind(&index, &tags[t], &PartitionNumber);
+		}
+	}
+	double indexed_elapsed = now() - start;
+	printf("%-28s %10.2f us/lookup\n", "lookup, scanning disks", linear_elapsed / ((double)rounds * count) * 1e6);
+	printf("%-28s %10.2f us/lookup  %zu/%zu tags found, %s\n", "lookup, index", indexed_elapsed / ((double)iterations * count) * 1e6,
+	       found, count, mismatches ? "*** MISMATCH with the scan" : "same answers as the scan");
+	printf("%-28s %10s %s\n", "lookup, cache", "", cache_mismatches ? "*** MISMATCH with the scan" : "same answers as the scan");
+
+	FreeDeviceIndex(&index);
+	backend->ProbeWorkers = workers;
+	fake->ProbeCount = 0;
+	fake->ListCount = 0;
+}
+
+// what a trace point costs, disabled (as in every normal run) and, when tracing, enabled
+static void BenchTrace(unsigned iterations)
+{
+	FILE *traced = trace_file;
+	volatile uint64_t sink = 0;
+	unsigned points = iterations * 1000;
+
+	trace_file = NULL;
+	double start = now();
+	for(unsigned i = 0; i < points; ++i) {
+		uint64_t begin = TRACE_BEGIN();
+		sink += begin;
+		TRACE_END("BenchTrace", begin, "%u", i);
+	}
+	printf("%-28s %10.2f ns/point\n", "trace point (disabled)", (now() - start) / points * 1e9);
+
+	trace_file = traced;
+	if(!trace_file) return;
+	start = now();
+	for(unsigned i = 0; i < iterations; ++i) {
+		uint64_t begin = TRACE_BEGIN();
+		TRACE_END("BenchTrace", begin, "%u", i);
+	}
+	printf("%-28s %10.2f us/point\n", "trace point (enabled)", (now() - start) / iterations * 1e6);
+}
+
+// what linux-side --list does per disk: open, read and check the partition table, close
+static void BenchParse(char **images, size_t count, unsigned iterations, uint32_t sector_size)
+{
+	size_t failures = 0;
+	double start = now();
+	for(unsigned i = 0; i < iterations; ++i) {
+		for(size_t j = 0; j < count; ++j) {
+			int fd = open(images[j], O_RDONLY | O_CLOEXEC);
+			struct DiskInfo disk = { 0 };
+			disk.Drive = images[j];
+			if(fd < 0 || !ReadPartitionTableFd(fd, sector_size, &disk)) ++failures;
+			if(fd >= 0) close(fd);
+			disk.Drive = NULL; // not ours to free
+			FreeDiskInfo(&disk);
+		}
+	}
+	double elapsed = now() - start;
+	printf("%-28s %10.2f us/image %8.0f images/s%s\n", "parse images", elapsed / (iterations * count) * 1e6, iterations * count / elapsed,
+	       failures ? "  (some could not be read)" : "");
+}
+
+static int CompareTimes(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// runs the helper once more with its stdout captured, leaving its answer less the device, which each side names its own way
+// (/dev/sdX against \\.\PhysicalDrive<n>): "" for a whole disk, or " --partition <n>"; false if it failed
+static bool CaptureAnswer(const char *exe, char *const argv[], char *answer, size_t size)
+{
+	int pipefd[2];
+	if(pipe2(pipefd, O_CLOEXEC)) return false;
+	pid_t pid = SpawnHelper(exe, argv, -1, pipefd[1]);
+	close(pipefd[1]);
+	char output[PATH_MAX + 64];
+	size_t length = 0;
+	ssize_t r;
+	while(pid >= 0 && (r = read(pipefd[0], output + length, sizeof(output) - 1 - length)) > 0) length += (size_t)r;
+	close(pipefd[0]);
+	if(pid < 0 || WaitHelper(pid) != 0) return false;
+	output[length] = 0;
+	output[strcspn(output, "\n")] = 0;
+	const char *rest = strchr(output, ' ');
+	snprintf(answer, size, "%s", rest ? rest : "");
+	return length > 0;
+}
+
+// each helper run COMPARE_RUNS times for the one tag, its output thrown away, then once more to compare their answers;
+// the linux side only answers by itself for a disk that's attached (otherwise it execs the .exe too, so takes longer than
+// the .exe alone). Either failing, or the two disagreeing on the partition, fails the bench.
+static void BenchCompare(const char *tag)
+{
+	static const char *helpers[][2] = {
+		{ "wsl-mount-findfs.exe", "WSL_MOUNT_FINDFS_EXE" },
+		{ "wsl-mount-findfs", NULL },
+	};
+	char answers[sizeof(helpers) / sizeof(*helpers)][64];
+	int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	printf("%s, %d runs each\n", tag, COMPARE_RUNS);
+	fflush(stdout);
+	for(size_t h = 0; h < sizeof(helpers) / sizeof(*helpers); ++h) {
+		char exe[PATH_MAX];
+		LocateHelper(helpers[h][0], helpers[h][1], exe, sizeof(exe));
+		char *argv[] = { exe, (char *)tag, NULL };
+		double times[COMPARE_RUNS];
+		int status = -1;
+		unsigned runs = 0;
+		for(; runs < COMPARE_RUNS; ++runs) {
+			double start = now();
+			pid_t pid = SpawnHelper(exe, argv, -1, null_fd);
+			if(pid < 0) break; // (having said why)
+			status = WaitHelper(pid);
+			times[runs] = now() - start;
+			if(status) {
+				++runs;
+				break;
+			}
+		}
+		if(!runs) {
+			printf("*** MISMATCH: %s could not be run\n", helpers[h][0]);
+			failed = true;
+			continue;
+		}
+		qsort(times, runs, sizeof(*times), &CompareTimes);
+		printf("%-28s %10.2f ms median %8.2f ms fastest  exit status %d\n", helpers[h][0], times[runs / 2] * 1e3, times[0] * 1e3, status);
+		if(status) {
+			printf("*** MISMATCH: %s failed\n", helpers[h][0]);
+			failed = true;
+		} else if(!CaptureAnswer(exe, argv, answers[h], sizeof(answers[h]))) {
+			printf("*** MISMATCH: %s gave no answer\n", helpers[h][0]);
+			failed = true;
+		}
+	}
+	if(!failed && strcmp(answers[0], answers[1])) {
+		printf("*** MISMATCH: %s answered \"%s\", %s \"%s\"\n", helpers[0][0], answers[0], helpers[1][0], answers[1]);
+		failed = true;
+	}
+	if(null_fd >= 0) close(null_fd);
+}
+
+static void Usage(void)
+{
+	fputs("wsl-mount-findfs-bench [--disks <n>] [--partitions <n>] [--layout <description>] [--image <file>]...\n"
+	      "                       [--sector-size <bytes>] [--iterations <n>] [--latency <us>] [--slow <us>] [--workers <n>] [--trace=<file>]\n"
+	      "wsl-mount-findfs-bench --compare <Tag>\n"
+	      "  --disks, --partitions   GPT disks to simulate, if no --layout or --image is given (default 16 x 8)\n"
+	      "  --layout    disks to simulate, e.g. 900:gpt:128,100:mbr:4 (<disks>:<gpt|mbr|raw>:<partitions>,...)\n"
+	      "  --image     a raw disk image to read a layout from (may be repeated, and combined with --layout);\n"
+	      "              also times reading each one's partition table, as the linux side does for attached disks\n"
+	      "  --latency   simulated time to open and query each disk\n"
+	      "  --slow      simulated time for every 4th disk instead (e.g. a spun-down USB drive)\n"
+	      "  --trace     write each enumeration and probe as a Chrome trace event (see Trace.h)\n"
+	      "  --compare   times looking an attached disk's tag up with the linux-side wsl-mount-findfs and with wsl-mount-findfs.exe\n", stderr);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long disks = 16, partitions = 8, iterations = 1000, sector_size = 512;
+	unsigned long latency = 0, slow_latency = 0, workers = 4;
+	char **images = calloc(argc, sizeof(char *));
+	size_t image_count = 0;
+
+	TraceArguments(&argc, argv, "wsl-mount-findfs-bench");
+	if(argc == 3 && !strcmp(argv[1], "--compare")) {
+		BenchCompare(argv[2]);
+		return failed ? 1 : 0;
+	}
+	struct FakeDeviceBackend *fake = CreateFakeDeviceBackend();
+	if(!fake || !images) {
+		fputs("*** could not create fake backend\n", stderr);
+		return 1;
+	}
+
+	// --layout and --image add disks in command line order, so drive numbers follow it too
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "--layout") && i+1 < argc) {
+			if(!FakeAddDescribedDisks(fake, argv[++i], 1)) return 1;
+		} else if(!strcmp(argv[i], "--image") && i+1 < argc) {
+			images[image_count] = argv[++i];
+			if(!FakeAddImage(fake, images[image_count++], (uint32_t)sector_size)) return 1;
+		} else if(!strcmp(argv[i], "--sector-size") && i+1 < argc) {
+			sector_size = strtoul(argv[++i], NULL, 0);
+		} else if(!strcmp(argv[i], "--latency") && i+1 < argc) {
+			latency = strtoul(argv[++i], NULL, 0);
+		} else if(!strcmp(argv[i], "--slow") && i+1 < argc) {
+			slow_latency = strtoul(argv[++i], NULL, 0);
+		} else if(!strcmp(argv[i], "--workers") && i+1 < argc) {
+			workers = strtoul(argv[++i], NULL, 0);
+		} else if(!strcmp(argv[i], "--disks") && i+1 < argc) {
+			disks = strtoul(argv[++i], NULL, 0);
+		} else if(!strcmp(argv[i], "--partitions") && i+1 < argc) {
+			partitions = strtoul(argv[++i], NULL, 0);
+		} else if(!strcmp(argv[i], "--iterations") && i+1 < argc) {
+			iterations = strtoul(argv[++i], NULL, 0);
+		} else {
+			Usage();
+			return 1;
+		}
+	}
+	if(!iterations) {
+		fputs("*** --iterations must be nonzero\n", stderr);
+		return 1;
+	}
+
+	if(!fake->count) {
+		if(!disks || !partitions || partitions > FAKE_MAX_GPT_PARTITIONS) {
+			fprintf(stderr, "*** --disks must be nonzero, and --partitions between 1 and %d\n", FAKE_MAX_GPT_PARTITIONS);
+			return 1;
+		}
+		if(!FakeAddSyntheticDisks(fake, disks, PARTSTYLE_GPT, (uint32_t)partitions, 1)) {
+			fputs("*** could not create fake disks\n", stderr);
+			return 1;
+		}
+	}
+
+	size_t partition_total = 0;
+	for(size_t i = 0; i < fake->count; ++i) {
+		partition_total += fake->disks[i].PartitionCount;
+		FakeSetProbeLatency(fake, i, (unsigned)(slow_latency && i % 4 == 3 ? slow_latency : latency));
+	}
+
+	printf("%zu disks, %zu partitions, %lu iterations, %lu us/probe (%lu us every 4th)\n", fake->count, partition_total, iterations, latency, slow_latency ? slow_latency : latency);
+	BenchList(fake, (unsigned)iterations);
+	BenchCache(fake, (unsigned)iterations);
+	BenchProbe(fake, (unsigned)iterations, (unsigned)workers);
+	BenchIndex(fake, (unsigned)iterations);
+	BenchCrc((unsigned)iterations);
+	BenchGuid((unsigned)iterations);
+	BenchTrace((unsigned)iterations);
+	if(image_count) BenchParse(images, image_count, (unsigned)iterations, (uint32_t)sector_size);
+
+	fake->base.Destroy(&fake->base);
+	free(images);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,243 @@
+//Linux-side counterpart to wsl-mount-findfs.exe
+// Accepts the same arguments, but first looks for the tag among the disks already attached to the WSL VM
+// (enumerating /sys/class/block and reading their GPT directly), which avoids the cost of an interop
+// spawn of the win32 helper when there's nothing for windows to do.
+//
+// Only when the disk isn't visible (i.e. it still needs wsl --mount), or for --unmount (which has to go through
+// wsl.exe regardless), does it exec wsl-mount-findfs.exe to do the real work.
+//
+// Since linux can't know the \\.\PhysicalDrive<n> name, a disk found this way is reported by its linux device node:
+// <Tag>           prints /dev/sdX --partition <Index> (or just /dev/sdX with --bare, or for a disk tag like PTUUID=)
+// --mount <Tag>   does nothing (successfully) since the disk is already attached
+// --list          prints the attached disks in the same format as wsl-mount-findfs.exe --list
+//                  (as do --list=json and --list=nul)
+//
+// In batch mode (several tags, @<file>, or --batch) each attached tag gets its result line here,
+// and only the rest are passed along (still as one batch) to wsl-mount-findfs.exe
+// (as is --images=<dir>[;<dir>...], the windows directories of disk images it also searches),
+// whose exit status is combined with this one's (e.g. for an invalid tag)
+//
+// --trace=<file> (or $WSL_MOUNT_TRACE) records each phase and disk as Chrome trace events (see Trace.h), as does the win32 helper if run
+// --metrics=<file> (or $WSL_MOUNT_METRICS) is the log its steps' durations and outcomes go to (see Metrics.h), likewise
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "DeviceBackend.h"
+#include "DeviceIndex.h"
+#include "Interop.h"
+#include "Metrics.h"
+#include "Tag.h"
+#include "Trace.h"
+
+static bool PrintPartitionInfoCallback(const struct DiskInfo *disk, void *context)
+{
+	const enum ListFormat *format = context;
+	PrintDiskRecords(stdout, disk, *format);
+	return true;
+}
+
+struct FindTagContext
+{
+	struct Tag tag;
+	bool valid;
+	const char *arg;
+	char *Drive;
+	uint32_t PartitionNumber;
+};
+
+struct FindTagsContext
+{
+	struct FindTagContext *tags;
+	size_t count;
+	struct DeviceIndex index; // the disks seen so far
+};
+
+static bool MatchTags(const struct DiskInfo *disk, void *context)
+{
+	struct FindTagsContext *find = context;
+	if(!DeviceIndexAddDisk(&find->index, disk)) return true;
+
+	bool all_found = true;
+	for(size_t i = 0; i < find->count; ++i) {
+		struct FindTagContext *tag = &find->tags[i];
+		const struct DiskInfo *found;
+		if(tag->valid && !tag->Drive && (found = DeviceIndexFind(&find->index, &tag->tag, &tag->PartitionNumber))) {
+			tag->Drive = strdup(found->Drive);
+		}
+		all_found = all_found && (!tag->valid || tag->Drive);
+	}
+	return !all_found;
+}
+
+static bool IsTagArgument(const char *arg)
+{
+	return HasTagPrefix(arg) || arg[0] == '@';
+}
+
+static bool AddTag(struct FindTagsContext *find, const char *arg)
+{
+	struct FindTagContext *tags = realloc(find->tags, (find->count + 1) * sizeof(struct FindTagContext));
+	if(!tags) return false;
+	find->tags = tags;
+	find->tags[find->count] = (struct FindTagContext){ .arg = strdup(arg) };
+	return find->tags[find->count++].arg != NULL;
+}
+
+static bool ReadTagFile(struct FindTagsContext *find, const char *path)
+{
+	FILE *f = fopen(path, "re");
+	if(!f) {
+		fprintf(stderr, "*** %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	char line[256];
+	bool success = true;
+	while(success && fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		const char *tag = line + strspn(line, " \t");
+		if(*tag && *tag != '#') success = AddTag(find, tag);
+	}
+	fclose(f);
+	return success;
+}
+
+// hand the whole command line over to the win32 helper, preferring the copy installed alongside this one
+static int ExecWindowsHelper(char *argv[])
+{
+	char exe[PATH_MAX];
+	LocateHelper("wsl-mount-findfs.exe", "WSL_MOUNT_FINDFS_EXE", exe, sizeof(exe));
+
+	argv[0] = exe;
+	execvp(exe, argv);
+	fprintf(stderr, "*** exec %s: %s\n", exe, strerror(errno));
+	return 127;
+}
+
+// the same, but as a child, for when this has results of its own to combine with the helper's
+static int RunWindowsHelper(char *argv[])
+{
+	char exe[PATH_MAX];
+	LocateHelper("wsl-mount-findfs.exe", "WSL_MOUNT_FINDFS_EXE", exe, sizeof(exe));
+
+	argv[0] = exe;
+	pid_t pid = SpawnHelper(exe, argv, -1, -1);
+	return pid < 0 ? 127 : WaitHelper(pid);
+}
+
+int main(int argc, char *argv[])
+{
+	int options_argindex;
+	const char *tag;
+	const char *mount = NULL;
+
+	TraceArguments(&argc, argv, "wsl-mount-findfs");
+	MetricsArguments(&argc, argv);
+	if(argc >= 3 && (!strcmp(argv[1], "--mount") || !strcmp(argv[1], "--unmount"))) {
+		mount = argv[1];
+		tag = argv[2];
+		options_argindex = 3;
+	} else if(argc >= 2) {
+		tag = argv[1];
+		options_argindex = 2;
+	} else {
+		fputs("wsl-mount-findfs [--mount|--unmount] <PARTUUID|PTUUID|PARTLABEL|PARTTYPE|SERIAL|MODEL=...> [<Tag>|@<file>...] [--batch] [--images=<dir>[;<dir>...]] [--trace=<file>] [Options...]\n", stderr);
+		fputs("wsl-mount-findfs --list[=json|nul]\n", stderr);
+		return 1;
+	}
+
+	// only wsl.exe can detach a disk
+	if(!strcmp(mount ? mount : "", "--unmount")) return ExecWindowsHelper(argv);
+
+	struct DeviceBackend *backend = CreateLinuxDeviceBackend();
+	if(!backend) return 1;
+
+	enum ListFormat format;
+	if(ParseListOption(tag, &format)) {
+		setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+		EnumDisks(backend, &PrintPartitionInfoCallback, &format);
+		return 0;
+	}
+
+	bool batch = tag[0] == '@';
+	struct FindTagsContext find = { 0 };
+	bool success = tag[0] == '@' ? ReadTagFile(&find, tag+1) : AddTag(&find, tag);
+	int tags_argindex = options_argindex - 1;
+	for(; success && options_argindex < argc && IsTagArgument(argv[options_argindex]); ++options_argindex) {
+		const char *arg = argv[options_argindex];
+		success = arg[0] == '@' ? ReadTagFile(&find, arg+1) : AddTag(&find, arg);
+		batch = true;
+	}
+	if(!success) return 1;
+
+	bool bare = false;
+	for(int i = options_argindex; i < argc; ++i) {
+		if(!strcmp(argv[i], "--bare")) bare = true;
+		if(!strcmp(argv[i], "--batch")) batch = true;
+	}
+
+	for(size_t i = 0; i < find.count; ++i) {
+		find.tags[i].valid = ParseTag(find.tags[i].arg, &find.tags[i].tag);
+		if(!find.tags[i].valid && !batch) return 1;
+	}
+
+	uint64_t start = TraceNow();
+	EnumDisks(backend, &MatchTags, &find);
+	// the outcome is how many tags weren't attached (yet)
+	int missing = 0;
+	for(size_t i = 0; i < find.count; ++i) missing += find.tags[i].valid && !find.tags[i].Drive;
+	METRIC_END("findfs.resolve", start, missing);
+
+	if(!batch) {
+		struct FindTagContext *context = &find.tags[0];
+		if(!context->Drive) return ExecWindowsHelper(argv); // not attached (yet)
+
+		if(mount) {
+			fprintf(stderr, "%s is already attached as %s\n", tag, context->Drive);
+		} else if(bare || !TagNamesPartition(&context->tag)) {
+			printf("%s\n", context->Drive);
+		} else {
+			printf("%s --partition %u\n", context->Drive, context->PartitionNumber);
+		}
+		return 0;
+	}
+
+	// report what's already attached, and pass whatever isn't on to the win32 helper (still in batch mode)
+	char **forward_argv = calloc((size_t)argc + find.count + 2, sizeof(char *));
+	if(!forward_argv) return 1;
+	int forward_argc = 0;
+	forward_argv[forward_argc++] = argv[0];
+	for(int i = 1; i < tags_argindex; ++i) forward_argv[forward_argc++] = argv[i];
+	int forwarded_tags = 0;
+
+	int result = 0;
+	for(size_t i = 0; i < find.count; ++i) {
+		const struct FindTagContext *context = &find.tags[i];
+		if(!context->valid) {
+			printf("%s 1\n", context->arg);
+			result = 1;
+		} else if(!context->Drive) {
+			forward_argv[forward_argc++] = (char *)context->arg;
+			++forwarded_tags;
+		} else if(bare || !TagNamesPartition(&context->tag)) {
+			printf("%s 0 %s\n", context->arg, context->Drive);
+		} else {
+			printf("%s 0 %s --partition %u\n", context->arg, context->Drive, context->PartitionNumber);
+		}
+	}
+	if(!forwarded_tags) return result;
+
+	forward_argv[forward_argc++] = "--batch";
+	for(int i = options_argindex; i < argc; ++i) {
+		if(strcmp(argv[i], "--batch")) forward_argv[forward_argc++] = argv[i];
+	}
+	fflush(stdout);
+	// an invalid tag fails the batch even if the helper finds all the others, so it can't just be exec'd
+	if(!result) return ExecWindowsHelper(forward_argv);
+	int status = RunWindowsHelper(forward_argv);
+	return status ? status : result;
+}
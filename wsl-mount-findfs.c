@@ -1,22 +1,53 @@
 //Simple helper decoding findfs-style tags to the corresponding args for wsl --mount
 // except that it allows you to specify <Disk> by using the linux blkid-style tags
 // note that linux filesystem-level LABEL= or UUID= cannot be used, since windows cannot see these
-// only two possibilities are supported:
+// only tags from the partition table, or that the disk itself reports, are supported:
 // PTUUID=<uuid>
+// SERIAL=<serial number>, MODEL=<model> (the first disk of that model)
 // PARTUUID=<uuid>
-//   This also adds --partition <Index>
+// PARTLABEL=<GPT partition name>, PARTTYPE=<GPT partition type uuid> (the first partition of that type)
+//   These also add --partition <Index>
 //   unless using you gave --bare, in which case it selects the physical device containing this partition
 //
 // If you pass the --mount|--unmount flags, it will also turn around and actally pass the call on to wsl.exe
 // Unlike calling wsl.exe yourself, it will automatically trigger UAC elevation if necessary for this.
-
+// Since that's elevated, the only options passed on are --bare, and --type, --options or --name with a plain value.
+//
+// Several tags (or @<file> listing them, one per line) can be given at once, or --batch used, in which case
+// they're all resolved by a single pass over the disks, all the wsl.exe calls are made from a single elevated process,
+// and each tag gets a result line: <Tag> <ExitCode> [<Device> [--partition <Index>]]
+//
+// Concurrent invocations that need elevation (the several wsl-mount@ units systemd starts at boot, say) go one step further,
+// coalescing through a lock file next to the cache: whichever gets there first enumerates and elevates for all of them,
+// and the rest just use its results (see SingleFlight.h). Plain partition lookups never wait on that.
+//
+// --images=<dir>[;<dir>...] (or $WSL_MOUNT_FINDFS_IMAGES) also looks for tags that aren't on any disk in the disk images
+// (*.img, *.raw, fixed *.vhd) in those directories, giving --vhd <Path> [--partition <Index>] for those found in one;
+// each image's partition table is remembered along with its size and modification time, in <cache>.images (see CreateImageDeviceBackend)
+//
+// --list prints every tag of every disk; --list=json (JSON lines) or --list=nul (NUL-delimited key=value) give
+// a record per disk and per partition instead, for scripts (see PrintDiskRecords)
+//
+// --trace=<file> (or $WSL_MOUNT_TRACE) records how long each phase took, and each disk, as Chrome trace events (see Trace.h),
+// including those of the elevated copy
+// --metrics=<file> (or $WSL_MOUNT_METRICS, or else %LOCALAPPDATA%\wsl-mount-metrics.log) gets how long the enumeration,
+// UAC elevation, and each wsl.exe took, and how they came out (see Metrics.h), the elevated copy's included
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <io.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <windows.h>
-#include <setupapi.h>
 #include <process.h>
+#include "Crt.h"
+#include "DeviceBackend.h"
 #include "IntegrityLevel.h"
+#include "Metrics.h"
+#include "ResolveCache.h"
+#include "SingleFlight.h"
+#include "Trace.h"
 
 void ReportLastError(const char *caption, ...)
 {
@@ -34,202 +65,489 @@ void ReportLastError(const char *caption, ...)
 	LocalFree(messageBuffer);
 }
 
-typedef void (*ENUMDEVICEHANDLE_CALLBACK)(LPCTSTR, HANDLE, LPVOID);
+struct ListContext
+{
+	enum ListFormat format;
+	struct ResolveCache cache;
+};
 
-// https://stackoverflow.com/questions/327718/how-to-list-physical-disks
-void EnumClassDevHandles(REFGUID ClassGuid, DWORD dwDesiredAccess, ENUMDEVICEHANDLE_CALLBACK callback, LPVOID context)
+static bool PrintPartitionInfoCallback(const struct DiskInfo *disk, void *context)
 {
-	HDEVINFO hDiskClassDevices = SetupDiGetClassDevs(ClassGuid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+	struct ListContext *list = context;
+	PrintDiskRecords(stdout, disk, list->format);
 
-	if(hDiskClassDevices == INVALID_HANDLE_VALUE) {
-		ReportLastError("SetupDiGetClassDevs");
-		return;
-	}
+	// we've seen every disk anyway, so might as well refresh the cache while we're at it
+	ResolveCacheRecordDisk(&list->cache, disk);
+	return true;
+}
 
-	DWORD deviceIndex = 0;
-	SP_DEVICE_INTERFACE_DATA DeviceInterfaceData = { .cbSize = sizeof(SP_DEVICE_INTERFACE_DATA) };
+// the tags can be given as several arguments, or read from @<file> (one per line)
+static bool IsTagArgument(const char *arg)
+{
+	return HasTagPrefix(arg) || arg[0] == '@';
+}
 
-	while(SetupDiEnumDeviceInterfaces(hDiskClassDevices, NULL, ClassGuid, deviceIndex++, &DeviceInterfaceData))
-	{
-		PSP_DEVICE_INTERFACE_DETAIL_DATA DeviceInterfaceDetailData = NULL;
-		DWORD DeviceInterfaceDetailDataSize = 0;
-		BOOL success = SetupDiGetDeviceInterfaceDetail(hDiskClassDevices, &DeviceInterfaceData, DeviceInterfaceDetailData, DeviceInterfaceDetailDataSize, &DeviceInterfaceDetailDataSize, NULL);
+struct TagArgument
+{
+	char *arg;
+	bool valid;
+	char wsl_device_args[MAX_PATH + 32]; // <Device> [--partition <Index>]
+	DWORD ExitCode;
+};
 
+struct TagArguments
+{
+	struct TagArgument *tags;
+	size_t count;
+};
 
-		if(!success && GetLastError() == ERROR_INSUFFICIENT_BUFFER) {
-			DeviceInterfaceDetailData = malloc(DeviceInterfaceDetailDataSize);
+static bool AddTagArgument(struct TagArguments *tags, const char *arg)
+{
+	struct TagArgument *grown = realloc(tags->tags, (tags->count + 1) * sizeof(struct TagArgument));
+	if(!grown) return false;
+	tags->tags = grown;
+	tags->tags[tags->count] = (struct TagArgument){ .arg = _strdup(arg) };
+	return tags->tags[tags->count++].arg != NULL;
+}
 
-			ZeroMemory(DeviceInterfaceDetailData, DeviceInterfaceDetailDataSize);
-			DeviceInterfaceDetailData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
-			success = SetupDiGetDeviceInterfaceDetail(hDiskClassDevices, &DeviceInterfaceData, DeviceInterfaceDetailData, DeviceInterfaceDetailDataSize, &DeviceInterfaceDetailDataSize, NULL);
-		}
+static bool ReadTagFile(struct TagArguments *tags, const char *path)
+{
+	FILE *f = OpenStream(path, "r");
+	if(!f) {
+		fprintf(stderr, "*** could not read %s\n", path);
+		return false;
+	}
 
-		if(success && DeviceInterfaceDetailData) {
-			HANDLE hDevice = CreateFile(DeviceInterfaceDetailData->DevicePath, dwDesiredAccess, FILE_SHARE_READ|FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-			if(hDevice == INVALID_HANDLE_VALUE) {
-				ReportLastError("CreateFile(%ls)", DeviceInterfaceDetailData->DevicePath);
-			} else {
+	char line[256];
+	bool success = true;
+	while(success && fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		const char *tag = line + strspn(line, " \t");
+		if(*tag && *tag != '#') success = AddTagArgument(tags, tag);
+	}
+	fclose(f);
+	return success;
+}
 
-				(*callback)(DeviceInterfaceDetailData->DevicePath, hDevice, context);
-				CloseHandle(hDevice);
-			}
-		} else {
-			ReportLastError("SetupDiGetDeviceInterfaceDetail");
-		}
+static void AppendParameter(char *parameters, size_t size, const char *arg)
+{
+	if(*parameters) strcat_s(parameters, size, " ");
+	strcat_s(parameters, size, arg);
+}
 
-		free(DeviceInterfaceDetailData);
+// runs wsl.exe (from this process, so at its integrity level), returning its exit code
+static DWORD RunWsl(const char *parameters)
+{
+	char wsl_exe[MAX_PATH];
+	if(!SearchPathA(NULL, "wsl.exe", NULL, MAX_PATH, wsl_exe, NULL)) {
+		strcpy_s(wsl_exe, sizeof(wsl_exe), "wsl.exe");
+		fprintf(stderr, "*** wsl.exe not found by SearchPath()\n");
 	}
 
-	if(GetLastError() != ERROR_NO_MORE_ITEMS) ReportLastError("SetupDiEnumDeviceInterfaces");
-
-	SetupDiDestroyDeviceInfoList(hDiskClassDevices);
+	char command_line[2048 + MAX_PATH] = "wsl.exe ";
+	strcat_s(command_line, sizeof(command_line), parameters);
+
+	STARTUPINFOA startup = { .cb = sizeof(STARTUPINFOA) };
+	PROCESS_INFORMATION process;
+	DWORD ExitCode = 1;
+	uint64_t start = TraceNow();
+	if(CreateProcessA(wsl_exe, command_line, NULL, NULL, FALSE, 0, NULL, NULL, &startup, &process)) {
+		WaitForSingleObject(process.hProcess, INFINITE);
+		GetExitCodeProcess(process.hProcess, &ExitCode);
+		CloseHandle(process.hProcess);
+		CloseHandle(process.hThread);
+	} else {
+		ReportLastError("CreateProcess(%s)", command_line);
+	}
+	TRACE_END("wsl.exe", start, "%s: exit %lu", parameters, ExitCode);
+	METRIC_END("findfs.wsl", start, (int)ExitCode);
+	return ExitCode;
 }
 
-// https://learn.microsoft.com/en-us/windows/win32/devio/calling-deviceiocontrol
-PDRIVE_LAYOUT_INFORMATION_EX GetDriveLayoutInformationEx(HANDLE hDevice)
+//
+// the flight: concurrent invocations (e.g. the wsl-mount@ units systemd starts together at boot) coalesce through
+// the cache's lock file, so that one of them enumerates the disks and elevates for all of them (see SingleFlight.h)
+// Each request is one tag as <--mount|--unmount|-> <bare: 0|1> <options for wsl.exe> <--images directories> <Tag>, tab-separated,
+// and its result <ExitCode> <wsl_device_args>, also tab-separated
+// The queue can be written by anything running as this user, so what runs them checks each request (see FlightRequestAllowed)
+// rather than hand an elevated wsl.exe whatever it's given
+//
+
+struct FlightContext
 {
-	DWORD drive_layout_size = sizeof(DRIVE_LAYOUT_INFORMATION_EX);
-	PDRIVE_LAYOUT_INFORMATION_EX drive_layout = malloc(drive_layout_size);
-	DWORD bytesReturned;
-	BOOL success = DeviceIoControl(hDevice, IOCTL_DISK_GET_DRIVE_LAYOUT_EX, NULL, 0, drive_layout, drive_layout_size, &bytesReturned, NULL);
-	while(!success && (GetLastError() == ERROR_INSUFFICIENT_BUFFER || GetLastError() == ERROR_MORE_DATA)) {
-		/* Annoyingly, this call does not return how much space it needs' assume that we need to add room for another partition since that's the variable-sized array */
-		drive_layout = realloc(drive_layout, drive_layout_size += sizeof(PARTITION_INFORMATION_EX));
-		ZeroMemory(drive_layout, drive_layout_size);
-		success = DeviceIoControl(hDevice, IOCTL_DISK_GET_DRIVE_LAYOUT_EX, NULL, 0, drive_layout, drive_layout_size, &bytesReturned, NULL);
+	const char *cache_path; // NULL if caching is disabled
+	const char *base; // the flight's files, if coalescing
+	unsigned ProbeWorkers;
+	const char *image_index; // NULL if caching is disabled
+};
+
+// the wsl --mount options a request may pass on, each followed by a value
+static const char *const flight_value_options[] = { "--type", "-t", "--options", "-o", "--name", "-n" };
+#define FLIGHT_VALUE_CHARS "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789._,=:+-/"
+
+struct FlightTag
+{
+	char line[FLIGHT_LINE_MAX]; // the request, split up
+	const char *mount; // NULL for a lookup
+	bool bare;
+	const char *options;
+	const char *images; // directories of disk images to search, NULL for none
+	bool valid;
+	bool well_formed; // bare is 0 or 1
+	struct Tag tag;
+};
+
+static void ParseFlightRequest(const char *request, struct FlightTag *tag)
+{
+	strcpy_s(tag->line, sizeof(tag->line), request);
+	char *field[5] = { tag->line };
+	for(int i = 1; i < 5 && field[i-1]; ++i) {
+		field[i] = strchr(field[i-1], '\t');
+		if(field[i]) *field[i]++ = '\0';
 	}
+	tag->mount = strcmp(field[0], "-") ? field[0] : NULL;
+	tag->bare = field[1] && !strcmp(field[1], "1");
+	tag->well_formed = field[1] && (!strcmp(field[1], "0") || tag->bare);
+	tag->options = field[2] ? field[2] : "";
+	tag->images = field[3] && *field[3] ? field[3] : NULL;
+	// (already reported by the invocation that queued it, if it wasn't valid)
+	tag->valid = field[4] && ParseTagQuietly(field[4], &tag->tag);
+}
 
-	if(!success) {
-		ReportLastError("IOCTL_DISK_GET_DRIVE_LAYOUT_EX");
-		free(drive_layout);
-		drive_layout = NULL;
+// only a lookup, --mount or --unmount of a tag (which whoever runs it resolves itself), with nothing for wsl.exe but
+// --bare and the options above, each with a value that can't be taken for another option or break out of the command line
+static bool FlightRequestAllowed(const struct FlightTag *tag)
+{
+	if(!tag->valid || !tag->well_formed) return false;
+	if(tag->images && strchr(tag->images, '"')) return false;
+	if(!tag->mount) return true; // (a lookup's options go nowhere)
+	if(strcmp(tag->mount, "--mount") && strcmp(tag->mount, "--unmount")) return false;
+
+	char options[FLIGHT_LINE_MAX], *context = NULL;
+	strcpy_s(options, sizeof(options), tag->options);
+	for(char *token = strtok_s(options, " ", &context); token; token = strtok_s(NULL, " ", &context)) {
+		if(!strcmp(token, "--bare")) continue;
+		bool takes_value = false;
+		for(size_t i = 0; i < ARRAYSIZE(flight_value_options) && !takes_value; ++i) takes_value = !strcmp(token, flight_value_options[i]);
+		const char *value = takes_value ? strtok_s(NULL, " ", &context) : NULL;
+		if(!value || value[0] == '-' || value[strspn(value, FLIGHT_VALUE_CHARS)]) return false;
 	}
+	return true;
+}
 
-	return drive_layout;
+// mounts, and whole disks (which have always been looked up elevated, as the serial number may only be reported
+// to an administrator anyway)
+static bool FlightRequestNeedsElevation(const char *request)
+{
+	struct FlightTag tag;
+	ParseFlightRequest(request, &tag);
+	return tag.mount || (tag.valid && !TagNamesPartition(&tag.tag));
 }
 
-char * GetPhysicalDrive(LPCTSTR name, HANDLE hDevice) {
-	STORAGE_DEVICE_NUMBER device_number = {0};
-	DWORD bytesReturned;
-	if(!DeviceIoControl(hDevice, IOCTL_STORAGE_GET_DEVICE_NUMBER, NULL, 0, &device_number, sizeof(device_number), &bytesReturned, NULL)) {
-		ReportLastError("IOCTL_STORAGE_GET_DEVICE_NUMBER");
-	}
-	
-	// apparently the \\.\PhysicalDrive<n> part is something you just construct - even Old New Thing just did so rather than pull out some way to retrieve this string
-	// https://devblogs.microsoft.com/oldnewthing/20201021-00/?p=104387 "How do I get from a volume to the physical disk that holds it?"
-	if(device_number.DeviceType == FILE_DEVICE_DISK) {
-		char PhysicalDrive[MAX_PATH];
-		sprintf_s(PhysicalDrive, MAX_PATH, "\\\\.\\PhysicalDrive%u", device_number.DeviceNumber);
-		return _strdup(PhysicalDrive);
-	} else {
-		fprintf(stderr, "*** %ls is not FILE_DEVICE_DISK, cannot map to \\\\.\\PhysicalDrive<n>", name);
-		return NULL;
+struct ImageMatch
+{
+	const struct FlightTag *tags;
+	struct ResolveRequest *resolve;
+	char **images; // the image each tag was found in
+	size_t count;
+	const char *directories; // only the requests that asked for these are looked for
+};
+
+// EnumDisks goes through the images in list order (directory by directory, each sorted by name), so a tag in more
+// than one image (e.g. a copied .vhdx) is always found in the same one, the first, just as on the disks
+static bool MatchImage(const struct DiskInfo *disk, void *context)
+{
+	struct ImageMatch *match = context;
+	bool all_found = true;
+	for(size_t i = 0; i < match->count; ++i) {
+		struct ResolveRequest *resolve = &match->resolve[i];
+		if(!match->tags[i].valid || resolve->result != RESOLVE_NOT_FOUND) continue;
+		if(!match->tags[i].images || strcmp(match->tags[i].images, match->directories)) continue;
+		if(DiskMatchesTag(disk, &resolve->tag, &resolve->PartitionNumber) && (match->images[i] = _strdup(disk->Drive))) {
+			resolve->result = RESOLVE_ENUMERATED;
+		} else {
+			all_found = false;
+		}
 	}
+	return !all_found;
 }
 
-bool parse_guid(const char *str, GUID *guid)
+// runs a batch of requests from this process: all the tags resolved by one pass over the disks, then the wsl.exe calls
+static void RunFlightHere(struct FlightRequest *requests, size_t count, void *context)
 {
-	return sscanf_s(str, "%08lx-%04hx-%04hx-%02hhx%02hhx-%02hhx%02hhx%02hhx%02hhx%02hhx%02hhx",
-	                &guid->Data1, &guid->Data2, &guid->Data3,
-	                &guid->Data4[0], &guid->Data4[1], &guid->Data4[2], &guid->Data4[3], &guid->Data4[4], &guid->Data4[5], &guid->Data4[6], &guid->Data4[7]) == 11;
+	struct FlightContext *flight = context;
+	struct FlightTag *tags = calloc(count ? count : 1, sizeof(struct FlightTag));
+	struct ResolveRequest *resolve = calloc(count ? count : 1, sizeof(struct ResolveRequest));
+	char **images = calloc(count ? count : 1, sizeof(char *));
+	if(!tags || !resolve || !images) {
+		for(size_t i = 0; i < count; ++i) strcpy_s(requests[i].result, sizeof(requests[i].result), "1\t");
+		free(tags);
+		free(resolve);
+		free(images);
+		return;
+	}
+
+	bool any_valid = false;
+	for(size_t i = 0; i < count; ++i) {
+		ParseFlightRequest(requests[i].request, &tags[i]);
+		if(tags[i].valid && !FlightRequestAllowed(&tags[i])) {
+			fprintf(stderr, "*** refused: %s\n", requests[i].request);
+			tags[i].valid = false;
+		}
+		// invalid tags are left in place (with a null GUID, that never matches) so results line up with the requests
+		if(tags[i].valid) resolve[i].tag = tags[i].tag;
+		any_valid = any_valid || tags[i].valid;
+	}
+
+	if(any_valid) {
+		struct ResolveCache cache = { 0 };
+		if(flight->cache_path) LoadResolveCache(&cache, flight->cache_path);
+		struct DeviceBackend *backend = CreateWin32DeviceBackend(FILE_READ_ATTRIBUTES);
+		if(!backend) {
+			for(size_t i = 0; i < count; ++i) strcpy_s(requests[i].result, sizeof(requests[i].result), "1\t");
+			FreeResolveCache(&cache);
+			free(tags);
+			free(resolve);
+			free(images);
+			return;
+		}
+		backend->ProbeWorkers = flight->ProbeWorkers;
+		uint64_t start = TraceNow();
+		ResolveTags(backend, flight->cache_path ? &cache : NULL, resolve, count);
+		TRACE_END("ResolveTags", start, "%zu tags", count);
+		// the outcome is how many tags weren't found
+		int missing = 0;
+		for(size_t i = 0; i < count; ++i) missing += tags[i].valid && resolve[i].result == RESOLVE_NOT_FOUND;
+		METRIC_END("findfs.resolve", start, missing);
+		backend->Destroy(backend);
+
+		// whatever isn't on any disk may be in one of the images its invocation named, to be attached with wsl --mount --vhd
+		// (one pass per distinct --images, in the order they were first asked for; nearly always there's just the one)
+		for(size_t first = 0; missing && first < count; ++first) {
+			if(!tags[first].valid || !tags[first].images || resolve[first].result != RESOLVE_NOT_FOUND) continue;
+			bool searched = false;
+			for(size_t i = 0; i < first && !searched; ++i) searched = tags[i].valid && tags[i].images && !strcmp(tags[i].images, tags[first].images);
+			if(searched) continue;
+
+			struct ImageDeviceBackend *image_backend = CreateImageDeviceBackend(tags[first].images, flight->image_index);
+			if(!image_backend) continue;
+			if(flight->ProbeWorkers) image_backend->base.ProbeWorkers = flight->ProbeWorkers;
+			struct ImageMatch match = { tags, resolve, images, count, tags[first].images };
+			start = TraceNow();
+			EnumDisks(&image_backend->base, &MatchImage, &match);
+			missing = 0;
+			for(size_t i = 0; i < count; ++i) missing += tags[i].valid && resolve[i].result == RESOLVE_NOT_FOUND;
+			TRACE_END("ResolveImages", start, "%zu images, %u read", image_backend->count, image_backend->ReadCount);
+			METRIC_END("findfs.images", start, missing);
+			image_backend->base.Destroy(&image_backend->base);
+		}
+		start = TRACE_BEGIN();
+		if(flight->cache_path) SaveResolveCache(&cache, flight->cache_path);
+		TRACE_END("SaveResolveCache", start, "%s", flight->cache_path ? flight->cache_path : "(disabled)");
+		FreeResolveCache(&cache);
+	}
+
+	for(size_t i = 0; i < count; ++i) {
+		const struct FlightTag *tag = &tags[i];
+		if(!tag->valid || resolve[i].result == RESOLVE_NOT_FOUND) {
+			strcpy_s(requests[i].result, sizeof(requests[i].result), "1\t");
+			continue;
+		}
+		char wsl_device_args[MAX_PATH + 32];
+		bool unmount = tag->mount && !strcmp(tag->mount, "--unmount");
+		if(images[i]) {
+			// wsl --unmount takes the image's path as it is, wsl --mount after --vhd
+			const char *quote = strchr(images[i], ' ') ? "\"" : "";
+			int len = snprintf(wsl_device_args, sizeof(wsl_device_args), "%s%s%s%s", unmount ? "" : "--vhd ", quote, images[i], quote);
+			if(len < 0 || (size_t)len + 16 >= sizeof(wsl_device_args)) {
+				fprintf(stderr, "*** path too long: %s\n", images[i]);
+				strcpy_s(requests[i].result, sizeof(requests[i].result), "1\t");
+				continue;
+			}
+		} else {
+			sprintf_s(wsl_device_args, sizeof(wsl_device_args), "\\\\.\\PhysicalDrive%u", resolve[i].DriveNumber);
+		}
+		// wsl --unmount actually detaches the whole disk and doesn't accept --partition
+		if(!tag->bare && TagNamesPartition(&tag->tag) && !unmount) {
+			char PartitionNumber[32];
+			sprintf_s(PartitionNumber, sizeof(PartitionNumber), " --partition %u", resolve[i].PartitionNumber);
+			strcat_s(wsl_device_args, sizeof(wsl_device_args), PartitionNumber);
+		}
+
+		DWORD ExitCode = 0;
+		if(tag->mount) {
+			char parameters[2048] = "";
+			AppendParameter(parameters, sizeof(parameters), tag->mount);
+			AppendParameter(parameters, sizeof(parameters), wsl_device_args);
+			if(*tag->options) AppendParameter(parameters, sizeof(parameters), tag->options);
+			ExitCode = RunWsl(parameters);
+		}
+		sprintf_s(requests[i].result, sizeof(requests[i].result), "%lu\t%s", ExitCode, wsl_device_args);
+	}
+	for(size_t i = 0; i < count; ++i) free(images[i]);
+	free(tags);
+	free(resolve);
+	free(images);
 }
 
-typedef char GUIDSTR[37];
-const char * format_guid(GUIDSTR buf, REFGUID guid)
+// a request as one command line argument: %XX for anything that isn't plainly itself (tabs, spaces, quotes, backslashes)
+static bool EncodeRequest(char *out, size_t size, const char *request)
 {
-	sprintf_s(buf, sizeof(GUIDSTR), "%08lx-%04hx-%04hx-%02hhx%02hhx-%02hhx%02hhx%02hhx%02hhx%02hhx%02hhx",
-	          guid->Data1, guid->Data2, guid->Data3,
-	          guid->Data4[0], guid->Data4[1], guid->Data4[2], guid->Data4[3], guid->Data4[4], guid->Data4[5], guid->Data4[6], guid->Data4[7]);
-	return buf;
+	size_t used = 0;
+	for(const unsigned char *p = (const unsigned char *)request; *p; ++p) {
+		if(used + 4 > size) return false;
+		if(strchr(FLIGHT_VALUE_CHARS, *p)) out[used++] = (char)*p;
+		else used += (size_t)sprintf_s(out + used, size - used, "%%%02X", *p);
+	}
+	out[used] = '\0';
+	return true;
 }
 
-void PrintPartitionInfo(LPCTSTR name, HANDLE hDevice, LPVOID context)
+static bool DecodeRequest(char *out, size_t size, const char *arg)
 {
-	printf("DevicePath = %ls\n", name);
-
-	// TODO: could look up more things using IOCTL_STORAGE_QUERY_PROPERTY 
-	// https://learn.microsoft.com/en-us/windows/win32/api/winioctl/ni-winioctl-ioctl_storage_query_property
-	// if we wanted to invent windows-specific tags, but I think the partition UUIDs will do for now
-	char *PhysicalDrive = GetPhysicalDrive(name, hDevice);
-	PDRIVE_LAYOUT_INFORMATION_EX drive_layout = GetDriveLayoutInformationEx(hDevice);
-
-	if(drive_layout) {
-		switch(drive_layout->PartitionStyle) {
-			case PARTITION_STYLE_MBR:
-				GUIDSTR guidstr;
-				for(DWORD i = 0; i < drive_layout->PartitionCount; ++i) {
-					if(drive_layout->PartitionEntry[i].Mbr.PartitionType != PARTITION_ENTRY_UNUSED) {
-						// MBR does not actually store a GUID, but windows seems to construct one out of something, so allow searching for it
-						printf("%s --partition %d PARTUUID=%s\n", PhysicalDrive, i, format_guid(guidstr, &drive_layout->PartitionEntry[i].Mbr.PartitionId));
-					}
-				}
-				break;
-			case PARTITION_STYLE_GPT:
-				printf("%s PTUUID=%s\n", PhysicalDrive, format_guid(guidstr, &drive_layout->Gpt.DiskId));
-				for(DWORD i = 0; i < drive_layout->PartitionCount; ++i) {
-					printf("%s --partition %d PARTUUID=%s\n", PhysicalDrive, drive_layout->PartitionEntry[i].PartitionNumber, format_guid(guidstr, &drive_layout->PartitionEntry[i].Gpt.PartitionId));
-				}
-				break;
+	size_t used = 0;
+	for(; *arg; ++used) {
+		unsigned int c;
+		if(used + 1 >= size) return false;
+		if(*arg != '%') {
+			out[used] = *arg++;
+		} else if(sscanf_s(arg + 1, "%2x", &c) == 1 && isxdigit((unsigned char)arg[1]) && isxdigit((unsigned char)arg[2])) {
+			out[used] = (char)c;
+			arg += 3;
+		} else {
+			return false;
 		}
 	}
-	free(PhysicalDrive);
-	free(drive_layout);
+	out[used] = '\0';
+	return true;
 }
 
-struct FindGUIDContext
-{
-	GUID guid;
-	const char *PhysicalDrive;
-	DWORD PartitionNumber;
-};
+#define ELEVATED_PARAMETERS_MAX 32000 // CreateProcess's limit for a whole command line is 32767
 
-void MatchPTUUID(LPCTSTR name, HANDLE hDevice, struct FindGUIDContext *context)
+// what the leader of a flight runs: the batch here if it can be, or else in one elevated copy of this (a single UAC prompt),
+// which then also serves whoever queued up during the prompt, so that they don't need one of their own
+// The requests go to the elevated copy on its command line, rather than in a file that anything else running as this user
+// could rewrite during the prompt; only more than fit on one command line (thirty-odd mounts) take more than one prompt
+static void RunFlight(struct FlightRequest *requests, size_t count, void *context)
 {
-	PDRIVE_LAYOUT_INFORMATION_EX drive_layout = GetDriveLayoutInformationEx(hDevice);
+	struct FlightContext *flight = context;
+	bool elevate = false;
+	for(size_t i = 0; i < count; ++i) elevate = elevate || FlightRequestNeedsElevation(requests[i].request);
+	if(!elevate || GetCurrentProcessIntegrityLevel() >= SECURITY_MANDATORY_HIGH_RID) {
+		RunFlightHere(requests, count, context);
+		return;
+	}
 
-	if(drive_layout && IsEqualGUID(&context->guid, &drive_layout->Gpt.DiskId)) {
-		context->PhysicalDrive = GetPhysicalDrive(name, hDevice);
+	// anything without a status line didn't get run (e.g. UAC was declined)
+	for(size_t i = 0; i < count; ++i) strcpy_s(requests[i].result, sizeof(requests[i].result), "1\t");
+
+	// (the temporary file just reserves a name: the elevated copy creates <name>.status anew, refusing one already there)
+	char temp_dir[MAX_PATH], temp_path[MAX_PATH], status_path[MAX_PATH + 8];
+	if(!GetTempPathA(MAX_PATH, temp_dir) || !GetTempFileNameA(temp_dir, "wmf", 0, temp_path)) {
+		ReportLastError("GetTempFileName");
+		return;
 	}
-	free(drive_layout);
+	sprintf_s(status_path, sizeof(status_path), "%s.status", temp_path);
+
+	char *parameters = malloc(ELEVATED_PARAMETERS_MAX), arg[3 * FLIGHT_LINE_MAX + 16], encoded[3 * FLIGHT_LINE_MAX];
+	for(size_t first = 0, next; parameters && first < count; first = next) {
+		sprintf_s(parameters, ELEVATED_PARAMETERS_MAX, "--run-flight \"%s\"", status_path);
+		if(flight->base) {
+			sprintf_s(arg, sizeof(arg), "\"--flight=%s\"", flight->base);
+			AppendParameter(parameters, ELEVATED_PARAMETERS_MAX, arg);
+		}
+		if(flight->ProbeWorkers) {
+			sprintf_s(arg, sizeof(arg), "--parallel=%u", flight->ProbeWorkers);
+			AppendParameter(parameters, ELEVATED_PARAMETERS_MAX, arg);
+		}
+		if(TracePath()) {
+			sprintf_s(arg, sizeof(arg), "\"--trace=%s\"", TracePath());
+			AppendParameter(parameters, ELEVATED_PARAMETERS_MAX, arg);
+		}
+		if(MetricsPath()) {
+			sprintf_s(arg, sizeof(arg), "\"--metrics=%s\"", MetricsPath());
+			AppendParameter(parameters, ELEVATED_PARAMETERS_MAX, arg);
+		}
+		for(next = first; next < count; ++next) {
+			if(!EncodeRequest(encoded, sizeof(encoded), requests[next].request)) break;
+			sprintf_s(arg, sizeof(arg), "--request=%s", encoded);
+			if(next > first && strlen(parameters) + strlen(arg) + 2 > ELEVATED_PARAMETERS_MAX) break;
+			AppendParameter(parameters, ELEVATED_PARAMETERS_MAX, arg);
+		}
+		if(next == first) ++next; // (too long to pass on at all, so fails)
+		RunSelfElevated(parameters);
+
+		FILE *status = OpenStream(status_path, "r");
+		for(size_t i = first; status && i < next && fgets(requests[i].result, sizeof(requests[i].result), status); ++i) {
+			requests[i].result[strcspn(requests[i].result, "\r\n")] = '\0';
+		}
+		if(status) fclose(status);
+		remove(status_path);
+	}
+	free(parameters);
+	remove(temp_path);
+}
+
+// the images' partition tables are remembered next to the lookup cache, and likewise not at all if that's disabled
+static const char * ImageIndexPath(const char *cache_path, char *path, size_t size)
+{
+	if(!cache_path) return NULL;
+	int len = snprintf(path, size, "%s.images", cache_path);
+	return len >= 0 && (size_t)len < size ? path : NULL;
 }
 
-void MatchPARTUUID(LPCTSTR name, HANDLE hDevice, struct FindGUIDContext *context)
+// the elevated copy: --run-flight <status file> [--flight=<base>] [--parallel=<n>] --request=<request>...
+// runs the requests (each as encoded by EncodeRequest), writing their results to the status file, which it creates,
+// then (while it's still elevated) everything queued in the flight meanwhile
+static int RunFlightFile(int argc, char *argv[])
 {
-	PDRIVE_LAYOUT_INFORMATION_EX drive_layout = GetDriveLayoutInformationEx(hDevice);
-
-	if(drive_layout) {
-		switch(drive_layout->PartitionStyle) {
-			case PARTITION_STYLE_MBR:
-				for(DWORD i = 0; i < drive_layout->PartitionCount; ++i) {
-					// MBR does not actually store a GUID, but windows seems to construct one out of something, so allow searching for it
-					if(IsEqualGUID(&context->guid, &drive_layout->PartitionEntry[i].Mbr.PartitionId)) {
-						context->PhysicalDrive = GetPhysicalDrive(name, hDevice);
-						context->PartitionNumber = drive_layout->PartitionEntry[i].PartitionNumber;
-					}
-				}
-				break;
-			case PARTITION_STYLE_GPT:
-				for(DWORD i = 0; i < drive_layout->PartitionCount; ++i) {
-					if(IsEqualGUID(&context->guid, &drive_layout->PartitionEntry[i].Gpt.PartitionId)) {
-						context->PhysicalDrive = GetPhysicalDrive(name, hDevice);
-						context->PartitionNumber = drive_layout->PartitionEntry[i].PartitionNumber;
-					}
-				}
-				break;
+	char image_index[MAX_PATH + 8];
+	struct FlightContext flight = { .cache_path = DefaultResolveCachePath() };
+	flight.image_index = ImageIndexPath(flight.cache_path, image_index, sizeof(image_index));
+	struct FlightRequest *requests = calloc((size_t)argc, sizeof(struct FlightRequest));
+	if(!requests) return 1;
+	size_t count = 0;
+	for(int i = 3; i < argc; ++i) {
+		if(!strncmp(argv[i], "--flight=", 9)) flight.base = argv[i] + 9;
+		if(!strncmp(argv[i], "--parallel=", 11)) flight.ProbeWorkers = strtoul(argv[i] + 11, NULL, 10);
+		if(!strncmp(argv[i], "--request=", 10)) {
+			requests[count].id[0] = '\0';
+			// (one that doesn't decode is left empty, which is no valid request, so it still gets its line of the results)
+			if(!DecodeRequest(requests[count].request, sizeof(requests[count].request), argv[i] + 10)) requests[count].request[0] = '\0';
+			++count;
 		}
 	}
-	free(drive_layout);
+
+	RunFlightHere(requests, count, &flight);
+
+	// CREATE_NEW, so as not to write through anything put in its place
+	const char *status_path = argv[2];
+	HANDLE out = CreateFileA(status_path, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+	bool success = out != INVALID_HANDLE_VALUE;
+	if(!success) ReportLastError("CreateFile(%s)", status_path);
+	for(size_t i = 0; success && i < count; ++i) {
+		char line[FLIGHT_LINE_MAX + 2];
+		int len = sprintf_s(line, sizeof(line), "%s\n", requests[i].result);
+		DWORD written;
+		success = len > 0 && WriteFile(out, line, (DWORD)len, &written, NULL) && written == (DWORD)len;
+	}
+	if(out != INVALID_HANDLE_VALUE) success = CloseHandle(out) && success;
+	free(requests);
+
+	if(flight.base) DrainSingleFlight(flight.base, &RunFlightHere, &flight);
+	return success ? 0 : 1;
 }
 
 int main(int argc, char* argv[])
 {
-	#define MAX_TAG_ARGC 3 // <Device> [--partition <Index>]
-
-	const char *wsl_device_argv[MAX_TAG_ARGC+1] = { NULL }; 
 	int options_argindex;
 	const char *tag;
 	const char *mount = NULL;
-	
+
+	TraceArguments(&argc, argv, "wsl-mount-findfs.exe");
+	MetricsArguments(&argc, argv);
+	if(argc >= 3 && !strcmp(argv[1], "--run-flight")) return RunFlightFile(argc, argv);
+
 	if(argc >= 3 && (!strcmp(argv[1], "--mount") || !strcmp(argv[1], "--unmount"))) {
 		mount = argv[1];
 		tag = argv[2];
@@ -238,92 +556,135 @@ int main(int argc, char* argv[])
 		tag = argv[1];
 		options_argindex = 2;
 	} else {
-		fputs("wsl-mount-findfs.exe [--mount|--unmount] <PARTUUID|PTUUID=...> [Options...]\n", stderr);
+		fputs("wsl-mount-findfs.exe [--mount|--unmount] <PARTUUID|PTUUID|PARTLABEL|PARTTYPE|SERIAL|MODEL=...> [<Tag>|@<file>...] [--batch] [--parallel[=<n>]] [--images=<dir>[;<dir>...]] [--trace=<file>] [Options...]\n", stderr);
+		fputs("wsl-mount-findfs.exe --list[=json|nul]\n", stderr);
 		return 1;
 	}
 
-	// wsl --unmount actually detaches the whole disk and doesn't accept --partition
-	bool bare = mount && !strcmp(mount, "--unmount");
-	for(int i = options_argindex; i < argc; ++i) {
-		if(!strcmp(argv[i], "--bare")) bare = true;
+	const char *cache_path = DefaultResolveCachePath();
+
+	struct ListContext list = { LIST_TEXT };
+	if(ParseListOption(tag, &list.format)) {
+		// the records go out as they're built, through one large buffer rather than a write per line;
+		// and in binary, since --list=nul is for consumers that split on NULs, not CRLFs
+		if(list.format != LIST_TEXT) _setmode(_fileno(stdout), _O_BINARY);
+		setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+		struct DeviceBackend *backend = CreateWin32DeviceBackend(FILE_READ_ATTRIBUTES);
+		if(!backend) return 1;
+		list.cache.dirty = true;
+		EnumDisks(backend, &PrintPartitionInfoCallback, &list);
+		backend->Destroy(backend);
+		fflush(stdout);
+		if(cache_path) SaveResolveCache(&list.cache, cache_path);
+		FreeResolveCache(&list.cache);
+		return 0;
 	}
 
-
-	char PartitionNumber[11];
-
-	if(!strcmp(tag, "--list")) {
-		EnumClassDevHandles(&GUID_DEVINTERFACE_DISK, FILE_READ_ATTRIBUTES, &PrintPartitionInfo, NULL);
-	} else if(!strncmp(tag, "PARTUUID=", 9)) {
-		struct FindGUIDContext context = { 0 };
-		if(parse_guid(tag+9, &context.guid)) {
-			EnumClassDevHandles(&GUID_DEVINTERFACE_DISK, FILE_READ_ATTRIBUTES, &MatchPARTUUID, &context);
-			wsl_device_argv[0] = context.PhysicalDrive;
-			if(!bare) {
-				wsl_device_argv[1] = "--partition";
-				_ultoa_s(context.PartitionNumber, PartitionNumber, sizeof(PartitionNumber), 10);
-				wsl_device_argv[2] = PartitionNumber;
-			}
-		} else {
-			fprintf(stderr, "*** %s: invalid GUID\n", tag);
+	// batch mode: several tags resolved by one enumeration, with one result line per tag
+	bool batch = tag[0] == '@';
+	struct TagArguments tags = { 0 };
+	bool success = tag[0] == '@' ? ReadTagFile(&tags, tag+1) : AddTagArgument(&tags, tag);
+	for(; success && options_argindex < argc && IsTagArgument(argv[options_argindex]); ++options_argindex) {
+		const char *arg = argv[options_argindex];
+		success = arg[0] == '@' ? ReadTagFile(&tags, arg+1) : AddTagArgument(&tags, arg);
+		batch = true;
+	}
+	if(!success) return 1;
+
+	bool bare = false;
+	char options[2048] = ""; // what gets passed on to wsl.exe
+	char image_index[MAX_PATH + 8], images_value[2048];
+	const char *images = GetEnvironment("WSL_MOUNT_FINDFS_IMAGES", images_value, sizeof(images_value));
+	struct FlightContext flight = { .cache_path = cache_path };
+	flight.image_index = ImageIndexPath(cache_path, image_index, sizeof(image_index));
+	for(int i = options_argindex; i < argc; ++i) {
+		if(!strcmp(argv[i], "--batch")) {
+			batch = true;
+			continue;
 		}
-	} else if(!strncmp(tag, "PTUUID=", 7)) {
-		RunAsHighIntegrity();
-		struct FindGUIDContext context = { 0 };
-		if(parse_guid(tag+7, &context.guid)) {
-			EnumClassDevHandles(&GUID_DEVINTERFACE_DISK, FILE_READ_ATTRIBUTES, &MatchPTUUID, &context);
-			wsl_device_argv[0] = context.PhysicalDrive;
-		} else {
-			fprintf(stderr, "*** %s: invalid GUID\n", tag);
+		// --parallel[=<n>] probes up to n disks at once (default 4), for systems with slow-to-open devices
+		if(!strncmp(argv[i], "--parallel", 10) && (argv[i][10] == '\0' || argv[i][10] == '=')) {
+			flight.ProbeWorkers = argv[i][10] ? strtoul(argv[i] + 11, NULL, 10) : 4;
+			continue;
 		}
-	} else {
-		fputs("*** wsl-mount-findfs.exe: <Tag> must be from the GPT partition table (i.e. PARTUUID|PTUUID=...)\n"
-		      "    Other linux blkid tags (e.g. UUID=, LABEL=, etc) are only parsed by linux\n"
-		      "    and so cannot be used to locate the device to attach to wsl\n", stderr);
-		return 1;
+		// --images=<dir>[;<dir>...] also searches the disk images in those directories
+		if(!strncmp(argv[i], "--images=", 9)) {
+			images = argv[i] + 9;
+			continue;
+		}
+		if(!strcmp(argv[i], "--bare")) bare = true;
+		AppendParameter(options, sizeof(options), argv[i]);
 	}
-
-	if(mount && wsl_device_argv[0]) {
-		char wsl_exe[MAX_PATH];
-		if(!SearchPathA(NULL, "wsl.exe", NULL, MAX_PATH, wsl_exe, NULL)) {
-			strcpy_s(wsl_exe, sizeof(wsl_exe), "wsl.exe");
-			fprintf(stderr, "*** wsl.exe not found by SearchPath()\n");
+	if(!images) images = "";
+
+	bool elevate = false;
+	struct FlightRequest *requests = calloc(tags.count ? tags.count : 1, sizeof(struct FlightRequest));
+	if(!requests) return 1;
+	for(size_t i = 0; i < tags.count; ++i) {
+		struct Tag parsed;
+		tags.tags[i].valid = ParseTag(tags.tags[i].arg, &parsed);
+		if(!tags.tags[i].valid && !batch) return 1;
+		// the images are part of the request, as whoever runs it may have been started with different ones
+		int len = snprintf(requests[i].request, sizeof(requests[i].request), "%s\t%d\t%s\t%s\t%s",
+		                   mount ? mount : "-", bare, options, images, tags.tags[i].arg);
+		if(len < 0 || (size_t)len >= sizeof(requests[i].request)) {
+			fprintf(stderr, "*** too long: %s %s --images=%s\n", tags.tags[i].arg, options, images);
+			return 1;
 		}
-
-		SHELLEXECUTEINFOA info = { .cbSize = sizeof(SHELLEXECUTEINFO) };
-		info.fMask = SEE_MASK_NOCLOSEPROCESS;
-		info.lpVerb = "runas";
-		info.lpFile = "wsl.exe";
-		char wsl_parameters[2048] = ""; // ShellExecute lpParameters has a lower limit than the 32768 of CreateProcess
-		info.lpParameters = wsl_parameters;
-
-		strcat_s(wsl_parameters,sizeof(wsl_parameters),mount);
-
-		for(int i = 0; wsl_device_argv[i]; ++i) {
-			strcat_s(wsl_parameters,sizeof(wsl_parameters)," ");
-			strcat_s(wsl_parameters,sizeof(wsl_parameters),wsl_device_argv[i]);
+		struct FlightTag check;
+		ParseFlightRequest(requests[i].request, &check);
+		if(check.valid && !FlightRequestAllowed(&check)) {
+			fprintf(stderr, "*** not passed on to wsl.exe: %s (only --bare, and --type, --options or --name with a plain value)\n", options);
+			return 1;
 		}
+		elevate = elevate || FlightRequestNeedsElevation(requests[i].request);
+	}
 
-		for(int i = options_argindex; i < argc; ++i) {
-			strcat_s(wsl_parameters,sizeof(wsl_parameters)," ");
-			strcat_s(wsl_parameters,sizeof(wsl_parameters),argv[i]);
+	// anything needing elevation shares it (and the enumeration) with whatever else is running at the time;
+	// plain partition lookups need neither, so don't wait behind anyone's UAC prompt
+	uint64_t start = TraceNow();
+	if(elevate && cache_path) {
+		flight.base = cache_path;
+		RunSingleFlight(flight.base, requests, tags.count, &RunFlight, &flight);
+	} else {
+		RunFlight(requests, tags.count, &flight);
+	}
+	TRACE_END(mount ? mount : "lookup", start, "%zu tags", tags.count);
+
+	int failed = 0;
+	for(size_t i = 0; i < tags.count; ++i) {
+		struct TagArgument *tag = &tags.tags[i];
+		char *device = strchr(requests[i].result, '\t');
+		tag->ExitCode = strtoul(requests[i].result, NULL, 10);
+		strcpy_s(tag->wsl_device_args, sizeof(tag->wsl_device_args), device ? device + 1 : "");
+		if(!device) tag->ExitCode = 1;
+		failed += tag->ExitCode != 0;
+	}
+	free(requests);
+	// the whole invocation, waiting on anyone else's flight included; the outcome is how many tags failed
+	char step[METRICS_STEP_MAX];
+	sprintf_s(step, sizeof(step), "findfs.%s", mount ? mount + 2 : "lookup");
+	METRIC_END(step, start, failed);
+
+	if(batch) {
+		int result = 0;
+		for(size_t i = 0; i < tags.count; ++i) {
+			const struct TagArgument *tag = &tags.tags[i];
+			printf("%s %lu%s%s\n", tag->arg, tag->ExitCode, *tag->wsl_device_args ? " " : "", tag->wsl_device_args);
+			if(tag->ExitCode) result = 1;
+			free(tag->arg);
 		}
-
-		if(!ShellExecuteExA(&info)) ReportLastError("ShellExecuteEx");
-		// FIXME: using runas like this loses the stdout/stderr from wsl.exe, even when *not* crossing integrity level isolation
-		// could look into CreateProcessElevated(): https://www.codeproject.com/Articles/19165/Vista-UAC-The-Definitive-Guide
-		// or the Elevation:Administrator! COM moniker https://learn.microsoft.com/en-us/windows/win32/com/the-com-elevation-moniker
-		// as other ways of getting access to high-integrity context that might better support capturing stdout/stderr
-
-		WaitForSingleObject(info.hProcess,INFINITE);
-		DWORD ExitCode;
-		GetExitCodeProcess(info.hProcess,&ExitCode);
-		CloseHandle(info.hProcess);
-		return ExitCode;
+		free(tags.tags);
+		return result;
 	}
 
-	for(int i = 0; wsl_device_argv[i]; ++i) {
-		if(i>0) fputc(' ', stdout);
-		fputs(wsl_device_argv[i], stdout);
-	}
+	// FIXME: wsl.exe is run from the elevated copy, in a console of its own, so its stdout/stderr are lost
+	// could look into CreateProcessElevated(): https://www.codeproject.com/Articles/19165/Vista-UAC-The-Definitive-Guide
+	// or the Elevation:Administrator! COM moniker https://learn.microsoft.com/en-us/windows/win32/com/the-com-elevation-moniker
+	// as other ways of getting access to high-integrity context that might better support capturing stdout/stderr
+	const struct TagArgument *result = &tags.tags[0];
+	if(mount && *result->wsl_device_args) return result->ExitCode;
+
+	fputs(result->wsl_device_args, stdout);
 	fputwc(L'\n', stdout);
 }
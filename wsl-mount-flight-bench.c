@@ -0,0 +1,229 @@
+//Starts many clients at once, as systemd does with the wsl-mount@ units at boot, each mounting one tag the way
+// wsl-mount-findfs.exe does (see SingleFlight.h), and counts how many disk enumerations and elevations (UAC prompts)
+// that actually cost, with and without coalescing them
+// The disks are simulated (see DeviceBackendFake.c), as is elevation: a sleep standing in for the UAC prompt and wsl.exe,
+// one at a time (as UAC prompts are). Each round starts with no cache (as at first boot); the clients share one after that.
+//
+// wsl-mount-flight-bench [--clients <n>] [--disks <n>] [--partitions <n>] [--latency <us>] [--elevation <ms>] [--rounds <n>]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "DeviceBackend.h"
+#include "ResolveCache.h"
+#include "SingleFlight.h"
+
+static struct {
+	unsigned long clients, disks, partitions, latency, elevation_ms, rounds;
+} options = { .clients = 16, .disks = 16, .partitions = 8, .latency = 200, .elevation_ms = 100, .rounds = 3 };
+
+static struct {
+	char cache[4096];
+	char uac[4096]; // locked for each simulated UAC prompt
+} paths;
+
+// what each client reports back, in one write() to the pipe (so atomically)
+struct ClientReport
+{
+	unsigned enumerations;
+	unsigned elevations;
+	unsigned batch; // requests it ran, if it led
+	bool led;
+	bool correct;
+	double elapsed_ms;
+};
+
+struct ClientContext
+{
+	struct FakeDeviceBackend *fake;
+	struct ClientReport report;
+	const char *base; // NULL when not coalescing
+	bool elevated;
+};
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+// what the leader does (see RunFlight in wsl-mount-findfs.c): one ResolveTags for the whole batch, and one (simulated)
+// elevation for all of its mounts, which then also serves everyone who queued up meanwhile
+static void RunBatch(struct FlightRequest *requests, size_t count, void *context)
+{
+	struct ClientContext *client = context;
+	struct ResolveRequest *resolve = calloc(count, sizeof(struct ResolveRequest));
+	if(!resolve) return;
+	bool mount = false;
+	for(size_t i = 0; i < count; ++i) {
+		const char *tag = strchr(requests[i].request, '\t');
+		mount = mount || !strncmp(requests[i].request, "--mount\t", 8);
+		ParseTagQuietly(tag ? tag + 1 : "", &resolve[i].tag);
+	}
+
+	struct ResolveCache cache;
+	LoadResolveCache(&cache, paths.cache);
+	unsigned lists = client->fake->ListCount;
+	ResolveTags(&client->fake->base, &cache, resolve, count);
+	client->report.enumerations += client->fake->ListCount - lists;
+	SaveResolveCache(&cache, paths.cache);
+	FreeResolveCache(&cache);
+	if(mount && !client->elevated) {
+		++client->report.elevations;
+		int uac = open(paths.uac, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		if(uac >= 0) flock(uac, LOCK_EX);
+		nanosleep(&(struct timespec){ options.elevation_ms / 1000, (long)(options.elevation_ms % 1000) * 1000000 }, NULL);
+		if(uac >= 0) close(uac);
+	}
+
+	for(size_t i = 0; i < count; ++i) {
+		if(resolve[i].result == RESOLVE_NOT_FOUND) {
+			snprintf(requests[i].result, sizeof(requests[i].result), "1\t");
+		} else {
+			snprintf(requests[i].result, sizeof(requests[i].result), "0\t\\\\.\\PhysicalDrive%u --partition %u", resolve[i].DriveNumber, resolve[i].PartitionNumber);
+		}
+	}
+	client->report.batch += (unsigned)count;
+	free(resolve);
+
+	if(mount && !client->elevated && client->base) {
+		client->elevated = true;
+		DrainSingleFlight(client->base, &RunBatch, client);
+		client->elevated = false;
+	}
+}
+
+static int Client(unsigned index, const char *base, int start_fd, int report_fd)
+{
+	struct ClientContext client = { .fake = CreateFakeDeviceBackend(), .base = base };
+	if(!client.fake || !FakeAddSyntheticDisks(client.fake, options.disks, PARTSTYLE_GPT, (uint32_t)options.partitions, 1)) return 1;
+	for(size_t i = 0; i < client.fake->count; ++i) FakeSetProbeLatency(client.fake, i, (unsigned)options.latency);
+
+	// each client mounts a different partition (until they run out)
+	const struct DiskInfo *disk = &client.fake->disks[index % client.fake->count];
+	const struct PartitionInfo *partition = &disk->PartitionEntry[index / client.fake->count % disk->PartitionCount];
+	struct Tag tag = { .kind = TAG_PARTUUID, .guid = partition->PartitionId };
+	char tag_str[160], expected[FLIGHT_LINE_MAX];
+	FormatTag(tag_str, sizeof(tag_str), &tag);
+	snprintf(expected, sizeof(expected), "0\t\\\\.\\PhysicalDrive%d --partition %u", disk->DriveNumber, partition->PartitionNumber);
+	struct FlightRequest request = { .id = "" };
+	snprintf(request.request, sizeof(request.request), "--mount\t%s", tag_str);
+
+	// all go together, once the parent closes its end
+	char c;
+	while(read(start_fd, &c, 1) < 0 && errno == EINTR) {}
+
+	double start = now_ms();
+	if(base) {
+		client.report.led = RunSingleFlight(base, &request, 1, &RunBatch, &client);
+	} else {
+		RunBatch(&request, 1, &client);
+		client.report.led = true;
+	}
+	client.report.elapsed_ms = now_ms() - start;
+	client.report.correct = !strcmp(request.result, expected);
+	if(write(report_fd, &client.report, sizeof(client.report)) != sizeof(client.report)) return 1;
+	client.fake->base.Destroy(&client.fake->base);
+	return 0;
+}
+
+static void Round(const char *scenario, const char *base)
+{
+	remove(paths.cache);
+	int start_pipe[2], report_pipe[2];
+	if(pipe(start_pipe) || pipe(report_pipe)) {
+		perror("pipe");
+		exit(1);
+	}
+
+	for(unsigned i = 0; i < options.clients; ++i) {
+		pid_t pid = fork();
+		if(pid < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if(!pid) {
+			close(start_pipe[1]);
+			close(report_pipe[0]);
+			_exit(Client(i, base, start_pipe[0], report_pipe[1]));
+		}
+	}
+	close(start_pipe[0]);
+	close(report_pipe[1]);
+	double start = now_ms();
+	close(start_pipe[1]);
+
+	struct ClientReport total = { 0 }, report;
+	unsigned leaders = 0, correct = 0, reports = 0, largest_batch = 0;
+	double slowest = 0;
+	while(read(report_pipe[0], &report, sizeof(report)) == sizeof(report)) {
+		++reports;
+		total.enumerations += report.enumerations;
+		total.elevations += report.elevations;
+		leaders += report.led;
+		correct += report.correct;
+		if(report.batch > largest_batch) largest_batch = report.batch;
+		if(report.elapsed_ms > slowest) slowest = report.elapsed_ms;
+	}
+	double elapsed = now_ms() - start;
+	close(report_pipe[0]);
+	while(wait(NULL) > 0) {}
+
+	printf("%-14s %3lu clients %3u leaders %3u enumerations %3u elevations  largest batch %3u  slowest %8.1fms  all done %8.1fms%s\n",
+	       scenario, options.clients, leaders, total.enumerations, total.elevations, largest_batch, slowest, elapsed,
+	       correct == options.clients && reports == options.clients ? "" : "  *** WRONG RESULTS");
+}
+
+int main(int argc, char *argv[])
+{
+	for(int i = 1; i < argc; ++i) {
+		unsigned long *option = NULL;
+		if(!strcmp(argv[i], "--clients")) option = &options.clients;
+		else if(!strcmp(argv[i], "--disks")) option = &options.disks;
+		else if(!strcmp(argv[i], "--partitions")) option = &options.partitions;
+		else if(!strcmp(argv[i], "--latency")) option = &options.latency;
+		else if(!strcmp(argv[i], "--elevation")) option = &options.elevation_ms;
+		else if(!strcmp(argv[i], "--rounds")) option = &options.rounds;
+		if(!option || i+1 >= argc) {
+			fputs("wsl-mount-flight-bench [--clients <n>] [--disks <n>] [--partitions <n>] [--latency <us>] [--elevation <ms>] [--rounds <n>]\n", stderr);
+			return 1;
+		}
+		*option = strtoul(argv[++i], NULL, 0);
+	}
+	if(!options.clients || !options.disks || !options.partitions || options.partitions > FAKE_MAX_GPT_PARTITIONS) {
+		fprintf(stderr, "*** --clients and --disks must be nonzero, and --partitions between 1 and %d\n", FAKE_MAX_GPT_PARTITIONS);
+		return 1;
+	}
+
+	char dir[] = "/tmp/wsl-mount-flight-bench.XXXXXX";
+	if(!mkdtemp(dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	char base[sizeof(dir) + 16];
+	snprintf(base, sizeof(base), "%s/flight", dir);
+	snprintf(paths.cache, sizeof(paths.cache), "%s/cache", dir);
+	snprintf(paths.uac, sizeof(paths.uac), "%s/uac", dir);
+
+	printf("%lu disks, %lu partitions each, %lu us/probe, %lu ms/elevation\n", options.disks, options.partitions, options.latency, options.elevation_ms);
+	for(unsigned long round = 0; round < options.rounds; ++round) {
+		Round("independent", NULL);
+		Round("single-flight", base);
+	}
+
+	char path[sizeof(base) + 16];
+	snprintf(path, sizeof(path), "%s.lock", base);
+	remove(path);
+	snprintf(path, sizeof(path), "%s.queue", base);
+	remove(path);
+	remove(paths.cache);
+	remove(paths.uac);
+	return rmdir(dir) ? 1 : 0; // (anything else left behind would be an orphaned result)
+}
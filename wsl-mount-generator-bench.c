@@ -0,0 +1,251 @@
+//Checks wsl-mount-generator's units (see MountGenerator.h) against the golden output below, for a sample crypttab and fstab,
+// and times generating them (--rounds times, each into an empty directory, as systemd runs it).
+// Any unit or symlink missing, different, or not expected is reported as a MISMATCH (with what was written instead).
+//
+// wsl-mount-generator-bench [--dir <dir>] [--rounds <n>]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "MountGenerator.h"
+
+static struct {
+	const char *dir;
+	unsigned long rounds;
+} options = { .dir = "/var/tmp", .rounds = 1000 };
+
+static const char crypttab[] =
+	"# <name> <source> <key> <options>\n"
+	"data PARTUUID=9cae1423-26bb-4676-87bf-ec2dd707b27f none luks,discard,x-wsl-mount\n"
+	"backup PTUUID=0b7e3bb2-5bd7-4f5e-9a0c-2d1a4d3c7e11 /etc/keys/backup.key luks,nofail,readonly,key-slot=1\n"
+	"archive SERIAL=WD-WX12345678 none luks,noauto\n"
+	// left to systemd-cryptsetup-generator
+	"root UUID=3f0a55a6-8c0e-4f55-9e4d-2b1f1c6e7a10 none luks\n"
+	// skipped (and reported): it would need quoting
+	"evil PTUUID=0b7e3bb2-5bd7-4f5e-9a0c-2d1a4d3c7e11 /etc/keys/$(reboot) luks\n";
+
+static const char fstab[] =
+	"UUID=5d2e7c61-0f7b-4c1a-8d63-3a9e8b1f2c44 / ext4 defaults 0 1\n"
+	"/dev/mapper/data /data btrfs subvol=@data,noauto,x-systemd.automount 0 0\n"
+	"PARTUUID=6b123123-236b-1b43-97ea-776941c0d2ee /scratch ext4 x-wsl-mount,nofail 0 2\n"
+	// the same partition again: one unit
+	"PARTUUID=6b123123-236b-1b43-97ea-776941c0d2ee /scratch/ro none x-wsl-mount,bind,ro 0 0\n"
+	"PARTLABEL=media /media/shared exfat x-wsl-mount,noauto 0 0\n";
+
+#define UNLOCK_UNIT(name, before) \
+	"# Automatically generated by wsl-mount-generator\n" \
+	"\n" \
+	"[Unit]\n" \
+	"Description=Attach and unlock " name "\n" \
+	"Documentation=man:crypttab(5)\n" \
+	"SourcePath=crypttab\n" \
+	"DefaultDependencies=no\n" \
+	"IgnoreOnIsolate=true\n" \
+	"After=cryptsetup-pre.target systemd-binfmt.service\n" \
+	"Before=blockdev@dev-mapper-" name ".target" before " umount.target\n" \
+	"Wants=blockdev@dev-mapper-" name ".target\n" \
+	"Conflicts=umount.target\n" \
+	"\n" \
+	"[Service]\n" \
+	"Type=oneshot\n" \
+	"RemainAfterExit=yes\n" \
+	"TimeoutSec=0\n" \
+	"KeyringMode=shared\n"
+
+#define ATTACH_UNIT(tag) \
+	"# Automatically generated by wsl-mount-generator\n" \
+	"\n" \
+	"[Unit]\n" \
+	"Description=Attach " tag "\n" \
+	"SourcePath=fstab\n" \
+	"DefaultDependencies=no\n" \
+	"After=systemd-binfmt.service\n" \
+	"Before=umount.target\n" \
+	"Conflicts=umount.target\n" \
+	"\n" \
+	"[Service]\n" \
+	"Type=oneshot\n" \
+	"RemainAfterExit=yes\n" \
+	"TimeoutSec=0\n" \
+	"ExecStart=/usr/local/sbin/wsl-mount-wait --mount \"" tag "\"\n"
+
+#define MEDIA_UNIT "wsl-mount@PARTLABEL\\x3dmedia.service"
+#define SCRATCH_UNIT "wsl-mount@PARTUUID\\x3d6b123123\\x2d236b\\x2d1b43\\x2d97ea\\x2d776941c0d2ee.service"
+
+// a unit (text) or a symlink (link)
+static const struct {
+	const char *path, *text, *link;
+} golden[] = {
+	{ "systemd-cryptsetup@data.service", UNLOCK_UNIT("data", " cryptsetup.target")
+	  "ExecStart=/bin/sh -c 'dev=$$(/usr/local/sbin/wsl-mount-wait --mount \"PARTUUID=9cae1423-26bb-4676-87bf-ec2dd707b27f\") && "
+	  "/usr/local/sbin/luks-askpass-wincred.exe \"data\" | /usr/sbin/cryptsetup open --type luks --key-file=- --allow-discards \"$$dev\" \"data\"'\n"
+	  "ExecStop=/usr/sbin/cryptsetup close \"data\"\n", NULL },
+	{ "systemd-cryptsetup@backup.service", UNLOCK_UNIT("backup", "")
+	  "ExecStart=/bin/sh -c 'dev=$$(/usr/local/sbin/wsl-mount-wait --mount \"PTUUID=0b7e3bb2-5bd7-4f5e-9a0c-2d1a4d3c7e11\") && "
+	  "/usr/sbin/cryptsetup open --type luks --key-file=\"/etc/keys/backup.key\" --readonly --key-slot=1 \"$$dev\" \"backup\"'\n"
+	  "ExecStop=/usr/sbin/cryptsetup close \"backup\"\n", NULL },
+	{ "systemd-cryptsetup@archive.service", UNLOCK_UNIT("archive", " cryptsetup.target")
+	  "ExecStart=/bin/sh -c 'dev=$$(/usr/local/sbin/wsl-mount-wait --mount \"SERIAL=WD-WX12345678\") && "
+	  "/usr/local/sbin/luks-askpass-wincred.exe \"archive\" | /usr/sbin/cryptsetup open --type luks --key-file=- \"$$dev\" \"archive\"'\n"
+	  "ExecStop=/usr/sbin/cryptsetup close \"archive\"\n", NULL },
+	{ SCRATCH_UNIT, ATTACH_UNIT("PARTUUID=6b123123-236b-1b43-97ea-776941c0d2ee"), NULL },
+	{ MEDIA_UNIT, ATTACH_UNIT("PARTLABEL=media"), NULL },
+	{ "cryptsetup.target.requires/systemd-cryptsetup@data.service", NULL, "../systemd-cryptsetup@data.service" },
+	{ "cryptsetup.target.wants/systemd-cryptsetup@backup.service", NULL, "../systemd-cryptsetup@backup.service" },
+	{ "dev-mapper-data.device.requires/systemd-cryptsetup@data.service", NULL, "../systemd-cryptsetup@data.service" },
+	{ "dev-mapper-backup.device.requires/systemd-cryptsetup@backup.service", NULL, "../systemd-cryptsetup@backup.service" },
+	{ "dev-mapper-archive.device.requires/systemd-cryptsetup@archive.service", NULL, "../systemd-cryptsetup@archive.service" },
+	{ "dev-disk-by\\x2dpartuuid-6b123123\\x2d236b\\x2d1b43\\x2d97ea\\x2d776941c0d2ee.device.requires/" SCRATCH_UNIT, NULL, "../" SCRATCH_UNIT },
+	{ "dev-disk-by\\x2dpartlabel-media.device.requires/" MEDIA_UNIT, NULL, "../" MEDIA_UNIT },
+};
+#define GOLDEN_COUNT (sizeof(golden) / sizeof(golden[0]))
+
+static const char *checked_dir;
+static bool correct;
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static bool WriteFile(const char *path, const char *text)
+{
+	FILE *f = fopen(path, "w");
+	if(!f || fputs(text, f) < 0 || fclose(f)) {
+		fprintf(stderr, "*** %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static int RemoveEntry(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	(void)st, (void)type, (void)ftw;
+	remove(path);
+	return 0;
+}
+
+// anything written that isn't in the golden output
+static int CheckExpected(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	(void)st, (void)ftw;
+	if(type == FTW_D || type == FTW_DP) return 0;
+	const char *relative = path + strlen(checked_dir) + 1;
+	for(size_t i = 0; i < GOLDEN_COUNT; ++i) {
+		if(!strcmp(golden[i].path, relative)) return 0;
+	}
+	printf("*** MISMATCH: %s was not expected\n", relative);
+	correct = false;
+	return 0;
+}
+
+static bool Check(const char *dir)
+{
+	correct = true;
+	for(size_t i = 0; i < GOLDEN_COUNT; ++i) {
+		char path[4400], got[8192];
+		snprintf(path, sizeof(path), "%s/%s", dir, golden[i].path);
+		ssize_t length;
+		if(golden[i].link) {
+			length = readlink(path, got, sizeof(got) - 1);
+		} else {
+			int fd = open(path, O_RDONLY | O_NOFOLLOW);
+			length = fd < 0 ? -1 : read(fd, got, sizeof(got) - 1);
+			if(fd >= 0) close(fd);
+		}
+		if(length < 0) {
+			printf("*** MISMATCH: %s is missing\n", golden[i].path);
+			correct = false;
+			continue;
+		}
+		got[length] = '\0';
+		const char *want = golden[i].link ? golden[i].link : golden[i].text;
+		if(strcmp(got, want)) {
+			printf("*** MISMATCH: %s is\n%s\nrather than\n%s\n", golden[i].path, got, want);
+			correct = false;
+		}
+	}
+	checked_dir = dir;
+	nftw(dir, &CheckExpected, 16, FTW_PHYS);
+	return correct;
+}
+
+int main(int argc, char *argv[])
+{
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "--dir") && i+1 < argc) options.dir = argv[++i];
+		else if(!strcmp(argv[i], "--rounds") && i+1 < argc) options.rounds = strtoul(argv[++i], NULL, 0);
+		else {
+			fputs("wsl-mount-generator-bench [--dir <dir>] [--rounds <n>]\n", stderr);
+			return 1;
+		}
+	}
+
+	char root[4096];
+	snprintf(root, sizeof(root), "%s/wsl-mount-generator-bench.XXXXXX", options.dir);
+	if(!mkdtemp(root)) {
+		fprintf(stderr, "*** mkdtemp: %s\n", strerror(errno));
+		return 1;
+	}
+	// relative paths, so that SourcePath= is the same wherever it runs
+	if(chdir(root) || !WriteFile("crypttab", crypttab) || !WriteFile("fstab", fstab)) return 1;
+	struct GeneratorConfig config = { .crypttab = "crypttab", .fstab = "fstab", .wait = "/usr/local/sbin/wsl-mount-wait",
+	                                  .askpass = "/usr/local/sbin/luks-askpass-wincred.exe", .cryptsetup = "/usr/sbin/cryptsetup" };
+
+	mkdir("units", 0755);
+	int volumes = GenerateMountUnits(&config, "units");
+	bool passed = Check("units");
+	if(volumes != 6) {
+		printf("*** MISMATCH: %d volumes rather than 6\n", volumes);
+		passed = false;
+	}
+	if(passed) printf("golden output: %zu units and symlinks, as expected (the evil entry skipped)\n", GOLDEN_COUNT);
+
+	// helpers that would need quoting in the units' sh -c '...': an askpass with a space loses the two entries that ask,
+	// a wait with a quote everything
+	struct GeneratorConfig unquotable[] = { config, config };
+	unquotable[0].askpass = "/mnt/c/Program Files/luks-askpass-wincred.exe";
+	unquotable[1].wait = "/usr/local/sbin/wsl-mount-wait'; reboot; '";
+	static const int unquotable_volumes[] = { 4, 0 };
+	int saved_stderr = dup(2), null = open("/dev/null", O_WRONLY);
+	dup2(null, 2);
+	for(size_t i = 0; i < sizeof(unquotable) / sizeof(*unquotable); ++i) {
+		char dir[64];
+		snprintf(dir, sizeof(dir), "unquotable.%zu", i);
+		mkdir(dir, 0755);
+		volumes = GenerateMountUnits(&unquotable[i], dir);
+		if(volumes != unquotable_volumes[i]) {
+			printf("*** MISMATCH: %d volumes with %s rather than %d\n", volumes, i ? unquotable[i].wait : unquotable[i].askpass,
+			       unquotable_volumes[i]);
+			passed = false;
+		}
+	}
+	if(passed) printf("helpers that would need quoting: their units skipped, as expected\n");
+
+
+	// (the evil entry's warning once is enough)
+	double elapsed = 0;
+	for(unsigned long round = 0; round < options.rounds; ++round) {
+		char dir[64];
+		snprintf(dir, sizeof(dir), "units.%lu", round);
+		mkdir(dir, 0755);
+		double start = now_ms();
+		GenerateMountUnits(&config, dir);
+		elapsed += now_ms() - start;
+	}
+	dup2(saved_stderr, 2);
+	close(null);
+	printf("%lu rounds: %.3fms per run (%zu units and symlinks)\n", options.rounds, elapsed / (double)(options.rounds ? options.rounds : 1),
+	       GOLDEN_COUNT);
+
+	if(chdir("/") == 0) nftw(root, &RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+//systemd generator writing the attach/unlock units for the crypttab and fstab volumes on disks that need wsl --mount (see MountGenerator.h)
+//
+// wsl-mount-generator [--crypttab <file>] [--fstab <file>] [--cryptsetup <exe>] <normal-dir> [<early-dir> <late-dir>]
+//
+// As a generator (/etc/systemd/system-generators/wsl-mount-generator, a symlink to the installed one, so that it finds
+// wsl-mount-wait and luks-askpass-wincred.exe next to it) it's given all three directories, and writes to the early one,
+// so that its systemd-cryptsetup@ units take the place of those systemd-cryptsetup-generator writes for the same entries.
+// Given just one directory (to try it out), it writes there.
+
+#include <stdio.h>
+#include <string.h>
+#include "Crypttab.h"
+#include "Interop.h"
+#include "MountGenerator.h"
+
+int main(int argc, char *argv[])
+{
+	char wait[4096], askpass[4096];
+	struct GeneratorConfig config = { .crypttab = DEFAULT_CRYPTTAB, .fstab = "/etc/fstab", .wait = wait, .askpass = askpass,
+	                                  .cryptsetup = "/usr/sbin/cryptsetup" };
+	int i = 1;
+	for(; i + 1 < argc && !strncmp(argv[i], "--", 2); i += 2) {
+		if(!strcmp(argv[i], "--crypttab")) config.crypttab = argv[i+1];
+		else if(!strcmp(argv[i], "--fstab")) config.fstab = argv[i+1];
+		else if(!strcmp(argv[i], "--cryptsetup")) config.cryptsetup = argv[i+1];
+		else break;
+	}
+	if(argc - i != 1 && argc - i != 3) {
+		fputs("wsl-mount-generator [--crypttab <file>] [--fstab <file>] [--cryptsetup <exe>] <normal-dir> [<early-dir> <late-dir>]\n", stderr);
+		return 1;
+	}
+	LocateHelper("wsl-mount-wait", NULL, wait, sizeof(wait));
+	LocateHelper("luks-askpass-wincred.exe", NULL, askpass, sizeof(askpass));
+
+	return GenerateMountUnits(&config, argc - i == 3 ? argv[i+1] : argv[i]) < 0 ? 1 : 0;
+}
@@ -0,0 +1,306 @@
+//Checks wsl-mount-idle's teardown against a fake --root: proc/self/mountinfo and proc/meminfo, sys/class/block (symlinks into
+// sys/devices, as the kernel has them) and dev/mapper, with stand-in umount, cryptsetup and wsl-mount-findfs scripts that log
+// what they were asked to do (and do it to the fake files), and times how long each scenario took to be torn down.
+// Each scenario's log is compared with what should have been run, in order; anything else is reported as a MISMATCH.
+//
+// wsl-mount-idle-bench [--dir <dir>] [--exe <wsl-mount-idle>]
+//
+// The volumes are data (dm-crypt, /dev/mapper/data on sdc1) and scratch (plain, /dev/sdd1), idle after 200ms.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "Interop.h"
+
+#define IDLE "0.2"
+#define INTERVAL "0.05"
+#define IO_INTERVAL_MS 50
+#define TIMEOUT_MS 10000
+
+static struct {
+	const char *dir;
+	char exe[PATH_MAX];
+} options = { .dir = "/tmp" };
+
+// one script for all three, telling which it is by its name; $IDLE_BENCH_ROOT is the fake root
+// umount takes the mount out of mountinfo (rewriting it in place, as wsl-mount-idle keeps it open), unless <root>/busy
+// says to fail the once; cryptsetup close lets go of the partition under dm-0
+static const char standin[] =
+	"#!/bin/sh\n"
+	"root=\"$IDLE_BENCH_ROOT\"\n"
+	"name=$(basename \"$0\")\n"
+	"echo \"$name $*\" >> \"$root/log\"\n"
+	"case \"$name\" in\n"
+	"umount)\n"
+	"\tif [ -e \"$root/busy\" ]; then rm \"$root/busy\"; exit 32; fi\n"
+	"\tgrep -v \" $1 \" \"$root/proc/self/mountinfo\" > \"$root/mountinfo.new\"\n"
+	"\tcat \"$root/mountinfo.new\" > \"$root/proc/self/mountinfo\";;\n"
+	"cryptsetup)\n"
+	"\trm -f \"$root/sys/devices/sdc/sdc1/holders/dm-0\";;\n"
+	"esac\n";
+
+static const char config[] =
+	"data PARTLABEL=data data /data ext4\n"
+	"scratch PARTLABEL=scratch - /scratch ext4\n";
+
+static const char mountinfo[] =
+	"36 25 254:0 / /data rw,relatime shared:1 - ext4 /dev/mapper/data rw\n"
+	"37 25 8:49 / /scratch rw,relatime shared:2 - ext4 /dev/sdd1 rw\n";
+
+static const char block_stat[] = "       0        0        0        0        0        0        0        0        0        0        0\n";
+
+struct Scenario
+{
+	const char *name;
+	const char *mounts; // besides /data and /scratch
+	bool busy; // umount fails the first time
+	unsigned io_ms; // how long /data's device keeps doing I/O
+	const char *expected; // the stand-ins' log
+};
+
+static const struct Scenario scenarios[] = {
+	{ "idle", "", false, 0,
+	  "umount /data\ncryptsetup close data\nwsl-mount-findfs --unmount PARTLABEL=data\n"
+	  "umount /scratch\nwsl-mount-findfs --unmount PARTLABEL=scratch\n" },
+	// another partition of data's disk is mounted, so it mustn't be detached
+	{ "disk still in use", "38 25 8:34 / /other rw,relatime shared:3 - ext4 /dev/sdc2 rw\n", false, 0,
+	  "umount /data\ncryptsetup close data\n"
+	  "umount /scratch\nwsl-mount-findfs --unmount PARTLABEL=scratch\n" },
+	// data is tried again after another idle period, scratch goes ahead meanwhile
+	{ "busy mount", "", true, 0,
+	  "umount /data\n"
+	  "umount /scratch\nwsl-mount-findfs --unmount PARTLABEL=scratch\n"
+	  "umount /data\ncryptsetup close data\nwsl-mount-findfs --unmount PARTLABEL=data\n" },
+	// data is only idle once the I/O stops
+	{ "I/O for 600ms", "", false, 600,
+	  "umount /scratch\nwsl-mount-findfs --unmount PARTLABEL=scratch\n"
+	  "umount /data\ncryptsetup close data\nwsl-mount-findfs --unmount PARTLABEL=data\n" },
+};
+#define SCENARIO_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static bool WriteFile(const char *root, const char *path, const char *text)
+{
+	char full[PATH_MAX];
+	snprintf(full, sizeof(full), "%s/%s", root, path);
+	FILE *f = fopen(full, "w");
+	if(!f || fputs(text, f) < 0 || fclose(f)) {
+		fprintf(stderr, "*** %s: %s\n", full, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static bool MakeDirs(const char *root, const char *path)
+{
+	char full[PATH_MAX];
+	if((size_t)snprintf(full, sizeof(full), "%s/%s", root, path) >= sizeof(full)) return false;
+	for(char *slash = full + strlen(root) + 1; (slash = strchr(slash, '/')); ++slash) {
+		*slash = '\0';
+		mkdir(full, 0755);
+		*slash = '/';
+	}
+	if(mkdir(full, 0755) && errno != EEXIST) {
+		fprintf(stderr, "*** mkdir %s: %s\n", full, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static bool Link(const char *root, const char *path, const char *target)
+{
+	char full[PATH_MAX];
+	snprintf(full, sizeof(full), "%s/%s", root, path);
+	if(symlink(target, full)) {
+		fprintf(stderr, "*** symlink %s: %s\n", full, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static bool MakeRoot(const char *root, const struct Scenario *scenario)
+{
+	static const char *dirs[] = {
+		"proc/self", "sys/class/block", "dev/mapper", "bin",
+		"sys/devices/sdc/holders", "sys/devices/sdc/sdc1/holders", "sys/devices/sdc/sdc2/holders",
+		"sys/devices/sdd/holders", "sys/devices/sdd/sdd1/holders", "sys/devices/virtual/block/dm-0/slaves",
+	};
+	static const char *links[][2] = {
+		{ "sys/class/block/sdc", "../../devices/sdc" },
+		{ "sys/class/block/sdc1", "../../devices/sdc/sdc1" },
+		{ "sys/class/block/sdc2", "../../devices/sdc/sdc2" },
+		{ "sys/class/block/sdd", "../../devices/sdd" },
+		{ "sys/class/block/sdd1", "../../devices/sdd/sdd1" },
+		{ "sys/class/block/dm-0", "../../devices/virtual/block/dm-0" },
+		{ "dev/mapper/data", "../dm-0" },
+		{ "bin/umount", "standin" },
+		{ "bin/cryptsetup", "standin" },
+		{ "bin/wsl-mount-findfs", "standin" },
+	};
+	static const char *files[][2] = {
+		{ "sys/devices/sdc/sdc1/partition", "1\n" },
+		{ "sys/devices/sdc/sdc2/partition", "2\n" },
+		{ "sys/devices/sdd/sdd1/partition", "1\n" },
+		{ "sys/devices/sdc/sdc1/holders/dm-0", "" },
+		{ "sys/devices/virtual/block/dm-0/slaves/sdc1", "" },
+		{ "sys/devices/virtual/block/dm-0/stat", block_stat },
+		{ "sys/devices/sdd/sdd1/stat", block_stat },
+		{ "dev/dm-0", "" },
+		{ "dev/sdc2", "" },
+		{ "dev/sdd1", "" },
+		{ "proc/meminfo", "MemTotal:        8000000 kB\nMemAvailable:    6000000 kB\nCached:          1000000 kB\n" },
+		{ "config", config },
+		{ "bin/standin", standin },
+	};
+
+	for(size_t i = 0; i < sizeof(dirs) / sizeof(*dirs); ++i) {
+		if(!MakeDirs(root, dirs[i])) return false;
+	}
+	for(size_t i = 0; i < sizeof(files) / sizeof(*files); ++i) {
+		if(!WriteFile(root, files[i][0], files[i][1])) return false;
+	}
+	for(size_t i = 0; i < sizeof(links) / sizeof(*links); ++i) {
+		if(!Link(root, links[i][0], links[i][1])) return false;
+	}
+
+	char path[PATH_MAX], mounts[1024];
+	snprintf(path, sizeof(path), "%s/bin/standin", root);
+	chmod(path, 0755);
+	snprintf(mounts, sizeof(mounts), "%s%s", mountinfo, scenario->mounts);
+	return WriteFile(root, "proc/self/mountinfo", mounts) && WriteFile(root, "log", "") && (!scenario->busy || WriteFile(root, "busy", ""));
+}
+
+static void ReadLog(const char *root, char *log, size_t size)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/log", root);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	ssize_t length = fd < 0 ? 0 : read(fd, log, size - 1);
+	log[length > 0 ? length : 0] = '\0';
+	if(fd >= 0) close(fd);
+}
+
+static int RemoveEntry(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	(void)st, (void)type, (void)ftw;
+	remove(path);
+	return 0;
+}
+
+// runs wsl-mount-idle --once against a fresh root, returning whether the stand-ins were run as expected
+static bool RunScenario(const char *dir, unsigned index)
+{
+	const struct Scenario *scenario = &scenarios[index];
+	char root[PATH_MAX];
+	snprintf(root, sizeof(root), "%s/%u", dir, index);
+	if(mkdir(root, 0755) || !MakeRoot(root, scenario)) {
+		printf("*** MISMATCH: %s: could not set up %s\n", scenario->name, root);
+		return false;
+	}
+	setenv("IDLE_BENCH_ROOT", root, 1);
+
+	char config_path[PATH_MAX], umount[PATH_MAX], cryptsetup[PATH_MAX], findfs[PATH_MAX], output[PATH_MAX];
+	snprintf(config_path, sizeof(config_path), "%s/config", root);
+	snprintf(umount, sizeof(umount), "%s/bin/umount", root);
+	snprintf(cryptsetup, sizeof(cryptsetup), "%s/bin/cryptsetup", root);
+	snprintf(findfs, sizeof(findfs), "%s/bin/wsl-mount-findfs", root);
+	snprintf(output, sizeof(output), "%s/output", root);
+	char *argv[] = { options.exe, "--root", root, "--config", config_path, "--idle", IDLE, "--interval", INTERVAL,
+	                 "--umount", umount, "--cryptsetup", cryptsetup, "--findfs", findfs, "--once", NULL };
+
+	// what it reports (including the busy umount) goes to <root>/output, to look at if anything's amiss
+	int out = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	int saved_stderr = dup(2);
+	if(out >= 0) dup2(out, 2);
+	double start = now_ms();
+	pid_t pid = SpawnHelper(options.exe, argv, -1, out);
+	dup2(saved_stderr, 2);
+	close(saved_stderr);
+	if(out >= 0) close(out);
+	if(pid < 0) return false;
+
+	bool correct = true;
+	char log[4096];
+	char stat_path[PATH_MAX];
+	snprintf(stat_path, sizeof(stat_path), "%s/sys/devices/virtual/block/dm-0/stat", root);
+	for(unsigned written = 1; scenario->io_ms && now_ms() - start < scenario->io_ms; ++written) {
+		// rewritten in place, as wsl-mount-idle keeps it open
+		FILE *f = fopen(stat_path, "w");
+		if(f) {
+			fprintf(f, "%8u        0 %8u        0        0        0        0        0        0        0        0\n", written, written * 8);
+			fclose(f);
+		}
+		usleep(IO_INTERVAL_MS * 1000);
+	}
+	if(scenario->io_ms) {
+		ReadLog(root, log, sizeof(log));
+		if(strstr(log, "umount /data")) {
+			printf("*** MISMATCH: %s: /data was unmounted while it was still doing I/O\n", scenario->name);
+			correct = false;
+		}
+	}
+
+	int status;
+	pid_t waited;
+	while(!(waited = waitpid(pid, &status, WNOHANG)) && now_ms() - start < TIMEOUT_MS) usleep(5000);
+	double elapsed = now_ms() - start;
+	if(!waited) {
+		printf("*** MISMATCH: %s: still running after %ums (see %s)\n", scenario->name, TIMEOUT_MS, output);
+		kill(pid, SIGTERM);
+		WaitHelper(pid);
+		correct = false;
+	}
+
+	ReadLog(root, log, sizeof(log));
+	if(strcmp(log, scenario->expected)) {
+		printf("*** MISMATCH: %s: ran\n%srather than\n%s", scenario->name, log, scenario->expected);
+		correct = false;
+	}
+	printf("%-20s %8.1f ms to tear down  %s\n", scenario->name, elapsed, correct ? "as expected" : "*** MISMATCH");
+	return correct;
+}
+
+int main(int argc, char *argv[])
+{
+	LocateHelper("wsl-mount-idle", NULL, options.exe, sizeof(options.exe));
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "--dir") && i+1 < argc) options.dir = argv[++i];
+		else if(!strcmp(argv[i], "--exe") && i+1 < argc) snprintf(options.exe, sizeof(options.exe), "%s", argv[++i]);
+		else {
+			fputs("wsl-mount-idle-bench [--dir <dir>] [--exe <wsl-mount-idle>]\n", stderr);
+			return 1;
+		}
+	}
+
+	char dir[PATH_MAX];
+	snprintf(dir, sizeof(dir), "%s/wsl-mount-idle-bench.XXXXXX", options.dir);
+	if(!mkdtemp(dir)) {
+		fprintf(stderr, "*** mkdtemp: %s\n", strerror(errno));
+		return 1;
+	}
+
+	printf("idle after %ss, sampled every %ss\n", IDLE, INTERVAL);
+	bool passed = true;
+	for(unsigned i = 0; i < SCENARIO_COUNT; ++i) passed = RunScenario(dir, i) && passed;
+
+	// (left behind to look at, if anything didn't go as expected)
+	if(passed) nftw(dir, &RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+	else printf("fake roots left in %s\n", dir);
+	return passed ? 0 : 1;
+}
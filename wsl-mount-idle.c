@@ -0,0 +1,558 @@
+//tears volumes down again once nothing has used them for a while, since data.automount (or the broker) brings them up on demand
+// but nothing ever takes them down, leaving the dm-crypt device, its page cache and the attached disk pinned in the VM
+// For each volume of the broker's config (or those named) that's mounted, it samples the I/O statistics of the device
+// under the mount point (/sys/class/block/<dm-N>/stat, one pread each), and once those haven't moved, with nothing in flight,
+// for --idle seconds (600), it runs the teardown in order:
+//   umount <mount point>; cryptsetup close <Volume> (if encrypted); wsl-mount-findfs --unmount <Tag> (if attached by tag)
+// reporting how much memory that gave back (MemAvailable and Cached, from /proc/meminfo, before and after).
+// With --record, it first has wsl-mount-warm record what was in the page cache, for replaying after the next mount.
+// A mount that's busy (umount fails) or a close that fails counts as activity: it tries again after another idle period.
+// wsl --unmount detaches the whole disk, so it's skipped (leaving the disk attached) while anything else on that disk
+// is mounted or held open (by dm-crypt, say).
+//
+// wsl-mount-idle [--config <file>] [--idle <seconds>] [--interval <seconds>] [--record] [--root <dir>] [--umount <exe>]
+//                [--cryptsetup <exe>] [--findfs <exe>] [--warm <exe>] [--once] [--trace=<file>] [<Volume>...]
+//
+// Between samples (every --interval seconds, 10) it waits on /proc/self/mountinfo, so it also notices a volume being mounted
+// or unmounted straight away, and sleeps without waking at all while none are mounted.
+// --once exits as soon as there's nothing (left) mounted to tear down, rather than waiting for the next mount.
+//
+// For testing without windows (or root), --root reads proc/self/mountinfo, proc/meminfo and sys/class/block, and resolves
+// dev/ symlinks, in a scratch directory instead of /, and --umount/--cryptsetup/--findfs/--warm can point at stand-in scripts
+// (wsl-mount-idle-bench sets all that up, and checks what it does).
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "Interop.h"
+#include "MountConfig.h"
+#include "Trace.h"
+
+#define DEFAULT_IDLE 600
+#define DEFAULT_INTERVAL 10
+#define BLOCK_STAT_FIELDS 17
+#define BLOCK_STAT_IN_FLIGHT 8 // (field 9, the only one that isn't a running total)
+
+enum TeardownStep {
+	TEARDOWN_NONE, // mounted (or never seen mounted), nothing under way
+	TEARDOWN_CLOSE, // unmounted, still to be closed
+	TEARDOWN_DETACH, // closed, disk still to be detached
+};
+
+struct IdleVolume
+{
+	const struct MountEntry *config;
+	bool mounted;
+	char device[NAME_MAX + 1]; // the block device under the mount point (e.g. dm-0)
+	char partition[NAME_MAX + 1]; // the one that's on (e.g. sdc1); the same as device if that isn't dm
+	int stat_fd;
+	unsigned long long stat[BLOCK_STAT_FIELDS];
+	double active; // when it was last seen doing I/O (or mounted, or a teardown step last failed)
+	enum TeardownStep step;
+};
+
+struct MountTableEntry
+{
+	char *target;
+	char *source;
+};
+
+static struct {
+	struct IdleVolume *volumes;
+	size_t count;
+	struct MountTableEntry *mounts;
+	size_t mount_count;
+	int mountinfo;
+
+	const char *root;
+	double idle, interval;
+	char umount[PATH_MAX];
+	char cryptsetup[PATH_MAX];
+	char findfs[PATH_MAX];
+	char warm[PATH_MAX];
+	bool record;
+	bool once;
+} monitor = { .root = "", .idle = DEFAULT_IDLE, .interval = DEFAULT_INTERVAL };
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// <--root><path>
+static void RootPath(char *path, size_t size, const char *format, const char *name)
+{
+	int len = snprintf(path, size, "%s", monitor.root);
+	snprintf(path + len, size - (size_t)len, format, name);
+}
+
+//
+// the mount table
+//
+
+// mountinfo escapes spaces and the like as \ooo
+static char * Unescape(char *str)
+{
+	char *out = str;
+	for(const char *in = str; *in; ++out) {
+		if(in[0] == '\\' && in[1] >= '0' && in[1] <= '3' && in[2] >= '0' && in[2] <= '7' && in[3] >= '0' && in[3] <= '7') {
+			*out = (char)((in[1] - '0') << 6 | (in[2] - '0') << 3 | (in[3] - '0'));
+			in += 4;
+		} else {
+			*out = *in++;
+		}
+	}
+	*out = '\0';
+	return str;
+}
+
+static void FreeMountTable(void)
+{
+	for(size_t i = 0; i < monitor.mount_count; ++i) {
+		free(monitor.mounts[i].target);
+		free(monitor.mounts[i].source);
+	}
+	free(monitor.mounts);
+	monitor.mounts = NULL;
+	monitor.mount_count = 0;
+}
+
+// <id> <parent> <major:minor> <root> <mount point> <options> [<optional>...] - <fstype> <source> <super options>
+static bool ReadMountTable(void)
+{
+	int fd = monitor.mountinfo;
+	char *data = NULL;
+	size_t size = 0, capacity = 0;
+	if(lseek(fd, 0, SEEK_SET) < 0) return false;
+	for(;;) {
+		if(capacity - size < 4096) {
+			char *grown = realloc(data, capacity += 16384);
+			if(!grown) {
+				free(data);
+				return false;
+			}
+			data = grown;
+		}
+		ssize_t n = read(fd, data + size, capacity - size - 1);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) break;
+		size += (size_t)n;
+	}
+	if(!data) return false;
+	data[size] = '\0';
+
+	FreeMountTable();
+	char *save_line;
+	for(char *line = strtok_r(data, "\n", &save_line); line; line = strtok_r(NULL, "\n", &save_line)) {
+		char *save, *field[5] = { NULL };
+		field[0] = strtok_r(line, " ", &save);
+		for(int i = 1; i < 5 && field[i-1]; ++i) field[i] = strtok_r(NULL, " ", &save);
+		char *separator = field[4] ? strtok_r(NULL, " ", &save) : NULL;
+		while(separator && strcmp(separator, "-")) separator = strtok_r(NULL, " ", &save);
+		char *fstype = separator ? strtok_r(NULL, " ", &save) : NULL;
+		char *source = fstype ? strtok_r(NULL, " ", &save) : NULL;
+		if(!source) continue;
+
+		struct MountTableEntry *grown = realloc(monitor.mounts, (monitor.mount_count + 1) * sizeof(struct MountTableEntry));
+		if(!grown) break;
+		monitor.mounts = grown;
+		monitor.mounts[monitor.mount_count].target = strdup(Unescape(field[4]));
+		monitor.mounts[monitor.mount_count].source = strdup(Unescape(source));
+		if(monitor.mounts[monitor.mount_count].target && monitor.mounts[monitor.mount_count].source) ++monitor.mount_count;
+	}
+	free(data);
+	return true;
+}
+
+// what's mounted there (the last mount on top, if several), NULL if nothing
+static const char * MountSource(const char *target)
+{
+	for(size_t i = monitor.mount_count; i-- > 0;) {
+		if(!strcmp(monitor.mounts[i].target, target)) return monitor.mounts[i].source;
+	}
+	return NULL;
+}
+
+//
+// block devices
+//
+
+// /dev/mapper/data -> dm-0 (under --root, following <root>/dev/mapper/data); false for a source that isn't a block device (tmpfs, 9p, ...)
+static bool BlockDeviceName(const char *source, char *name, size_t size)
+{
+	if(strncmp(source, "/dev/", 5)) return false;
+	char rooted[PATH_MAX], resolved[PATH_MAX];
+	RootPath(rooted, sizeof(rooted), "%s", source);
+	const char *path = realpath(rooted, resolved) ? resolved : source;
+	const char *slash = strrchr(path, '/');
+	snprintf(name, size, "%s", slash + 1);
+	return *name != '\0';
+}
+
+// the device a dm device sits on (its only slave, for dm-crypt); the device itself if it's not dm
+static void UnderlyingDevice(const char *device, char *name, size_t size)
+{
+	char path[PATH_MAX];
+	RootPath(path, sizeof(path), "/sys/class/block/%s/slaves", device);
+	snprintf(name, size, "%s", device);
+	DIR *dir = opendir(path);
+	if(!dir) return;
+	for(struct dirent *entry; (entry = readdir(dir));) {
+		if(entry->d_name[0] == '.') continue;
+		snprintf(name, size, "%s", entry->d_name);
+		break;
+	}
+	closedir(dir);
+}
+
+// reads <device>/stat, which has been open since the volume was mounted: each sample is one pread
+static bool ReadBlockStat(int fd, unsigned long long stat[BLOCK_STAT_FIELDS])
+{
+	char buf[512];
+	ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if(len <= 0) return false;
+	buf[len] = '\0';
+	char *p = buf;
+	for(int i = 0; i < BLOCK_STAT_FIELDS; ++i) {
+		char *end;
+		stat[i] = strtoull(p, &end, 10);
+		if(end == p) stat[i] = 0; // (older kernels have 11 or 15 fields)
+		p = end;
+	}
+	return true;
+}
+
+static bool DirectoryEmpty(const char *path)
+{
+	DIR *dir = opendir(path);
+	if(!dir) return true;
+	bool empty = true;
+	for(struct dirent *entry; empty && (entry = readdir(dir));) empty = entry->d_name[0] == '.';
+	closedir(dir);
+	return empty;
+}
+
+// whether <dir> (a disk's or partition's sysfs directory) is mounted, or held open by another device (e.g. dm-crypt)
+static bool BlockDeviceInUse(const char *dir, const char *name)
+{
+	char path[PATH_MAX + 16];
+	snprintf(path, sizeof(path), "%s/holders", dir);
+	if(!DirectoryEmpty(path)) return true;
+	for(size_t i = 0; i < monitor.mount_count; ++i) {
+		char mounted[NAME_MAX + 1];
+		if(BlockDeviceName(monitor.mounts[i].source, mounted, sizeof(mounted)) && !strcmp(mounted, name)) return true;
+	}
+	return false;
+}
+
+// whether anything on the disk containing this partition is still in use (naming it in user), so that wsl --unmount,
+// which detaches the whole disk, would pull it out from under someone
+static bool DiskInUse(const char *partition, char *user, size_t size)
+{
+	char path[PATH_MAX], disk[PATH_MAX];
+	RootPath(path, sizeof(path), "/sys/class/block/%s", partition);
+	if(!*partition || !realpath(path, disk)) {
+		snprintf(user, size, "%s (not found, so can't tell)", *partition ? partition : "its disk");
+		return true;
+	}
+	RootPath(path, sizeof(path), "/sys/class/block/%s/partition", partition);
+	if(!access(path, F_OK)) *strrchr(disk, '/') = '\0'; // (a partition's directory is inside its disk's)
+
+	snprintf(user, size, "%s", strrchr(disk, '/') + 1);
+	if(BlockDeviceInUse(disk, user)) return true;
+	DIR *dir = opendir(disk);
+	if(!dir) return false;
+	bool in_use = false;
+	for(struct dirent *entry; !in_use && (entry = readdir(dir));) {
+		char child[PATH_MAX + NAME_MAX + 16];
+		snprintf(child, sizeof(child), "%s/%s/partition", disk, entry->d_name);
+		if(entry->d_name[0] == '.' || access(child, F_OK)) continue;
+		*strrchr(child, '/') = '\0';
+		in_use = BlockDeviceInUse(child, entry->d_name);
+		if(in_use) snprintf(user, size, "%s", entry->d_name);
+	}
+	closedir(dir);
+	return in_use;
+}
+
+// a /proc/meminfo line, in MiB
+static double MemInfo(const char *key)
+{
+	char path[PATH_MAX], line[256];
+	RootPath(path, sizeof(path), "%s", "/proc/meminfo");
+	FILE *f = fopen(path, "r");
+	if(!f) return 0;
+	double kb = 0;
+	size_t len = strlen(key);
+	while(fgets(line, sizeof(line), f)) {
+		if(!strncmp(line, key, len) && line[len] == ':') {
+			kb = strtod(line + len + 1, NULL);
+			break;
+		}
+	}
+	fclose(f);
+	return kb / 1024;
+}
+
+//
+// teardown
+//
+
+static int RunStep(const char *name, const char *what, char *const argv[])
+{
+	uint64_t start = TRACE_BEGIN();
+	pid_t pid = SpawnHelper(argv[0], argv, -1, -1);
+	int result = pid > 0 ? WaitHelper(pid) : -1;
+	TRACE_END(name, start, "%s: %d", what, result);
+	return result;
+}
+
+static void Teardown(struct IdleVolume *volume)
+{
+	const struct MountEntry *config = volume->config;
+	double idle = now() - volume->active;
+	double available = MemInfo("MemAvailable"), cached = MemInfo("Cached");
+	uint64_t start = TRACE_BEGIN();
+
+	if(volume->step == TEARDOWN_NONE) {
+		if(monitor.record) {
+			char *argv[] = { monitor.warm, "record", config->target, NULL };
+			RunStep("wsl-mount-warm record", config->target, argv);
+		}
+		char *argv[] = { monitor.umount, config->target, NULL };
+		int result = RunStep("umount", config->target, argv);
+		if(result) {
+			// (umount exits with 32 for "target is busy": open files, or a process's working directory)
+			fprintf(stderr, "*** umount %s failed (%d), busy? trying again after another %.0fs idle\n", config->target, result, monitor.idle);
+			volume->active = now();
+			return;
+		}
+		volume->mounted = false;
+		close(volume->stat_fd);
+		volume->stat_fd = -1;
+		volume->step = TEARDOWN_CLOSE;
+	}
+	if(volume->step == TEARDOWN_CLOSE) {
+		if(config->key) {
+			char *argv[] = { monitor.cryptsetup, "close", config->name, NULL };
+			int result = RunStep("cryptsetup close", config->name, argv);
+			if(result) {
+				fprintf(stderr, "*** cryptsetup close %s failed (%d), trying again after another %.0fs idle\n", config->name, result, monitor.idle);
+				volume->active = now();
+				return;
+			}
+		}
+		volume->step = TEARDOWN_DETACH;
+	}
+	if(volume->step == TEARDOWN_DETACH) {
+		char user[NAME_MAX + 64];
+		ReadMountTable(); // (without what was just unmounted)
+		if(!config->is_tag) {
+			// (an image or device path, that wasn't attached by tag)
+		} else if(DiskInUse(volume->partition, user, sizeof(user))) {
+			printf("%s: leaving the disk attached, %s is still in use\n", config->name, user);
+		} else {
+			char *argv[] = { monitor.findfs, "--unmount", config->source, NULL };
+			int result = RunStep("wsl-mount-findfs --unmount", config->source, argv);
+			if(result) {
+				fprintf(stderr, "*** wsl-mount-findfs --unmount %s failed (%d), trying again after another %.0fs idle\n", config->source, result, monitor.idle);
+				volume->active = now();
+				return;
+			}
+		}
+		volume->step = TEARDOWN_NONE;
+	}
+	TRACE_END("Teardown", start, "%s after %.0fs idle", config->name, idle);
+
+	double available_after = MemInfo("MemAvailable"), cached_after = MemInfo("Cached");
+	printf("%s torn down after %.0fs idle, reclaimed %.1f MiB (MemAvailable %.1f -> %.1f MiB, Cached %.1f -> %.1f MiB)\n",
+	       config->name, idle, available_after - available, available, available_after, cached, cached_after);
+}
+
+//
+// monitoring
+//
+
+static void Mounted(struct IdleVolume *volume, const char *source)
+{
+	volume->mounted = true;
+	volume->step = TEARDOWN_NONE;
+	volume->active = now();
+	volume->device[0] = volume->partition[0] = '\0';
+	if(volume->stat_fd >= 0) close(volume->stat_fd);
+	volume->stat_fd = -1;
+
+	char path[PATH_MAX];
+	if(BlockDeviceName(source, volume->device, sizeof(volume->device))) {
+		UnderlyingDevice(volume->device, volume->partition, sizeof(volume->partition));
+		RootPath(path, sizeof(path), "/sys/class/block/%s/stat", volume->device);
+		volume->stat_fd = open(path, O_RDONLY | O_CLOEXEC);
+	}
+	if(volume->stat_fd < 0 || !ReadBlockStat(volume->stat_fd, volume->stat)) {
+		// (never idle, since there's no telling)
+		fprintf(stderr, "*** %s: no I/O statistics for %s (%s), not watching it\n", volume->config->name, source, volume->device);
+	}
+	printf("%s mounted on %s from %s, watching %s\n", volume->config->name, volume->config->target, source, volume->device);
+}
+
+static void Unmounted(struct IdleVolume *volume)
+{
+	volume->mounted = false;
+	if(volume->stat_fd >= 0) close(volume->stat_fd);
+	volume->stat_fd = -1;
+	// unmounted by someone else: the rest of the teardown follows after another idle period
+	if(volume->step == TEARDOWN_NONE) {
+		printf("%s unmounted\n", volume->config->name);
+		volume->step = TEARDOWN_CLOSE;
+		volume->active = now();
+	}
+}
+
+// returns whether there's anything (left) to watch
+static bool Sample(void)
+{
+	double t = now();
+	bool watching = false;
+	for(size_t i = 0; i < monitor.count; ++i) {
+		struct IdleVolume *volume = &monitor.volumes[i];
+		const char *source = MountSource(volume->config->target);
+		if(source && !volume->mounted) Mounted(volume, source);
+		else if(!source && volume->mounted) Unmounted(volume);
+
+		if(volume->mounted) {
+			unsigned long long stat[BLOCK_STAT_FIELDS];
+			if(volume->stat_fd < 0 || !ReadBlockStat(volume->stat_fd, stat)) {
+				volume->active = t;
+			} else if(stat[BLOCK_STAT_IN_FLIGHT] || memcmp(stat, volume->stat, sizeof(stat))) {
+				memcpy(volume->stat, stat, sizeof(stat));
+				volume->active = t;
+			}
+		}
+		if((volume->mounted || volume->step != TEARDOWN_NONE) && t - volume->active >= monitor.idle) Teardown(volume);
+		watching = watching || volume->mounted || volume->step != TEARDOWN_NONE;
+	}
+	return watching;
+}
+
+static volatile sig_atomic_t stopping;
+
+static void OnSignal(int sig)
+{
+	(void)sig;
+	stopping = 1;
+}
+
+static bool ParseSeconds(const char *value, double *seconds)
+{
+	char *end;
+	*seconds = strtod(value, &end);
+	return end != value && !*end && *seconds >= 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *config = DEFAULT_MOUNT_CONFIG;
+	TraceArguments(&argc, argv, "wsl-mount-idle");
+	LocateHelper("wsl-mount-findfs", NULL, monitor.findfs, sizeof(monitor.findfs));
+	LocateHelper("wsl-mount-warm", NULL, monitor.warm, sizeof(monitor.warm));
+	snprintf(monitor.umount, sizeof(monitor.umount), "umount");
+	snprintf(monitor.cryptsetup, sizeof(monitor.cryptsetup), "cryptsetup");
+
+	int i = 1;
+	bool usage = false;
+	for(; i < argc && !strncmp(argv[i], "--", 2); ++i) {
+		if(!strcmp(argv[i], "--once")) {
+			monitor.once = true;
+		} else if(!strcmp(argv[i], "--record")) {
+			monitor.record = true;
+		} else if(!strcmp(argv[i], "--config") && i+1 < argc) {
+			config = argv[++i];
+		} else if(!strcmp(argv[i], "--idle") && i+1 < argc) {
+			usage = usage || !ParseSeconds(argv[++i], &monitor.idle);
+		} else if(!strcmp(argv[i], "--interval") && i+1 < argc) {
+			usage = usage || !ParseSeconds(argv[++i], &monitor.interval) || !monitor.interval;
+		} else if(!strcmp(argv[i], "--root") && i+1 < argc) {
+			monitor.root = argv[++i];
+		} else if(!strcmp(argv[i], "--umount") && i+1 < argc) {
+			snprintf(monitor.umount, sizeof(monitor.umount), "%s", argv[++i]);
+		} else if(!strcmp(argv[i], "--cryptsetup") && i+1 < argc) {
+			snprintf(monitor.cryptsetup, sizeof(monitor.cryptsetup), "%s", argv[++i]);
+		} else if(!strcmp(argv[i], "--findfs") && i+1 < argc) {
+			snprintf(monitor.findfs, sizeof(monitor.findfs), "%s", argv[++i]);
+		} else if(!strcmp(argv[i], "--warm") && i+1 < argc) {
+			snprintf(monitor.warm, sizeof(monitor.warm), "%s", argv[++i]);
+		} else {
+			usage = true;
+			break;
+		}
+	}
+	if(usage) {
+		fputs("wsl-mount-idle [--config <file>] [--idle <seconds>] [--interval <seconds>] [--record] [--root <dir>] [--umount <exe>]\n"
+		      "               [--cryptsetup <exe>] [--findfs <exe>] [--warm <exe>] [--once] [--trace=<file>] [<Volume>...]\n", stderr);
+		return 1;
+	}
+
+	struct MountEntry *entries;
+	size_t count;
+	if(!LoadMountConfig(config, &entries, &count)) return 1;
+	monitor.volumes = calloc(count ? count : 1, sizeof(struct IdleVolume));
+	if(!monitor.volumes) return 1;
+	for(size_t e = 0; e < count; ++e) {
+		bool named = i == argc;
+		for(int a = i; !named && a < argc; ++a) named = !strcmp(argv[a], entries[e].name);
+		if(!named || !entries[e].target) continue;
+		monitor.volumes[monitor.count++] = (struct IdleVolume){ .config = &entries[e], .stat_fd = -1 };
+	}
+	for(int a = i; a < argc; ++a) {
+		bool found = false;
+		for(size_t v = 0; !found && v < monitor.count; ++v) found = !strcmp(argv[a], monitor.volumes[v].config->name);
+		if(!found) {
+			fprintf(stderr, "*** %s is not a volume with a mount point in %s\n", argv[a], config);
+			return 1;
+		}
+	}
+
+	char path[PATH_MAX];
+	RootPath(path, sizeof(path), "%s", "/proc/self/mountinfo");
+	monitor.mountinfo = open(path, O_RDONLY | O_CLOEXEC);
+	if(monitor.mountinfo < 0 || !ReadMountTable()) {
+		fprintf(stderr, "*** %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	struct sigaction action = { .sa_handler = &OnSignal }; // no SA_RESTART, so poll returns EINTR
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	// the kernel flags /proc/self/mountinfo with POLLPRI on every mount or unmount;
+	// a stand-in file (--root) never is, so that's just read again every interval
+	bool fake = *monitor.root != '\0';
+	while(!stopping) {
+		bool watching = Sample();
+		if(!watching && monitor.once) break;
+		struct pollfd fd = { .fd = monitor.mountinfo, .events = POLLPRI };
+		int timeout = watching || fake ? (int)(monitor.interval * 1e3) : -1;
+		int ready = poll(&fd, 1, timeout);
+		if((ready > 0 && (fd.revents & (POLLPRI | POLLERR))) || fake) ReadMountTable();
+	}
+
+	close(monitor.mountinfo);
+	FreeMountTable();
+	for(size_t v = 0; v < monitor.count; ++v) {
+		if(monitor.volumes[v].stat_fd >= 0) close(monitor.volumes[v].stat_fd);
+	}
+	free(monitor.volumes);
+	FreeMountConfig(entries, count);
+	return 0;
+}
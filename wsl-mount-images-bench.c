@@ -0,0 +1,404 @@
+//Benchmarks (and checks) looking tags up in a directory of disk images, with and without the image index
+// Generates --images sparse images in a temporary directory (or --dir): mostly GPT, with some MBR and fixed VHDs, a dynamic VHD
+// (which can't be looked into, so has nothing to find) and a GPT with a damaged primary header, plus files that aren't images
+// at all, then times listing every image with no index (with one, then --workers readers), with the index and nothing changed,
+// with --changed images touched since, and a single lookup.
+// Every layout read (or taken from the index) is compared with what was written, printing *** MISMATCH if any differs,
+// including after an image is rewritten with new GUIDs in the same size, which only the modification time gives away.
+// The images are just written, so their sectors are in the page cache: the cold numbers are the floor, not a spun-down disk
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "Crc32.h"
+#include "DeviceBackend.h"
+#include "Tag.h"
+
+#define SECTOR 512
+#define IMAGE_BYTES (16 * 1024 * 1024)
+#define GPT_ENTRIES 128
+#define GPT_ENTRY_SIZE 128
+#define GPT_ENTRY_SECTORS (GPT_ENTRIES * GPT_ENTRY_SIZE / SECTOR)
+
+static struct {
+	unsigned long images;
+	unsigned long partitions;
+	unsigned long workers;
+	unsigned long changed;
+	unsigned long rounds;
+	const char *dir;
+} options = { .images = 1000, .partitions = 4, .workers = 4, .changed = 10, .rounds = 3 };
+
+static char index_path[4096];
+static bool failed;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+enum ImageKind {
+	IMAGE_GPT,
+	IMAGE_GPT_DAMAGED, // primary header unreadable, so found by the backup
+	IMAGE_MBR,
+	IMAGE_FIXED_VHD, // a GPT disk followed by a VHD footer
+	IMAGE_DYNAMIC_VHD,
+};
+
+static enum ImageKind KindOf(unsigned long image)
+{
+	// (just the one of each of the odd ones, which are complained about whenever they're read)
+	if(image == 6) return IMAGE_DYNAMIC_VHD;
+	if(image == 5) return IMAGE_GPT_DAMAGED;
+	if(image % 7 == 3) return IMAGE_MBR;
+	if(image % 5 == 1) return IMAGE_FIXED_VHD;
+	return IMAGE_GPT;
+}
+
+static void ImagePath(char *path, size_t size, unsigned long image)
+{
+	enum ImageKind kind = KindOf(image);
+	const char *extension = kind == IMAGE_FIXED_VHD || kind == IMAGE_DYNAMIC_VHD ? "vhd" : image % 9 == 0 ? "RAW" : "img";
+	snprintf(path, size, "%s/image%05lu.%s", options.dir, image, extension);
+}
+
+static void put_le16(uint8_t *p, uint16_t v) { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); }
+static void put_le32(uint8_t *p, uint32_t v) { put_le16(p, (uint16_t)v); put_le16(p + 2, (uint16_t)(v >> 16)); }
+static void put_le64(uint8_t *p, uint64_t v) { put_le32(p, (uint32_t)v); put_le32(p + 4, (uint32_t)(v >> 32)); }
+
+static void guid_to_le_bytes(uint8_t bytes[16], const GUID *guid)
+{
+	put_le32(bytes, guid->Data1);
+	put_le16(bytes + 4, guid->Data2);
+	put_le16(bytes + 6, guid->Data3);
+	memcpy(bytes + 8, guid->Data4, 8);
+}
+
+// what each image should be read as; seed changes every GUID (and name), as a rewritten image would
+static void ExpectedLayout(unsigned long image, uint32_t seed, struct DiskInfo *disk)
+{
+	enum ImageKind kind = KindOf(image);
+	uint32_t partitions = kind == IMAGE_DYNAMIC_VHD ? 0 : kind == IMAGE_MBR && options.partitions > 4 ? 4 : (uint32_t)options.partitions;
+	*disk = (struct DiskInfo){ .DriveNumber = -1, .PartitionCount = partitions };
+	disk->PartitionEntry = calloc(partitions ? partitions : 1, sizeof(struct PartitionInfo));
+	if(kind == IMAGE_DYNAMIC_VHD) return;
+
+	if(kind == IMAGE_MBR) {
+		disk->PartitionStyle = PARTSTYLE_MBR;
+		disk->Signature = seed * 0x9E3779B9u ^ (uint32_t)image;
+	} else {
+		disk->PartitionStyle = PARTSTYLE_GPT;
+		disk->DiskId = (GUID){ seed * 0x9E3779B9u ^ (uint32_t)image, 0, 0x4000, { 0x80, (uint8_t)image, (uint8_t)(image >> 8), (uint8_t)(image >> 16) } };
+	}
+	for(uint32_t p = 0; p < partitions; ++p) {
+		struct PartitionInfo *partition = &disk->PartitionEntry[p];
+		partition->PartitionNumber = p + 1;
+		partition->StartingOffset = (uint64_t)(2048 + p * 2048) * SECTOR;
+		partition->PartitionLength = 2048 * SECTOR;
+		if(kind == IMAGE_MBR) {
+			partition->MbrType = 0x83;
+			continue;
+		}
+		partition->PartitionId = disk->DiskId;
+		partition->PartitionId.Data2 = (uint16_t)(p + 1);
+		parse_guid("0fc63daf-8483-4772-8e79-3d69d8477de4", &partition->PartitionType);
+		snprintf(partition->Name, sizeof(partition->Name), "image%lu-%u part%u", image, seed, p + 1);
+	}
+}
+
+static void WriteGptHeader(uint8_t *header, const struct DiskInfo *disk, uint64_t lba, uint64_t alternate, uint64_t entries_lba,
+                           uint64_t sectors, uint32_t entries_crc)
+{
+	memset(header, 0, SECTOR);
+	memcpy(header, "EFI PART", 8);
+	put_le32(header + 8, 0x00010000);
+	put_le32(header + 12, 92);
+	put_le64(header + 24, lba);
+	put_le64(header + 32, alternate);
+	put_le64(header + 40, 2 + GPT_ENTRY_SECTORS);
+	put_le64(header + 48, sectors - 2 - GPT_ENTRY_SECTORS);
+	guid_to_le_bytes(header + 56, &disk->DiskId);
+	put_le64(header + 72, entries_lba);
+	put_le32(header + 80, GPT_ENTRIES);
+	put_le32(header + 84, GPT_ENTRY_SIZE);
+	put_le32(header + 88, entries_crc);
+	put_le32(header + 16, crc32_ieee(0, header, 92));
+}
+
+static bool WriteImage(unsigned long image, uint32_t seed)
+{
+	char path[4096];
+	ImagePath(path, sizeof(path), image);
+	enum ImageKind kind = KindOf(image);
+	struct DiskInfo disk;
+	ExpectedLayout(image, seed, &disk);
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd < 0) {
+		fprintf(stderr, "*** %s: %s\n", path, strerror(errno));
+		FreeDiskInfo(&disk);
+		return false;
+	}
+	uint64_t sectors = IMAGE_BYTES / SECTOR;
+	uint8_t sector[SECTOR] = { 0 };
+	bool success = !ftruncate(fd, IMAGE_BYTES);
+
+	if(kind == IMAGE_MBR) {
+		put_le32(sector + 440, disk.Signature);
+		for(uint32_t p = 0; p < disk.PartitionCount; ++p) {
+			uint8_t *entry = sector + 446 + 16 * p;
+			entry[4] = disk.PartitionEntry[p].MbrType;
+			put_le32(entry + 8, (uint32_t)(disk.PartitionEntry[p].StartingOffset / SECTOR));
+			put_le32(entry + 12, (uint32_t)(disk.PartitionEntry[p].PartitionLength / SECTOR));
+		}
+		sector[510] = 0x55;
+		sector[511] = 0xAA;
+		success = success && pwrite(fd, sector, SECTOR, 0) == SECTOR;
+	} else if(kind != IMAGE_DYNAMIC_VHD) {
+		uint8_t entries[GPT_ENTRIES * GPT_ENTRY_SIZE] = { 0 };
+		for(uint32_t p = 0; p < disk.PartitionCount; ++p) {
+			const struct PartitionInfo *partition = &disk.PartitionEntry[p];
+			uint8_t *entry = entries + p * GPT_ENTRY_SIZE;
+			guid_to_le_bytes(entry, &partition->PartitionType);
+			guid_to_le_bytes(entry + 16, &partition->PartitionId);
+			put_le64(entry + 32, partition->StartingOffset / SECTOR);
+			put_le64(entry + 40, (partition->StartingOffset + partition->PartitionLength) / SECTOR - 1);
+			for(size_t c = 0; partition->Name[c] && c < 36; ++c) put_le16(entry + 56 + 2 * c, (uint8_t)partition->Name[c]);
+		}
+		uint32_t entries_crc = crc32_ieee(0, entries, sizeof(entries));
+
+		// protective MBR
+		sector[446 + 4] = 0xEE;
+		put_le32(sector + 446 + 8, 1);
+		put_le32(sector + 446 + 12, (uint32_t)(sectors - 1));
+		sector[510] = 0x55;
+		sector[511] = 0xAA;
+		success = success && pwrite(fd, sector, SECTOR, 0) == SECTOR;
+
+		WriteGptHeader(sector, &disk, 1, sectors - 1, 2, sectors, entries_crc);
+		if(kind == IMAGE_GPT_DAMAGED) sector[60] ^= 0xFF; // (in the disk GUID, so only the CRC gives it away)
+		success = success && pwrite(fd, sector, SECTOR, SECTOR) == SECTOR;
+		success = success && pwrite(fd, entries, sizeof(entries), 2 * SECTOR) == (ssize_t)sizeof(entries);
+		WriteGptHeader(sector, &disk, sectors - 1, 1, sectors - 1 - GPT_ENTRY_SECTORS, sectors, entries_crc);
+		success = success && pwrite(fd, entries, sizeof(entries), (off_t)(sectors - 1 - GPT_ENTRY_SECTORS) * SECTOR) == (ssize_t)sizeof(entries);
+		success = success && pwrite(fd, sector, SECTOR, (off_t)(sectors - 1) * SECTOR) == SECTOR;
+	}
+
+	// a VHD footer after the disk (the dynamic one's copy at the start is all there is to tell it by)
+	if(kind == IMAGE_FIXED_VHD || kind == IMAGE_DYNAMIC_VHD) {
+		memset(sector, 0, sizeof(sector));
+		memcpy(sector, "conectix", 8);
+		sector[63] = kind == IMAGE_FIXED_VHD ? 2 : 3;
+		success = success && pwrite(fd, sector, SECTOR, IMAGE_BYTES) == SECTOR;
+		if(kind == IMAGE_DYNAMIC_VHD) success = success && pwrite(fd, sector, SECTOR, 0) == SECTOR;
+	}
+
+	success = !close(fd) && success;
+	if(!success) fprintf(stderr, "*** could not write %s\n", path);
+	FreeDiskInfo(&disk);
+	return success;
+}
+
+static bool SameLayout(const struct DiskInfo *a, const struct DiskInfo *b)
+{
+	if(a->PartitionStyle != b->PartitionStyle || !IsEqualGUID(&a->DiskId, &b->DiskId) || a->Signature != b->Signature
+	   || a->PartitionCount != b->PartitionCount) {
+		return false;
+	}
+	for(uint32_t p = 0; p < a->PartitionCount; ++p) {
+		const struct PartitionInfo *pa = &a->PartitionEntry[p], *pb = &b->PartitionEntry[p];
+		if(pa->PartitionNumber != pb->PartitionNumber || pa->StartingOffset != pb->StartingOffset || pa->PartitionLength != pb->PartitionLength
+		   || !IsEqualGUID(&pa->PartitionId, &pb->PartitionId) || !IsEqualGUID(&pa->PartitionType, &pb->PartitionType)
+		   || pa->MbrType != pb->MbrType || strcmp(pa->Name, pb->Name)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+struct ScanContext
+{
+	const uint32_t *seeds; // what each image was last written with
+	unsigned long seen;
+	unsigned long mismatched;
+	const struct Tag *tag; // stop once this is found, if set
+	char found[4096];
+	uint32_t PartitionNumber;
+};
+
+static bool CheckImage(const struct DiskInfo *disk, void *context)
+{
+	struct ScanContext *scan = context;
+	const char *name = strrchr(disk->Drive, '/');
+	unsigned long image;
+	if(!name || sscanf(name, "/image%lu.", &image) != 1 || image >= options.images || strcmp(disk->Drive, disk->DevicePath) || disk->DriveNumber != -1) {
+		printf("*** MISMATCH: unexpected image %s\n", disk->Drive);
+		++scan->mismatched;
+		return true;
+	}
+	++scan->seen;
+
+	struct DiskInfo expected;
+	ExpectedLayout(image, scan->seeds[image], &expected);
+	if(!SameLayout(disk, &expected)) {
+		printf("*** MISMATCH: %s doesn't read back as written\n", disk->Drive);
+		++scan->mismatched;
+	}
+	FreeDiskInfo(&expected);
+
+	if(scan->tag && DiskMatchesTag(disk, scan->tag, &scan->PartitionNumber)) {
+		snprintf(scan->found, sizeof(scan->found), "%s", disk->Drive);
+		return false;
+	}
+	return true;
+}
+
+// lists every image (or until tag is found) through a backend of its own, as each wsl-mount-findfs.exe would,
+// the best of rounds (which should be 1 for a scenario that the first round changes, such as building the index)
+static void Scan(const char *scenario, unsigned long rounds, bool use_index, unsigned long workers, const uint32_t *seeds,
+                 const struct Tag *tag, unsigned long expect_read)
+{
+	double best = 0;
+	unsigned long listed = 0, read = 0;
+	for(unsigned long round = 0; round < rounds; ++round) {
+		struct ScanContext scan = { .seeds = seeds, .tag = tag };
+		double start = now();
+		struct ImageDeviceBackend *images = CreateImageDeviceBackend(options.dir, use_index ? index_path : NULL);
+		if(!images) {
+			fputs("*** out of memory\n", stderr);
+			exit(1);
+		}
+		images->base.ProbeWorkers = (unsigned)workers;
+		EnumDisks(&images->base, &CheckImage, &scan);
+		listed = images->count;
+		read = images->ReadCount;
+		images->base.Destroy(&images->base);
+		double elapsed = now() - start;
+		if(!round || elapsed < best) best = elapsed;
+
+		if(read != expect_read) {
+			printf("*** MISMATCH: %s read %lu images, expected %lu\n", scenario, read, expect_read);
+			failed = true;
+		}
+		if(!tag && scan.seen != listed) {
+			printf("*** MISMATCH: %s got %lu of the %lu images listed\n", scenario, scan.seen, listed);
+			failed = true;
+		}
+		if(scan.mismatched) failed = true;
+		if(tag && !scan.found[0]) {
+			printf("*** MISMATCH: %s didn't find its tag\n", scenario);
+			failed = true;
+		}
+	}
+	printf("%-28s %6lu listed %6lu read  %9.2f ms\n", scenario, listed, read, best * 1e3);
+}
+
+int main(int argc, char *argv[])
+{
+	for(int i = 1; i < argc; ++i) {
+		unsigned long *option = NULL;
+		if(!strcmp(argv[i], "--images")) option = &options.images;
+		else if(!strcmp(argv[i], "--partitions")) option = &options.partitions;
+		else if(!strcmp(argv[i], "--workers")) option = &options.workers;
+		else if(!strcmp(argv[i], "--changed")) option = &options.changed;
+		else if(!strcmp(argv[i], "--rounds")) option = &options.rounds;
+		else if(!strcmp(argv[i], "--dir") && i+1 < argc) {
+			options.dir = argv[++i];
+			continue;
+		}
+		if(!option || i+1 >= argc) {
+			fputs("wsl-mount-images-bench [--images <n>] [--partitions <n>] [--workers <n>] [--changed <n>] [--rounds <n>] [--dir <dir>]\n", stderr);
+			return 1;
+		}
+		*option = strtoul(argv[++i], NULL, 0);
+	}
+	if(options.images < 8 || !options.partitions || options.partitions > GPT_ENTRIES || !options.rounds || options.changed > options.images) {
+		fprintf(stderr, "*** --images must be at least 8, --partitions between 1 and %d, --rounds nonzero, and --changed at most --images\n", GPT_ENTRIES);
+		return 1;
+	}
+
+	char temp_dir[] = "/tmp/wsl-mount-images-bench.XXXXXX";
+	bool temporary = !options.dir;
+	if(temporary && !(options.dir = mkdtemp(temp_dir))) {
+		perror("mkdtemp");
+		return 1;
+	}
+	// the index lives elsewhere, so that it isn't mistaken for an image, nor its rewriting for a change to the directory
+	snprintf(index_path, sizeof(index_path), "%s.index", options.dir);
+
+	uint32_t *seeds = calloc(options.images, sizeof(uint32_t));
+	if(!seeds) return 1;
+	double start = now();
+	for(unsigned long image = 0; image < options.images; ++image) {
+		seeds[image] = 1;
+		if(!WriteImage(image, seeds[image])) return 1;
+	}
+	// things that aren't images, nor looked at
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/notes.txt", options.dir);
+	FILE *notes = fopen(path, "w");
+	if(notes) fclose(notes);
+	snprintf(path, sizeof(path), "%s/directory.img", options.dir);
+	mkdir(path, 0755);
+	printf("%lu images of %d MiB (GPT, MBR, fixed and dynamic VHD), %lu partitions each, written in %.0f ms\n",
+	       options.images, IMAGE_BYTES >> 20, options.partitions, (now() - start) * 1e3);
+
+	Scan("no index, 1 reader", options.rounds, false, 1, seeds, NULL, options.images);
+	char scenario[64];
+	snprintf(scenario, sizeof(scenario), "no index, %lu readers", options.workers);
+	Scan(scenario, options.rounds, false, options.workers, seeds, NULL, options.images);
+
+	// builds the index the rest use
+	remove(index_path);
+	Scan("building the index", 1, true, options.workers, seeds, NULL, options.images);
+	Scan("indexed, unchanged", options.rounds, true, options.workers, seeds, NULL, 0);
+
+	// touched (same contents, a new modification time), but for the first, which is rewritten with new GUIDs in the same size
+	struct timespec times[2] = { { 0, UTIME_OMIT }, { 1000000000, 0 } };
+	for(unsigned long i = 0; i < options.changed; ++i) {
+		unsigned long image = i * (options.images / options.changed);
+		ImagePath(path, sizeof(path), image);
+		if(!i) {
+			seeds[image] = 2;
+			if(!WriteImage(image, seeds[image])) return 1;
+		}
+		if(utimensat(AT_FDCWD, path, times, 0)) perror(path);
+	}
+	snprintf(scenario, sizeof(scenario), "indexed, %lu changed", options.changed);
+	Scan(scenario, 1, true, options.workers, seeds, NULL, options.changed);
+
+	// one removed: nothing to read, but the index no longer matches
+	ImagePath(path, sizeof(path), options.images - 1);
+	remove(path);
+	--options.images;
+	Scan("indexed, one removed", 1, true, options.workers, seeds, NULL, 0);
+
+	// a lookup of the rewritten image's last partition (listed first, so it's found without going further than that)
+	struct DiskInfo rewritten;
+	ExpectedLayout(0, seeds[0], &rewritten);
+	struct Tag tag = { .kind = TAG_PARTUUID, .guid = rewritten.PartitionEntry[rewritten.PartitionCount - 1].PartitionId };
+	FreeDiskInfo(&rewritten);
+	Scan("lookup, indexed", options.rounds, true, 1, seeds, &tag, 0);
+
+	for(unsigned long image = 0; temporary && image < options.images; ++image) {
+		ImagePath(path, sizeof(path), image);
+		remove(path);
+	}
+	if(temporary) {
+		snprintf(path, sizeof(path), "%s/notes.txt", options.dir);
+		remove(path);
+		snprintf(path, sizeof(path), "%s/directory.img", options.dir);
+		rmdir(path);
+		rmdir(options.dir);
+	}
+	remove(index_path);
+	free(seeds);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,409 @@
+//minimal init for a mount-only WSL distribution: brings up the volumes in its config, then idles
+// (the "running standalone" idea: \\wsl.localhost\<distro>\data served without booting a whole distribution and systemd)
+//
+// wsl-mount-init [--config <file>] [--findfs <exe>] [--askpass <exe>] [--timeout <seconds>] [--jobs <n>]
+//                [--test] [--once] [--budget <ms>]
+//
+// It's meant to be the distribution's /sbin/init (with [boot] systemd=true in its wsl.conf, WSL execs that as pid 1),
+// in which case it first mounts /proc, /sys, /dev and /run, and registers WSLInterop (the .exe helpers need it), as systemd would.
+// Then, in one pass each:
+// - resolves every tag in the config (/etc/wsl-mount-broker.conf, see MountConfig.h) with a single enumeration of the attached disks,
+//   attaching all the missing ones with a single wsl-mount-findfs --mount --batch (so at most one UAC prompt)
+// - unlocks every encrypted volume in-process with libcryptsetup (see LuksUnlock.h: concurrent KDFs, one askpass batch)
+// - mounts them with mount(2)
+// and reports how long each phase took from its start (and the total since boot, to compare with `systemd-analyze`).
+// After that it just reaps orphans until it's asked to stop, when it unmounts and closes what it brought up.
+//
+// Each phase's duration and failures (and each KDF's) go to the metrics log too (see Metrics.h).
+//
+// --test resolves and checks passphrases only (no device-mapper, no mounts, so no root needed; sources may be LUKS image files),
+// --once exits rather than idling, and --budget <ms> makes it exit with 2 if bringing everything up took longer than that.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "DeviceBackend.h"
+#include "DeviceWait.h"
+#include "Interop.h"
+#include "Metrics.h"
+#include "MountConfig.h"
+#ifdef HAVE_LIBCRYPTSETUP
+#include "LuksUnlock.h"
+#endif
+
+#define DEFAULT_TIMEOUT 30
+#define INTEROP_REGISTRATION ":WSLInterop:M::MZ::/init:PF"
+
+struct Volume
+{
+	struct MountEntry *config;
+	char device[PATH_MAX];
+	bool resolved, unlocked, mounted;
+	bool activated; // unlocked here, rather than already active, so it's ours to deactivate
+};
+
+static struct {
+	const char *config;
+	char findfs[PATH_MAX];
+	char askpass[PATH_MAX];
+	unsigned timeout;
+	unsigned jobs;
+	bool test;
+	bool once;
+	unsigned budget_ms;
+
+	struct Volume *volumes;
+	size_t count;
+	double started;
+} init = { .config = DEFAULT_MOUNT_CONFIG, .timeout = DEFAULT_TIMEOUT };
+
+static double now_ms(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static double elapsed_ms(void)
+{
+	return now_ms(CLOCK_MONOTONIC) - init.started;
+}
+
+//
+// pid 1
+//
+
+// what WSL's own init or systemd would otherwise have done
+static void EarlyMounts(void)
+{
+	static const struct {
+		const char *source, *target, *fstype;
+		unsigned long flags;
+	} mounts[] = {
+		{ "proc", "/proc", "proc", MS_NOSUID | MS_NODEV | MS_NOEXEC },
+		{ "sysfs", "/sys", "sysfs", MS_NOSUID | MS_NODEV | MS_NOEXEC },
+		{ "devtmpfs", "/dev", "devtmpfs", MS_NOSUID },
+		{ "tmpfs", "/run", "tmpfs", MS_NOSUID | MS_NODEV },
+		{ "binfmt_misc", "/proc/sys/fs/binfmt_misc", "binfmt_misc", MS_NOSUID | MS_NODEV | MS_NOEXEC },
+	};
+	for(size_t i = 0; i < sizeof(mounts) / sizeof(mounts[0]); ++i) {
+		mkdir(mounts[i].target, 0755);
+		// EBUSY: WSL already mounted it
+		if(mount(mounts[i].source, mounts[i].target, mounts[i].fstype, mounts[i].flags, NULL) && errno != EBUSY) {
+			fprintf(stderr, "*** mount %s: %s\n", mounts[i].target, strerror(errno));
+		}
+	}
+}
+
+// so the win32 helpers can run (see /etc/binfmt.d/WSLInterop.conf in the README)
+static void RegisterInterop(void)
+{
+	if(!access("/proc/sys/fs/binfmt_misc/WSLInterop", F_OK)) return;
+	int fd = open("/proc/sys/fs/binfmt_misc/register", O_WRONLY | O_CLOEXEC);
+	if(fd < 0 || write(fd, INTEROP_REGISTRATION, strlen(INTEROP_REGISTRATION)) < 0) {
+		fprintf(stderr, "*** registering WSLInterop: %s\n", strerror(errno));
+	}
+	if(fd >= 0) close(fd);
+}
+
+//
+// resolve
+//
+
+static bool ResolveDisk(const struct DiskInfo *disk, void *context)
+{
+	size_t *unresolved = context;
+	for(size_t i = 0; i < init.count; ++i) {
+		struct Volume *volume = &init.volumes[i];
+		uint32_t PartitionNumber;
+		if(volume->resolved || !DiskMatchesTag(disk, &volume->config->tag, &PartitionNumber)) continue;
+
+		if(!TagNamesPartition(&volume->config->tag)) {
+			snprintf(volume->device, sizeof(volume->device), "%s", disk->Drive);
+			volume->resolved = true;
+		} else {
+			volume->resolved = FindPartitionDevice(disk->Drive, PartitionNumber, volume->device, sizeof(volume->device));
+		}
+		if(volume->resolved) --*unresolved;
+	}
+	return *unresolved > 0;
+}
+
+// resolves whatever it can among the attached disks, returning how many tags are left
+static size_t ResolveAttached(struct DeviceBackend *backend)
+{
+	size_t unresolved = 0;
+	for(size_t i = 0; i < init.count; ++i) unresolved += !init.volumes[i].resolved;
+	if(unresolved) EnumDisks(backend, &ResolveDisk, &unresolved);
+	return unresolved;
+}
+
+// wsl-mount-findfs --mount <Tag>... --batch --bare for every tag that isn't attached yet
+static void AttachMissing(void)
+{
+	char **argv = calloc(init.count + 5, sizeof(char *));
+	if(!argv) return;
+	size_t argc = 0;
+	argv[argc++] = init.findfs;
+	argv[argc++] = "--mount";
+	for(size_t i = 0; i < init.count; ++i) {
+		if(!init.volumes[i].resolved) argv[argc++] = init.volumes[i].config->source;
+	}
+	argv[argc++] = "--batch";
+	argv[argc++] = "--bare";
+
+	pid_t pid = SpawnHelper(init.findfs, argv, -1, -1);
+	int result = pid > 0 ? WaitHelper(pid) : -1;
+	if(result) fprintf(stderr, "*** wsl-mount-findfs --mount exited with %d\n", result);
+	free(argv);
+}
+
+static size_t Resolve(void)
+{
+	for(size_t i = 0; i < init.count; ++i) {
+		struct Volume *volume = &init.volumes[i];
+		if(volume->config->is_tag) continue;
+		snprintf(volume->device, sizeof(volume->device), "%s", volume->config->source);
+		volume->resolved = true;
+	}
+
+	struct DeviceBackend *backend = CreateLinuxDeviceBackend();
+	if(!backend) return init.count;
+	// listening from before the first look, so that nothing can appear unnoticed in between
+	struct DeviceWait wait;
+	OpenDeviceWait(&wait, DEFAULT_DEVICE_LINKS);
+	size_t unresolved = ResolveAttached(backend);
+	if(unresolved) {
+		AttachMissing();
+		// wsl --mount returns before the disks show up in the VM, so check again each time a block device does
+		double attached = elapsed_ms();
+		for(double deadline = attached + init.timeout * 1e3; unresolved && elapsed_ms() < deadline;) {
+			DeviceWaitNext(&wait, (int)(deadline - elapsed_ms()) + 1);
+			unresolved = ResolveAttached(backend);
+		}
+		printf("attached +%.1fms, appeared %.1fms later (%u device events)\n", attached, elapsed_ms() - attached, wait.events);
+	}
+	CloseDeviceWait(&wait);
+	backend->Destroy(backend);
+
+	for(size_t i = 0; i < init.count; ++i) {
+		if(!init.volumes[i].resolved) fprintf(stderr, "*** %s: %s not found\n", init.volumes[i].config->name, init.volumes[i].config->source);
+	}
+	return unresolved;
+}
+
+//
+// unlock
+//
+
+static size_t Unlock(void)
+{
+	size_t failed = 0;
+#ifdef HAVE_LIBCRYPTSETUP
+	struct LuksVolume *luks = calloc(init.count ? init.count : 1, sizeof(struct LuksVolume));
+	struct Volume **owner = calloc(init.count ? init.count : 1, sizeof(struct Volume *));
+	struct KeyslotHints hints = { 0 };
+	const char *hints_path = DefaultKeyslotHintsPath();
+	if(!luks || !owner) {
+		free(luks);
+		free(owner);
+		return init.count;
+	}
+	if(hints_path) LoadKeyslotHints(&hints, hints_path);
+	struct LuksUnlock unlock = { .askpass = init.askpass, .jobs = init.jobs, .test = init.test, .hints = hints_path ? &hints : NULL };
+
+	size_t count = 0;
+	for(size_t i = 0; i < init.count; ++i) {
+		struct Volume *volume = &init.volumes[i];
+		if(!volume->config->key || !volume->resolved) continue;
+		struct LuksVolume *v = &luks[count];
+		snprintf(v->name, sizeof(v->name), "%s", volume->config->name);
+		snprintf(v->device, sizeof(v->device), "%s", volume->device);
+		v->target = volume->config->key;
+		v->key_slot = -1;
+		OpenLuksVolume(&unlock, v);
+		owner[count++] = volume;
+	}
+	UnlockLuksVolumes(&unlock, luks, count);
+
+	for(size_t i = 0; i < count; ++i) {
+		owner[i]->unlocked = luks[i].state == LUKS_UNLOCKED || luks[i].state == LUKS_ACTIVE;
+		owner[i]->activated = luks[i].state == LUKS_UNLOCKED;
+		if(owner[i]->unlocked) printf("%s unlocked (%.0f ms KDF, %u attempt(s))\n", luks[i].name, luks[i].kdf_ms, luks[i].attempts);
+		else ++failed;
+		CloseLuksVolume(&luks[i]);
+	}
+	if(hints_path) SaveKeyslotHints(&hints, hints_path);
+	FreeKeyslotHints(&hints);
+	free(owner);
+	free(luks);
+#else
+	for(size_t i = 0; i < init.count; ++i) {
+		if(!init.volumes[i].config->key) continue;
+		fprintf(stderr, "*** %s is encrypted, but this wsl-mount-init was built without libcryptsetup\n", init.volumes[i].config->name);
+		++failed;
+	}
+#endif
+	return failed;
+}
+
+//
+// mount
+//
+
+static size_t Mount(void)
+{
+	size_t failed = 0;
+	for(size_t i = 0; i < init.count; ++i) {
+		struct Volume *volume = &init.volumes[i];
+		const struct MountEntry *config = volume->config;
+		if(!config->target || !volume->resolved || (config->key && !volume->unlocked)) continue;
+
+		char source[PATH_MAX];
+		if(config->key) snprintf(source, sizeof(source), "/dev/mapper/%s", config->name);
+		else snprintf(source, sizeof(source), "%s", volume->device);
+		if(init.test) {
+			printf("%s would mount %s on %s\n", config->name, source, config->target);
+			continue;
+		}
+
+		char data[1024];
+		unsigned long flags = ParseMountOptions(config->options, data, sizeof(data));
+		mkdir(config->target, 0755);
+		if(!IsMountPoint(config->target) && mount(source, config->target, config->fstype, flags, data)) {
+			fprintf(stderr, "*** mount %s %s: %s\n", source, config->target, strerror(errno));
+			++failed;
+			continue;
+		}
+		volume->mounted = true;
+		printf("%s mounted on %s\n", config->name, config->target);
+	}
+	return failed;
+}
+
+static void Teardown(void)
+{
+	for(size_t i = init.count; i-- > 0;) {
+		struct Volume *volume = &init.volumes[i];
+		if(volume->mounted && umount2(volume->config->target, 0)) {
+			fprintf(stderr, "*** umount %s: %s\n", volume->config->target, strerror(errno));
+			continue;
+		}
+#ifdef HAVE_LIBCRYPTSETUP
+		if(volume->activated && !init.test) crypt_deactivate(NULL, volume->config->name);
+#endif
+	}
+}
+
+//
+// idle
+//
+
+// reaps orphans (as pid 1 must) until asked to stop
+static void Idle(void)
+{
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &signals, NULL);
+
+	for(;;) {
+		int sig = sigwaitinfo(&signals, NULL);
+		if(sig == SIGCHLD) {
+			while(waitpid(-1, NULL, WNOHANG) > 0) {}
+		} else if(sig == SIGTERM || sig == SIGINT) {
+			return;
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	init.started = now_ms(CLOCK_MONOTONIC);
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	init.jobs = cores > 0 ? (unsigned)cores : 1;
+	LocateHelper("wsl-mount-findfs.exe", NULL, init.findfs, sizeof(init.findfs));
+	LocateHelper("luks-askpass-wincred.exe", NULL, init.askpass, sizeof(init.askpass));
+
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "--config") && i+1 < argc) {
+			init.config = argv[++i];
+		} else if(!strcmp(argv[i], "--findfs") && i+1 < argc) {
+			snprintf(init.findfs, sizeof(init.findfs), "%s", argv[++i]);
+		} else if(!strcmp(argv[i], "--askpass") && i+1 < argc) {
+			snprintf(init.askpass, sizeof(init.askpass), "%s", argv[++i]);
+		} else if(!strcmp(argv[i], "--timeout") && i+1 < argc) {
+			init.timeout = (unsigned)strtoul(argv[++i], NULL, 0);
+		} else if(!strcmp(argv[i], "--jobs") && i+1 < argc) {
+			init.jobs = (unsigned)strtoul(argv[++i], NULL, 0);
+			if(!init.jobs) init.jobs = 1;
+		} else if(!strcmp(argv[i], "--budget") && i+1 < argc) {
+			init.budget_ms = (unsigned)strtoul(argv[++i], NULL, 0);
+		} else if(!strcmp(argv[i], "--test")) {
+			init.test = true;
+		} else if(!strcmp(argv[i], "--once")) {
+			init.once = true;
+		} else {
+			fputs("wsl-mount-init [--config <file>] [--findfs <exe>] [--askpass <exe>] [--timeout <seconds>] [--jobs <n>]\n"
+			      "               [--test] [--once] [--budget <ms>]\n", stderr);
+			return 1;
+		}
+	}
+
+	if(getpid() == 1) {
+		EarlyMounts();
+		RegisterInterop();
+	}
+	MetricsStart(NULL);
+
+	struct MountEntry *entries;
+	size_t count;
+	if(!LoadMountConfig(init.config, &entries, &count)) {
+		// as pid 1, exiting would end the distribution; better to stay up so someone can look at why
+		if(getpid() == 1) Idle();
+		return 1;
+	}
+	init.volumes = calloc(count ? count : 1, sizeof(struct Volume));
+	if(!init.volumes) return 1;
+	for(size_t i = 0; i < count; ++i) init.volumes[i].config = &entries[i];
+	init.count = count;
+
+	size_t failed = Resolve();
+	double resolved = elapsed_ms();
+	RecordMetricDuration("init.resolve", (uint64_t)(resolved * 1e3), (int)failed);
+	size_t unlock_failed = Unlock();
+	double unlocked = elapsed_ms();
+	RecordMetricDuration("init.unlock", (uint64_t)((unlocked - resolved) * 1e3), (int)unlock_failed);
+	size_t mount_failed = Mount();
+	double mounted = elapsed_ms();
+	RecordMetricDuration("init.mount", (uint64_t)((mounted - unlocked) * 1e3), (int)mount_failed);
+	failed += unlock_failed + mount_failed;
+
+	printf("resolved +%.1fms, unlocked +%.1fms, mounted +%.1fms (%.1fms since boot)%s\n", resolved, unlocked, mounted,
+	       now_ms(CLOCK_BOOTTIME), failed ? ", with failures" : "");
+	int result = failed ? 1 : 0;
+	if(init.budget_ms && mounted > init.budget_ms) {
+		fprintf(stderr, "*** took %.1fms, over the %ums budget\n", mounted, init.budget_ms);
+		result = 2;
+	}
+	fflush(stdout);
+
+	if(!init.once || getpid() == 1) {
+		Idle();
+		Teardown();
+	}
+	FreeMountConfig(entries, count);
+	free(init.volumes);
+	return result;
+}
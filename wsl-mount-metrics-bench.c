@@ -0,0 +1,184 @@
+//Measures what recording a step metric costs (see Metrics.h), and checks the log holds up with many processes appending at once:
+// - the cost of a metric point with recording off, and of a record appended with it on, from one process
+// - --processes processes each appending --records records at once, twice over (the second lot starting with the log full,
+//   so they all race to rotate it): no record may be lost, torn, or rotated away twice,
+//   and the percentiles of the durations (a known spread) must come out exactly
+//
+// wsl-mount-metrics-bench [--dir <dir>] [--processes <n>] [--records <n>]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "Metrics.h"
+#include "Trace.h"
+
+#define SPREAD 1000 // durations are 0..SPREAD-1 us, evenly
+
+static struct {
+	const char *dir;
+	unsigned long processes, records;
+} options = { .dir = "/var/tmp", .processes = 8, .records = 10000 };
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static int CompareDurations(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// every 10th is a cancelled prompt, as it were
+static void AppendRecords(unsigned long records)
+{
+	for(unsigned long i = 0; i < records; ++i) RecordMetricDuration("bench.step", i % SPREAD, i % 10 ? 0 : 1223);
+}
+
+// the processes all start appending together, once they've all opened the log (and rotated it, if it's full)
+static double RunProcesses(const char *log)
+{
+	int go[2];
+	if(pipe(go)) return 0;
+	double start = 0;
+	for(unsigned long p = 0; p < options.processes; ++p) {
+		if(fork() == 0) {
+			close(go[1]);
+			MetricsStart(log);
+			char byte;
+			if(read(go[0], &byte, 1) < 0) _exit(1);
+			AppendRecords(options.records);
+			_exit(metrics_enabled ? 0 : 1);
+		}
+	}
+	close(go[0]);
+	usleep(100000);
+	start = now_ms();
+	close(go[1]);
+	int failed = 0;
+	for(unsigned long p = 0; p < options.processes; ++p) {
+		int status;
+		if(wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) ++failed;
+	}
+	double elapsed = now_ms() - start;
+	if(failed) printf("*** MISMATCH: %d processes couldn't record\n", failed);
+	return elapsed;
+}
+
+// the records of the log (and its .old) should be exactly what was appended, and summarize as expected
+static bool Check(const char *log, size_t expected, const char *when)
+{
+	struct MetricRecord *records = NULL;
+	size_t count = 0;
+	ReadMetrics(log, &records, &count);
+	uint64_t *durations = calloc(count + 1, sizeof(uint64_t));
+	size_t cancelled = 0;
+	for(size_t i = 0; durations && i < count; ++i) {
+		durations[i] = records[i].duration_us;
+		cancelled += records[i].outcome == 1223;
+	}
+	if(durations) qsort(durations, count, sizeof(uint64_t), &CompareDurations);
+
+	struct stat st, old_st;
+	char old_path[4208];
+	snprintf(old_path, sizeof(old_path), "%s.old", log);
+	off_t bytes = (stat(log, &st) ? 0 : st.st_size) + (stat(old_path, &old_st) ? 0 : old_st.st_size);
+
+	bool correct = durations && count == expected && (size_t)bytes == expected * sizeof(struct MetricRecord)
+	               && cancelled == expected / 10;
+	// each duration appears expected/SPREAD times, so the one at rank r is (r-1)/(expected/SPREAD)
+	static const double percentiles[] = { 50, 90, 99 };
+	for(size_t i = 0; correct && i < sizeof(percentiles) / sizeof(percentiles[0]); ++i) {
+		size_t rank = expected * (size_t)percentiles[i] / 100;
+		uint64_t want = (uint64_t)((rank - 1) / (expected / SPREAD));
+		uint64_t got = MetricsPercentile(durations, count, percentiles[i]);
+		if(got != want) {
+			printf("*** MISMATCH: p%.0f %s is %llu, not %llu\n", percentiles[i], when, (unsigned long long)got, (unsigned long long)want);
+			correct = false;
+		}
+	}
+	if(count != expected || cancelled != expected / 10 || (size_t)bytes != expected * sizeof(struct MetricRecord)) {
+		printf("*** MISMATCH: %s, %zu records read (%zu cancelled), %lld bytes, expected %zu records\n", when, count, cancelled,
+		       (long long)bytes, expected);
+	}
+	if(correct) printf("%s: %zu records, p50 %llu p90 %llu p99 %llu us, %zu cancelled, as expected\n", when, count,
+	                   (unsigned long long)MetricsPercentile(durations, count, 50), (unsigned long long)MetricsPercentile(durations, count, 90),
+	                   (unsigned long long)MetricsPercentile(durations, count, 99), cancelled);
+	free(durations);
+	free(records);
+	return correct;
+}
+
+int main(int argc, char *argv[])
+{
+	for(int i = 1; i < argc; ++i) {
+		unsigned long *option = NULL;
+		if(!strcmp(argv[i], "--dir") && i+1 < argc) {
+			options.dir = argv[++i];
+			continue;
+		}
+		if(!strcmp(argv[i], "--processes")) option = &options.processes;
+		else if(!strcmp(argv[i], "--records")) option = &options.records;
+		if(!option || i+1 >= argc) {
+			fputs("wsl-mount-metrics-bench [--dir <dir>] [--processes <n>] [--records <n>]\n", stderr);
+			return 1;
+		}
+		*option = strtoul(argv[++i], NULL, 0);
+	}
+	// a multiple of the spread (for exact percentiles), and enough in all to fill the log once
+	if(!options.processes || options.records % SPREAD || options.processes * options.records < METRICS_MAX_RECORDS
+	   || options.processes * options.records > 2 * METRICS_MAX_RECORDS) {
+		fprintf(stderr, "*** --records must be a multiple of %d, and --processes times --records between %d and %d\n",
+		        SPREAD, METRICS_MAX_RECORDS, 2 * METRICS_MAX_RECORDS);
+		return 1;
+	}
+
+	char log[4200], old_path[4208];
+	snprintf(log, sizeof(log), "%s/wsl-mount-metrics-bench.%d.log", options.dir, (int)getpid());
+	snprintf(old_path, sizeof(old_path), "%s.old", log);
+	remove(log);
+	remove(old_path);
+
+	// a metric point with recording off, then on, from one process
+	const unsigned long points = 200000;
+	double start = now_ms();
+	for(unsigned long i = 0; i < points; ++i) {
+		uint64_t begin = TraceNow();
+		METRIC_END("bench.off", begin, 0);
+	}
+	double off = now_ms() - start;
+	if(!MetricsStart(log)) {
+		fprintf(stderr, "*** could not open %s\n", log);
+		return 1;
+	}
+	start = now_ms();
+	for(unsigned long i = 0; i < SPREAD * 10; ++i) {
+		uint64_t begin = TraceNow();
+		METRIC_END("bench.on", begin, 0);
+	}
+	double on = now_ms() - start;
+	printf("metric point: %.1fns off (reading the clock and a test), %.2fus recorded\n", off * 1e6 / points, on * 1e3 / (SPREAD * 10));
+	remove(log);
+
+	size_t total = options.processes * options.records;
+	double elapsed = RunProcesses(log);
+	printf("%lu processes x %lu records at once: %.1fms, %.2fus per record\n", options.processes, options.records, elapsed,
+	       elapsed * 1e3 / (double)options.records);
+	bool correct = Check(log, total, "after the first lot");
+
+	// the log's full now: the second lot all find it so, and only one of them may rotate it
+	elapsed = RunProcesses(log);
+	printf("%lu processes x %lu records at once, rotating first: %.1fms\n", options.processes, options.records, elapsed);
+	correct = Check(log, 2 * total, "after rotating") && correct;
+
+	remove(log);
+	remove(old_path);
+	return correct ? 0 : 1;
+}
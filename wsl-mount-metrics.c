@@ -0,0 +1,217 @@
+//summarizes the step metrics the helpers record (see Metrics.h): per step, how many runs, how many failed and how,
+// and the 50th/90th/99th percentile and worst durations, across every run still in the logs
+//
+// wsl-mount-metrics [--log <file>]... [--since <hours>] [--prometheus <file>|-]
+// wsl-mount-metrics record [--metrics=<file>] <step> <milliseconds> [<outcome>]
+//
+// --log defaults to this side's log; the windows helpers' is their own (%LOCALAPPDATA%\wsl-mount-metrics.log, e.g.
+// /mnt/c/Users/<user>/AppData/Local/wsl-mount-metrics.log), unless $WSL_MOUNT_METRICS/--metrics= pointed everything at one file.
+// --prometheus writes the same as a summary and a counter, for node_exporter's textfile collector (atomically, as it wants);
+// being a ring, the logs only go back so far, so the counts are of what's in them, not since forever.
+// record appends one record, for stand-ins of the windows helpers (and anything else scripted) to report their steps.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "Metrics.h"
+
+struct StepSummary
+{
+	const char *step;
+	size_t count, failures;
+	uint64_t p50, p90, p99, max, sum;
+	struct { int outcome; size_t count; } outcomes[8]; // the most common eight
+	size_t outcome_count;
+};
+
+static int CompareRecords(const void *a, const void *b)
+{
+	const struct MetricRecord *x = a, *y = b;
+	int order = strcmp(x->step, y->step);
+	if(order) return order;
+	return x->duration_us < y->duration_us ? -1 : x->duration_us > y->duration_us;
+}
+
+static int CompareInts(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return x < y ? -1 : x > y;
+}
+
+// records[0..count) are all of one step, ordered by duration
+static void Summarize(const struct MetricRecord *records, size_t count, uint64_t *durations, int *outcomes, struct StepSummary *summary)
+{
+	*summary = (struct StepSummary){ .step = records[0].step, .count = count };
+	for(size_t i = 0; i < count; ++i) {
+		durations[i] = records[i].duration_us;
+		outcomes[i] = records[i].outcome;
+		summary->sum += records[i].duration_us;
+		summary->failures += records[i].outcome != 0;
+	}
+	summary->p50 = MetricsPercentile(durations, count, 50);
+	summary->p90 = MetricsPercentile(durations, count, 90);
+	summary->p99 = MetricsPercentile(durations, count, 99);
+	summary->max = durations[count - 1];
+
+	qsort(outcomes, count, sizeof(int), &CompareInts);
+	for(size_t i = 0; i < count;) {
+		size_t run = 1;
+		while(i + run < count && outcomes[i + run] == outcomes[i]) ++run;
+		size_t slot = summary->outcome_count;
+		if(slot == sizeof(summary->outcomes) / sizeof(summary->outcomes[0])) {
+			// full: replace the least common, if this is more so
+			slot = 0;
+			for(size_t j = 1; j < summary->outcome_count; ++j) {
+				if(summary->outcomes[j].count < summary->outcomes[slot].count) slot = j;
+			}
+			if(summary->outcomes[slot].count >= run) slot = (size_t)-1;
+		} else {
+			++summary->outcome_count;
+		}
+		if(slot != (size_t)-1) {
+			summary->outcomes[slot].outcome = outcomes[i];
+			summary->outcomes[slot].count = run;
+		}
+		i += run;
+	}
+}
+
+static void PrintTable(const struct StepSummary *summaries, size_t count)
+{
+	printf("%-24s %7s %6s %10s %10s %10s %10s  outcomes\n", "step", "count", "failed", "p50 ms", "p90 ms", "p99 ms", "max ms");
+	for(size_t i = 0; i < count; ++i) {
+		const struct StepSummary *s = &summaries[i];
+		printf("%-24s %7zu %6zu %10.1f %10.1f %10.1f %10.1f ", s->step, s->count, s->failures,
+		       s->p50 / 1e3, s->p90 / 1e3, s->p99 / 1e3, s->max / 1e3);
+		for(size_t j = 0; j < s->outcome_count; ++j) printf(" %d:%zu", s->outcomes[j].outcome, s->outcomes[j].count);
+		printf("\n");
+	}
+}
+
+static void PrintPrometheus(FILE *out, const struct StepSummary *summaries, size_t count)
+{
+	fputs("# HELP wsl_mount_step_duration_seconds How long each wsl-mount step took, over the runs in the metrics logs.\n"
+	      "# TYPE wsl_mount_step_duration_seconds summary\n", out);
+	for(size_t i = 0; i < count; ++i) {
+		const struct StepSummary *s = &summaries[i];
+		fprintf(out, "wsl_mount_step_duration_seconds{step=\"%s\",quantile=\"0.5\"} %.6f\n", s->step, s->p50 / 1e6);
+		fprintf(out, "wsl_mount_step_duration_seconds{step=\"%s\",quantile=\"0.9\"} %.6f\n", s->step, s->p90 / 1e6);
+		fprintf(out, "wsl_mount_step_duration_seconds{step=\"%s\",quantile=\"0.99\"} %.6f\n", s->step, s->p99 / 1e6);
+		fprintf(out, "wsl_mount_step_duration_seconds_sum{step=\"%s\"} %.6f\n", s->step, s->sum / 1e6);
+		fprintf(out, "wsl_mount_step_duration_seconds_count{step=\"%s\"} %zu\n", s->step, s->count);
+	}
+	fputs("# HELP wsl_mount_step_outcomes_total Runs of each wsl-mount step by outcome (0 is success; 1223 is a cancelled prompt).\n"
+	      "# TYPE wsl_mount_step_outcomes_total counter\n", out);
+	for(size_t i = 0; i < count; ++i) {
+		const struct StepSummary *s = &summaries[i];
+		for(size_t j = 0; j < s->outcome_count; ++j) {
+			fprintf(out, "wsl_mount_step_outcomes_total{step=\"%s\",outcome=\"%d\"} %zu\n", s->step, s->outcomes[j].outcome, s->outcomes[j].count);
+		}
+	}
+}
+
+// replaces the file atomically, as the textfile collector may read it at any moment
+static bool WritePrometheus(const char *path, const struct StepSummary *summaries, size_t count)
+{
+	if(!strcmp(path, "-")) {
+		PrintPrometheus(stdout, summaries, count);
+		return true;
+	}
+	char tmp_path[4200];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+	FILE *out = fopen(tmp_path, "w");
+	if(!out) {
+		perror(tmp_path);
+		return false;
+	}
+	PrintPrometheus(out, summaries, count);
+	if(fclose(out) || rename(tmp_path, path)) {
+		perror(path);
+		remove(tmp_path);
+		return false;
+	}
+	return true;
+}
+
+static int Record(int argc, char *argv[])
+{
+	MetricsArguments(&argc, argv);
+	if(argc < 4 || argc > 5) {
+		fputs("wsl-mount-metrics record [--metrics=<file>] <step> <milliseconds> [<outcome>]\n", stderr);
+		return 1;
+	}
+	if(!metrics_enabled) {
+		fputs("*** no metrics log to record to\n", stderr);
+		return 1;
+	}
+	RecordMetricDuration(argv[2], (uint64_t)(strtod(argv[3], NULL) * 1e3), argc > 4 ? atoi(argv[4]) : 0);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc > 1 && !strcmp(argv[1], "record")) return Record(argc, argv);
+
+	const char **logs = calloc((size_t)argc + 1, sizeof(char *));
+	size_t log_count = 0;
+	const char *prometheus = NULL;
+	double since_hours = 0;
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "--log") && i+1 < argc) logs[log_count++] = argv[++i];
+		else if(!strcmp(argv[i], "--since") && i+1 < argc) since_hours = strtod(argv[++i], NULL);
+		else if(!strcmp(argv[i], "--prometheus") && i+1 < argc) prometheus = argv[++i];
+		else {
+			fputs("wsl-mount-metrics [--log <file>]... [--since <hours>] [--prometheus <file>|-]\n"
+			      "wsl-mount-metrics record [--metrics=<file>] <step> <milliseconds> [<outcome>]\n", stderr);
+			return 1;
+		}
+	}
+	if(!log_count) {
+		const char *path = getenv("WSL_MOUNT_METRICS");
+		logs[log_count] = path && *path ? path : DefaultMetricsPath();
+		if(logs[log_count]) ++log_count;
+	}
+
+	struct MetricRecord *records = NULL;
+	size_t count = 0;
+	for(size_t i = 0; i < log_count; ++i) {
+		if(!ReadMetrics(logs[i], &records, &count)) fprintf(stderr, "*** could not read %s\n", logs[i]);
+	}
+
+	if(since_hours > 0) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		uint64_t cutoff = (uint64_t)ts.tv_sec * 1000000 - (uint64_t)(since_hours * 3600e6);
+		size_t kept = 0;
+		for(size_t i = 0; i < count; ++i) {
+			if(records[i].time_us >= cutoff) records[kept++] = records[i];
+		}
+		count = kept;
+	}
+
+	qsort(records, count, sizeof(struct MetricRecord), &CompareRecords);
+	struct StepSummary *summaries = calloc(count + 1, sizeof(struct StepSummary));
+	uint64_t *durations = calloc(count + 1, sizeof(uint64_t));
+	int *outcomes = calloc(count + 1, sizeof(int));
+	if(!summaries || !durations || !outcomes) return 1;
+	size_t summary_count = 0;
+	for(size_t i = 0; i < count;) {
+		size_t run = 1;
+		while(i + run < count && !strcmp(records[i + run].step, records[i].step)) ++run;
+		Summarize(records + i, run, durations, outcomes, &summaries[summary_count++]);
+		i += run;
+	}
+
+	int result = 0;
+	if(prometheus) result = WritePrometheus(prometheus, summaries, summary_count) ? 0 : 1;
+	else PrintTable(summaries, summary_count);
+
+	free(outcomes);
+	free(durations);
+	free(summaries);
+	free(records);
+	free(logs);
+	return result;
+}
@@ -0,0 +1,189 @@
+//waits for disks/partitions to appear in the WSL VM, and prints their device nodes (as findfs would) as soon as they do
+// Takes the same tags as wsl-mount-findfs, and with --mount first attaches any that aren't there yet (one wsl-mount-findfs
+// --mount --batch), so that a unit can go straight from wsl --mount to cryptsetup without polling findfs in between:
+//   ExecStart=/usr/local/sbin/wsl-mount-wait --mount %I
+//
+// wsl-mount-wait [--mount] [--timeout <seconds>] [--links <dir>] [--findfs <exe>] [--trace=<file>] <Tag>...
+//
+// It wakes on the kernel's block device uevents and on new /dev/disk/by-partuuid|by-partlabel links (see DeviceWait.h),
+// checking the links and then the attached disks' partition tables each time. Each tag gets one line on stdout,
+// its device node, in the order given, once all have appeared; each one that had to be waited for is also reported
+// on stderr with how long after the attach returned (or the wait began) it appeared.
+// Exits 1 if any didn't appear within --timeout (30s).
+//
+// For testing without windows, --links can point at a scratch directory (create <dir>/by-partuuid/<uuid> to "attach"
+// a partition), and --findfs at a stand-in script.
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "DeviceBackend.h"
+#include "DeviceWait.h"
+#include "Interop.h"
+#include "Tag.h"
+#include "Trace.h"
+
+#define DEFAULT_TIMEOUT 30
+
+struct WaitTag
+{
+	const char *arg;
+	struct Tag tag;
+	char device[PATH_MAX];
+	bool found;
+	bool reported; // how long it took to appear
+};
+
+static struct {
+	struct WaitTag *tags;
+	size_t count;
+	const char *links;
+	char findfs[PATH_MAX];
+	unsigned timeout;
+	const char *since; // what the latencies are measured from
+} options = { .links = DEFAULT_DEVICE_LINKS, .timeout = DEFAULT_TIMEOUT };
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static bool ResolveDisk(const struct DiskInfo *disk, void *context)
+{
+	size_t *unresolved = context;
+	for(size_t i = 0; i < options.count; ++i) {
+		struct WaitTag *tag = &options.tags[i];
+		uint32_t PartitionNumber;
+		if(tag->found || !DiskMatchesTag(disk, &tag->tag, &PartitionNumber)) continue;
+
+		if(!TagNamesPartition(&tag->tag)) {
+			snprintf(tag->device, sizeof(tag->device), "%s", disk->Drive);
+			tag->found = true;
+		} else {
+			// (the disk's uevent comes before its partitions'; until theirs, the partition isn't there to use)
+			tag->found = FindPartitionDevice(disk->Drive, PartitionNumber, tag->device, sizeof(tag->device));
+		}
+		if(tag->found) --*unresolved;
+	}
+	return *unresolved > 0;
+}
+
+// resolves whatever has appeared, returning how many tags are left
+static size_t Resolve(struct DeviceBackend *backend, double attached, const char *why)
+{
+	uint64_t start = TRACE_BEGIN();
+	size_t unresolved = 0;
+	for(size_t i = 0; i < options.count; ++i) {
+		struct WaitTag *tag = &options.tags[i];
+		if(!tag->found) tag->found = FindDeviceLink(options.links, &tag->tag, tag->device, sizeof(tag->device));
+		unresolved += !tag->found;
+	}
+	if(unresolved) EnumDisks(backend, &ResolveDisk, &unresolved);
+	TRACE_END("Resolve", start, "%s, %zu left", why, unresolved);
+
+	// (those already there at the first look weren't waited for, so have nothing to report)
+	double latency = now_ms() - attached;
+	for(size_t i = 0; i < options.count; ++i) {
+		struct WaitTag *tag = &options.tags[i];
+		if(!tag->found || tag->reported) continue;
+		if(attached) fprintf(stderr, "%s appeared as %s %.1fms after %s (on %s)\n", tag->arg, tag->device, latency, options.since, why);
+		tag->reported = true;
+	}
+	return unresolved;
+}
+
+// wsl-mount-findfs --mount <Tag>... --batch --bare for every tag that isn't attached yet, with its result lines on stderr
+static int AttachMissing(void)
+{
+	char **argv = calloc(options.count + 5, sizeof(char *));
+	if(!argv) return -1;
+	size_t argc = 0;
+	argv[argc++] = options.findfs;
+	argv[argc++] = "--mount";
+	for(size_t i = 0; i < options.count; ++i) {
+		if(!options.tags[i].found) argv[argc++] = (char *)options.tags[i].arg;
+	}
+	argv[argc++] = "--batch";
+	argv[argc++] = "--bare";
+
+	uint64_t start = TRACE_BEGIN();
+	pid_t pid = SpawnHelper(options.findfs, argv, -1, STDERR_FILENO);
+	int result = pid > 0 ? WaitHelper(pid) : -1;
+	TRACE_END("AttachMissing", start, "%d", result);
+	if(result) fprintf(stderr, "*** wsl-mount-findfs --mount exited with %d\n", result);
+	free(argv);
+	return result;
+}
+
+int main(int argc, char *argv[])
+{
+	bool mount = false;
+	TraceArguments(&argc, argv, "wsl-mount-wait");
+	LocateHelper("wsl-mount-findfs", NULL, options.findfs, sizeof(options.findfs));
+
+	int i = 1;
+	for(; i < argc && !strncmp(argv[i], "--", 2); ++i) {
+		if(!strcmp(argv[i], "--mount")) {
+			mount = true;
+		} else if(!strcmp(argv[i], "--timeout") && i+1 < argc) {
+			options.timeout = (unsigned)strtoul(argv[++i], NULL, 0);
+		} else if(!strcmp(argv[i], "--links") && i+1 < argc) {
+			options.links = argv[++i];
+		} else if(!strcmp(argv[i], "--findfs") && i+1 < argc) {
+			snprintf(options.findfs, sizeof(options.findfs), "%s", argv[++i]);
+		} else {
+			break;
+		}
+	}
+	if(i >= argc || !strncmp(argv[i], "--", 2)) {
+		fputs("wsl-mount-wait [--mount] [--timeout <seconds>] [--links <dir>] [--findfs <exe>] [--trace=<file>] <Tag>...\n", stderr);
+		return 1;
+	}
+
+	options.count = (size_t)(argc - i);
+	options.tags = calloc(options.count, sizeof(struct WaitTag));
+	if(!options.tags) return 1;
+	for(size_t t = 0; t < options.count; ++t) {
+		options.tags[t].arg = argv[i + (int)t];
+		if(!ParseTag(options.tags[t].arg, &options.tags[t].tag)) return 1;
+	}
+
+	struct DeviceBackend *backend = CreateLinuxDeviceBackend();
+	if(!backend) return 1;
+
+	// listening before the first look (and the attach), so nothing can appear unnoticed in between
+	struct DeviceWait wait;
+	OpenDeviceWait(&wait, options.links);
+	if(wait.uevent_fd < 0 && wait.inotify_fd < 0) fputs("(no uevents or links to watch, polling)\n", stderr);
+
+	size_t unresolved = Resolve(backend, 0, "initial");
+	double attached = now_ms();
+	options.since = "the wait began";
+	if(unresolved && mount) {
+		if(AttachMissing()) return 1;
+		attached = now_ms();
+		options.since = "the attach returned";
+		unresolved = Resolve(backend, attached, "return");
+	}
+	for(double deadline = attached + options.timeout * 1e3; unresolved && now_ms() < deadline;) {
+		bool changed = DeviceWaitNext(&wait, (int)(deadline - now_ms()) + 1);
+		unresolved = Resolve(backend, attached, changed ? "event" : "recheck");
+	}
+	unsigned events = wait.events;
+	CloseDeviceWait(&wait);
+	backend->Destroy(backend);
+
+	if(unresolved) {
+		for(size_t t = 0; t < options.count; ++t) {
+			if(!options.tags[t].found) fprintf(stderr, "*** %s did not appear within %u seconds (%u device events)\n", options.tags[t].arg, options.timeout, events);
+		}
+		return 1;
+	}
+	for(size_t t = 0; t < options.count; ++t) puts(options.tags[t].device);
+	return 0;
+}
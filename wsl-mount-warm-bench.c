@@ -0,0 +1,249 @@
+//Times first access to a directory tree with its page cache cold, and after wsl-mount-warm's replay (see WarmProfile.h),
+// on an ordinary linux filesystem: it builds a tree of --dirs directories of --files files of --size KiB each,
+// "uses" --touch percent of them (listing their directories and reading them whole), records that, then drops the tree's pages
+// and times the same listings and reads cold, and again after replaying the profile.
+// The pages are dropped with posix_fadvise(POSIX_FADV_DONTNEED), which needs no root but can't drop the dentry and inode
+// caches (so only file data is cold), nor anything on tmpfs (whose pages are the files): --dir should be on a disk.
+//
+// wsl-mount-warm-bench [--dir <dir>] [--dirs <n>] [--files <n>] [--size <KiB>] [--touch <percent>] [--jobs <n>] [--memory <MiB>]
+//                      [--rounds <n>] [--trace=<file>]
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "Trace.h"
+#include "WarmProfile.h"
+
+static struct {
+	const char *dir;
+	unsigned long dirs, files, size_kib, touch, jobs, memory_mib, rounds;
+} options = { .dir = "/var/tmp", .dirs = 20, .files = 50, .size_kib = 64, .touch = 25, .jobs = 8, .rounds = 3 };
+
+static char root[4096];
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+// d<dir>/f<file>, relative to root
+static void FilePath(char *path, size_t size, unsigned long d, unsigned long f)
+{
+	if(f == (unsigned long)-1) snprintf(path, size, "%s/d%03lu", root, d);
+	else snprintf(path, size, "%s/d%03lu/f%03lu", root, d, f);
+}
+
+// the session's files: the same scattered --touch percent each time
+static bool Touched(unsigned long d, unsigned long f)
+{
+	return (d * options.files + f) * 37 % 100 < options.touch;
+}
+
+static bool CreateTree(void)
+{
+	size_t size = options.size_kib << 10;
+	unsigned char *data = malloc(size ? size : 1);
+	if(!data) return false;
+	uint32_t x = 2463534242u;
+	for(unsigned long d = 0; d < options.dirs; ++d) {
+		char path[4200];
+		FilePath(path, sizeof(path), d, (unsigned long)-1);
+		if(mkdir(path, 0755)) return false;
+		for(unsigned long f = 0; f < options.files; ++f) {
+			for(size_t i = 0; i < size; ++i) {
+				x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+				data[i] = (unsigned char)x;
+			}
+			FilePath(path, sizeof(path), d, f);
+			int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+			// (written back before being dropped, since dirty pages can't be)
+			bool written = fd >= 0 && write(fd, data, size) == (ssize_t)size && !fsync(fd);
+			if(fd >= 0) close(fd);
+			if(!written) return false;
+		}
+	}
+	free(data);
+	return true;
+}
+
+static void RemoveTree(void)
+{
+	char path[4200];
+	for(unsigned long d = 0; d < options.dirs; ++d) {
+		for(unsigned long f = 0; f < options.files; ++f) {
+			FilePath(path, sizeof(path), d, f);
+			unlink(path);
+		}
+		FilePath(path, sizeof(path), d, (unsigned long)-1);
+		rmdir(path);
+	}
+	rmdir(root);
+}
+
+// drops the tree's pages from the cache, returning the fraction that's still resident (ideally none)
+static double Evict(void)
+{
+	size_t resident = 0, pages = 0;
+	long page_size = sysconf(_SC_PAGESIZE);
+	size_t size = options.size_kib << 10;
+	unsigned char *vec = malloc(size / (size_t)page_size + 1);
+	for(unsigned long d = 0; vec && size && d < options.dirs; ++d) {
+		for(unsigned long f = 0; f < options.files; ++f) {
+			char path[4200];
+			FilePath(path, sizeof(path), d, f);
+			int fd = open(path, O_RDONLY | O_CLOEXEC);
+			if(fd < 0) continue;
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+			if(map != MAP_FAILED && !mincore(map, size, vec)) {
+				size_t n = (size + (size_t)page_size - 1) / (size_t)page_size;
+				for(size_t p = 0; p < n; ++p) resident += vec[p] & 1;
+				pages += n;
+			}
+			if(map != MAP_FAILED) munmap(map, size);
+			close(fd);
+		}
+	}
+	free(vec);
+	return pages ? (double)resident / (double)pages : 0;
+}
+
+static int CompareDoubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+// what the session does (and a user from windows would again): list each directory, stat what's in it, read its touched files
+// Reports the total, and the median and 99th percentile of each file's open+read
+static void FirstAccess(const char *scenario)
+{
+	double *latency = calloc(options.dirs * options.files + 1, sizeof(double));
+	size_t count = 0;
+	size_t size = options.size_kib << 10;
+	char *buffer = malloc(size ? size : 1);
+	double start = now_ms();
+	for(unsigned long d = 0; latency && buffer && d < options.dirs; ++d) {
+		char path[4200];
+		FilePath(path, sizeof(path), d, (unsigned long)-1);
+		DIR *dir = opendir(path);
+		for(struct dirent *entry; dir && (entry = readdir(dir));) {
+			struct stat st;
+			fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW);
+		}
+		if(dir) closedir(dir);
+
+		for(unsigned long f = 0; f < options.files; ++f) {
+			if(!Touched(d, f)) continue;
+			FilePath(path, sizeof(path), d, f);
+			double file_start = now_ms();
+			int fd = open(path, O_RDONLY | O_CLOEXEC);
+			while(fd >= 0 && read(fd, buffer, size) > 0) {}
+			if(fd >= 0) close(fd);
+			latency[count++] = now_ms() - file_start;
+		}
+	}
+	double total = now_ms() - start;
+	qsort(latency, count, sizeof(double), &CompareDoubles);
+	printf("%-8s first access %8.1fms  per file p50 %7.3fms  p99 %7.3fms\n", scenario, total,
+	       count ? latency[count / 2] : 0, count ? latency[count * 99 / 100] : 0);
+	free(latency);
+	free(buffer);
+}
+
+int main(int argc, char *argv[])
+{
+	TraceArguments(&argc, argv, "wsl-mount-warm-bench");
+	for(int i = 1; i < argc; ++i) {
+		unsigned long *option = NULL;
+		if(!strcmp(argv[i], "--dir") && i+1 < argc) {
+			options.dir = argv[++i];
+			continue;
+		}
+		if(!strcmp(argv[i], "--dirs")) option = &options.dirs;
+		else if(!strcmp(argv[i], "--files")) option = &options.files;
+		else if(!strcmp(argv[i], "--size")) option = &options.size_kib;
+		else if(!strcmp(argv[i], "--touch")) option = &options.touch;
+		else if(!strcmp(argv[i], "--jobs")) option = &options.jobs;
+		else if(!strcmp(argv[i], "--memory")) option = &options.memory_mib;
+		else if(!strcmp(argv[i], "--rounds")) option = &options.rounds;
+		if(!option || i+1 >= argc) {
+			fputs("wsl-mount-warm-bench [--dir <dir>] [--dirs <n>] [--files <n>] [--size <KiB>] [--touch <percent>] [--jobs <n>] [--memory <MiB>]\n"
+			      "                     [--rounds <n>] [--trace=<file>]\n", stderr);
+			return 1;
+		}
+		*option = strtoul(argv[++i], NULL, 0);
+	}
+	if(!options.dirs || !options.files || !options.size_kib || options.dirs > 1000 || options.files > 1000) {
+		fputs("*** --dirs and --files must be between 1 and 1000, and --size nonzero\n", stderr);
+		return 1;
+	}
+
+	snprintf(root, sizeof(root), "%s/wsl-mount-warm-bench.XXXXXX", options.dir);
+	if(!mkdtemp(root)) {
+		perror(root);
+		return 1;
+	}
+	if(!CreateTree()) {
+		perror("creating the tree");
+		RemoveTree();
+		return 1;
+	}
+	unsigned long touched = 0;
+	for(unsigned long d = 0; d < options.dirs; ++d) {
+		for(unsigned long f = 0; f < options.files; ++f) touched += Touched(d, f);
+	}
+	printf("%lu files of %lu KiB in %lu directories (%s), %lu touched (%.1f MiB), %lu jobs, %lu MiB cap\n",
+	       options.dirs * options.files, options.size_kib, options.dirs, root, touched, touched * options.size_kib / 1024.0,
+	       options.jobs, options.memory_mib);
+
+	// the session being recorded
+	double left = Evict();
+	if(left > 0.1) fprintf(stderr, "*** %.0f%% of the tree's pages couldn't be dropped (tmpfs?), so nothing will be cold\n", left * 100);
+	FirstAccess("session");
+	struct WarmProfile recorded, profile;
+	RecordWarmProfile(&recorded, root);
+
+	// it should be just the touched files (whole), and their directories and the root; and read back the same
+	char profile_path[4200];
+	snprintf(profile_path, sizeof(profile_path), "%s.profile", root);
+	SaveWarmProfile(&recorded, profile_path);
+	LoadWarmProfile(&profile, profile_path);
+	remove(profile_path);
+	size_t files = 0;
+	bool correct = profile.count == recorded.count;
+	for(size_t i = 0; i < profile.count; ++i) {
+		const struct WarmEntry *entry = &profile.entries[i];
+		files += !entry->directory;
+		unsigned long d, f;
+		if(!entry->directory) correct = correct && sscanf(entry->path, "d%lu/f%lu", &d, &f) == 2 && Touched(d, f) && entry->bytes == options.size_kib << 10;
+		correct = correct && !strcmp(entry->path, recorded.entries[i].path) && entry->bytes == recorded.entries[i].bytes;
+	}
+	if(!correct || files != touched) printf("*** MISMATCH: recorded %zu files (of %lu touched), %zu entries\n", files, touched, profile.count);
+
+	for(unsigned long round = 0; round < options.rounds; ++round) {
+		Evict();
+		FirstAccess("cold");
+
+		Evict();
+		double start = now_ms();
+		struct WarmStats stats;
+		ReplayWarmProfile(&profile, root, (unsigned)options.jobs, (uint64_t)options.memory_mib << 20, &stats);
+		printf("replay   %zu directories, %zu files, %.1f MiB in %.1fms%s\n", stats.directories, stats.files, stats.bytes / 1048576.0,
+		       now_ms() - start, stats.skipped ? " (some over the cap)" : "");
+		FirstAccess("warm");
+	}
+
+	FreeWarmProfile(&recorded);
+	FreeWarmProfile(&profile);
+	RemoveTree();
+	return correct ? 0 : 1;
+}
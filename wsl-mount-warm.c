@@ -0,0 +1,132 @@
+//warms a volume's page cache after it's mounted, with what previous sessions used, so that the first listings and opens
+// from windows (\\wsl.localhost\<distribution>\data) don't each go cold through 9P, dm-crypt, and the disk (see WarmProfile.h)
+//   record: before unmounting, notes which files (and which parts of them) are in the page cache, and the directories above them,
+//           merging that with the earlier sessions' profile (entries not seen for --keep sessions, 3, are dropped)
+//   replay: after mounting, reads those back in, --jobs (8) files at a time, directories first and then the most recently used
+//           and smallest files, up to --memory MiB (256, 0 for no cap) in all
+//
+// wsl-mount-warm record [--profile <file>] [--keep <sessions>] [--trace=<file>] <mount point>
+// wsl-mount-warm replay [--profile <file>] [--jobs <n>] [--memory <MiB>] [--trace=<file>] <mount point>
+//
+// The profile defaults to /var/cache/wsl-mount-warm/<mount point, systemd-escape'd>.profile.
+// Recording is what wsl-mount-idle --record does before its umount, or the ExecStop= of a unit bound to the mount.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "Trace.h"
+#include "WarmProfile.h"
+
+#define DEFAULT_PROFILE_DIR "/var/cache/wsl-mount-warm"
+#define DEFAULT_KEEP 3
+#define DEFAULT_JOBS 8
+#define DEFAULT_MEMORY_MIB 256
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+// /data/photos -> /var/cache/wsl-mount-warm/data-photos.profile (as systemd-escape --path would name it, give or take)
+static void DefaultProfilePath(const char *target, char *path, size_t size)
+{
+	char name[256];
+	size_t len = 0;
+	const char *p = target + strspn(target, "/");
+	if(!*p) name[len++] = '-';
+	for(; *p && len + 4 < sizeof(name); ++p) {
+		if(*p == '/') {
+			if(p[1] && p[1] != '/') name[len++] = '-';
+		} else if(*p == '-' || *p == '\\' || *p < ' ') {
+			len += (size_t)snprintf(name + len, sizeof(name) - len, "\\x%02x", (unsigned char)*p);
+		} else {
+			name[len++] = *p;
+		}
+	}
+	name[len] = '\0';
+	snprintf(path, size, "%s/%s.profile", DEFAULT_PROFILE_DIR, name);
+}
+
+static int Record(const char *target, const char *profile_path, unsigned keep)
+{
+	double start = now_ms();
+	struct WarmProfile profile, previous;
+	if(!RecordWarmProfile(&profile, target)) return 1;
+	size_t directories = 0, files = 0;
+	uint64_t bytes = 0;
+	for(size_t i = 0; i < profile.count; ++i) {
+		directories += profile.entries[i].directory;
+		files += !profile.entries[i].directory;
+		bytes += profile.entries[i].bytes;
+	}
+
+	LoadWarmProfile(&previous, profile_path);
+	MergeWarmProfile(&profile, &previous, keep);
+	bool saved = SaveWarmProfile(&profile, profile_path);
+	printf("recorded %zu directories, %zu files (%.1f MiB cached) of %s in %.1fms, %zu entries with earlier sessions'\n",
+	       directories, files, bytes / 1048576.0, target, now_ms() - start, profile.count);
+	FreeWarmProfile(&previous);
+	FreeWarmProfile(&profile);
+	return saved ? 0 : 1;
+}
+
+static int Replay(const char *target, const char *profile_path, unsigned jobs, uint64_t memory_cap)
+{
+	double start = now_ms();
+	struct WarmProfile profile;
+	LoadWarmProfile(&profile, profile_path);
+	if(!profile.count) {
+		printf("nothing recorded for %s yet (%s)\n", target, profile_path);
+		return 0;
+	}
+	struct WarmStats stats;
+	ReplayWarmProfile(&profile, target, jobs, memory_cap, &stats);
+	printf("warmed %zu directories, %zu files (%.1f MiB) of %s in %.1fms", stats.directories, stats.files, stats.bytes / 1048576.0,
+	       target, now_ms() - start);
+	if(stats.skipped) printf(", %zu left out (gone, or over the %llu MiB cap)", stats.skipped, (unsigned long long)(memory_cap >> 20));
+	printf("\n");
+	FreeWarmProfile(&profile);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	TraceArguments(&argc, argv, "wsl-mount-warm");
+	const char *command = argc > 1 ? argv[1] : "";
+	bool record = !strcmp(command, "record"), replay = !strcmp(command, "replay");
+	const char *profile_path = NULL;
+	unsigned keep = DEFAULT_KEEP, jobs = DEFAULT_JOBS;
+	uint64_t memory_cap = (uint64_t)DEFAULT_MEMORY_MIB << 20;
+
+	int i = 2;
+	for(; i + 1 < argc && !strncmp(argv[i], "--", 2); i += 2) {
+		if(!strcmp(argv[i], "--profile")) profile_path = argv[i+1];
+		else if(!strcmp(argv[i], "--keep") && record) keep = (unsigned)strtoul(argv[i+1], NULL, 0);
+		else if(!strcmp(argv[i], "--jobs") && replay) jobs = (unsigned)strtoul(argv[i+1], NULL, 0);
+		else if(!strcmp(argv[i], "--memory") && replay) memory_cap = (uint64_t)strtoull(argv[i+1], NULL, 0) << 20;
+		else break;
+	}
+	if((!record && !replay) || i + 1 != argc) {
+		fputs("wsl-mount-warm record [--profile <file>] [--keep <sessions>] [--trace=<file>] <mount point>\n"
+		      "wsl-mount-warm replay [--profile <file>] [--jobs <n>] [--memory <MiB>] [--trace=<file>] <mount point>\n", stderr);
+		return 1;
+	}
+	const char *target = argv[i];
+	if(!jobs) jobs = 1;
+
+	char default_path[4096];
+	if(!profile_path) {
+		DefaultProfilePath(target, default_path, sizeof(default_path));
+		profile_path = default_path;
+		if(record && mkdir(DEFAULT_PROFILE_DIR, 0700) && errno != EEXIST) {
+			fprintf(stderr, "*** %s: %s\n", DEFAULT_PROFILE_DIR, strerror(errno));
+			return 1;
+		}
+	}
+	return record ? Record(target, profile_path, keep) : Replay(target, profile_path, jobs, memory_cap);
+}